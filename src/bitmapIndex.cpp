@@ -0,0 +1,324 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include "bitmapIndex.h"
+#include "filescan.h"
+#include "exceptions/bad_index_info_exception.h"
+#include "exceptions/no_such_key_found_exception.h"
+#include "exceptions/file_not_found_exception.h"
+#include "exceptions/end_of_file_exception.h"
+#include "exceptions/invalid_page_size_exception.h"
+
+namespace badgerdb
+{
+
+static_assert(sizeof(BitmapIndexMetaInfo) <= Page::MIN_SIZE, "BitmapIndexMetaInfo must fit in the meta page.");
+
+template <>
+std::map<int, RoaringBitmap>& BitmapIndex::bitmaps<int>() { return intBitmaps; }
+
+template <>
+std::map<double, RoaringBitmap>& BitmapIndex::bitmaps<double>() { return doubleBitmaps; }
+
+template <>
+std::map<StringKey, RoaringBitmap>& BitmapIndex::bitmaps<StringKey>() { return stringBitmaps; }
+
+// -----------------------------------------------------------------------------
+// BitmapIndex::BitmapIndex -- Constructor
+// -----------------------------------------------------------------------------
+
+BitmapIndex::BitmapIndex(const std::string & relationName,
+		std::string & outIndexName,
+		BufMgr *bufMgrIn,
+		const int attrByteOffset,
+		const Datatype attrType)
+{
+	bufMgr = bufMgrIn;
+	headerPageNum = 1;
+
+	std::ostringstream idxStr;
+	idxStr << relationName << '.' << attrByteOffset << ".bitmap";
+	outIndexName = idxStr.str();
+
+	attributeType = attrType;
+	this->attrByteOffset = attrByteOffset;
+	firstPageNo = 0;
+	numPages = 0;
+	dirty = true;
+
+	switch (attributeType) {
+	case INTEGER:
+		serializeFn = &BitmapIndex::serializeKernel<int>;
+		deserializeFn = &BitmapIndex::deserializeKernel<int>;
+		insertEntryFn = &BitmapIndex::insertEntryKernel<int>;
+		deleteEntryFn = &BitmapIndex::deleteEntryKernel<int>;
+		lookupFn = &BitmapIndex::lookupKernel<int>;
+		numValuesFn = &BitmapIndex::numValuesKernel<int>;
+		break;
+	case DOUBLE:
+		serializeFn = &BitmapIndex::serializeKernel<double>;
+		deserializeFn = &BitmapIndex::deserializeKernel<double>;
+		insertEntryFn = &BitmapIndex::insertEntryKernel<double>;
+		deleteEntryFn = &BitmapIndex::deleteEntryKernel<double>;
+		lookupFn = &BitmapIndex::lookupKernel<double>;
+		numValuesFn = &BitmapIndex::numValuesKernel<double>;
+		break;
+	case STRING:
+		serializeFn = &BitmapIndex::serializeKernel<StringKey>;
+		deserializeFn = &BitmapIndex::deserializeKernel<StringKey>;
+		insertEntryFn = &BitmapIndex::insertEntryKernel<StringKey>;
+		deleteEntryFn = &BitmapIndex::deleteEntryKernel<StringKey>;
+		lookupFn = &BitmapIndex::lookupKernel<StringKey>;
+		numValuesFn = &BitmapIndex::numValuesKernel<StringKey>;
+		break;
+	default:
+		throw BadIndexInfoException("Unsupported attribute type.");
+	}
+
+	bool created = false;
+	try {
+		file = new BlobFile(outIndexName, false);
+	} catch(FileNotFoundException e) {
+		file = new BlobFile(outIndexName, true);
+		created = true;
+	}
+
+	try {
+		if (file->pageSize() > bufMgr->getFrameSize()) {
+			throw InvalidPageSizeException(file->pageSize(), outIndexName);
+		}
+
+		if (!created) {
+			Page *metaPage;
+			bufMgr->readPage(file, headerPageNum, metaPage);
+			BitmapIndexMetaInfo *meta = (BitmapIndexMetaInfo*)metaPage;
+			if (meta->attrType != attributeType || meta->attrByteOffset != attrByteOffset) {
+				bufMgr->unPinPage(file, headerPageNum, false);
+				bufMgr->flushFile(file);
+				throw BadIndexInfoException("Index file " + outIndexName + " was built over a different attribute.");
+			}
+			firstPageNo = meta->firstPageNo;
+			numPages = meta->numPages;
+			std::vector<char> bytes(meta->numBytes);
+			bufMgr->unPinPage(file, headerPageNum, false);
+
+			const std::size_t pageSize = file->pageSize();
+			for (int i = 0; i < numPages && i * pageSize < bytes.size(); i++) {
+				const std::size_t count = std::min(pageSize, bytes.size() - i * pageSize);
+				Page *page;
+				bufMgr->readPage(file, firstPageNo + i, page);
+				memcpy(&bytes[i * pageSize], page, count);
+				bufMgr->unPinPage(file, firstPageNo + i, false);
+			}
+			(this->*deserializeFn)(bytes);
+			dirty = false;
+		}
+	} catch(BadgerDbException & e) {
+		delete file;
+		if (created) {
+			File::remove(outIndexName);
+		}
+		throw;
+	}
+
+	if (created) {
+		Page *metaPage;
+		bufMgr->allocPage(file, headerPageNum, metaPage);
+		BitmapIndexMetaInfo *meta = (BitmapIndexMetaInfo*)metaPage;
+		strncpy(meta->relationName, relationName.c_str(), sizeof(meta->relationName));
+		bufMgr->unPinPage(file, headerPageNum, true);
+
+		FileScan fscan(relationName, bufMgr);
+		try
+		{
+			RecordId scanRid;
+			while(1)
+			{
+				fscan.scanNext(scanRid);
+				std::string recordStr = fscan.getRecord();
+				const char *record = recordStr.c_str();
+				(this->*insertEntryFn)(record + attrByteOffset, scanRid);
+			}
+		}
+		catch(EndOfFileException e)
+		{
+		}
+		writeBitmaps();
+		bufMgr->commit();
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BitmapIndex::~BitmapIndex -- destructor
+// -----------------------------------------------------------------------------
+
+BitmapIndex::~BitmapIndex()
+{
+	writeBitmaps();
+	bufMgr->commit();
+	bufMgr->flushFile(file);
+	delete file;
+}
+
+// -----------------------------------------------------------------------------
+// BitmapIndex::writeBitmaps
+// -----------------------------------------------------------------------------
+
+void BitmapIndex::writeBitmaps()
+{
+	if (!dirty) {
+		return;
+	}
+
+	std::vector<char> bytes;
+	(this->*serializeFn)(bytes);
+
+	const std::size_t pageSize = file->pageSize();
+	const int needed = (bytes.size() + pageSize - 1) / pageSize;
+	if (needed > numPages) {
+		// Pages of a BlobFile are never freed, so bitmaps that outgrow their run move to a fresh run at
+		// the end of the file, twice as large so that growing by one entry at a time wastes few pages.
+		// Nothing else allocates in between, so the run is contiguous.
+		const int newNumPages = std::max(needed, 2 * numPages);
+		for (int i = 0; i < newNumPages; i++) {
+			PageId newPageNo;
+			Page *newPage;
+			bufMgr->allocPage(file, newPageNo, newPage);
+			if (i == 0) {
+				firstPageNo = newPageNo;
+			}
+			bufMgr->unPinPage(file, newPageNo, true);
+		}
+		numPages = newNumPages;
+	}
+
+	for (int i = 0; i < needed; i++) {
+		const std::size_t count = std::min(pageSize, bytes.size() - i * pageSize);
+		Page *page;
+		bufMgr->readPage(file, firstPageNo + i, page);
+		memcpy((void*)page, &bytes[i * pageSize], count);
+		bufMgr->unPinPage(file, firstPageNo + i, true);
+	}
+
+	Page *metaPage;
+	bufMgr->readPage(file, headerPageNum, metaPage);
+	BitmapIndexMetaInfo *meta = (BitmapIndexMetaInfo*)metaPage;
+	meta->attrByteOffset = attrByteOffset;
+	meta->attrType = attributeType;
+	meta->firstPageNo = firstPageNo;
+	meta->numPages = numPages;
+	meta->numBytes = bytes.size();
+	bufMgr->unPinPage(file, headerPageNum, true);
+	dirty = false;
+}
+
+template <class T>
+void BitmapIndex::serializeKernel(std::vector<char> & bytes)
+{
+	// Every record, the number of values, then each value followed by its bitmap
+	allRecords.serialize(bytes);
+	const std::map<T, RoaringBitmap> & values = bitmaps<T>();
+	const std::uint32_t numValues = values.size();
+	bytes.insert(bytes.end(), (const char*)&numValues, (const char*)&numValues + sizeof(numValues));
+	for (typename std::map<T, RoaringBitmap>::const_iterator it = values.begin(); it != values.end(); ++it) {
+		bytes.insert(bytes.end(), (const char*)&it->first, (const char*)&it->first + sizeof(T));
+		it->second.serialize(bytes);
+	}
+}
+
+template <class T>
+void BitmapIndex::deserializeKernel(const std::vector<char> & bytes)
+{
+	std::map<T, RoaringBitmap> & values = bitmaps<T>();
+	values.clear();
+	if (bytes.empty()) {
+		allRecords = RoaringBitmap();
+		return;
+	}
+
+	const char *pos = &bytes[0];
+	pos += allRecords.deserialize(pos);
+	std::uint32_t numValues;
+	memcpy(&numValues, pos, sizeof(numValues));
+	pos += sizeof(numValues);
+	for (std::uint32_t i = 0; i < numValues; i++) {
+		T key;
+		memcpy((void*)&key, pos, sizeof(T));
+		pos += sizeof(T);
+		pos += values[key].deserialize(pos);
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BitmapIndex::insertEntry
+// -----------------------------------------------------------------------------
+
+void BitmapIndex::insertEntry(const void *key, const RecordId rid)
+{
+	(this->*insertEntryFn)(key, rid);
+}
+
+template <class T>
+void BitmapIndex::insertEntryKernel(const void *keyPtr, const RecordId rid)
+{
+	bitmaps<T>()[keyFromPtr<T>(keyPtr)].add(rid);
+	allRecords.add(rid);
+	dirty = true;
+}
+
+// -----------------------------------------------------------------------------
+// BitmapIndex::deleteEntry
+// -----------------------------------------------------------------------------
+
+void BitmapIndex::deleteEntry(const void *key, const RecordId rid)
+{
+	(this->*deleteEntryFn)(key, rid);
+}
+
+template <class T>
+void BitmapIndex::deleteEntryKernel(const void *keyPtr, const RecordId rid)
+{
+	std::map<T, RoaringBitmap> & values = bitmaps<T>();
+	typename std::map<T, RoaringBitmap>::iterator it = values.find(keyFromPtr<T>(keyPtr));
+	if (it == values.end() || !it->second.remove(rid)) {
+		throw NoSuchKeyFoundException();
+	}
+	if (it->second.empty()) {
+		values.erase(it);
+	}
+	allRecords.remove(rid);
+	dirty = true;
+}
+
+// -----------------------------------------------------------------------------
+// BitmapIndex::lookup
+// -----------------------------------------------------------------------------
+
+void BitmapIndex::lookup(const void *key, RoaringBitmap & outBitmap)
+{
+	(this->*lookupFn)(key, outBitmap);
+}
+
+template <class T>
+void BitmapIndex::lookupKernel(const void *keyPtr, RoaringBitmap & outBitmap)
+{
+	const std::map<T, RoaringBitmap> & values = bitmaps<T>();
+	typename std::map<T, RoaringBitmap>::const_iterator it = values.find(keyFromPtr<T>(keyPtr));
+	outBitmap = it == values.end() ? RoaringBitmap() : it->second;
+}
+
+template <class T>
+std::size_t BitmapIndex::numValuesKernel()
+{
+	return bitmaps<T>().size();
+}
+
+}
@@ -0,0 +1,279 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "types.h"
+#include "page.h"
+#include "file.h"
+#include "buffer.h"
+#include "btree.h"
+#include "roaringBitmap.h"
+
+namespace badgerdb
+{
+
+/**
+ * @brief The meta page, which holds metadata for a BitmapIndex, is always the first page of the index file.
+ * The bitmaps are serialized into a separate run of pages.
+*/
+struct BitmapIndexMetaInfo{
+  /**
+   * Name of base relation.
+   */
+	char relationName[20];
+
+  /**
+   * Offset of attribute, over which index is built, inside the record stored in pages.
+   */
+	int attrByteOffset;
+
+  /**
+   * Type of the attribute over which index is built.
+   */
+	Datatype attrType;
+
+  /**
+   * Page number of the first page of the bitmap run, 0 before the bitmaps were first written.
+   */
+	PageId firstPageNo;
+
+  /**
+   * Number of consecutive pages reserved for the bitmaps.
+   */
+	int numPages;
+
+  /**
+   * Number of bytes of the serialized bitmaps.
+   */
+	std::uint64_t numBytes;
+};
+
+/**
+ * @brief BitmapIndex class. An index on a single attribute of a relation with few distinct values, made of
+ * one RoaringBitmap of record ids per value. Predicates over several such attributes are answered by
+ * combining the bitmaps with &, | and -, and complement() for negation, instead of intersecting lists of
+ * record ids.
+ *
+ * The bitmaps are kept in memory while the index is open. They are read from the index file when it is
+ * opened and written back to it when the index is closed.
+*/
+class BitmapIndex {
+
+ private:
+
+  /**
+   * File object for the index file.
+   */
+	BlobFile	*file;
+
+  /**
+   * Buffer Manager Instance.
+   */
+	BufMgr	*bufMgr;
+
+  /**
+   * Page number of meta page.
+   */
+	PageId	headerPageNum;
+
+  /**
+   * Datatype of attribute over which index is built.
+   */
+	Datatype	attributeType;
+
+  /**
+   * Offset of attribute, over which index is built, inside records.
+   */
+	int 		attrByteOffset;
+
+  /**
+   * Page number of the first page of the bitmap run, 0 before the bitmaps were first written.
+   */
+	PageId	firstPageNo;
+
+  /**
+   * Number of pages in the bitmap run.
+   */
+	int			numPages;
+
+  /**
+   * Every record id in the index, whatever its value.
+   */
+	RoaringBitmap	allRecords;
+
+  /**
+   * Bitmap of every value of an INTEGER index.
+   */
+	std::map<int, RoaringBitmap>	intBitmaps;
+
+  /**
+   * Bitmap of every value of a DOUBLE index.
+   */
+	std::map<double, RoaringBitmap>	doubleBitmaps;
+
+  /**
+   * Bitmap of every value of a STRING index.
+   */
+	std::map<StringKey, RoaringBitmap>	stringBitmaps;
+
+  /**
+   * The bitmap map for key type T.
+   */
+	template <class T>
+	std::map<T, RoaringBitmap>& bitmaps();
+
+  /**
+   * True if the bitmaps changed since they were read or written.
+   */
+	bool		dirty;
+
+  /**
+   * Write the bitmaps and the meta page if the bitmaps changed.
+   */
+	void writeBitmaps();
+
+  /**
+   * Serialize the bitmaps of keys of type T, after allRecords.
+   */
+	template <class T>
+	void serializeKernel(std::vector<char> & bytes);
+
+  /**
+   * Read back bitmaps written by serializeKernel().
+   */
+	template <class T>
+	void deserializeKernel(const std::vector<char> & bytes);
+
+  /**
+   * Body of insertEntry() for keys of type T.
+   */
+	template <class T>
+	void insertEntryKernel(const void* key, const RecordId rid);
+
+  /**
+   * Body of deleteEntry() for keys of type T.
+   */
+	template <class T>
+	void deleteEntryKernel(const void* key, const RecordId rid);
+
+  /**
+   * Body of lookup() for keys of type T.
+   */
+	template <class T>
+	void lookupKernel(const void* key, RoaringBitmap & outBitmap);
+
+  /**
+   * Number of distinct values for keys of type T.
+   */
+	template <class T>
+	std::size_t numValuesKernel();
+
+  /**
+   * Instantiation of serializeKernel() chosen for attributeType.
+   */
+	void (BitmapIndex::*serializeFn)(std::vector<char>&);
+
+  /**
+   * Instantiation of deserializeKernel() chosen for attributeType.
+   */
+	void (BitmapIndex::*deserializeFn)(const std::vector<char>&);
+
+  /**
+   * Instantiation of insertEntryKernel() chosen for attributeType.
+   */
+	void (BitmapIndex::*insertEntryFn)(const void*, const RecordId);
+
+  /**
+   * Instantiation of deleteEntryKernel() chosen for attributeType.
+   */
+	void (BitmapIndex::*deleteEntryFn)(const void*, const RecordId);
+
+  /**
+   * Instantiation of lookupKernel() chosen for attributeType.
+   */
+	void (BitmapIndex::*lookupFn)(const void*, RoaringBitmap&);
+
+  /**
+   * Instantiation of numValuesKernel() chosen for attributeType.
+   */
+	std::size_t (BitmapIndex::*numValuesFn)();
+
+ public:
+
+  /**
+   * BitmapIndex Constructor.
+	 * Open the index file if it exists. If not, create it and add every tuple in the base relation to the
+	 * bitmap of its value using FileScan class. The index file is named relationName.attrByteOffset.bitmap.
+   *
+   * @param relationName        Name of file.
+   * @param outIndexName        Return the name of index file.
+   * @param bufMgrIn						Buffer Manager Instance
+   * @param attrByteOffset			Offset of attribute, over which index is to be built, in the record
+   * @param attrType						Datatype of attribute over which index is built
+   * @throws  BadIndexInfoException     If the index file already exists for a different attribute.
+   * @throws  InvalidPageSizeException  If the pages of the index file do not fit in the frames of bufMgrIn.
+   */
+	BitmapIndex(const std::string & relationName, std::string & outIndexName,
+						BufMgr *bufMgrIn,	const int attrByteOffset,	const Datatype attrType);
+
+  /**
+   * BitmapIndex Destructor.
+	 * Write the bitmaps if they changed, flush the index file and close it.
+	 */
+	~BitmapIndex();
+
+  /**
+	 * Add a record to the bitmap of its value.
+   * @param key			Value of the record, pointer to integer/double/char string
+   * @param rid			Record ID of the record.
+	**/
+	void insertEntry(const void* key, const RecordId rid);
+
+  /**
+	 * Remove a record from the bitmap of its value.
+   * @param key			Value of the record, pointer to integer/double/char string
+   * @param rid			Record ID of the record.
+	 * @throws  NoSuchKeyFoundException If the record is not in the bitmap of the value.
+	**/
+	void deleteEntry(const void* key, const RecordId rid);
+
+  /**
+	 * Find the bitmap of the records with the given value.
+   * @param key			Value to look up, pointer to integer/double/char string
+   * @param outBitmap	Records with the value returned in this, empty if there are none.
+	**/
+	void lookup(const void* key, RoaringBitmap & outBitmap);
+
+  /**
+	 * Records of the index that are not in the given bitmap, for negated predicates.
+   * @param bitmap	Bitmap to complement.
+	**/
+	RoaringBitmap complement(const RoaringBitmap & bitmap) const { return allRecords - bitmap; }
+
+  /**
+   * Every record id in the index.
+   */
+	const RoaringBitmap& records() const { return allRecords; }
+
+  /**
+   * Number of entries in the index.
+   */
+	std::uint64_t size() const { return allRecords.cardinality(); }
+
+  /**
+   * Number of distinct values in the index.
+   */
+	std::size_t numValues() { return (this->*numValuesFn)(); }
+};
+
+}
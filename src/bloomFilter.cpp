@@ -0,0 +1,96 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "bloomFilter.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace badgerdb
+{
+
+BloomFilter::BloomFilter(const std::uint32_t numBlocksIn)
+	: numBlocks(std::max<std::uint32_t>(numBlocksIn, 1)),
+	  words(std::max<std::uint32_t>(numBlocksIn, 1) * BLOCKWORDS, 0)
+{
+}
+
+std::uint32_t BloomFilter::blocksForKeys(const std::uint64_t numKeys)
+{
+	std::uint64_t blocks = ( numKeys * BITSPERKEY + BLOCKBITS - 1 ) / BLOCKBITS;
+	return blocks == 0 ? 1 : (std::uint32_t)blocks;
+}
+
+void BloomFilter::insert(const std::uint64_t hash)
+{
+	std::uint64_t *blk = const_cast<std::uint64_t*>(block(hash));
+	// The low half of the hash is spent on the bits inside the block, the high half picked the block.
+	std::uint64_t x = hash;
+	for (int i = 0; i < NUMPROBES; i++) {
+		x = x * 0x9E3779B97F4A7C15ULL + 0x632BE59BD9B4E019ULL;
+		int bit = (int)(x >> 55); // 9 bits, 0..511
+		blk[bit >> 6] |= (std::uint64_t)1 << (bit & 63);
+	}
+}
+
+bool BloomFilter::mayContain(const std::uint64_t hash) const
+{
+	const std::uint64_t *blk = block(hash);
+	std::uint64_t x = hash;
+	for (int i = 0; i < NUMPROBES; i++) {
+		x = x * 0x9E3779B97F4A7C15ULL + 0x632BE59BD9B4E019ULL;
+		int bit = (int)(x >> 55);
+		if (!(blk[bit >> 6] & ((std::uint64_t)1 << (bit & 63))))
+			return false;
+	}
+	return true;
+}
+
+void BloomFilter::clear()
+{
+	std::fill(words.begin(), words.end(), 0);
+}
+
+std::uint64_t BloomFilter::hashInt(const int key)
+{
+	// splitmix64 finalizer
+	std::uint64_t z = (std::uint64_t)(std::uint32_t)key + 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+/**
+ * splitmix64 finalizer over a full 64-bit word.
+ */
+static std::uint64_t mix64(std::uint64_t z)
+{
+	z += 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+std::uint64_t BloomFilter::hashDouble(const double key)
+{
+	double k = (key == 0.0) ? 0.0 : key;
+	std::uint64_t bits;
+	memcpy(&bits, &k, sizeof(bits));
+	return mix64(bits);
+}
+
+std::uint64_t BloomFilter::hashBytes(const char* bytes, const std::size_t len)
+{
+	// FNV-1a over the bytes, then a final mix so every output bit depends on every input bit
+	std::uint64_t h = 0xCBF29CE484222325ULL;
+	for (std::size_t i = 0; i < len; i++) {
+		h = (h ^ (unsigned char)bytes[i]) * 0x100000001B3ULL;
+	}
+	return mix64(h);
+}
+
+}
@@ -0,0 +1,152 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace badgerdb
+{
+
+/**
+ * @brief Blocked Bloom filter over 64-bit key hashes.
+ *
+ * The bit array is split into 512-bit blocks, one cache line each. A key only sets and tests bits
+ * inside the single block selected by its hash, so a probe costs one cache miss no matter how many
+ * bits are checked. The raw words are laid out so that a whole number of blocks fits in a page,
+ * which lets BTreeIndex persist the filter on a run of index file pages.
+ *
+ * @warning This class is not threadsafe.
+ */
+class BloomFilter
+{
+ public:
+  /**
+   * Number of 64-bit words in one block.
+   */
+	static const int BLOCKWORDS = 8;
+
+  /**
+   * Number of bits in one block.
+   */
+	static const int BLOCKBITS = BLOCKWORDS * 64;
+
+  /**
+   * Number of blocks stored in one page of the index file.
+   *
+   * @param pageSize  Page size of the index file in bytes.
+   */
+	static std::uint32_t blocksPerPage(const std::size_t pageSize) { return pageSize / ( BLOCKWORDS * sizeof( std::uint64_t ) ); }
+
+  /**
+   * Number of filter bits budgeted per key when sizing the filter.
+   */
+	static const int BITSPERKEY = 10;
+
+  /**
+   * Number of bits set and tested for every key.
+   */
+	static const int NUMPROBES = 7;
+
+  /**
+   * Constructor of BloomFilter class. All bits start cleared.
+   *
+   * @param numBlocks   Number of 512-bit blocks in the filter. Must be at least 1.
+   */
+	BloomFilter(const std::uint32_t numBlocks);
+
+  /**
+   * Number of blocks needed to hold numKeys keys at BITSPERKEY bits each.
+   *
+   * @param numKeys   Expected number of keys.
+   * @return          Number of blocks, at least one.
+   */
+	static std::uint32_t blocksForKeys(const std::uint64_t numKeys);
+
+  /**
+   * Number of keys the filter was sized for.
+   */
+	std::uint64_t capacity() const { return ( (std::uint64_t)numBlocks * BLOCKBITS ) / BITSPERKEY; }
+
+  /**
+   * Add a key to the filter.
+   *
+   * @param hash    64-bit hash of the key, e.g. from hashInt().
+   */
+	void insert(const std::uint64_t hash);
+
+  /**
+   * Test a key against the filter. False positives are possible, false negatives are not.
+   *
+   * @param hash    64-bit hash of the key, e.g. from hashInt().
+   * @return        False if the key was definitely never inserted.
+   */
+	bool mayContain(const std::uint64_t hash) const;
+
+  /**
+   * Clear every bit of the filter.
+   */
+	void clear();
+
+  /**
+   * Number of blocks in the filter.
+   */
+	std::uint32_t getNumBlocks() const { return numBlocks; }
+
+  /**
+   * Raw words of the filter, BLOCKWORDS words per block. Used to copy the filter to and from pages.
+   */
+	std::uint64_t* data() { return &words[0]; }
+
+  /**
+   * Mix an INTEGER key into a 64-bit hash suitable for insert() and mayContain().
+   *
+   * @param key     Key to hash.
+   * @return        Hash value.
+   */
+	static std::uint64_t hashInt(const int key);
+
+  /**
+   * Mix a DOUBLE key into a 64-bit hash. 0.0 and -0.0 hash alike since they compare equal.
+   *
+   * @param key     Key to hash.
+   * @return        Hash value.
+   */
+	static std::uint64_t hashDouble(const double key);
+
+  /**
+   * Mix a fixed-length byte string, such as a STRING key, into a 64-bit hash.
+   *
+   * @param bytes   First byte of the key.
+   * @param len     Number of bytes.
+   * @return        Hash value.
+   */
+	static std::uint64_t hashBytes(const char* bytes, const std::size_t len);
+
+ private:
+  /**
+   * Number of 512-bit blocks.
+   */
+	std::uint32_t numBlocks;
+
+  /**
+   * The bit array, numBlocks * BLOCKWORDS words.
+   */
+	std::vector<std::uint64_t> words;
+
+  /**
+   * Pointer to the first word of the block selected by hash.
+   */
+	const std::uint64_t* block(const std::uint64_t hash) const
+	{
+		return &words[ ( ( hash >> 32 ) * numBlocks >> 32 ) * BLOCKWORDS ];
+	}
+};
+
+}
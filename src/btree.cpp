@@ -5,8 +5,12 @@
  * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
  */
 
+#include <algorithm>
+#include <cstring>
+#include <vector>
 #include "btree.h"
 #include "filescan.h"
+#include "frozenIndex.h"
 #include "exceptions/bad_index_info_exception.h"
 #include "exceptions/bad_opcodes_exception.h"
 #include "exceptions/bad_scanrange_exception.h"
@@ -15,6 +19,7 @@
 #include "exceptions/index_scan_completed_exception.h"
 #include "exceptions/file_not_found_exception.h"
 #include "exceptions/end_of_file_exception.h"
+#include "exceptions/invalid_page_size_exception.h"
 
 
 //#define DEBUG
@@ -22,6 +27,28 @@
 namespace badgerdb
 {
 
+template <>
+IndexKeys<int>& BTreeIndex::indexKeys<int>() { return intKeys; }
+
+template <>
+IndexKeys<double>& BTreeIndex::indexKeys<double>() { return doubleKeys; }
+
+template <>
+IndexKeys<StringKey>& BTreeIndex::indexKeys<StringKey>() { return stringKeys; }
+
+/**
+ * Index of the child a scan from lowVal descends to. Copies of a pivot key may end the leaf left of it when a
+ * run of duplicates was split, so a GTE scan goes left of an equal pivot.
+ */
+template <class T>
+static int scanChildIndex(const T keyArray[], const int numEntries, const T & lowVal, const Operator lowOp)
+{
+	if (lowOp == GTE) {
+		return std::lower_bound(keyArray, keyArray + numEntries, lowVal) - keyArray;
+	}
+	return std::upper_bound(keyArray, keyArray + numEntries, lowVal) - keyArray;
+}
+
 // -----------------------------------------------------------------------------
 // BTreeIndex::BTreeIndex -- Constructor
 // -----------------------------------------------------------------------------
@@ -30,88 +57,216 @@ BTreeIndex::BTreeIndex(const std::string & relationName,
 		std::string & outIndexName,
 		BufMgr *bufMgrIn,
 		const int attrByteOffset,
-		const Datatype attrType)
+		const Datatype attrType,
+		const bool useBloomFilter,
+		const std::size_t pageSize,
+		const bool bufferedInsertsIn,
+		const std::size_t memtableSizeIn)
 {
-	bufMgr = bufMgrIn;
-	headerPageNum = 1;
-
 	// Create name of the index file
 	std::ostringstream idxStr;
 	idxStr << relationName << '.' << attrByteOffset;
 	outIndexName = idxStr.str();
 
+	openIndex(relationName, outIndexName, bufMgrIn, attrByteOffset, attrType, useBloomFilter, pageSize,
+						bufferedInsertsIn, memtableSizeIn);
+}
+
+BTreeIndex::BTreeIndex(const std::string & indexName,
+		BufMgr *bufMgrIn,
+		const int attrByteOffset,
+		const Datatype attrType,
+		const std::size_t pageSize)
+{
+	openIndex("", indexName, bufMgrIn, attrByteOffset, attrType, false, pageSize, false, 0);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::openIndex
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::openIndex(const std::string & relationName,
+		const std::string & outIndexName,
+		BufMgr *bufMgrIn,
+		const int attrByteOffset,
+		const Datatype attrType,
+		const bool useBloomFilter,
+		const std::size_t pageSize,
+		const bool bufferedInsertsIn,
+		const std::size_t memtableSizeIn)
+{
+	bufMgr = bufMgrIn;
+	headerPageNum = 1;
+
 	// Set up object attributes
 	attributeType = attrType;
 	this->attrByteOffset = attrByteOffset;
 	scanExecuting = false;
-	
+	defragExecuting = false;
+	bloomFilter = NULL;
+	bloomFirstPageNo = 0;
+	bloomNumPages = 0;
+	bloomNumKeys = 0;
+	leafModel = NULL;
+	leafModelError = 0;
+	bufferedInserts = bufferedInsertsIn;
+	memtableSize = memtableSizeIn;
+	memtableEntries = 0;
+	mergingEntries = 0;
+	stopMerging = false;
+	mergeErrorReported = false;
+
+	// The first commit records that the Bloom filter pages are no longer current
+	metaDirty = true;
+
+	bool created = false;
 	try {
 		file = new BlobFile(outIndexName, false); // Try opening existing index file
 
 		// use existing file
 		std::cout << "Open exisitng Index File" << outIndexName << std::endl;
+	} catch(FileNotFoundException e) {
+		// have to create new file
+		std::cout << "Creating new index file" << outIndexName << std::endl;
+		file = new BlobFile(outIndexName, true, pageSize);
+		created = true;
+	}
+
+	std::uint32_t bloomNumBlocks = 0;
+	bool bloomValid = false;
+	try {
+		if (file->pageSize() > bufMgr->getFrameSize()) {
+			throw InvalidPageSizeException(file->pageSize(), outIndexName);
+		}
 
-		// Read meta page
-		Page *metaPage;
-		bufMgr->readPage(file, headerPageNum, metaPage);
+		if (!created) {
+			// Read meta page
+			Page *metaPage;
+			bufMgr->readPage(file, headerPageNum, metaPage);
+
+			// Set up rootPageNo and leafRoot from IndexMetaInfo
+			IndexMetaInfo *meta = (IndexMetaInfo*)metaPage;
+			if (meta->attrType != attributeType || meta->attrByteOffset != attrByteOffset) {
+				bufMgr->unPinPage(file, headerPageNum, false);
+				bufMgr->flushFile(file);
+				throw BadIndexInfoException("Index file " + outIndexName + " was built over a different attribute.");
+			}
+			rootPageNum = meta->rootPageNo;
+			leafRoot = meta->leafRoot;
+			bufferedInserts = meta->bufferedInserts;
+			bloomFirstPageNo = meta->bloomFirstPageNo;
+			bloomNumPages = meta->bloomNumPages;
+			bloomNumKeys = meta->bloomNumKeys;
+			bloomNumBlocks = meta->bloomNumBlocks;
+			bloomValid = meta->bloomValid;
+			leafExtentStart.assign(meta->leafExtentStart, meta->leafExtentStart + meta->numLeafExtents);
+			leafExtentUsed.assign(meta->leafExtentUsed, meta->leafExtentUsed + meta->numLeafExtents);
+
+			bufMgr->unPinPage(file, headerPageNum, false); // Meta Info page no longer needed
+		}
 
-		// Set up rootPageNo and leafRoot from IndexMetaInfo
-		IndexMetaInfo *meta = (IndexMetaInfo*)metaPage;
-		rootPageNum = meta->rootPageNo;
-		leafRoot = meta->leafRoot;
+		// Pick the kernels for the key type, page size and node layout once, every later call goes straight to them
+		switch (attributeType) {
+		case INTEGER:
+			bindKernelsForPageSize<int>(file->pageSize());
+			break;
+		case DOUBLE:
+			bindKernelsForPageSize<double>(file->pageSize());
+			break;
+		case STRING:
+			bindKernelsForPageSize<StringKey>(file->pageSize());
+			break;
+		default:
+			throw BadIndexInfoException("Unsupported attribute type.");
+		}
+	} catch(BadgerDbException & e) {
+		delete file;
+		if (created) {
+			File::remove(outIndexName);
+		}
+		throw;
+	}
 
-		bufMgr->unPinPage(file, headerPageNum, false); // Meta Info page no longer needed
+	if (memtableSize > 0) {
+		mergeThread = std::thread(&BTreeIndex::mergeLoop, this);
+	}
 
-	} catch(FileNotFoundException e) {
-		// have to create new file
-		std::cout << "Creating new index file" << outIndexName << std::endl;
-		file = new BlobFile(outIndexName, true);
+	// A failed merge can surface through the inserts below, the thread has to be joined before the exception leaves
+	try {
+		if (!created) {
+			if (bloomFirstPageNo != 0 && bloomValid) {
+				loadBloomFilter(bloomNumBlocks);
+			} else if (bloomFirstPageNo != 0 || useBloomFilter) {
+				rebuildBloomFilter();
+			}
 
-		// allocate page for meta info
-		Page *metaPage;
-		bufMgr->allocPage(file, headerPageNum, metaPage);
-		std::cout << "metaPageNum: " << headerPageNum << std::endl;
+		} else {
+			// allocate page for meta info
+			Page *metaPage;
+			bufMgr->allocPage(file, headerPageNum, metaPage);
+			std::cout << "metaPageNum: " << headerPageNum << std::endl;
+
+			// allocate page for root
+			leafRoot = true; // root is the only node and is a leaf.
+			Page *rootPage;
+			allocLeafPage(0, rootPageNum, rootPage);
+			std::cout << "rootPageNum: " << rootPageNum << std::endl;
+			// initialize root node, an all-zero page is an empty leaf without right sibling for every key type
+			memset((void*)rootPage, 0, file->pageSize());
+			
+			// populate meta info with the root page num
+			IndexMetaInfo *meta = (IndexMetaInfo*)(metaPage);
+			meta->attrByteOffset = attrByteOffset;
+			meta->attrType = attributeType;
+			meta->rootPageNo = rootPageNum;
+			meta->leafRoot = true;
+			meta->bufferedInserts = bufferedInserts;
+			meta->bloomFirstPageNo = 0;
+			meta->bloomNumPages = 0;
+			meta->bloomNumBlocks = 0;
+			meta->bloomNumKeys = 0;
+			meta->bloomValid = false;
+			meta->numLeafExtents = 0;
+
+			bufMgr->unPinPage(file, headerPageNum, true);
+			bufMgr->unPinPage(file, rootPageNum, true);
+
+			// scan the file with the relation data (use FileScan) and keep the entries <key, rid>
+			// An index opened by name alone starts empty
+			if (!relationName.empty()) {
+				FileScan fscan(relationName, bufMgr);
+				try
+				{
+					RecordId scanRid;
+					while(1)
+					{
+						fscan.scanNext(scanRid);
+						std::string recordStr = fscan.getRecord();
+						const char *record = recordStr.c_str();
+						void *key = (void*)(record + attrByteOffset);
+						insertEntry(key, scanRid);
+						// std::cout << "Inserted key: " << *((int*)key) << " rid: (" << scanRid.page_number << ", " << scanRid.slot_number << ")" << std::endl;
+					}
+				}
+				catch(EndOfFileException e)
+				{
+					std::cout << "Finish inserted all to B+ Tree records" << std::endl;
+				}
+			}
 
-		// allocate page for root
-		leafRoot = true; // root is the only node and is a leaf.
-		Page *rootPage;
-		bufMgr->allocPage(file, rootPageNum, rootPage);
-		std::cout << "rootPageNum: " << rootPageNum << std::endl;
-		// initialize root node
-		LeafNodeInt *root = (LeafNodeInt*)(rootPage);
-		root->numEntries = 0;
-		root->rightSibPageNo = 0;
-		
-		// populate meta info with the root page num
-		IndexMetaInfo *meta = (IndexMetaInfo*)(metaPage);
-		meta->attrByteOffset = attrByteOffset;
-		meta->attrType = attributeType;
-		meta->rootPageNo = rootPageNum;
-		meta->leafRoot = true;
-
-		bufMgr->unPinPage(file, headerPageNum, true);
-		bufMgr->unPinPage(file, rootPageNum, false);
-
-		// scan the file with the relation data (use FileScan) and keep the entries <key, rid>		FileScan fscan(relationName, bufMgr);
-		FileScan fscan(relationName, bufMgr);
-		try
-		{
-			RecordId scanRid;
-			while(1)
-			{
-				fscan.scanNext(scanRid);
-				std::string recordStr = fscan.getRecord();
-				const char *record = recordStr.c_str();
-				void *key = (void*)(record + attrByteOffset);
-				insertEntry(key, scanRid);
-				// std::cout << "Inserted key: " << *((int*)key) << " rid: (" << scanRid.page_number << ", " << scanRid.slot_number << ")" << std::endl;
+			// Build the filter once over the finished leaves instead of growing it insert by insert.
+			if (useBloomFilter) {
+				rebuildBloomFilter();
 			}
 		}
-		catch(EndOfFileException e)
-		{
-			std::cout << "Finish inserted all to B+ Tree records" << std::endl;
+	} catch (...) {
+		if (memtableSize > 0) {
+			stopMergeThread();
 		}
+		throw;
 	}
+	std::lock_guard<std::recursive_mutex> lock(treeLatch);
+	commitChanges();
 }
 
 
@@ -119,9 +274,55 @@ BTreeIndex::BTreeIndex(const std::string & relationName,
 // BTreeIndex::~BTreeIndex -- destructor
 // -----------------------------------------------------------------------------
 
-BTreeIndex::~BTreeIndex()
+BTreeIndex::~BTreeIndex() noexcept(false)
 {
+	// Unpin page that is currently scanning
+	if (scanExecuting) {
+		endScan();
+	}
+
+	// Let the merge thread finish the memtable before the tree is closed
+	bool failedBefore = false;
+	if (memtableSize > 0) {
+		{
+			std::lock_guard<std::mutex> lock(memtableLatch);
+			failedBefore = (mergeError != nullptr);
+		}
+		try {
+			if (!failedBefore) {
+				flushMemtable();
+			}
+		} catch (...) {
+			// Kept in mergeError and rethrown below, once the index is closed
+		}
+		stopMergeThread();
+	}
+
+	if (bloomFilter) {
+		storeBloomFilter();
+	}
+
 	// Update Index meta info to the Index meta info page
+	writeMeta(true);
+	bufMgr->commit();
+	delete bloomFilter;
+	delete leafModel;
+
+	bufMgr->flushFile(file);
+	delete file;
+
+	// Report a merge that failed after the last insertEntry() or flushMemtable()
+	if (mergeError && (!failedBefore || !mergeErrorReported) && !std::uncaught_exception()) {
+		std::rethrow_exception(mergeError);
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::writeMeta
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::writeMeta(const bool closing)
+{
 	Page *metaPage;
 	IndexMetaInfo *meta;
 	bufMgr->readPage(file, headerPageNum, metaPage);
@@ -130,18 +331,239 @@ BTreeIndex::~BTreeIndex()
 	meta->attrType = attributeType;
 	meta->rootPageNo = rootPageNum;
 	meta->leafRoot = leafRoot;
+	meta->bufferedInserts = bufferedInserts;
+	meta->bloomFirstPageNo = bloomFirstPageNo;
+	meta->bloomNumPages = bloomNumPages;
+	meta->bloomNumBlocks = bloomFilter ? bloomFilter->getNumBlocks() : 0;
+	meta->bloomNumKeys = bloomNumKeys;
+	meta->bloomValid = closing;
+	meta->numLeafExtents = leafExtentStart.size();
+	std::copy(leafExtentStart.begin(), leafExtentStart.end(), meta->leafExtentStart);
+	std::copy(leafExtentUsed.begin(), leafExtentUsed.end(), meta->leafExtentUsed);
 	bufMgr->unPinPage(file, headerPageNum, true);
+	metaDirty = false;
+}
 
-	// Unpin page that is currently scanning
-	if (scanExecuting) {
-		bufMgr->unPinPage(file, currentPageNum, false);
+// -----------------------------------------------------------------------------
+// BTreeIndex::commitChanges
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::commitChanges()
+{
+	if (!bufMgr->hasLog()) {
+		return;
+	}
+	if (metaDirty) {
+		writeMeta(false);
 	}
+	bufMgr->commit();
+}
 
-	bufMgr->flushFile(file);
-	delete file;
+// -----------------------------------------------------------------------------
+// BTreeIndex::allocLeafPage
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::allocLeafPage(const PageId nearPageNo, PageId & pageNo, Page *& page)
+{
+	int numExtents = leafExtentStart.size();
+	int ext = -1;
+
+	// The extent holding nearPageNo, or failing that the extent laid out right after it
+	if (nearPageNo != 0) {
+		for (int i = 0; i < numExtents; i++) {
+			if (leafExtentStart[i] <= nearPageNo && nearPageNo < leafExtentStart[i] + LEAFEXTENTSIZE) {
+				ext = i;
+				break;
+			}
+		}
+		if (ext >= 0 && leafExtentUsed[ext] == LEAFEXTENTSIZE) {
+			PageId nextStart = leafExtentStart[ext] + LEAFEXTENTSIZE;
+			ext = -1;
+			for (int i = 0; i < numExtents; i++) {
+				if (leafExtentStart[i] == nextStart && leafExtentUsed[i] < LEAFEXTENTSIZE) {
+					ext = i;
+					break;
+				}
+			}
+		}
+	} else if (numExtents > 0 && leafExtentUsed[numExtents - 1] < LEAFEXTENTSIZE) {
+		ext = numExtents - 1;
+	}
+
+	// A fresh extent, or once the meta page cannot track more, any extent with room left
+	if (ext < 0) {
+		if (numExtents < MAXLEAFEXTENTS) {
+			leafExtentStart.push_back(bufMgr->allocateExtent(file, LEAFEXTENTSIZE));
+			leafExtentUsed.push_back(0);
+			ext = numExtents;
+		} else {
+			for (int i = 0; i < numExtents; i++) {
+				if (leafExtentUsed[i] < LEAFEXTENTSIZE) {
+					ext = i;
+					break;
+				}
+			}
+			if (ext < 0) {
+				bufMgr->allocPage(file, pageNo, page);
+				return;
+			}
+		}
+	}
+
+	pageNo = leafExtentStart[ext] + leafExtentUsed[ext];
+	leafExtentUsed[ext]++;
+	metaDirty = true;
+	bufMgr->claimPage(file, pageNo, page);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::leftmostLeafPageNo
+// -----------------------------------------------------------------------------
+
+template <class T, std::size_t PAGESIZE>
+PageId BTreeIndex::leftmostLeafPageNo()
+{
+	if (leafRoot) {
+		return rootPageNum;
+	}
+
+	PageId pageNo = rootPageNum;
+	while (true) {
+		Page *page;
+		bufMgr->readPage(file, pageNo, page);
+		PageId childPageNo;
+		int level;
+		if (bufferedInserts) {
+			BufferedNonLeafNode<T, PAGESIZE> *node = (BufferedNonLeafNode<T, PAGESIZE>*)page;
+			childPageNo = node->pageNoArray[0];
+			level = node->level;
+		} else {
+			NonLeafNode<T, PAGESIZE> *node = (NonLeafNode<T, PAGESIZE>*)page;
+			childPageNo = node->pageNoArray[0];
+			level = node->level;
+		}
+		bufMgr->unPinPage(file, pageNo, false);
+		pageNo = childPageNo;
+		if (level == 1) {
+			return pageNo;
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::rebuildBloomFilter
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::rebuildBloomFilter()
+{
+	std::lock_guard<std::recursive_mutex> lock(treeLatch);
+	(this->*rebuildBloomFilterFn)();
+	commitChanges();
+}
+
+template <class T, std::size_t PAGESIZE>
+void BTreeIndex::rebuildBloomFilterKernel()
+{
+	// Count the keys first so the filter can be sized for them
+	const std::uint32_t blocksPerPage = BloomFilter::blocksPerPage(PAGESIZE);
+	std::uint64_t numKeys = 0;
+	PageId firstLeafPageNo = leftmostLeafPageNo<T, PAGESIZE>();
+	PageId pageNo = firstLeafPageNo;
+	while (pageNo != 0) {
+		Page *page;
+		bufMgr->readPage(file, pageNo, page);
+		LeafNode<T, PAGESIZE> *leaf = (LeafNode<T, PAGESIZE>*)page;
+		numKeys += leaf->numEntries;
+		PageId nextPageNo = leaf->rightSibPageNo;
+		bufMgr->unPinPage(file, pageNo, false);
+		pageNo = nextPageNo;
+	}
+
+	// Inserts still buffered above the leaves are keys of the index too
+	std::vector< RIDKeyPair<T> > messages;
+	if (bufferedInserts && !leafRoot) {
+		collectMessages<T, PAGESIZE>(rootPageNum, NULL, NULL, messages);
+		numKeys += messages.size();
+	}
+
+	int numPages = (BloomFilter::blocksForKeys(numKeys) + blocksPerPage - 1) / blocksPerPage;
+	if (numPages > bloomNumPages) {
+		// Pages of a BlobFile are never freed, so a filter that outgrows its run moves to a fresh
+		// run at the end of the file. Nothing else allocates in between, so the run is contiguous.
+		for (int i = 0; i < numPages; i++) {
+			PageId newPageNo;
+			Page *newPage;
+			bufMgr->allocPage(file, newPageNo, newPage);
+			if (i == 0) {
+				bloomFirstPageNo = newPageNo;
+			}
+			bufMgr->unPinPage(file, newPageNo, true);
+		}
+		bloomNumPages = numPages;
+		metaDirty = true;
+	}
+
+	// Use every block of the run, a larger filter costs nothing extra to probe
+	delete bloomFilter;
+	bloomFilter = new BloomFilter(bloomNumPages * blocksPerPage);
+	bloomNumKeys = numKeys;
+
+	pageNo = firstLeafPageNo;
+	while (pageNo != 0) {
+		Page *page;
+		bufMgr->readPage(file, pageNo, page);
+		LeafNode<T, PAGESIZE> *leaf = (LeafNode<T, PAGESIZE>*)page;
+		for (int i = 0; i < leaf->numEntries; i++) {
+			bloomFilter->insert(keyHash(leaf->keyArray[i]));
+		}
+		PageId nextPageNo = leaf->rightSibPageNo;
+		bufMgr->unPinPage(file, pageNo, false);
+		pageNo = nextPageNo;
+	}
+	for (std::size_t i = 0; i < messages.size(); i++) {
+		bloomFilter->insert(keyHash(messages[i].key));
+	}
+
+	storeBloomFilter();
+}
+
+void BTreeIndex::loadBloomFilter(const std::uint32_t numBlocks)
+{
+	bloomFilter = new BloomFilter(numBlocks);
+	const std::size_t wordsPerPage = BloomFilter::blocksPerPage(file->pageSize()) * BloomFilter::BLOCKWORDS;
+	std::size_t wordsLeft = (std::size_t)numBlocks * BloomFilter::BLOCKWORDS;
+	std::uint64_t *words = bloomFilter->data();
+
+	for (int i = 0; i < bloomNumPages && wordsLeft > 0; i++) {
+		std::size_t n = std::min(wordsLeft, wordsPerPage);
+		Page *page;
+		bufMgr->readPage(file, bloomFirstPageNo + i, page);
+		memcpy(words, (const void*)page, n * sizeof(std::uint64_t));
+		bufMgr->unPinPage(file, bloomFirstPageNo + i, false);
+		words += n;
+		wordsLeft -= n;
+	}
+}
+
+void BTreeIndex::storeBloomFilter()
+{
+	const std::size_t wordsPerPage = BloomFilter::blocksPerPage(file->pageSize()) * BloomFilter::BLOCKWORDS;
+	std::size_t wordsLeft = (std::size_t)bloomFilter->getNumBlocks() * BloomFilter::BLOCKWORDS;
+	const std::uint64_t *words = bloomFilter->data();
+
+	for (int i = 0; i < bloomNumPages && wordsLeft > 0; i++) {
+		std::size_t n = std::min(wordsLeft, wordsPerPage);
+		Page *page;
+		bufMgr->readPage(file, bloomFirstPageNo + i, page);
+		memcpy((void*)page, words, n * sizeof(std::uint64_t));
+		bufMgr->unPinPage(file, bloomFirstPageNo + i, true);
+		words += n;
+		wordsLeft -= n;
+	}
 }
 
-void BTreeIndex::insertLeafArrays(const RIDKeyPair<int> ridKey, int keyArray[], RecordId ridArray[], const int numEntries) 
+template <class T>
+void BTreeIndex::insertLeafArrays(const RIDKeyPair<T> ridKey, T keyArray[], RecordId ridArray[], const int numEntries) 
 {
 	int insertIdx = numEntries; // Default, value append at the end (No shifting need)
 	// Find index in keyArray to insert to (shiting needed)
@@ -161,8 +583,9 @@ void BTreeIndex::insertLeafArrays(const RIDKeyPair<int> ridKey, int keyArray[],
 	ridArray[insertIdx] = ridKey.rid;
 }
 
-void BTreeIndex::insertNonleafArrays(const PropogationInfo propInfo, const int insertIdx, 
-												int keyArray[], PageId pageNoArray[], const int numEntries) 
+template <class T>
+void BTreeIndex::insertNonleafArrays(const PropogationInfo<T> propInfo, const int insertIdx, 
+												T keyArray[], PageId pageNoArray[], const int numEntries) 
 {
 	// Shift element to the right of insertIdx
 	for (int i = numEntries; i > insertIdx; i--) {
@@ -179,23 +602,28 @@ void BTreeIndex::insertNonleafArrays(const PropogationInfo propInfo, const int i
 // -----------------------------------------------------------------------------
 // BTreeIndex::insertEntry
 // -----------------------------------------------------------------------------
-void BTreeIndex::insertHelper(const RIDKeyPair<int> ridKey, const PageId nodePageNo, const int nodeType, 
-															PropogationInfo & propInfo, bool & splitted)
+template <class T, std::size_t PAGESIZE>
+void BTreeIndex::insertHelper(const RIDKeyPair<T> ridKey, const PageId nodePageNo, const int nodeType, 
+															PropogationInfo<T> & propInfo, bool & splitted)
 {
-	Page *page;
+	const int LEAFSIZE = NodeCapacity<T, PAGESIZE>::LEAF;
+	const int NONLEAFSIZE = NodeCapacity<T, PAGESIZE>::NONLEAF;
+
+	// The handle unpins the node on every way out, also when the insert below it throws
+	PageHandle page;
 	bufMgr->readPage(file, nodePageNo, page);
 
 	if (nodeType) { // leaf
-		LeafNodeInt *node = (LeafNodeInt*)(page);
+		LeafNode<T, PAGESIZE> *node = (LeafNode<T, PAGESIZE>*)(page.page());
 		
 		// Leaf Node is full
-		if (node->numEntries == INTARRAYLEAFSIZE) {
+		if (node->numEntries == LEAFSIZE) {
 			splitted = true;
 			int nodeNumEntries = node->numEntries;
 
 			// Copy and insert to temporary arrays
-			int tempKeyArray[ INTARRAYLEAFSIZE + 1];
-			RecordId tempRidArray[ INTARRAYLEAFSIZE + 1];
+			T tempKeyArray[ LEAFSIZE + 1];
+			RecordId tempRidArray[ LEAFSIZE + 1];
 			std::copy(node->keyArray, node->keyArray + nodeNumEntries, tempKeyArray);
 			std::copy(node->ridArray, node->ridArray + nodeNumEntries, tempRidArray);
 			insertLeafArrays(ridKey, tempKeyArray, tempRidArray, nodeNumEntries);
@@ -204,9 +632,9 @@ void BTreeIndex::insertHelper(const RIDKeyPair<int> ridKey, const PageId nodePag
 			// Allocate right page. Left page will used the page allocated by the original page.
 			Page *rightPage;
 			propInfo.leftPageNo = nodePageNo;
-			bufMgr->allocPage(file, propInfo.rightPageNo, rightPage);
-			LeafNodeInt *leftNode = node;
-			LeafNodeInt *rightNode = (LeafNodeInt*)(rightPage);
+			allocLeafPage(nodePageNo, propInfo.rightPageNo, rightPage);
+			LeafNode<T, PAGESIZE> *leftNode = node;
+			LeafNode<T, PAGESIZE> *rightNode = (LeafNode<T, PAGESIZE>*)(rightPage);
 			leftNode->numEntries = (nodeNumEntries+1)/2;
 			rightNode->numEntries = (nodeNumEntries+1) - leftNode->numEntries;
 			
@@ -225,9 +653,12 @@ void BTreeIndex::insertHelper(const RIDKeyPair<int> ridKey, const PageId nodePag
 			// Set up necessary info for propogation
 			propInfo.middleKey = rightNode->keyArray[0];
 			propInfo.fromLeaf = true;
+			if (leafModel) {
+				leafModel->splitLeaf(propInfo.leftPageNo, propInfo.rightPageNo, modelKey(propInfo.middleKey));
+			}
 
 			// Get rid of old page node and unpin new pages
-			bufMgr->unPinPage(file, propInfo.leftPageNo, true);
+			page.markDirty();
 			bufMgr->unPinPage(file, propInfo.rightPageNo, true);
 
 			leafRoot = false; // The root can never be split after a split 
@@ -239,13 +670,13 @@ void BTreeIndex::insertHelper(const RIDKeyPair<int> ridKey, const PageId nodePag
 			splitted = false;
 			insertLeafArrays(ridKey, node->keyArray, node->ridArray, node->numEntries);
 			node->numEntries++;
-			bufMgr->unPinPage(file, nodePageNo, true); 
+			page.markDirty();
 		}
 	} else { // Nonleaf
 		// Find the next page to traverse
-		NonLeafNodeInt *node = (NonLeafNodeInt*)(page);
+		NonLeafNode<T, PAGESIZE> *node = (NonLeafNode<T, PAGESIZE>*)(page.page());
 		PageId childPageNo;
-		PropogationInfo childPropInfo;
+		PropogationInfo<T> childPropInfo;
 		bool childSplitted;
 		int insertIdx;
 		childPageNo = node->pageNoArray[node->numEntries];
@@ -258,29 +689,29 @@ void BTreeIndex::insertHelper(const RIDKeyPair<int> ridKey, const PageId nodePag
 			}
 		}
 
-		insertHelper(ridKey, childPageNo, node->level, childPropInfo, childSplitted); // start traversing
+		insertHelper<T, PAGESIZE>(ridKey, childPageNo, node->level, childPropInfo, childSplitted); // start traversing
 
 		// Handle split propogation
 		if (childSplitted) {
 			// Nonleaf node is full
-			if (node->numEntries == INTARRAYNONLEAFSIZE) {
+			if (node->numEntries == NONLEAFSIZE) {
 			splitted = true;
 			int nodeNumEntries = node->numEntries;
 
 			// Copy and insert to temporary arrays
-			int tempKeyArray[ INTARRAYLEAFSIZE + 1];
-			PageId tempPageNoArray[ INTARRAYLEAFSIZE + 2];
+			T tempKeyArray[ NONLEAFSIZE + 1];
+			PageId tempPageNoArray[ NONLEAFSIZE + 2];
 			std::copy(node->keyArray, node->keyArray + nodeNumEntries, tempKeyArray);
 			std::copy(node->pageNoArray, node->pageNoArray + nodeNumEntries+ 1, tempPageNoArray);
 			insertNonleafArrays(childPropInfo, insertIdx, tempKeyArray, tempPageNoArray, node->numEntries);
 
 			// Distrubute entries to both nodes
 			// Allocate right page. Left page will used the page allocated by the original page.
-			Page *rightPage;
+			PageHandle rightPage;
 			propInfo.leftPageNo = nodePageNo; 
 			bufMgr->allocPage(file, propInfo.rightPageNo, rightPage);
-			NonLeafNodeInt *leftNode = node;
-			NonLeafNodeInt *rightNode = (NonLeafNodeInt*)(rightPage);
+			NonLeafNode<T, PAGESIZE> *leftNode = node;
+			NonLeafNode<T, PAGESIZE> *rightNode = (NonLeafNode<T, PAGESIZE>*)(rightPage.page());
 			leftNode->numEntries = (nodeNumEntries+1-1)/2;
 			rightNode->numEntries = (nodeNumEntries+1-1) - leftNode->numEntries;
 			
@@ -301,8 +732,8 @@ void BTreeIndex::insertHelper(const RIDKeyPair<int> ridKey, const PageId nodePag
 			propInfo.fromLeaf = false;
 
 			// Get rid of old page node and unpin new pages
-			bufMgr->unPinPage(file, propInfo.leftPageNo, true);
-			bufMgr->unPinPage(file, propInfo.rightPageNo, true);
+			page.markDirty();
+			rightPage.markDirty();
 			
 			// std::cout << "Splitted Nonleaf" << std::endl;
 
@@ -311,12 +742,11 @@ void BTreeIndex::insertHelper(const RIDKeyPair<int> ridKey, const PageId nodePag
 				splitted = false;
 				insertNonleafArrays(childPropInfo, insertIdx, node->keyArray, node->pageNoArray, node->numEntries);
 				node->numEntries++;
-				bufMgr->unPinPage(file, nodePageNo, true); 
+				page.markDirty();
 			}
 		// Child was not splitted
 		} else {
 			splitted = false; // current node is not splitted;
-			bufMgr->unPinPage(file, nodePageNo, false);
 		}
 	}
 }
@@ -327,19 +757,31 @@ void BTreeIndex::insertHelper(const RIDKeyPair<int> ridKey, const PageId nodePag
 
 const void BTreeIndex::insertEntry(const void *key, const RecordId rid) 
 {
-	PropogationInfo propInfo;
+	// The merge thread commits the memtable once it reaches the tree
+	if (memtableSize > 0) {
+		(this->*memtableInsertFn)(key, rid);
+		return;
+	}
+	(this->*insertEntryFn)(key, rid);
+	commitChanges();
+}
+
+template <class T, std::size_t PAGESIZE>
+void BTreeIndex::insertEntryKernel(const void *key, const RecordId rid) 
+{
+	PropogationInfo<T> propInfo;
 	bool splitted;
-	RIDKeyPair<int> ridKey;
-	ridKey.set(rid, *((int*)(key)));
+	RIDKeyPair<T> ridKey;
+	ridKey.set(rid, keyFromPtr<T>(key));
 
-	insertHelper(ridKey, rootPageNum, leafRoot, propInfo, splitted); // Start traversing the root page.
+	insertHelper<T, PAGESIZE>(ridKey, rootPageNum, leafRoot, propInfo, splitted); // Start traversing the root page.
 
 	if (splitted) { // Root is splitted, Have to create new root page
 		Page *rootPage;
 		bufMgr->allocPage(file, rootPageNum, rootPage); // Allocate new root page
 		
 		// Set up content of the root page.
-		NonLeafNodeInt *root = (NonLeafNodeInt*)(rootPage);
+		NonLeafNode<T, PAGESIZE> *root = (NonLeafNode<T, PAGESIZE>*)(rootPage);
 		root->level = propInfo.fromLeaf;
 		root->numEntries = 1;
 		root->keyArray[0] = propInfo.middleKey;
@@ -347,9 +789,25 @@ const void BTreeIndex::insertEntry(const void *key, const RecordId rid)
 		root->pageNoArray[1] = propInfo.rightPageNo;
 
 		bufMgr->unPinPage(file, rootPageNum, true);
+		metaDirty = true;
 		
 		// std::cout << "Root splitted" << std::endl;
 	} 
+
+	addToBloomFilter<T, PAGESIZE>(ridKey.key);
+}
+
+template <class T, std::size_t PAGESIZE>
+void BTreeIndex::addToBloomFilter(const T & key)
+{
+	if (bloomFilter) {
+		bloomFilter->insert(keyHash(key));
+		bloomNumKeys++;
+		// Past twice its design load the false positive rate climbs quickly, so resize it
+		if (bloomNumKeys > 2 * bloomFilter->capacity()) {
+			rebuildBloomFilterKernel<T, PAGESIZE>();
+		}
+	}
 }
 
 // -----------------------------------------------------------------------------
@@ -361,6 +819,34 @@ const void BTreeIndex::startScan(const void* lowValParm,
    const void* highValParm,
    const Operator highOpParm)
 {
+	if (memtableSize == 0) {
+		(this->*startScanFn)(lowValParm, lowOpParm, highValParm, highOpParm);
+		return;
+	}
+
+	// Keep the merge thread out of the tree until endScan()
+	if (scanExecuting) {
+		endScan();
+	}
+	scanLatch = std::unique_lock<std::recursive_mutex>(treeLatch);
+	try {
+		(this->*startScanFn)(lowValParm, lowOpParm, highValParm, highOpParm);
+	} catch (BadgerDbException & e) {
+		if (!scanExecuting && scanLatch.owns_lock()) {
+			scanLatch.unlock();
+		}
+		throw;
+	}
+}
+
+template <class T, std::size_t PAGESIZE>
+void BTreeIndex::startScanKernel(const void* lowValParm,
+   const Operator lowOpParm,
+   const void* highValParm,
+   const Operator highOpParm)
+{
+	const T lowVal = keyFromPtr<T>(lowValParm);
+	const T highVal = keyFromPtr<T>(highValParm);
 
 	// If there is another scan pending end that scan.
 	if(scanExecuting){
@@ -375,30 +861,37 @@ const void BTreeIndex::startScan(const void* lowValParm,
 	scanExecuting = true;
 	lowOp = lowOpParm;
 	highOp = highOpParm;
-	lowValInt = *(int*)lowValParm;
-	highValInt = *(int*)highValParm;
+	indexKeys<T>().lowVal = lowVal;
+	indexKeys<T>().highVal = highVal;
 
-	if (lowValInt > highValInt){
+	if (lowVal > highVal){
 		scanExecuting = false;
 		throw BadScanrangeException();
 	} 
 
+	// Equality probe for a key the Bloom filter has never seen: no leaf can hold it
+	if (bloomFilter && lowOp == GTE && highOp == LTE && lowVal == highVal
+			&& !bloomFilter->mayContain(keyHash(lowVal))) {
+		scanExecuting = false;
+		throw NoSuchKeyFoundException();
+	}
+
 	// if the root node is the only node in the tree
 	if (leafRoot){
 		currentPageNum = rootPageNum;
 		bufMgr->readPage(file, currentPageNum, currentPageData);
-		LeafNodeInt* currentLeafRoot = (LeafNodeInt*) currentPageData;
+		LeafNode<T, PAGESIZE>* currentLeafRoot = (LeafNode<T, PAGESIZE>*) currentPageData;
 
 		// [1, 3, 5, 7, 12] >=5  nextEntry: 1
 		nextEntry = currentLeafRoot->numEntries; // default values for case where there is no value that match the scan
-		for (int i = 0; i < INTARRAYLEAFSIZE; i++){
+		for (int i = 0; i < currentLeafRoot->numEntries; i++){
 
-			if (lowOp == GTE && currentLeafRoot->keyArray[i] >= lowValInt){
+			if (lowOp == GTE && currentLeafRoot->keyArray[i] >= lowVal){
 				nextEntry = i;
 				break;
 			}
 
-			if(lowOp == GT && currentLeafRoot->keyArray[i] > lowValInt){
+			if(lowOp == GT && currentLeafRoot->keyArray[i] > lowVal){
 				nextEntry = i;
 				break;
 			}
@@ -407,55 +900,51 @@ const void BTreeIndex::startScan(const void* lowValParm,
 
 	// If the root node is not a leaf and not the only node in tree
 	else {
-		
-		// start at root
-		bufMgr->readPage(file, rootPageNum, currentPageData);
-		currentPageNum = rootPageNum;
-		NonLeafNodeInt* currentNode = (NonLeafNodeInt*) currentPageData;
+		// A model emptied by a split it could not place is built again before it is used
+		if (leafModelError > 0 && ( leafModel == NULL || leafModel->numLeaves() == 0 )) {
+			buildLeafModelKernel<T, PAGESIZE>();
+		}
+
+		PageId nextId;
+		if (leafModel != NULL) {
+			// The model names the leaf, so no non-leaf node is read
+			nextId = leafModel->findLeaf(modelKey(lowVal), lowOp == GT);
+		} else {
+
+		// start at root, the handle keeps the node being descended through pinned
+		PageHandle node;
+		bufMgr->readPage(file, rootPageNum, node);
+		NonLeafNode<T, PAGESIZE>* currentNode = (NonLeafNode<T, PAGESIZE>*) node.page();
 
 		while (currentNode->level != 1){
 			// [1, 3, 5]  GT 2  nextEntry: 1
 			//[0], [1, 2], [4], [5, 6]
-			nextEntry = currentNode->numEntries; // default
-			for (int i = 0; i < currentNode->numEntries; i++){
-				if (lowValInt < currentNode->keyArray[i]) {
-					nextEntry = i;
-					break;
-				}
-			}
-			//unpin old page and read new page number
-			PageId nextId = currentNode->pageNoArray[nextEntry];
-			bufMgr->unPinPage(file, currentPageNum, false);
-			bufMgr->readPage(file, nextId, currentPageData);
-	    	currentNode = (NonLeafNodeInt*) currentPageData;
-			currentPageNum = nextId;
+			nextEntry = scanChildIndex(currentNode->keyArray, currentNode->numEntries, lowVal, lowOp);
+			//read new page number, which unpins the old page
+			bufMgr->readPage(file, currentNode->pageNoArray[nextEntry], node);
+	    	currentNode = (NonLeafNode<T, PAGESIZE>*) node.page();
 		}
 
 		// Select the leaf node from the last nonleaf node
-		nextEntry = currentNode->numEntries; // default
-		for (int i = 0; i < currentNode->numEntries; i++){
-				if (lowValInt < currentNode->keyArray[i]) {
-					nextEntry = i;
-					break;
-				}
+		nextEntry = scanChildIndex(currentNode->keyArray, currentNode->numEntries, lowVal, lowOp);
+		nextId = currentNode->pageNoArray[nextEntry];
+		node.release();
 		}
-		PageId nextId = currentNode->pageNoArray[nextEntry];
 
 		bool found = false;
 		while(!found){
-			//unpin old page and read new leaf page
-			bufMgr->unPinPage(file, currentPageNum, false);
+			//read new leaf page
 			bufMgr->readPage(file, nextId, currentPageData);
-			LeafNodeInt* currentNodeLeaf = (LeafNodeInt*) currentPageData;
+			LeafNode<T, PAGESIZE>* currentNodeLeaf = (LeafNode<T, PAGESIZE>*) currentPageData;
 			currentPageNum = nextId;
 
 			nextEntry = currentNodeLeaf->numEntries; // default value for the case when no value match the scan range
 			for (int i = 0; i < currentNodeLeaf->numEntries; i++){
-				if(lowOp == GT && lowValInt < currentNodeLeaf->keyArray[i]){
+				if(lowOp == GT && lowVal < currentNodeLeaf->keyArray[i]){
 					nextEntry = i;
 					return;
 				}
-				else if(lowOp == GTE && lowValInt <= currentNodeLeaf->keyArray[i]){
+				else if(lowOp == GTE && lowVal <= currentNodeLeaf->keyArray[i]){
 					nextEntry = i;
 					return;
 				}
@@ -467,8 +956,9 @@ const void BTreeIndex::startScan(const void* lowValParm,
 				throw NoSuchKeyFoundException();
 			}
 			else {
-				//Assign next node to the sibling of current leaf node
+				//Assign next node to the sibling of current leaf node and unpin the current one
 				nextId = currentNodeLeaf->rightSibPageNo;
+				bufMgr->unPinPage(file, currentPageNum, false);
 			}
 		}
 	}
@@ -482,6 +972,36 @@ const void BTreeIndex::startScan(const void* lowValParm,
 // -----------------------------------------------------------------------------
 
 const void BTreeIndex::scanNext(RecordId& outRid) 
+{
+	(this->*scanNextFn)(outRid);
+}
+
+template <class T, std::size_t PAGESIZE>
+bool BTreeIndex::nextScanLeaf()
+{
+	const PageId nextPageNo = ((LeafNode<T, PAGESIZE>*)currentPageData)->rightSibPageNo;
+	if (nextPageNo == 0) {
+		return false;
+	}
+
+	// Pin the sibling before letting go of the current leaf, so a failed read leaves the scan on a pinned leaf
+	Page *nextPage;
+	bufMgr->readPage(file, nextPageNo, nextPage);
+	bufMgr->unPinPage(file, currentPageNum, false);
+	currentPageNum = nextPageNo;
+	currentPageData = nextPage;
+	nextEntry = 0;
+
+	// start reading the leaf after it while this one is scanned
+	const PageId aheadPageNo = ((LeafNode<T, PAGESIZE>*)currentPageData)->rightSibPageNo;
+	if (aheadPageNo != 0) {
+		bufMgr->prefetch(file, aheadPageNo, 1);
+	}
+	return true;
+}
+
+template <class T, std::size_t PAGESIZE>
+void BTreeIndex::scanNextKernel(RecordId& outRid) 
 {
     // Ensure scan is currently executing
     if(!scanExecuting)
@@ -489,35 +1009,25 @@ const void BTreeIndex::scanNext(RecordId& outRid)
         throw ScanNotInitializedException();
     }
 
-    // Cast page to leaf node
-    LeafNodeInt* currentNode = (LeafNodeInt*)currentPageData;
-    // if the next entry exceeds a leaf's key occupancy or the page is
-    if (nextEntry == currentNode->numEntries) {
-        // unpin the page
-        bufMgr->unPinPage(file, currentPageNum, false);
-        // get the sibling
-        currentPageNum = currentNode->rightSibPageNo;
+    // if the next entry exceeds a leaf's key occupancy, go on to the sibling
+    if (nextEntry == ((LeafNode<T, PAGESIZE>*)currentPageData)->numEntries) {
         // if there isn't another node
-        if(currentPageNum == 0)
+        if(!nextScanLeaf<T, PAGESIZE>())
         {
             throw IndexScanCompletedException();
         }
-        else {
-            // reset the entry
-            nextEntry = 0;
-            // read next page, update node
-            bufMgr->readPage(file, currentPageNum, currentPageData);
-            currentNode = (LeafNodeInt*)currentPageData;
-        }
     }
+    // Cast page to leaf node
+    LeafNode<T, PAGESIZE>* currentNode = (LeafNode<T, PAGESIZE>*)currentPageData;
     // get current key
-    int currentKey = currentNode->keyArray[nextEntry];
+    const T currentKey = currentNode->keyArray[nextEntry];
+    const T highVal = indexKeys<T>().highVal;
     // check if key is in valid range
-    if(highOp == LT && !(currentKey < highValInt))
+    if(highOp == LT && !(currentKey < highVal))
     {
         throw IndexScanCompletedException();
     }
-    else if(highOp == LTE && !(currentKey <= highValInt))
+    else if(highOp == LTE && !(currentKey <= highVal))
     {
         throw IndexScanCompletedException();
     }
@@ -541,6 +1051,1060 @@ const void BTreeIndex::endScan()
     bufMgr->unPinPage(file, currentPageNum, false);
     // set scan to not executing
     scanExecuting = false;
+    intKeys.scanMessages.clear();
+    doubleKeys.scanMessages.clear();
+    stringKeys.scanMessages.clear();
+    if (scanLatch.owns_lock())
+    {
+        scanLatch.unlock();
+    }
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::defragment
+// -----------------------------------------------------------------------------
+
+bool BTreeIndex::defragment(const double targetFill, const int maxNodes)
+{
+	std::lock_guard<std::recursive_mutex> lock(treeLatch);
+	bool done = (this->*defragmentFn)(targetFill, maxNodes);
+	commitChanges();
+
+	// Leaves moved to new pages, the next scan builds the model again
+	delete leafModel;
+	leafModel = NULL;
+	return done;
+}
+
+template <class T, std::size_t PAGESIZE>
+bool BTreeIndex::defragmentKernel(const double targetFill, const int maxNodes)
+{
+	const int LEAFSIZE = NodeCapacity<T, PAGESIZE>::LEAF;
+
+	// A lone root leaf has nothing to reorder, and buffered indexes already write their leaves in batches
+	if (leafRoot || bufferedInserts) {
+		defragExecuting = false;
+		return true;
+	}
+
+	int perLeaf = (int)(targetFill * LEAFSIZE);
+	perLeaf = std::max(1, std::min(perLeaf, LEAFSIZE));
+
+	for (int i = 0; i < maxNodes; i++) {
+		T nextKey;
+		bool more = defragmentLeafGroup<T, PAGESIZE>(indexKeys<T>().defragNextKey, !defragExecuting, perLeaf, nextKey);
+		if (!more) {
+			defragExecuting = false;
+			return true;
+		}
+		defragExecuting = true;
+		indexKeys<T>().defragNextKey = nextKey;
+	}
+	return false;
 }
 
-}
\ No newline at end of file
+template <class T, std::size_t PAGESIZE>
+bool BTreeIndex::defragmentLeafGroup(const T key, const bool leftmost, const int perLeaf, T & nextKey)
+{
+	const int NONLEAFSIZE = NodeCapacity<T, PAGESIZE>::NONLEAF;
+
+	// Descend to the level-1 node covering key. Along the way remember the node just left of the current
+	// one on the same level, whose rightmost leaf precedes our leaves in the chain, and the separator that
+	// bounds the current node on the right.
+	PageId nodePageNo = rootPageNum;
+	PageId leftPageNo = 0;
+	bool hasUpper = false;
+	T upperKey = T();
+	Page *page;
+	bufMgr->readPage(file, nodePageNo, page);
+	NonLeafNode<T, PAGESIZE> *node = (NonLeafNode<T, PAGESIZE>*)page;
+
+	while (node->level != 1) {
+		int idx = node->numEntries;
+		if (!leftmost) {
+			for (int i = 0; i < node->numEntries; i++) {
+				if (key < node->keyArray[i]) {
+					idx = i;
+					break;
+				}
+			}
+		} else {
+			idx = 0;
+		}
+		if (idx < node->numEntries) {
+			hasUpper = true;
+			upperKey = node->keyArray[idx];
+		}
+
+		PageId childLeftPageNo = 0;
+		if (idx > 0) {
+			childLeftPageNo = node->pageNoArray[idx - 1];
+		} else if (leftPageNo != 0) {
+			Page *leftPage;
+			bufMgr->readPage(file, leftPageNo, leftPage);
+			NonLeafNode<T, PAGESIZE> *leftNode = (NonLeafNode<T, PAGESIZE>*)leftPage;
+			childLeftPageNo = leftNode->pageNoArray[leftNode->numEntries];
+			bufMgr->unPinPage(file, leftPageNo, false);
+		}
+
+		PageId childPageNo = node->pageNoArray[idx];
+		bufMgr->unPinPage(file, nodePageNo, false);
+		nodePageNo = childPageNo;
+		leftPageNo = childLeftPageNo;
+		bufMgr->readPage(file, nodePageNo, page);
+		node = (NonLeafNode<T, PAGESIZE>*)page;
+	}
+
+	PageId prevLeafPageNo = 0;
+	if (leftPageNo != 0) {
+		Page *leftPage;
+		bufMgr->readPage(file, leftPageNo, leftPage);
+		NonLeafNode<T, PAGESIZE> *leftNode = (NonLeafNode<T, PAGESIZE>*)leftPage;
+		prevLeafPageNo = leftNode->pageNoArray[leftNode->numEntries];
+		bufMgr->unPinPage(file, leftPageNo, false);
+	}
+
+	// Gather the entries of all leaves below this node, in key order
+	std::vector<T> keys;
+	std::vector<RecordId> rids;
+	PageId lastRightSibPageNo = 0;
+	int scanPos = -1; // position of a running scan within the gathered entries
+	for (int c = 0; c <= node->numEntries; c++) {
+		PageId leafPageNo = node->pageNoArray[c];
+		Page *leafPage;
+		bufMgr->readPage(file, leafPageNo, leafPage);
+		LeafNode<T, PAGESIZE> *leaf = (LeafNode<T, PAGESIZE>*)leafPage;
+		if (scanExecuting && currentPageNum == leafPageNo) {
+			scanPos = keys.size() + nextEntry;
+		}
+		keys.insert(keys.end(), leaf->keyArray, leaf->keyArray + leaf->numEntries);
+		rids.insert(rids.end(), leaf->ridArray, leaf->ridArray + leaf->numEntries);
+		lastRightSibPageNo = leaf->rightSibPageNo;
+		bufMgr->unPinPage(file, leafPageNo, false);
+	}
+
+	// Spread the entries evenly over as many leaves as the target fill calls for, but never more
+	// than the level-1 node can point to.
+	int total = keys.size();
+	int numLeaves = std::max(1, (total + perLeaf - 1) / perLeaf);
+	numLeaves = std::min(numLeaves, NONLEAFSIZE + 1);
+
+	std::vector<PageId> newPageNos(numLeaves);
+	std::vector<int> firstIdx(numLeaves + 1);
+	for (int j = 0; j <= numLeaves; j++) {
+		firstIdx[j] = (int)(((long long)total * j) / numLeaves);
+	}
+
+	// Allocate each new leaf next to the one before it so the run is consecutive in the file. Each leaf
+	// stays pinned only until its right sibling has been allocated.
+	Page *newPage;
+	Page *nextNewPage = NULL;
+	allocLeafPage(prevLeafPageNo, newPageNos[0], newPage);
+	for (int j = 0; j < numLeaves; j++) {
+		if (j + 1 < numLeaves) {
+			allocLeafPage(newPageNos[j], newPageNos[j + 1], nextNewPage);
+		}
+		LeafNode<T, PAGESIZE> *leaf = (LeafNode<T, PAGESIZE>*)newPage;
+		leaf->numEntries = firstIdx[j + 1] - firstIdx[j];
+		std::copy(keys.begin() + firstIdx[j], keys.begin() + firstIdx[j + 1], leaf->keyArray);
+		std::copy(rids.begin() + firstIdx[j], rids.begin() + firstIdx[j + 1], leaf->ridArray);
+		leaf->rightSibPageNo = (j + 1 < numLeaves) ? newPageNos[j + 1] : lastRightSibPageNo;
+		bufMgr->unPinPage(file, newPageNos[j], true);
+		newPage = nextNewPage;
+	}
+
+	// Point the level-1 node at the new leaves. Its key range is unchanged, so nothing above it changes.
+	node->numEntries = numLeaves - 1;
+	for (int j = 0; j < numLeaves; j++) {
+		node->pageNoArray[j] = newPageNos[j];
+		if (j > 0) {
+			node->keyArray[j - 1] = keys[firstIdx[j]];
+		}
+	}
+	bufMgr->unPinPage(file, nodePageNo, true);
+
+	if (prevLeafPageNo != 0) {
+		Page *prevPage;
+		bufMgr->readPage(file, prevLeafPageNo, prevPage);
+		((LeafNode<T, PAGESIZE>*)prevPage)->rightSibPageNo = newPageNos[0];
+		bufMgr->unPinPage(file, prevLeafPageNo, true);
+	}
+
+	// Move a running scan to the same entry in the new leaves
+	if (scanPos >= 0) {
+		int j = 0;
+		while (j + 1 < numLeaves && scanPos >= firstIdx[j + 1]) {
+			j++;
+		}
+		bufMgr->unPinPage(file, currentPageNum, false);
+		currentPageNum = newPageNos[j];
+		nextEntry = scanPos - firstIdx[j];
+		bufMgr->readPage(file, currentPageNum, currentPageData);
+	}
+
+	nextKey = upperKey;
+	return hasUpper;
+}
+
+// -----------------------------------------------------------------------------
+// Buffered inserts
+// -----------------------------------------------------------------------------
+
+/**
+ * Orders messages by key alone, so a stable sort keeps equal keys in arrival order.
+ */
+template <class T>
+static bool messageKeyLess(const RIDKeyPair<T> & a, const RIDKeyPair<T> & b)
+{
+	return a.key < b.key;
+}
+
+/**
+ * Index of the child a key is routed to: the first pivot greater than the key, else the last child.
+ */
+template <class T>
+static int childIndex(const std::vector<T> & keys, const T & key)
+{
+	return std::upper_bound(keys.begin(), keys.end(), key) - keys.begin();
+}
+
+template <class T, std::size_t PAGESIZE>
+void BTreeIndex::bufferedInsertKernel(const void *key, const RecordId rid)
+{
+	RIDKeyPair<T> ridKey;
+	ridKey.set(rid, keyFromPtr<T>(key));
+	std::vector< RIDKeyPair<T> > messages(1, ridKey);
+	std::vector< PageKeyPair<T> > siblings;
+
+	if (leafRoot) {
+		applyMessages<T, PAGESIZE>(rootPageNum, messages, siblings);
+		if (!siblings.empty()) {
+			growBufferedRoot<T, PAGESIZE>(1, siblings);
+		}
+	} else {
+		Page *rootPage;
+		bufMgr->readPage(file, rootPageNum, rootPage);
+		BufferedNonLeafNode<T, PAGESIZE> *root = (BufferedNonLeafNode<T, PAGESIZE>*)rootPage;
+		if (root->numMessages < BufferedNodeCapacity<T, PAGESIZE>::MESSAGES) {
+			// Most inserts only touch the root
+			root->msgKeyArray[root->numMessages] = ridKey.key;
+			root->msgRidArray[root->numMessages] = rid;
+			root->numMessages++;
+			bufMgr->unPinPage(file, rootPageNum, true);
+		} else {
+			int level = root->level;
+			bufMgr->unPinPage(file, rootPageNum, false);
+			flushMessages<T, PAGESIZE>(rootPageNum, messages, siblings);
+			if (!siblings.empty()) {
+				growBufferedRoot<T, PAGESIZE>(level + 1, siblings);
+			}
+		}
+	}
+
+	addToBloomFilter<T, PAGESIZE>(ridKey.key);
+}
+
+template <class T, std::size_t PAGESIZE>
+void BTreeIndex::loadBufferedNode(const PageId pageNo, BufferedNodeContents<T> & contents)
+{
+	Page *page;
+	bufMgr->readPage(file, pageNo, page);
+	BufferedNonLeafNode<T, PAGESIZE> *node = (BufferedNonLeafNode<T, PAGESIZE>*)page;
+	contents.level = node->level;
+	contents.keys.assign(node->keyArray, node->keyArray + node->numEntries);
+	contents.children.assign(node->pageNoArray, node->pageNoArray + node->numEntries + 1);
+	contents.messages.resize(node->numMessages);
+	for (int i = 0; i < node->numMessages; i++) {
+		contents.messages[i].set(node->msgRidArray[i], node->msgKeyArray[i]);
+	}
+	bufMgr->unPinPage(file, pageNo, false);
+}
+
+template <class T, std::size_t PAGESIZE>
+void BTreeIndex::storeBufferedNode(const PageId pageNo, const BufferedNodeContents<T> & contents, std::vector< PageKeyPair<T> > & siblings)
+{
+	const int capacity = BufferedNodeCapacity<T, PAGESIZE>::NONLEAF;
+	const int numChildren = contents.children.size();
+	const int numNodes = (numChildren + capacity) / (capacity + 1);
+
+	// Node j gets the children from firstChild[j] on; the pivot in front of it moves up as its separator
+	std::vector<int> firstChild(numNodes + 1);
+	std::vector<T> separators;
+	for (int j = 0; j <= numNodes; j++) {
+		firstChild[j] = (long long)j * numChildren / numNodes;
+		if (j > 0 && j < numNodes) {
+			separators.push_back(contents.keys[firstChild[j] - 1]);
+		}
+	}
+
+	for (int j = 0; j < numNodes; j++) {
+		PageId nodePageNo = pageNo;
+		Page *page;
+		if (j == 0) {
+			bufMgr->readPage(file, nodePageNo, page);
+		} else {
+			bufMgr->allocPage(file, nodePageNo, page);
+			PageKeyPair<T> sibling;
+			sibling.set(nodePageNo, separators[j - 1]);
+			siblings.push_back(sibling);
+		}
+
+		BufferedNonLeafNode<T, PAGESIZE> *node = (BufferedNonLeafNode<T, PAGESIZE>*)page;
+		node->level = contents.level;
+		node->numEntries = firstChild[j + 1] - firstChild[j] - 1;
+		for (int i = 0; i < node->numEntries; i++) {
+			node->keyArray[i] = contents.keys[firstChild[j] + i];
+		}
+		for (int i = 0; i <= node->numEntries; i++) {
+			node->pageNoArray[i] = contents.children[firstChild[j] + i];
+		}
+		node->numMessages = 0;
+		for (std::size_t i = 0; i < contents.messages.size(); i++) {
+			if (childIndex(separators, contents.messages[i].key) == j) {
+				node->msgKeyArray[node->numMessages] = contents.messages[i].key;
+				node->msgRidArray[node->numMessages] = contents.messages[i].rid;
+				node->numMessages++;
+			}
+		}
+		bufMgr->unPinPage(file, nodePageNo, true);
+	}
+}
+
+template <class T, std::size_t PAGESIZE>
+void BTreeIndex::flushMessages(const PageId pageNo, const std::vector< RIDKeyPair<T> > & messages, std::vector< PageKeyPair<T> > & siblings)
+{
+	BufferedNodeContents<T> contents;
+	loadBufferedNode<T, PAGESIZE>(pageNo, contents);
+	contents.messages.insert(contents.messages.end(), messages.begin(), messages.end());
+
+	// Move the largest batch down each time, so every page written below takes as many messages as possible
+	while (contents.messages.size() > (std::size_t)BufferedNodeCapacity<T, PAGESIZE>::MESSAGES) {
+		std::vector<int> counts(contents.children.size(), 0);
+		for (std::size_t i = 0; i < contents.messages.size(); i++) {
+			counts[childIndex(contents.keys, contents.messages[i].key)]++;
+		}
+		const int child = std::max_element(counts.begin(), counts.end()) - counts.begin();
+
+		std::vector< RIDKeyPair<T> > batch;
+		std::vector< RIDKeyPair<T> > rest;
+		for (std::size_t i = 0; i < contents.messages.size(); i++) {
+			if (childIndex(contents.keys, contents.messages[i].key) == child) {
+				batch.push_back(contents.messages[i]);
+			} else {
+				rest.push_back(contents.messages[i]);
+			}
+		}
+		contents.messages.swap(rest);
+
+		std::vector< PageKeyPair<T> > childSiblings;
+		if (contents.level == 1) {
+			applyMessages<T, PAGESIZE>(contents.children[child], batch, childSiblings);
+		} else {
+			flushMessages<T, PAGESIZE>(contents.children[child], batch, childSiblings);
+		}
+		for (std::size_t i = 0; i < childSiblings.size(); i++) {
+			contents.keys.insert(contents.keys.begin() + child + i, childSiblings[i].key);
+			contents.children.insert(contents.children.begin() + child + 1 + i, childSiblings[i].pageNo);
+		}
+	}
+
+	storeBufferedNode<T, PAGESIZE>(pageNo, contents, siblings);
+}
+
+template <class T, std::size_t PAGESIZE>
+void BTreeIndex::applyMessages(const PageId pageNo, const std::vector< RIDKeyPair<T> > & messages, std::vector< PageKeyPair<T> > & siblings)
+{
+	const int capacity = NodeCapacity<T, PAGESIZE>::LEAF;
+	std::vector< RIDKeyPair<T> > sorted(messages);
+	std::stable_sort(sorted.begin(), sorted.end(), messageKeyLess<T>);
+
+	Page *page;
+	bufMgr->readPage(file, pageNo, page);
+	LeafNode<T, PAGESIZE> *leaf = (LeafNode<T, PAGESIZE>*)page;
+	std::vector< RIDKeyPair<T> > entries(leaf->numEntries);
+	for (int i = 0; i < leaf->numEntries; i++) {
+		entries[i].set(leaf->ridArray[i], leaf->keyArray[i]);
+	}
+
+	// Entries already in the leaf stay ahead of newer ones with the same key
+	std::vector< RIDKeyPair<T> > merged(entries.size() + sorted.size());
+	std::merge(entries.begin(), entries.end(), sorted.begin(), sorted.end(), merged.begin(), messageKeyLess<T>);
+
+	const int numMerged = merged.size();
+	const int numLeaves = std::max(1, (numMerged + capacity - 1) / capacity);
+	const PageId rightSibPageNo = leaf->rightSibPageNo;
+	PageId leafPageNo = pageNo;
+	for (int j = 0; j < numLeaves; j++) {
+		const int begin = (long long)j * numMerged / numLeaves;
+		const int end = (long long)(j + 1) * numMerged / numLeaves;
+		if (j > 0) {
+			PageId newPageNo;
+			Page *newPage;
+			allocLeafPage(leafPageNo, newPageNo, newPage);
+			leaf->rightSibPageNo = newPageNo;
+			bufMgr->unPinPage(file, leafPageNo, true);
+			leafPageNo = newPageNo;
+			leaf = (LeafNode<T, PAGESIZE>*)newPage;
+
+			PageKeyPair<T> sibling;
+			sibling.set(newPageNo, merged[begin].key);
+			siblings.push_back(sibling);
+		}
+		leaf->numEntries = end - begin;
+		for (int i = begin; i < end; i++) {
+			leaf->keyArray[i - begin] = merged[i].key;
+			leaf->ridArray[i - begin] = merged[i].rid;
+		}
+	}
+	leaf->rightSibPageNo = rightSibPageNo;
+	bufMgr->unPinPage(file, leafPageNo, true);
+}
+
+template <class T, std::size_t PAGESIZE>
+void BTreeIndex::growBufferedRoot(int level, std::vector< PageKeyPair<T> > siblings)
+{
+	BufferedNodeContents<T> contents;
+	contents.level = level;
+	contents.children.push_back(rootPageNum);
+	for (std::size_t i = 0; i < siblings.size(); i++) {
+		contents.keys.push_back(siblings[i].key);
+		contents.children.push_back(siblings[i].pageNo);
+	}
+
+	Page *rootPage;
+	bufMgr->allocPage(file, rootPageNum, rootPage);
+	bufMgr->unPinPage(file, rootPageNum, true);
+	leafRoot = false;
+	metaDirty = true;
+
+	// A root over very many splits needs a level of its own above it
+	std::vector< PageKeyPair<T> > rootSiblings;
+	storeBufferedNode<T, PAGESIZE>(rootPageNum, contents, rootSiblings);
+	if (!rootSiblings.empty()) {
+		growBufferedRoot<T, PAGESIZE>(level + 1, rootSiblings);
+	}
+}
+
+template <class T, std::size_t PAGESIZE>
+void BTreeIndex::collectMessages(const PageId pageNo, const T* lowVal, const T* highVal, std::vector< RIDKeyPair<T> > & out)
+{
+	BufferedNodeContents<T> contents;
+	loadBufferedNode<T, PAGESIZE>(pageNo, contents);
+	for (std::size_t i = 0; i < contents.messages.size(); i++) {
+		const T & key = contents.messages[i].key;
+		if ((lowVal == NULL || !(key < *lowVal)) && (highVal == NULL || !(*highVal < key))) {
+			out.push_back(contents.messages[i]);
+		}
+	}
+	if (contents.level == 1) {
+		return;
+	}
+
+	// Messages are routed like keys, so only the children overlapping the range can hold any
+	int first = lowVal == NULL ? 0 : childIndex(contents.keys, *lowVal);
+	int last = highVal == NULL ? contents.keys.size() : childIndex(contents.keys, *highVal);
+	for (int i = first; i <= last; i++) {
+		collectMessages<T, PAGESIZE>(contents.children[i], lowVal, highVal, out);
+	}
+}
+
+template <class T, std::size_t PAGESIZE>
+void BTreeIndex::mergingStartScanKernel(const void* lowValParm,
+   const Operator lowOpParm,
+   const void* highValParm,
+   const Operator highOpParm)
+{
+	const T lowVal = keyFromPtr<T>(lowValParm);
+	const T highVal = keyFromPtr<T>(highValParm);
+
+	if (scanExecuting) {
+		endScan();
+	}
+
+	if ((lowOpParm != GTE && lowOpParm != GT) || (highOpParm != LT && highOpParm != LTE)) {
+		throw BadOpcodesException();
+	}
+
+	scanExecuting = true;
+	lowOp = lowOpParm;
+	highOp = highOpParm;
+	indexKeys<T>().lowVal = lowVal;
+	indexKeys<T>().highVal = highVal;
+
+	if (lowVal > highVal) {
+		scanExecuting = false;
+		throw BadScanrangeException();
+	}
+
+	// Inserts not in the leaves yet, sorted like the leaves so scanNext() can merge them in
+	std::vector< RIDKeyPair<T> > inRange;
+	if (memtableSize > 0) {
+		std::lock_guard<std::mutex> lock(memtableLatch);
+		const std::multimap<T, RecordId> *memtables[2] = {&indexKeys<T>().memtable, &indexKeys<T>().mergingMemtable};
+		for (int m = 0; m < 2; m++) {
+			typename std::multimap<T, RecordId>::const_iterator it = memtables[m]->lower_bound(lowVal);
+			typename std::multimap<T, RecordId>::const_iterator end = memtables[m]->upper_bound(highVal);
+			for (; it != end; ++it) {
+				RIDKeyPair<T> entry;
+				entry.set(it->second, it->first);
+				inRange.push_back(entry);
+			}
+		}
+	}
+
+	// The filter only knows the keys that reached the tree
+	if (bloomFilter && lowOp == GTE && highOp == LTE && lowVal == highVal && inRange.empty()
+			&& !bloomFilter->mayContain(keyHash(lowVal))) {
+		scanExecuting = false;
+		throw NoSuchKeyFoundException();
+	}
+
+	if (bufferedInserts && !leafRoot) {
+		collectMessages<T, PAGESIZE>(rootPageNum, &lowVal, &highVal, inRange);
+	}
+	std::vector< RIDKeyPair<T> > & scanMessages = indexKeys<T>().scanMessages;
+	scanMessages.clear();
+	indexKeys<T>().nextMessage = 0;
+	for (std::size_t i = 0; i < inRange.size(); i++) {
+		if ((lowOp == GT && !(lowVal < inRange[i].key)) || (highOp == LT && !(inRange[i].key < highVal))) {
+			continue;
+		}
+		scanMessages.push_back(inRange[i]);
+	}
+	std::stable_sort(scanMessages.begin(), scanMessages.end(), messageKeyLess<T>);
+
+	PageId pageNo = rootPageNum;
+	bool atLeaf = leafRoot;
+	while (!atLeaf) {
+		Page *page;
+		bufMgr->readPage(file, pageNo, page);
+		PageId childPageNo;
+		if (bufferedInserts) {
+			BufferedNonLeafNode<T, PAGESIZE> *node = (BufferedNonLeafNode<T, PAGESIZE>*)page;
+			childPageNo = node->pageNoArray[scanChildIndex(node->keyArray, node->numEntries, lowVal, lowOp)];
+			atLeaf = node->level == 1;
+		} else {
+			NonLeafNode<T, PAGESIZE> *node = (NonLeafNode<T, PAGESIZE>*)page;
+			childPageNo = node->pageNoArray[scanChildIndex(node->keyArray, node->numEntries, lowVal, lowOp)];
+			atLeaf = node->level == 1;
+		}
+		bufMgr->unPinPage(file, pageNo, false);
+		pageNo = childPageNo;
+	}
+
+	// First leaf entry in range; past the last leaf, stay on it so scanNext() can still drain the messages
+	currentPageNum = pageNo;
+	bufMgr->readPage(file, currentPageNum, currentPageData);
+	LeafNode<T, PAGESIZE>* leaf = (LeafNode<T, PAGESIZE>*) currentPageData;
+	while (true) {
+		nextEntry = leaf->numEntries;
+		for (int i = 0; i < leaf->numEntries; i++) {
+			if ((lowOp == GT && lowVal < leaf->keyArray[i]) || (lowOp == GTE && lowVal <= leaf->keyArray[i])) {
+				nextEntry = i;
+				break;
+			}
+		}
+		if (nextEntry < leaf->numEntries || leaf->rightSibPageNo == 0) {
+			break;
+		}
+		PageId nextPageNo = leaf->rightSibPageNo;
+		bufMgr->unPinPage(file, currentPageNum, false);
+		currentPageNum = nextPageNo;
+		bufMgr->readPage(file, currentPageNum, currentPageData);
+		leaf = (LeafNode<T, PAGESIZE>*) currentPageData;
+	}
+
+	if (!leafRoot && nextEntry == leaf->numEntries && scanMessages.empty()) {
+		endScan();
+		throw NoSuchKeyFoundException();
+	}
+}
+
+template <class T, std::size_t PAGESIZE>
+void BTreeIndex::mergingScanNextKernel(RecordId& outRid)
+{
+	if (!scanExecuting) {
+		throw ScanNotInitializedException();
+	}
+
+	IndexKeys<T> & keys = indexKeys<T>();
+	// Skip used up leaves, the last one stays pinned for endScan()
+	while (nextEntry == ((LeafNode<T, PAGESIZE>*)currentPageData)->numEntries && nextScanLeaf<T, PAGESIZE>()) {
+	}
+	LeafNode<T, PAGESIZE>* currentNode = (LeafNode<T, PAGESIZE>*)currentPageData;
+
+	const bool haveEntry = nextEntry < currentNode->numEntries;
+	const bool haveMessage = keys.nextMessage < keys.scanMessages.size();
+	if (!haveEntry && !haveMessage) {
+		throw IndexScanCompletedException();
+	}
+
+	// Messages were cut to the range already; the smallest leaf key past it ends the scan
+	if (haveMessage && (!haveEntry || keys.scanMessages[keys.nextMessage].key < currentNode->keyArray[nextEntry])) {
+		outRid = keys.scanMessages[keys.nextMessage].rid;
+		keys.nextMessage++;
+		return;
+	}
+	const T currentKey = currentNode->keyArray[nextEntry];
+	if ((highOp == LT && !(currentKey < keys.highVal)) || (highOp == LTE && !(currentKey <= keys.highVal))) {
+		throw IndexScanCompletedException();
+	}
+	outRid = currentNode->ridArray[nextEntry];
+	nextEntry++;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::freeze
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::freeze(std::string & outFrozenName)
+{
+	flushMemtable();
+	std::lock_guard<std::recursive_mutex> lock(treeLatch);
+	outFrozenName = file->filename() + ".frozen";
+	(this->*freezeFn)(outFrozenName);
+}
+
+template <class T, std::size_t PAGESIZE>
+void BTreeIndex::freezeKernel(const std::string & frozenName)
+{
+	Page *metaPage;
+	bufMgr->readPage(file, headerPageNum, metaPage);
+	IndexMetaInfo *meta = (IndexMetaInfo*)metaPage;
+	const std::string relationName(meta->relationName, strnlen(meta->relationName, sizeof(meta->relationName)));
+	bufMgr->unPinPage(file, headerPageNum, false);
+
+	FrozenIndexWriter<T, PAGESIZE> writer(frozenName, bufMgr, relationName, attrByteOffset, attributeType);
+	forEachEntryKernel<T, PAGESIZE>([&writer](const T & key, const RecordId & rid) { writer.append(key, rid); });
+	writer.finish();
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::collectEntries
+// -----------------------------------------------------------------------------
+
+template <class T, std::size_t PAGESIZE>
+void BTreeIndex::collectEntriesKernel(void *outEntries)
+{
+	std::vector< RIDKeyPair<T> > & entries = *(std::vector< RIDKeyPair<T> >*)outEntries;
+	forEachEntryKernel<T, PAGESIZE>([&entries](const T & key, const RecordId & rid) {
+		RIDKeyPair<T> entry;
+		entry.set(rid, key);
+		entries.push_back(entry);
+	});
+}
+
+template <class T, std::size_t PAGESIZE>
+void BTreeIndex::forEachEntryKernel(const std::function<void(const T&, const RecordId&)> & visit)
+{
+	// Inserts still buffered above the leaves are merged in on the way
+	std::vector< RIDKeyPair<T> > messages;
+	if (bufferedInserts && !leafRoot) {
+		collectMessages<T, PAGESIZE>(rootPageNum, NULL, NULL, messages);
+		std::stable_sort(messages.begin(), messages.end(), messageKeyLess<T>);
+	}
+
+	std::size_t nextMessage = 0;
+	PageId pageNo = leftmostLeafPageNo<T, PAGESIZE>();
+	while (pageNo != 0) {
+		Page *page;
+		bufMgr->readPage(file, pageNo, page);
+		LeafNode<T, PAGESIZE> *leaf = (LeafNode<T, PAGESIZE>*)page;
+		for (int i = 0; i < leaf->numEntries; i++) {
+			while (nextMessage < messages.size() && messages[nextMessage].key < leaf->keyArray[i]) {
+				visit(messages[nextMessage].key, messages[nextMessage].rid);
+				nextMessage++;
+			}
+			visit(leaf->keyArray[i], leaf->ridArray[i]);
+		}
+		PageId nextPageNo = leaf->rightSibPageNo;
+		bufMgr->unPinPage(file, pageNo, false);
+		pageNo = nextPageNo;
+	}
+	for (; nextMessage < messages.size(); nextMessage++) {
+		visit(messages[nextMessage].key, messages[nextMessage].rid);
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::useLeafModel
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::useLeafModel(const int maxError)
+{
+	if (attributeType == STRING || bufferedInserts || memtableSize > 0) {
+		throw BadIndexInfoException("A leaf model needs numeric keys and an index that inserts into its leaves directly.");
+	}
+	std::lock_guard<std::recursive_mutex> lock(treeLatch);
+	leafModelError = std::max(maxError, 1);
+	delete leafModel;
+	leafModel = NULL;
+	(this->*buildLeafModelFn)();
+}
+
+template <class T, std::size_t PAGESIZE>
+void BTreeIndex::buildLeafModelKernel()
+{
+	std::vector<double> lowerKeys;
+	std::vector<PageId> pageNos;
+	PageId pageNo = leftmostLeafPageNo<T, PAGESIZE>();
+	while (pageNo != 0) {
+		Page *page;
+		bufMgr->readPage(file, pageNo, page);
+		LeafNode<T, PAGESIZE> *leaf = (LeafNode<T, PAGESIZE>*)page;
+		// Only an empty tree has an empty leaf, and any lower key does for the first leaf
+		lowerKeys.push_back(leaf->numEntries > 0 ? modelKey(leaf->keyArray[0]) : 0);
+		pageNos.push_back(pageNo);
+		PageId nextPageNo = leaf->rightSibPageNo;
+		bufMgr->unPinPage(file, pageNo, false);
+		pageNo = nextPageNo;
+	}
+	if (leafModel == NULL) {
+		leafModel = new LeafModel(leafModelError);
+	}
+	leafModel->build(lowerKeys, pageNos);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::updateRid
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::updateRid(const void* key, const RecordId oldRid, const RecordId newRid)
+{
+	RidUpdate update;
+	update.key = key;
+	update.oldRid = oldRid;
+	update.newRid = newRid;
+	if ((this->*updateRidsFn)(std::vector<RidUpdate>(1, update)) == 0) {
+		throw NoSuchKeyFoundException();
+	}
+}
+
+std::size_t BTreeIndex::updateRids(const std::vector<RidUpdate> & updates)
+{
+	return (this->*updateRidsFn)(updates);
+}
+
+template <class T, std::size_t PAGESIZE>
+std::size_t BTreeIndex::updateRidsKernel(const std::vector<RidUpdate> & updates)
+{
+	std::vector< std::pair<T, std::size_t> > order;
+	for (std::size_t i = 0; i < updates.size(); i++) {
+		order.push_back(std::make_pair(keyFromPtr<T>(updates[i].key), i));
+	}
+	std::sort(order.begin(), order.end());
+
+	std::size_t updated = 0;
+	std::vector<bool> done(updates.size(), false);
+	if (memtableSize > 0) {
+		// The memtable being merged belongs to the merge thread while it runs, so wait until it is in the tree.
+		// A running scan keeps the merge thread out, which leaves that memtable to us.
+		std::unique_lock<std::mutex> lock(memtableLatch);
+		while (!scanExecuting && mergingEntries != 0) {
+			memtableChanged.wait(lock);
+		}
+		std::multimap<T, RecordId> * memtables[2] = { &indexKeys<T>().memtable, &indexKeys<T>().mergingMemtable };
+		for (std::size_t i = 0; i < order.size(); i++) {
+			const RidUpdate & update = updates[order[i].second];
+			for (int j = 0; j < 2 && !done[order[i].second]; j++) {
+				typedef typename std::multimap<T, RecordId>::iterator Iterator;
+				std::pair<Iterator, Iterator> range = memtables[j]->equal_range(order[i].first);
+				for (Iterator it = range.first; it != range.second; ++it) {
+					if (it->second == update.oldRid) {
+						it->second = update.newRid;
+						done[order[i].second] = true;
+						updated++;
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	std::lock_guard<std::recursive_mutex> lock(treeLatch);
+	PageId pinnedPageNo = 0;
+	Page *pinnedPage = NULL;
+	bool pinnedDirty = false;
+	for (std::size_t i = 0; i < order.size(); i++) {
+		if (done[order[i].second]) {
+			continue;
+		}
+		const RidUpdate & update = updates[order[i].second];
+		if ((bufferedInserts && !leafRoot && updateMessageRid<T, PAGESIZE>(order[i].first, update.oldRid, update.newRid))
+				|| updateLeafRid<T, PAGESIZE>(order[i].first, update.oldRid, update.newRid, pinnedPageNo, pinnedPage, pinnedDirty)) {
+			updated++;
+		}
+	}
+	if (pinnedPageNo != 0) {
+		bufMgr->unPinPage(file, pinnedPageNo, pinnedDirty);
+	}
+	if (updated > 0) {
+		commitChanges();
+	}
+	return updated;
+}
+
+template <class T, std::size_t PAGESIZE>
+bool BTreeIndex::updateLeafRid(const T & key, const RecordId oldRid, const RecordId newRid,
+		PageId & pinnedPageNo, Page *& pinnedPage, bool & pinnedDirty)
+{
+	// Leaves left of the pinned one only hold keys up to its first key
+	LeafNode<T, PAGESIZE> *leaf = (LeafNode<T, PAGESIZE>*)pinnedPage;
+	if (pinnedPageNo == 0 || leaf->numEntries == 0 || !(leaf->keyArray[0] < key)
+			|| leaf->keyArray[leaf->numEntries - 1] < key) {
+		if (pinnedPageNo != 0) {
+			bufMgr->unPinPage(file, pinnedPageNo, pinnedDirty);
+		}
+
+		// Copies of a pivot key may end the leaf left of it, so descend left of an equal pivot
+		PageId pageNo = rootPageNum;
+		bool isLeaf = leafRoot;
+		while (!isLeaf) {
+			Page *page;
+			bufMgr->readPage(file, pageNo, page);
+			PageId childPageNo;
+			if (bufferedInserts) {
+				BufferedNonLeafNode<T, PAGESIZE> *node = (BufferedNonLeafNode<T, PAGESIZE>*)page;
+				childPageNo = node->pageNoArray[scanChildIndex(node->keyArray, node->numEntries, key, GTE)];
+				isLeaf = node->level == 1;
+			} else {
+				NonLeafNode<T, PAGESIZE> *node = (NonLeafNode<T, PAGESIZE>*)page;
+				childPageNo = node->pageNoArray[scanChildIndex(node->keyArray, node->numEntries, key, GTE)];
+				isLeaf = node->level == 1;
+			}
+			bufMgr->unPinPage(file, pageNo, false);
+			pageNo = childPageNo;
+		}
+		pinnedPageNo = pageNo;
+		bufMgr->readPage(file, pinnedPageNo, pinnedPage);
+		pinnedDirty = false;
+	}
+
+	// Copies of the key may run on into the leaves to the right
+	while (true) {
+		leaf = (LeafNode<T, PAGESIZE>*)pinnedPage;
+		int i = std::lower_bound(leaf->keyArray, leaf->keyArray + leaf->numEntries, key) - leaf->keyArray;
+		for (; i < leaf->numEntries && !(key < leaf->keyArray[i]); i++) {
+			if (leaf->ridArray[i] == oldRid) {
+				leaf->ridArray[i] = newRid;
+				pinnedDirty = true;
+				return true;
+			}
+		}
+		if (i < leaf->numEntries || leaf->rightSibPageNo == 0) {
+			return false;
+		}
+		const PageId nextPageNo = leaf->rightSibPageNo;
+		bufMgr->unPinPage(file, pinnedPageNo, pinnedDirty);
+		pinnedPageNo = nextPageNo;
+		bufMgr->readPage(file, pinnedPageNo, pinnedPage);
+		pinnedDirty = false;
+	}
+}
+
+template <class T, std::size_t PAGESIZE>
+bool BTreeIndex::updateMessageRid(const T & key, const RecordId oldRid, const RecordId newRid)
+{
+	// Messages are routed like keys, so only the nodes on the path of the key can hold it
+	PageId pageNo = rootPageNum;
+	while (true) {
+		Page *page;
+		bufMgr->readPage(file, pageNo, page);
+		BufferedNonLeafNode<T, PAGESIZE> *node = (BufferedNonLeafNode<T, PAGESIZE>*)page;
+		for (int i = 0; i < node->numMessages; i++) {
+			if (!(node->msgKeyArray[i] < key) && !(key < node->msgKeyArray[i]) && node->msgRidArray[i] == oldRid) {
+				node->msgRidArray[i] = newRid;
+				bufMgr->unPinPage(file, pageNo, true);
+				return true;
+			}
+		}
+		const PageId childPageNo = node->pageNoArray[std::upper_bound(node->keyArray, node->keyArray + node->numEntries, key) - node->keyArray];
+		const bool lastLevel = node->level == 1;
+		bufMgr->unPinPage(file, pageNo, false);
+		if (lastLevel) {
+			return false;
+		}
+		pageNo = childPageNo;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// Memtable
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::flushMemtable()
+{
+	if (memtableSize == 0) {
+		return;
+	}
+	if (scanExecuting) {
+		endScan();
+	}
+
+	std::unique_lock<std::mutex> lock(memtableLatch);
+	while (mergingEntries != 0) {
+		memtableChanged.wait(lock);
+	}
+	throwMergeError();
+	if (memtableEntries != 0) {
+		(this->*sealMemtableFn)();
+		while (mergingEntries != 0) {
+			memtableChanged.wait(lock);
+		}
+		throwMergeError();
+	}
+}
+
+void BTreeIndex::mergeLoop()
+{
+	std::unique_lock<std::mutex> lock(memtableLatch);
+	while (true) {
+		while (mergingEntries == 0 && !stopMerging) {
+			memtableChanged.wait(lock);
+		}
+		if (mergingEntries == 0) {
+			return;
+		}
+
+		// Inserts go on into the other memtable while this one is merged
+		lock.unlock();
+		try {
+			std::lock_guard<std::recursive_mutex> treeLock(treeLatch);
+			(this->*mergeMemtableFn)();
+		} catch (...) {
+			// An exception must not leave the thread; hand it to the next caller and wake anyone waiting for the merge
+			lock.lock();
+			mergeError = std::current_exception();
+			mergingEntries = 0;
+			memtableChanged.notify_all();
+			return;
+		}
+		lock.lock();
+	}
+}
+
+void BTreeIndex::stopMergeThread()
+{
+	{
+		std::lock_guard<std::mutex> lock(memtableLatch);
+		stopMerging = true;
+		memtableChanged.notify_all();
+	}
+	mergeThread.join();
+}
+
+void BTreeIndex::throwMergeError()
+{
+	if (mergeError) {
+		mergeErrorReported = true;
+		std::rethrow_exception(mergeError);
+	}
+}
+
+template <class T>
+void BTreeIndex::memtableInsertKernel(const void *key, const RecordId rid)
+{
+	std::unique_lock<std::mutex> lock(memtableLatch);
+	throwMergeError();
+	indexKeys<T>().memtable.insert(std::make_pair(keyFromPtr<T>(key), rid));
+	memtableEntries++;
+	if (memtableEntries >= memtableSize) {
+		if (!scanExecuting) {
+			while (mergingEntries != 0) {
+				memtableChanged.wait(lock);
+			}
+		}
+		if (mergingEntries == 0 && !mergeError) {
+			sealMemtableKernel<T>();
+		}
+	}
+}
+
+template <class T>
+void BTreeIndex::sealMemtableKernel()
+{
+	indexKeys<T>().mergingMemtable.swap(indexKeys<T>().memtable);
+	mergingEntries = memtableEntries;
+	memtableEntries = 0;
+	memtableChanged.notify_all();
+}
+
+template <class T, std::size_t PAGESIZE>
+void BTreeIndex::mergeMemtableKernel()
+{
+	// Nothing else touches a memtable once it is handed over, until it is emptied below
+	std::multimap<T, RecordId> & merging = indexKeys<T>().mergingMemtable;
+	for (typename std::multimap<T, RecordId>::const_iterator it = merging.begin(); it != merging.end(); ++it) {
+		(this->*insertEntryFn)(&it->first, it->second);
+	}
+	commitChanges();
+
+	std::lock_guard<std::mutex> lock(memtableLatch);
+	merging.clear();
+	mergingEntries = 0;
+	memtableChanged.notify_all();
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::bindKernels
+// -----------------------------------------------------------------------------
+
+template <class T>
+void BTreeIndex::bindKernelsForPageSize(const std::size_t pageSize)
+{
+	switch (pageSize) {
+	case 4096:
+		bindKernels<T, 4096>();
+		break;
+	case 8192:
+		bindKernels<T, 8192>();
+		break;
+	case 16384:
+		bindKernels<T, 16384>();
+		break;
+	case 32768:
+		bindKernels<T, 32768>();
+		break;
+	case 65536:
+		bindKernels<T, 65536>();
+		break;
+	default:
+		throw InvalidPageSizeException(pageSize, file->filename());
+	}
+}
+
+template <class T, std::size_t PAGESIZE>
+void BTreeIndex::bindKernels()
+{
+	static_assert(sizeof(LeafNode<T, PAGESIZE>) <= PAGESIZE, "Leaf node must fit in a page.");
+	static_assert(sizeof(NonLeafNode<T, PAGESIZE>) <= PAGESIZE, "Non-leaf node must fit in a page.");
+	static_assert(sizeof(BufferedNonLeafNode<T, PAGESIZE>) <= PAGESIZE, "Buffered non-leaf node must fit in a page.");
+
+	leafOccupancy = NodeCapacity<T, PAGESIZE>::LEAF;
+	if (bufferedInserts) {
+		nodeOccupancy = BufferedNodeCapacity<T, PAGESIZE>::NONLEAF;
+		insertEntryFn = &BTreeIndex::bufferedInsertKernel<T, PAGESIZE>;
+	} else {
+		nodeOccupancy = NodeCapacity<T, PAGESIZE>::NONLEAF;
+		insertEntryFn = &BTreeIndex::insertEntryKernel<T, PAGESIZE>;
+	}
+	// Scans only need to merge when some inserts are kept outside the leaves
+	if (bufferedInserts || memtableSize > 0) {
+		startScanFn = &BTreeIndex::mergingStartScanKernel<T, PAGESIZE>;
+		scanNextFn = &BTreeIndex::mergingScanNextKernel<T, PAGESIZE>;
+	} else {
+		startScanFn = &BTreeIndex::startScanKernel<T, PAGESIZE>;
+		scanNextFn = &BTreeIndex::scanNextKernel<T, PAGESIZE>;
+	}
+	memtableInsertFn = &BTreeIndex::memtableInsertKernel<T>;
+	sealMemtableFn = &BTreeIndex::sealMemtableKernel<T>;
+	mergeMemtableFn = &BTreeIndex::mergeMemtableKernel<T, PAGESIZE>;
+	rebuildBloomFilterFn = &BTreeIndex::rebuildBloomFilterKernel<T, PAGESIZE>;
+	defragmentFn = &BTreeIndex::defragmentKernel<T, PAGESIZE>;
+	freezeFn = &BTreeIndex::freezeKernel<T, PAGESIZE>;
+	collectEntriesFn = &BTreeIndex::collectEntriesKernel<T, PAGESIZE>;
+	buildLeafModelFn = &BTreeIndex::buildLeafModelKernel<T, PAGESIZE>;
+	updateRidsFn = &BTreeIndex::updateRidsKernel<T, PAGESIZE>;
+}
+
+}
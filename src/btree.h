@@ -7,15 +7,24 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <exception>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <string>
 #include "string.h"
 #include <sstream>
+#include <thread>
+#include <vector>
 
 #include "types.h"
 #include "page.h"
 #include "file.h"
 #include "buffer.h"
+#include "bloomFilter.h"
+#include "leafModel.h"
 
 namespace badgerdb
 {
@@ -41,17 +50,155 @@ enum Operator
 	GT		/* Greater Than */
 };
 
+/**
+ * @brief Number of leading characters of a STRING attribute used as the key.
+ */
+const  int STRINGSIZE = 10;
+
+/**
+ * @brief Key of a STRING index: the first STRINGSIZE characters of the attribute, padded with NULs.
+ * Compared bytewise, so the B+Tree code can treat it like a scalar key.
+ */
+struct StringKey{
+  /**
+   * Characters of the key, not NUL terminated if the attribute is STRINGSIZE characters or longer.
+   */
+	char data[ STRINGSIZE ];
+};
+
+inline bool operator<( const StringKey& a, const StringKey& b ) { return memcmp( a.data, b.data, STRINGSIZE ) < 0; }
+inline bool operator>( const StringKey& a, const StringKey& b ) { return b < a; }
+inline bool operator<=( const StringKey& a, const StringKey& b ) { return !( b < a ); }
+inline bool operator>=( const StringKey& a, const StringKey& b ) { return !( a < b ); }
+inline bool operator==( const StringKey& a, const StringKey& b ) { return memcmp( a.data, b.data, STRINGSIZE ) == 0; }
+inline bool operator!=( const StringKey& a, const StringKey& b ) { return !( a == b ); }
+
+/**
+ * @brief Read a key of type T from an attribute inside a record, or from a value passed to startScan().
+ */
+template <class T>
+inline T keyFromPtr( const void* ptr )
+{
+	T key;
+	memcpy( &key, ptr, sizeof( T ) );
+	return key;
+}
+
+template <>
+inline StringKey keyFromPtr<StringKey>( const void* ptr )
+{
+	StringKey key;
+	strncpy( key.data, (const char*)ptr, STRINGSIZE );
+	return key;
+}
+
+/**
+ * @brief Hash a key for the Bloom filter.
+ */
+inline std::uint64_t keyHash( const int key ) { return BloomFilter::hashInt( key ); }
+inline std::uint64_t keyHash( const double key ) { return BloomFilter::hashDouble( key ); }
+inline std::uint64_t keyHash( const StringKey& key ) { return BloomFilter::hashBytes( key.data, STRINGSIZE ); }
+
+/**
+ * @brief Key as seen by a LeafModel. Strings have no model.
+ */
+inline double modelKey( const int key ) { return key; }
+inline double modelKey( const double key ) { return key; }
+inline double modelKey( const StringKey& key ) { return 0; }
+
+/**
+ * @brief Number of key slots in the B+Tree nodes for key type T on pages of PAGESIZE bytes.
+ * Slack is left for the padding the compiler inserts when T is wider than an int or not a multiple of one.
+ */
+template <class T, std::size_t PAGESIZE>
+struct NodeCapacity{
+ private:
+	static const std::size_t WIDE = alignof( T ) > alignof( int ) ? alignof( T ) : 0;
+	static const std::size_t LEAFSLACK = WIDE + ( sizeof( T ) % alignof( RecordId ) ? alignof( RecordId ) : 0 );
+	static const std::size_t NONLEAFSLACK = 2 * WIDE + ( sizeof( T ) % alignof( PageId ) ? alignof( PageId ) : 0 );
+
+ public:
+	//                                                  sibling ptr        numEntries        padding                    key             rid
+	static const int LEAF = ( PAGESIZE - sizeof( PageId ) - sizeof( int ) - LEAFSLACK ) / ( sizeof( T ) + sizeof( RecordId ) );
+
+	//                                                     level        extra pageNo        numEntries        padding                key             pageNo
+	static const int NONLEAF = ( PAGESIZE - sizeof( int ) - sizeof( PageId ) - sizeof( int ) - NONLEAFSLACK ) / ( sizeof( T ) + sizeof( PageId ) );
+};
+
+/**
+ * @brief Capacities of a BufferedNonLeafNode for key type T on pages of PAGESIZE bytes. The pivots take
+ * the first sixteenth of the page and the message buffer the rest, so a node of fanout F holds many times F
+ * pending inserts and a flush to its busiest child moves a batch rather than a single entry.
+ */
+template <class T, std::size_t PAGESIZE>
+struct BufferedNodeCapacity{
+	static const std::size_t PIVOTBYTES = PAGESIZE / 16;
+
+	// The pivots are laid out like a non-leaf node of PIVOTBYTES, the messages like the arrays of a leaf
+	static const int NONLEAF = NodeCapacity< T, PIVOTBYTES >::NONLEAF;
+	static const int MESSAGES = NodeCapacity< T, PAGESIZE - PIVOTBYTES >::LEAF;
+};
+
 /**
  * @brief Number of key slots in B+Tree leaf for INTEGER key.
  */
-//                                                  sibling ptr      numEntries       key               rid
-const  int INTARRAYLEAFSIZE = ( Page::SIZE - sizeof( PageId ) - sizeof( int )) / ( sizeof( int ) + sizeof( RecordId ) );
+const  int INTARRAYLEAFSIZE = NodeCapacity< int, Page::SIZE >::LEAF;
 
 /**
  * @brief Number of key slots in B+Tree non-leaf for INTEGER key.
  */
-//                                                     level     extra pageNo         numEntries         key             pageNo
-const  int INTARRAYNONLEAFSIZE = ( Page::SIZE - sizeof( int ) - sizeof( PageId ) - sizeof( int) ) / ( sizeof( int ) + sizeof( PageId ) );
+const  int INTARRAYNONLEAFSIZE = NodeCapacity< int, Page::SIZE >::NONLEAF;
+
+/**
+ * @brief Number of key slots in B+Tree leaf for DOUBLE key.
+ */
+const  int DOUBLEARRAYLEAFSIZE = NodeCapacity< double, Page::SIZE >::LEAF;
+
+/**
+ * @brief Number of key slots in B+Tree non-leaf for DOUBLE key.
+ */
+const  int DOUBLEARRAYNONLEAFSIZE = NodeCapacity< double, Page::SIZE >::NONLEAF;
+
+/**
+ * @brief Number of key slots in B+Tree leaf for STRING key.
+ */
+const  int STRINGARRAYLEAFSIZE = NodeCapacity< StringKey, Page::SIZE >::LEAF;
+
+/**
+ * @brief Number of key slots in B+Tree non-leaf for STRING key.
+ */
+const  int STRINGARRAYNONLEAFSIZE = NodeCapacity< StringKey, Page::SIZE >::NONLEAF;
+
+/**
+ * @brief Number of pages reserved at a time for B+Tree leaves.
+ */
+const  int LEAFEXTENTSIZE = 64;
+
+/**
+ * @brief Maximum number of leaf extents tracked in the meta page. Leaves allocated after that
+ * many extents are full fall back to plain page allocation.
+ */
+const  int MAXLEAFEXTENTS = 400;
+
+/**
+ * @brief An entry whose record moved, passed to BTreeIndex::updateRids().
+ */
+struct RidUpdate{
+  /**
+   * Key of the entry, pointer to integer/double/char string.
+   */
+	const void* key;
+
+  /**
+   * Record id the entry holds now.
+   */
+	RecordId oldRid;
+
+  /**
+   * Record id the entry gets.
+   */
+	RecordId newRid;
+};
 
 /**
  * @brief Structure to store a key-rid pair. It is used to pass the pair to functions that 
@@ -101,8 +248,9 @@ bool operator<( const RIDKeyPair<T>& r1, const RIDKeyPair<T>& r2 )
 
 /**
  * @brief Structure for all information that is necessary for handling the propogation of 
- * the split from the node's children.
+ * the split from the node's children. Is templated for the middle key.
  */
+template <class T>
 struct PropogationInfo {
   /**
    * Left pageId of the new left page.
@@ -117,7 +265,7 @@ struct PropogationInfo {
   /**
    * The middle key after the split.
    */
-  int middleKey;
+  T middleKey;
 
   /**
    * True if the the level that is propogated from is a leaf
@@ -158,8 +306,56 @@ struct IndexMetaInfo{
    * True if the root is leaf
    */
 	bool leafRoot;
+
+  /**
+   * True if the non-leaf nodes are BufferedNonLeafNode pages that buffer inserts.
+   */
+	bool bufferedInserts;
+
+  /**
+   * Page number of the first page of the Bloom filter run, or 0 if the index has no Bloom filter.
+   */
+	PageId bloomFirstPageNo;
+
+  /**
+   * Number of consecutive pages reserved for the Bloom filter.
+   */
+	int bloomNumPages;
+
+  /**
+   * Number of 512-bit blocks in use in the Bloom filter.
+   */
+	std::uint32_t bloomNumBlocks;
+
+  /**
+   * Number of keys covered by the Bloom filter.
+   */
+	std::uint64_t bloomNumKeys;
+
+  /**
+   * True if the Bloom filter pages hold every key of the index. An index that logs its changes keeps this false
+   * while it is open, so a filter left behind by a crash is rebuilt on the next open.
+   */
+	bool bloomValid;
+
+  /**
+   * Number of leaf extents reserved in the file.
+   */
+	int numLeafExtents;
+
+  /**
+   * First page number of every leaf extent, in the order they were reserved.
+   */
+	PageId leafExtentStart[ MAXLEAFEXTENTS ];
+
+  /**
+   * Number of pages of every leaf extent that have been handed out to leaves.
+   */
+	std::uint16_t leafExtentUsed[ MAXLEAFEXTENTS ];
 };
 
+static_assert(sizeof(IndexMetaInfo) <= Page::MIN_SIZE, "IndexMetaInfo must fit in the meta page of every page size.");
+
 /*
 Each node is a page, so once we read the page in we just cast the pointer to the page to this struct and use it to access the parts
 These structures basically are the format in which the information is stored in the pages for the index file depending on what kind of 
@@ -168,9 +364,10 @@ at this level are just above the leaf nodes. Otherwise set to 0.
 */
 
 /**
- * @brief Structure for all non-leaf nodes when the key is of INTEGER type.
+ * @brief Structure for all non-leaf nodes with keys of type T on pages of PAGESIZE bytes.
 */
-struct NonLeafNodeInt{
+template <class T, std::size_t PAGESIZE>
+struct NonLeafNode{
   /**
    * Level of the node in the tree.
    */
@@ -179,12 +376,12 @@ struct NonLeafNodeInt{
   /**
    * Stores keys.
    */
-	int keyArray[ INTARRAYNONLEAFSIZE ];
+	T keyArray[ NodeCapacity< T, PAGESIZE >::NONLEAF ];
 
   /**
    * Stores page numbers of child pages which themselves are other non-leaf/leaf nodes in the tree.
    */
-	PageId pageNoArray[ INTARRAYNONLEAFSIZE + 1 ];
+	PageId pageNoArray[ NodeCapacity< T, PAGESIZE >::NONLEAF + 1 ];
 
   /**
    * Stores number of entries in this node.
@@ -194,18 +391,89 @@ struct NonLeafNodeInt{
 
 
 /**
- * @brief Structure for all leaf nodes when the key is of INTEGER type.
+ * @brief Structure for the non-leaf nodes of an index with buffered inserts, with keys of type T on pages of
+ * PAGESIZE bytes. Besides the pivots, each node buffers inserts that are headed for its subtree. They are
+ * moved down in batches, to the child with the most pending messages, once the buffer overflows.
 */
-struct LeafNodeInt{
+template <class T, std::size_t PAGESIZE>
+struct BufferedNonLeafNode{
+  /**
+   * Level of the node in the tree, 1 if the children are leaves.
+   */
+	int level;
+
   /**
    * Stores keys.
    */
-	int keyArray[ INTARRAYLEAFSIZE ];
+	T keyArray[ BufferedNodeCapacity< T, PAGESIZE >::NONLEAF ];
+
+  /**
+   * Stores page numbers of child pages.
+   */
+	PageId pageNoArray[ BufferedNodeCapacity< T, PAGESIZE >::NONLEAF + 1 ];
+
+  /**
+   * Stores number of entries in this node.
+   */
+	int numEntries;
+
+  /**
+   * Number of buffered messages.
+   */
+	int numMessages;
+
+  /**
+   * Keys of the buffered inserts, in arrival order.
+   */
+	T msgKeyArray[ BufferedNodeCapacity< T, PAGESIZE >::MESSAGES ];
+
+  /**
+   * RecordIds of the buffered inserts.
+   */
+	RecordId msgRidArray[ BufferedNodeCapacity< T, PAGESIZE >::MESSAGES ];
+};
+
+/**
+ * @brief Contents of a BufferedNonLeafNode copied out of its page, so it can grow past the page while
+ * messages are flushed and be written back as one or more nodes.
+*/
+template <class T>
+struct BufferedNodeContents{
+  /**
+   * Level of the node in the tree.
+   */
+	int level;
+
+  /**
+   * Pivot keys.
+   */
+	std::vector<T> keys;
+
+  /**
+   * Child page numbers, one more than keys.
+   */
+	std::vector<PageId> children;
+
+  /**
+   * Buffered inserts, in arrival order.
+   */
+	std::vector< RIDKeyPair<T> > messages;
+};
+
+/**
+ * @brief Structure for all leaf nodes with keys of type T on pages of PAGESIZE bytes.
+*/
+template <class T, std::size_t PAGESIZE>
+struct LeafNode{
+  /**
+   * Stores keys.
+   */
+	T keyArray[ NodeCapacity< T, PAGESIZE >::LEAF ];
 
   /**
    * Stores RecordIds.
    */
-	RecordId ridArray[ INTARRAYLEAFSIZE ];
+	RecordId ridArray[ NodeCapacity< T, PAGESIZE >::LEAF ];
 
   /**
    * Page number of the leaf on the right side.
@@ -219,6 +487,78 @@ struct LeafNodeInt{
   int numEntries;
 };
 
+/**
+ * @brief Structure for all non-leaf nodes when the key is of INTEGER type.
+*/
+typedef NonLeafNode< int, Page::SIZE > NonLeafNodeInt;
+
+/**
+ * @brief Structure for all leaf nodes when the key is of INTEGER type.
+*/
+typedef LeafNode< int, Page::SIZE > LeafNodeInt;
+
+/**
+ * @brief Structure for all non-leaf nodes when the key is of DOUBLE type.
+*/
+typedef NonLeafNode< double, Page::SIZE > NonLeafNodeDouble;
+
+/**
+ * @brief Structure for all leaf nodes when the key is of DOUBLE type.
+*/
+typedef LeafNode< double, Page::SIZE > LeafNodeDouble;
+
+/**
+ * @brief Structure for all non-leaf nodes when the key is of STRING type.
+*/
+typedef NonLeafNode< StringKey, Page::SIZE > NonLeafNodeString;
+
+/**
+ * @brief Structure for all leaf nodes when the key is of STRING type.
+*/
+typedef LeafNode< StringKey, Page::SIZE > LeafNodeString;
+
+/**
+ * @brief Key values of one key type that BTreeIndex keeps between calls.
+*/
+template <class T>
+struct IndexKeys{
+  /**
+   * Low value for scan.
+   */
+	T lowVal;
+
+  /**
+   * High value for scan.
+   */
+	T highVal;
+
+  /**
+   * Lowest key of the next level-1 node whose leaves defragment() will rewrite.
+   */
+	T defragNextKey;
+
+  /**
+   * Inserts not in the leaves yet that fall in the range of the running scan, in key order. Only used with
+   * buffered inserts or a memtable.
+   */
+	std::vector< RIDKeyPair<T> > scanMessages;
+
+  /**
+   * Index of the next entry of scanMessages to return.
+   */
+	std::size_t nextMessage;
+
+  /**
+   * Inserts collected in memory since the memtable was last handed to the merge thread.
+   */
+	std::multimap< T, RecordId > memtable;
+
+  /**
+   * Full memtable the merge thread is inserting into the tree, empty when no merge is pending.
+   */
+	std::multimap< T, RecordId > mergingMemtable;
+};
+
 
 /**
  * @brief BTreeIndex class. It implements a B+ Tree index on a single attribute of a
@@ -231,7 +571,7 @@ class BTreeIndex {
   /**
    * File object for the index file.
    */
-	File		*file;
+	BlobFile	*file;
 
   /**
    * Buffer Manager Instance.
@@ -273,6 +613,11 @@ class BTreeIndex {
    */
 	int			nodeOccupancy;
 
+  /**
+   * True if the non-leaf nodes buffer inserts, see BufferedNonLeafNode.
+   */
+	bool		bufferedInserts;
+
 
 	// MEMBERS SPECIFIC TO SCANNING
 
@@ -297,44 +642,375 @@ class BTreeIndex {
 	Page		*currentPageData;
 
   /**
-   * Low INTEGER value for scan.
+   * Scan bounds and defragmentation position of an INTEGER index.
    */
-	int			lowValInt;
+	IndexKeys<int>	intKeys;
 
   /**
-   * Low DOUBLE value for scan.
+   * Scan bounds and defragmentation position of a DOUBLE index.
    */
-	double	lowValDouble;
+	IndexKeys<double>	doubleKeys;
 
   /**
-   * Low STRING value for scan.
+   * Scan bounds and defragmentation position of a STRING index.
    */
-	std::string	lowValString;
+	IndexKeys<StringKey>	stringKeys;
 
   /**
-   * High INTEGER value for scan.
+   * The IndexKeys member for key type T.
    */
-	int			highValInt;
+	template <class T>
+	IndexKeys<T>& indexKeys();
 
   /**
-   * High DOUBLE value for scan.
+   * Low Operator. Can only be GT(>) or GTE(>=).
    */
-	double	highValDouble;
+	Operator	lowOp;
 
   /**
-   * High STRING value for scan.
+   * High Operator. Can only be LT(<) or LTE(<=).
    */
-	std::string highValString;
-	
+	Operator	highOp;
+
+
+	// MEMBERS SPECIFIC TO THE BLOOM FILTER
+
   /**
-   * Low Operator. Can only be GT(>) or GTE(>=).
+   * In-memory copy of the Bloom filter over all keys, or NULL if the index has none.
    */
-	Operator	lowOp;
+	BloomFilter	*bloomFilter;
 
   /**
-   * High Operator. Can only be LT(<) or LTE(<=).
+   * Page number of the first page of the run holding the Bloom filter on disk.
    */
-	Operator	highOp;
+	PageId	bloomFirstPageNo;
+
+  /**
+   * Number of pages in the Bloom filter run.
+   */
+	int			bloomNumPages;
+
+  /**
+   * Number of keys covered by the Bloom filter.
+   */
+	std::uint64_t	bloomNumKeys;
+
+	// MEMBERS SPECIFIC TO THE LEAF MODEL
+
+  /**
+   * Model from keys to leaves used by scans instead of descending the non-leaf nodes, or NULL if the
+   * index has none or it has to be built again.
+   */
+	LeafModel	*leafModel;
+
+  /**
+   * Largest error of the leaf model, 0 if the index has no leaf model.
+   */
+	int			leafModelError;
+
+  /**
+   * Build the leaf model from the leaf chain.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void buildLeafModelKernel();
+
+	// MEMBERS SPECIFIC TO RID UPDATES
+
+  /**
+   * Body of updateRids(). Rewrite the record id of every entry found in place and return their number.
+   */
+	template <class T, std::size_t PAGESIZE>
+	std::size_t updateRidsKernel(const std::vector<RidUpdate> & updates);
+
+  /**
+   * Rewrite the record id of an entry in the leaves. Continues from the leaf pinned by the previous call if key
+   * can only be there or right of it, and leaves the last leaf it read pinned for the next call.
+   *
+   * @param pinnedPageNo	Page number of the pinned leaf, 0 if none is pinned.
+   * @param pinnedPage		The pinned leaf.
+   * @param pinnedDirty		True if the pinned leaf was changed.
+   * @return							True if the entry was found.
+   */
+	template <class T, std::size_t PAGESIZE>
+	bool updateLeafRid(const T & key, const RecordId oldRid, const RecordId newRid,
+										PageId & pinnedPageNo, Page *& pinnedPage, bool & pinnedDirty);
+
+  /**
+   * Rewrite the record id of a buffered insert on the path of key. Return true if it was found.
+   */
+	template <class T, std::size_t PAGESIZE>
+	bool updateMessageRid(const T & key, const RecordId oldRid, const RecordId newRid);
+
+	// MEMBERS SPECIFIC TO LEAF PAGE ALLOCATION
+
+  /**
+   * First page number of every leaf extent, in the order they were reserved.
+   */
+	std::vector<PageId> leafExtentStart;
+
+  /**
+   * Number of pages of every leaf extent that have been handed out to leaves.
+   */
+	std::vector<int> leafExtentUsed;
+
+  /**
+   * Allocate a page for a leaf node. Leaves are carved out of extents of LEAFEXTENTSIZE consecutive pages.
+   * The page is taken from the extent holding nearPageNo if it has room, otherwise from the extent reserved
+   * right after it, otherwise from a newly reserved extent, so that a leaf and its right sibling tend to be
+   * close together in the file.
+   *
+   * @param nearPageNo  Page the new leaf should be placed close to, usually its left sibling. 0 for no preference.
+   * @param pageNo      Page number of the new leaf returned via this reference.
+   * @param page        Pinned page of the new leaf returned via this reference.
+   */
+	void allocLeafPage(const PageId nearPageNo, PageId & pageNo, Page *& page);
+
+  /**
+   * Page number of the leftmost leaf, found by following pageNoArray[0] down from the root.
+   */
+	template <class T, std::size_t PAGESIZE>
+	PageId leftmostLeafPageNo();
+
+
+	// MEMBERS SPECIFIC TO DEFRAGMENTATION
+
+  /**
+   * True while a defragmentation pass is under way and the defragNextKey of the key type in use is valid.
+   */
+	bool		defragExecuting;
+
+  /**
+   * Helper function that will be called by defragment(). Rewrite all leaves below one level-1 node into a
+   * run of freshly allocated, consecutive pages, repacked to perLeaf entries each, and repoint the node,
+   * the leaf chain and any running scan at the new pages.
+   *
+   * @param key         Any key inside the range of the level-1 node to rewrite. Ignored if leftmost is true.
+   * @param leftmost    Rewrite the leftmost level-1 node.
+   * @param perLeaf     Target number of entries per rewritten leaf.
+   * @param nextKey     Lowest key of the level-1 node to the right, returned via this reference.
+   * @return            False if the rewritten node was the rightmost one on its level.
+   */
+	template <class T, std::size_t PAGESIZE>
+	bool defragmentLeafGroup(const T key, const bool leftmost, const int perLeaf, T & nextKey);
+
+	// MEMBERS SPECIFIC TO LOGGING
+
+  /**
+   * True if the meta page no longer matches the in-memory root, extent and Bloom filter fields.
+   */
+	bool		metaDirty;
+
+  /**
+   * Copy the in-memory root, extent and Bloom filter fields to the meta page.
+   *
+   * @param closing   True if the index is being closed and the Bloom filter pages are up to date.
+   */
+	void writeMeta(const bool closing);
+
+  /**
+   * End of a public operation. If the buffer manager logs its changes, bring the meta page up to date and
+   * commit, so the operation is replayed as a whole or not at all after a crash.
+   */
+	void commitChanges();
+
+	// MEMBERS SPECIFIC TO BUFFERED INSERTS
+
+  /**
+   * Body of insertEntry() for an index with buffered inserts. The entry is appended to the message buffer of
+   * the root and only reaches a leaf when the buffers on its path overflow.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void bufferedInsertKernel(const void* key, const RecordId rid);
+
+  /**
+   * Body of startScan() for an index with inserts that are not in the leaves yet, held in the buffers of the
+   * non-leaf nodes or in the memtable. Collects those in the scan range before positioning on the first leaf
+   * entry, so scanNext() can merge both.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void mergingStartScanKernel(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
+
+  /**
+   * Body of scanNext() for an index with inserts that are not in the leaves yet. Returns the smaller of the
+   * next leaf entry and the next collected insert.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void mergingScanNextKernel(RecordId& outRid);
+
+  /**
+   * Copy a buffered node out of its page.
+   *
+   * @param pageNo      Page number of the node.
+   * @param contents    Contents returned via this reference.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void loadBufferedNode(const PageId pageNo, BufferedNodeContents<T> & contents);
+
+  /**
+   * Write node contents back to their page. If there are more pivots than fit, the contents are split evenly
+   * over the page and new pages to its right, and the new pages are returned with their separator keys.
+   * The messages must fit in a single node.
+   *
+   * @param pageNo      Page number of the node.
+   * @param contents    Contents to write.
+   * @param siblings    New right siblings, with the separator key in front of each, appended to this vector.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void storeBufferedNode(const PageId pageNo, const BufferedNodeContents<T> & contents, std::vector< PageKeyPair<T> > & siblings);
+
+  /**
+   * Add messages to the buffer of a non-leaf node, then flush its busiest children until the buffer fits.
+   *
+   * @param pageNo      Page number of the node.
+   * @param messages    Messages for the node's subtree, in arrival order.
+   * @param siblings    New right siblings of the node if it had to split, appended to this vector.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void flushMessages(const PageId pageNo, const std::vector< RIDKeyPair<T> > & messages, std::vector< PageKeyPair<T> > & siblings);
+
+  /**
+   * Insert messages into a leaf. If they do not fit, the entries are spread evenly over the leaf and new
+   * leaves to its right.
+   *
+   * @param pageNo      Page number of the leaf.
+   * @param messages    Messages for the leaf, in arrival order.
+   * @param siblings    New right siblings of the leaf, appended to this vector.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void applyMessages(const PageId pageNo, const std::vector< RIDKeyPair<T> > & messages, std::vector< PageKeyPair<T> > & siblings);
+
+  /**
+   * Put a new root above the current root and the siblings it split into.
+   *
+   * @param level       Level of the new root.
+   * @param siblings    Right siblings of the old root with their separator keys.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void growBufferedRoot(int level, std::vector< PageKeyPair<T> > siblings);
+
+  /**
+   * Append the messages buffered in the subtree of a non-leaf node with keys in [*lowVal, *highVal].
+   *
+   * @param pageNo      Page number of the node.
+   * @param lowVal      Lowest key to collect, NULL for no lower bound.
+   * @param highVal     Highest key to collect, NULL for no upper bound.
+   * @param out         Messages appended to this vector, in no particular order.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void collectMessages(const PageId pageNo, const T* lowVal, const T* highVal, std::vector< RIDKeyPair<T> > & out);
+
+  /**
+   * Add a newly inserted key to the Bloom filter, if there is one, and resize the filter once it is overloaded.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void addToBloomFilter(const T & key);
+
+	// MEMBERS SPECIFIC TO THE MEMTABLE
+
+  /**
+   * Number of inserts the memtable collects before it is handed to the merge thread, 0 without a memtable.
+   */
+	std::size_t	memtableSize;
+
+  /**
+   * Number of entries in the memtable of the key type in use.
+   */
+	std::size_t	memtableEntries;
+
+  /**
+   * Number of entries in the mergingMemtable of the key type in use.
+   */
+	std::size_t	mergingEntries;
+
+  /**
+   * Set to make the merge thread exit once no merge is pending.
+   */
+	bool		stopMerging;
+
+  /**
+   * Exception that ended the merge thread, null while it runs. Rethrown by every later insertEntry() and
+   * flushMemtable(), since the entries it was merging are lost and no further memtable gets merged.
+   */
+	std::exception_ptr	mergeError;
+
+  /**
+   * Set once mergeError has been thrown to a caller, the destructor only rethrows an error nobody has seen.
+   */
+	bool		mergeErrorReported;
+
+  /**
+   * Guards the memtables, memtableEntries, mergingEntries, stopMerging and mergeError.
+   */
+	std::mutex	memtableLatch;
+
+  /**
+   * Signalled when a memtable is handed to the merge thread, when a merge is done and on stopMerging.
+   */
+	std::condition_variable	memtableChanged;
+
+  /**
+   * Held while the tree, the Bloom filter or the meta page are used with a merge thread running: by the merge
+   * thread for a whole merge, and by a scan from startScan() to endScan(). Taken before memtableLatch.
+   */
+	std::recursive_mutex	treeLatch;
+
+  /**
+   * Hold of treeLatch by the running scan.
+   */
+	std::unique_lock<std::recursive_mutex>	scanLatch;
+
+  /**
+   * Thread that merges full memtables into the tree.
+   */
+	std::thread	mergeThread;
+
+  /**
+   * Body of mergeThread. Waits for a full memtable, merges it and repeats until stopMerging is set or a merge
+   * throws, which is kept in mergeError.
+   */
+	void mergeLoop();
+
+  /**
+   * Make the merge thread exit once no merge is pending and join it.
+   */
+	void stopMergeThread();
+
+  /**
+   * Rethrow mergeError, if there is one. Called with memtableLatch held.
+   */
+	void throwMergeError();
+
+  /**
+   * Body of insertEntry() with a memtable. Adds the entry to the memtable; once it is full, hands it to the merge
+   * thread, first waiting for the previous one to be merged unless this thread's own scan holds the merge off.
+   */
+	template <class T>
+	void memtableInsertKernel(const void* key, const RecordId rid);
+
+  /**
+   * Hand the memtable to the merge thread. Called with memtableLatch held and no merge pending.
+   */
+	template <class T>
+	void sealMemtableKernel();
+
+  /**
+   * Insert the mergingMemtable into the tree in key order, so consecutive entries land in the same leaf while
+   * it is still in the buffer pool, then commit and empty it. Called by the merge thread with treeLatch held.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void mergeMemtableKernel();
+
+  /**
+   * Read the Bloom filter from its page run into bloomFilter.
+   *
+   * @param numBlocks   Number of blocks stored in the run.
+   */
+	void loadBloomFilter(const std::uint32_t numBlocks);
+
+  /**
+   * Write bloomFilter back to its page run.
+   */
+	void storeBloomFilter();
 
   /**
    * Helper function that will be called by insertEntry(). Traverse the the coresponding node
@@ -348,11 +1024,12 @@ class BTreeIndex {
    * @param splitted      True if the node with nodePid is splitted.
    *
    */
-  void insertHelper(const RIDKeyPair<int> ridKey, const PageId nodePageNo, const int nodeType,
-                    PropogationInfo & propInfo, bool & splitted);
+  template <class T, std::size_t PAGESIZE>
+  void insertHelper(const RIDKeyPair<T> ridKey, const PageId nodePageNo, const int nodeType,
+                    PropogationInfo<T> & propInfo, bool & splitted);
 
   /**
-   * Helper function that will be called inside insertHelper(). Make the insertion of keyArray and ridArray in the LeafNodeInt 
+   * Helper function that will be called inside insertHelper(). Make the insertion of keyArray and ridArray in the LeafNode 
    * with rid-key pair.
    * 
    * @param ridKey      RIDKeyPair of the entry to be inserted.
@@ -360,10 +1037,11 @@ class BTreeIndex {
    * @param ridArray    ridArray to be inserted with rid of ridKey.
    * @param numEntries  number of entries in the keyArray.
    */
-  void insertLeafArrays(const RIDKeyPair<int> ridKey, int keyArray[], RecordId ridArray[], const int numEntries);
+  template <class T>
+  void insertLeafArrays(const RIDKeyPair<T> ridKey, T keyArray[], RecordId ridArray[], const int numEntries);
 
   /**
-   * Helper function that will be called inside insertHelper(). Make the insertion of keyArray and pageNoArray in the NonLeafNodeInt 
+   * Helper function that will be called inside insertHelper(). Make the insertion of keyArray and pageNoArray in the NonLeafNode 
    * with propogation info from the child (middlekey, leftPageNo, rightPageNo after the child node was splitted)
    * 
    * @param propInfo    PropogationInfo from the child node (middlekey, leftPageNo, rightPageNo)
@@ -372,7 +1050,152 @@ class BTreeIndex {
    * @param pageNoArray ridArray to be inserted with leftPageNo, rightPageNo.
    * @param numEntries  number of entries in the keyArray.
    */
-  void insertNonleafArrays(const PropogationInfo propInfo, const int insertIdx, int keyArray[], PageId pageNoArray[], const int numEntries);
+  template <class T>
+  void insertNonleafArrays(const PropogationInfo<T> propInfo, const int insertIdx, T keyArray[], PageId pageNoArray[], const int numEntries);
+
+
+	// MEMBERS SPECIFIC TO KEY TYPE DISPATCH
+
+  /**
+   * Body of insertEntry() for keys of type T on pages of PAGESIZE bytes.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void insertEntryKernel(const void* key, const RecordId rid);
+
+  /**
+   * Body of startScan() for keys of type T on pages of PAGESIZE bytes.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void startScanKernel(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
+
+  /**
+   * Body of scanNext() for keys of type T on pages of PAGESIZE bytes.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void scanNextKernel(RecordId& outRid);
+
+  /**
+   * Move the scan to the right sibling of the current leaf. The last leaf is not left: it stays pinned until
+   * endScan() unpins it, so it is unpinned exactly once however the scan ends.
+   *
+   * @return    False if the current leaf is the last one.
+   */
+	template <class T, std::size_t PAGESIZE>
+	bool nextScanLeaf();
+
+  /**
+   * Body of rebuildBloomFilter() for keys of type T on pages of PAGESIZE bytes.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void rebuildBloomFilterKernel();
+
+  /**
+   * Body of defragment() for keys of type T on pages of PAGESIZE bytes.
+   */
+	template <class T, std::size_t PAGESIZE>
+	bool defragmentKernel(const double targetFill, const int maxNodes);
+
+  /**
+   * Point the kernels below at the instantiations for keys of type T on pages of PAGESIZE bytes and set
+   * leafOccupancy and nodeOccupancy. Called once by the constructor, so the public methods pay a single
+   * indirect call and every comparison inside a kernel is resolved at compile time.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void bindKernels();
+
+  /**
+   * Call bindKernels() for keys of type T with the PAGESIZE matching the page size of the index file.
+   *
+   * @param pageSize    Page size of the index file in bytes.
+   */
+	template <class T>
+	void bindKernelsForPageSize(const std::size_t pageSize);
+
+  /**
+   * Instantiation of insertEntryKernel() chosen for attributeType.
+   */
+	void (BTreeIndex::*insertEntryFn)(const void*, const RecordId);
+
+  /**
+   * Instantiation of startScanKernel() chosen for attributeType.
+   */
+	void (BTreeIndex::*startScanFn)(const void*, const Operator, const void*, const Operator);
+
+  /**
+   * Instantiation of scanNextKernel() chosen for attributeType.
+   */
+	void (BTreeIndex::*scanNextFn)(RecordId&);
+
+  /**
+   * Instantiation of rebuildBloomFilterKernel() chosen for attributeType.
+   */
+	void (BTreeIndex::*rebuildBloomFilterFn)();
+
+  /**
+   * Instantiation of defragmentKernel() chosen for attributeType.
+   */
+	bool (BTreeIndex::*defragmentFn)(const double, const int);
+
+  /**
+   * Instantiation of memtableInsertKernel() chosen for attributeType.
+   */
+	void (BTreeIndex::*memtableInsertFn)(const void*, const RecordId);
+
+  /**
+   * Instantiation of sealMemtableKernel() chosen for attributeType.
+   */
+	void (BTreeIndex::*sealMemtableFn)();
+
+  /**
+   * Instantiation of mergeMemtableKernel() chosen for attributeType.
+   */
+	void (BTreeIndex::*mergeMemtableFn)();
+
+  /**
+   * Call visit for every entry of the tree in key order, merging in the inserts still buffered above the leaves.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void forEachEntryKernel(const std::function<void(const T&, const RecordId&)> & visit);
+
+  /**
+   * Body of freeze() for keys of type T.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void freezeKernel(const std::string & frozenName);
+
+  /**
+   * Instantiation of freezeKernel() chosen for attributeType and the page size.
+   */
+	void (BTreeIndex::*freezeFn)(const std::string&);
+
+  /**
+   * Body of collectEntries() for keys of type T. outEntries points to a std::vector< RIDKeyPair<T> >.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void collectEntriesKernel(void* outEntries);
+
+  /**
+   * Instantiation of collectEntriesKernel() chosen for attributeType and the page size.
+   */
+	void (BTreeIndex::*collectEntriesFn)(void*);
+
+  /**
+   * Instantiation of buildLeafModelKernel() chosen for attributeType and the page size.
+   */
+	void (BTreeIndex::*buildLeafModelFn)();
+
+  /**
+   * Instantiation of updateRidsKernel() chosen for attributeType and the page size.
+   */
+	std::size_t (BTreeIndex::*updateRidsFn)(const std::vector<RidUpdate>&);
+
+  /**
+   * Body of the constructors. Open the index file outIndexName, or create it and, unless relationName is empty,
+   * insert an entry for every tuple of the relation.
+   */
+	void openIndex(const std::string & relationName, const std::string & outIndexName, BufMgr *bufMgrIn,
+								const int attrByteOffset, const Datatype attrType, const bool useBloomFilter, const std::size_t pageSize,
+								const bool bufferedInsertsIn, const std::size_t memtableSizeIn);
 	
  public:
 
@@ -386,19 +1209,50 @@ class BTreeIndex {
    * @param bufMgrIn						Buffer Manager Instance
    * @param attrByteOffset			Offset of attribute, over which index is to be built, in the record
    * @param attrType						Datatype of attribute over which index is built
+   * @param useBloomFilter			Keep a Bloom filter over the keys so equality probes for missing keys skip the leaves.
+   *                          Ignored if the existing index file already has one.
+   * @param pageSize						Page size of a new index file, which sets the fanout of the tree. Small pages suit
+   *                          point lookups, large pages suit long range scans. Ignored if the index file exists.
+   * @param bufferedInsertsIn	Build a write-optimized index whose non-leaf nodes buffer inserts and pass them down in
+   *                          batches, see BufferedNonLeafNode. Suits random-key ingest into indexes much larger than
+   *                          the buffer pool. Ignored if the index file exists.
+   * @param memtableSizeIn		Collect inserts in an in-memory memtable of this many entries, which a background
+   *                          thread merges into the tree in key order once it is full. Scans see the memtable
+   *                          too. Entries not merged yet are lost on a crash. 0 inserts straight into the tree.
    * @throws  BadIndexInfoException     If the index file already exists for the corresponding attribute, but values in metapage(relationName, attribute byte offset, attribute type etc.) do not match with values received through constructor parameters.
+   * @throws  InvalidPageSizeException  If pageSize is not supported, or the pages of the index file do not fit in the frames of bufMgrIn.
    */
 	BTreeIndex(const std::string & relationName, std::string & outIndexName,
-						BufMgr *bufMgrIn,	const int attrByteOffset,	const Datatype attrType);
+						BufMgr *bufMgrIn,	const int attrByteOffset,	const Datatype attrType,
+						const bool useBloomFilter = false, const std::size_t pageSize = Page::SIZE,
+						const bool bufferedInsertsIn = false, const std::size_t memtableSizeIn = 0);
+
+  /**
+   * BTreeIndex Constructor for an index file named by the caller. Open the file if it exists, or create an empty
+   * index in it. Suits indexes whose entries do not come from one scan of a relation, like the partitions of a
+   * PartitionedIndex.
+   *
+   * @param indexName           Name of the index file.
+   * @param bufMgrIn						Buffer Manager Instance
+   * @param attrByteOffset			Offset of attribute, over which index is to be built, in the record
+   * @param attrType						Datatype of attribute over which index is built
+   * @param pageSize						Page size of a new index file. Ignored if the index file exists.
+   * @throws  BadIndexInfoException     If the index file exists but was built over a different attribute.
+   * @throws  InvalidPageSizeException  If pageSize is not supported, or the pages of the index file do not fit in the frames of bufMgrIn.
+   */
+	BTreeIndex(const std::string & indexName, BufMgr *bufMgrIn, const int attrByteOffset, const Datatype attrType,
+						const std::size_t pageSize = Page::SIZE);
 	
 
   /**
    * BTreeIndex Destructor. 
 	 * End any initialized scan, flush index file, after unpinning any pinned pages, from the buffer manager
 	 * and delete file instance thereby closing the index file.
-	 * Destructor should not throw any exceptions. All exceptions should be caught in here itself. 
+	 * Destructor should not throw any exceptions. All exceptions should be caught in here itself. The one exception
+	 * is a failed background merge that no insertEntry() or flushMemtable() has reported yet, which is rethrown
+	 * once the index is closed, unless the stack is already unwinding.
 	 * */
-	~BTreeIndex();
+	~BTreeIndex() noexcept(false);
 
 
   /**
@@ -420,6 +1274,8 @@ class BTreeIndex {
 	 * If another scan is already executing, that needs to be ended here.
 	 * Set up all the variables for scan. Start from root to find out the leaf page that contains the first RecordID
 	 * that satisfies the scan parameters. Keep that page pinned in the buffer pool.
+	 * An equality probe (lowVal GTE, highVal LTE, lowVal == highVal) is first checked against the Bloom filter,
+	 * if the index has one, and a definite miss throws without reading any leaf.
    * @param lowVal	Low value of range, pointer to integer / double / char string
    * @param lowOp		Low operator (GT/GTE)
    * @param highVal	High value of range, pointer to integer / double / char string
@@ -446,6 +1302,90 @@ class BTreeIndex {
 	 * @throws ScanNotInitializedException If no scan has been initialized.
 	**/
 	const void endScan();
+
+  /**
+	 * Resize the Bloom filter for the current number of keys and refill it from the leaf level.
+	 * Creates the filter if the index does not have one yet. Called by the constructor after a bulk
+	 * build and by insertEntry() when the filter has absorbed twice the keys it was sized for.
+	**/
+	void rebuildBloomFilter();
+
+  /**
+	 * Run one step of an online defragmentation pass over the leaf level.
+	 * Each step takes the leaves below up to maxNodes level-1 nodes, in key order, and rewrites their entries
+	 * into new leaves allocated back to back at the end of the index file, filled to targetFill of
+	 * the leaf capacity. The level-1 node, the right sibling link of the preceding leaf and a running scan are
+	 * moved over to the new pages, so scans and inserts may continue between steps. Repeating the call until
+	 * it returns true leaves the whole leaf chain in physical key order.
+	 * The replaced leaf pages are not reused since pages of a BlobFile cannot be freed.
+   * @param targetFill	Fraction of a leaf to fill, between 0 and 1. Lowered as needed so a level-1 node never overflows.
+   * @param maxNodes		Number of level-1 nodes to process in this step.
+   * @return						True once the pass has reached the rightmost leaf. The next call starts a new pass.
+   *                    Always true for an index with buffered inserts, whose leaves are already written in batches
+   *                    and are not defragmented.
+	**/
+	bool defragment(const double targetFill = 0.9, const int maxNodes = 1);
+
+  /**
+	 * Merge everything in the memtable into the tree and wait until it is done. Ends a running scan first,
+	 * since a scan holds off the merge. Does nothing for an index without a memtable.
+   * @throws  The exception a background merge failed with, also thrown by insertEntry() from then on.
+	**/
+	void flushMemtable();
+
+  /**
+	 * Write every entry of the index to a FrozenIndex file named after the index file, with ".frozen" appended,
+	 * replacing an earlier one. The frozen file has the page size of the index, which is left as it is. Open the
+	 * result with FrozenIndex.
+   * @param outFrozenName	Return the name of the frozen index file.
+	**/
+	void freeze(std::string & outFrozenName);
+
+  /**
+	 * Append every entry of the index to outEntries in key order, equal keys in the order they were inserted.
+	 * T must be the key type of the index: int, double or StringKey.
+   * @param outEntries	Entries appended to this.
+	**/
+	template <class T>
+	void collectEntries(std::vector< RIDKeyPair<T> > & outEntries)
+	{
+		flushMemtable();
+		std::lock_guard<std::recursive_mutex> lock(treeLatch);
+		(this->*collectEntriesFn)(&outEntries);
+	}
+
+  /**
+	 * Let scans find their first leaf with a LeafModel, a piecewise-linear function from keys to positions in
+	 * the leaf chain, instead of descending the non-leaf nodes. Suits indexes over near-uniform numeric keys.
+	 * The model lives in memory only. It is built from the leaf chain here, kept up to date on leaf splits and
+	 * built again by the next scan after defragment() moved leaves.
+   * @param maxError	Largest distance, in leaves, between the predicted and the actual leaf. Smaller errors need
+   *                  more linear pieces.
+	 * @throws  BadIndexInfoException If the index is over strings, or buffers inserts in its non-leaf nodes or a memtable.
+	**/
+	void useLeafModel(const int maxError = 8);
+
+  /**
+   * The leaf model, or NULL if the index has none or it has to be built again.
+   */
+	const LeafModel* getLeafModel() const { return leafModel; }
+
+  /**
+	 * Give the entry <key,oldRid> the record id newRid, after its record moved. The record id is rewritten where
+	 * the entry is, so the tree does not change shape.
+   * @param key			Key of the entry, pointer to integer/double/char string
+   * @param oldRid	Record id the entry holds now.
+   * @param newRid	Record id the entry gets.
+	 * @throws  NoSuchKeyFoundException If the index holds no such entry.
+	**/
+	void updateRid(const void* key, const RecordId oldRid, const RecordId newRid);
+
+  /**
+	 * Batched updateRid(). The entries are looked up in key order, so entries in the same leaf cost one descent.
+   * @param updates	Entries to update.
+	 * @return	Number of entries found and updated. Entries the index does not hold are skipped.
+	**/
+	std::size_t updateRids(const std::vector<RidUpdate> & updates);
 	
 };
 
@@ -5,110 +5,130 @@
  * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
  */
 
+#include <algorithm>
 #include <memory>
 #include <iostream>
 #include "buffer.h"
 #include "bufHashTbl.h"
 #include "exceptions/hash_already_present_exception.h"
 #include "exceptions/hash_not_found_exception.h"
-#include "exceptions/hash_table_exception.h"
 
 namespace badgerdb {
 
-int BufHashTbl::hash(const File* file, const PageId pageNo)
+std::uint64_t BufHashTbl::mix(const File* file, const PageId pageNo)
 {
-  int tmp, value;
-  tmp = (long)file;  // cast of pointer to the file object to an integer
-  value = (tmp + pageNo) % HTSIZE;
+  // Mix all bits of the file pointer and the page number, so neighbouring pages of one file and equal page
+  // numbers of different files spread over the table (finalizer of MurmurHash3)
+  std::uint64_t value = (std::uint64_t)(std::uintptr_t)file ^ ((std::uint64_t)pageNo * 0x9e3779b97f4a7c15ULL);
+  value ^= value >> 33;
+  value *= 0xff51afd7ed558ccdULL;
+  value ^= value >> 33;
+  value *= 0xc4ceb9fe1a85ec53ULL;
+  value ^= value >> 33;
   return value;
 }
 
+std::size_t BufHashTbl::hash(const File* file, const PageId pageNo) const
+{
+  return (std::size_t)mix(file, pageNo) & (HTSIZE - 1);
+}
+
+std::size_t BufHashTbl::probe(const File* file, const PageId pageNo) const
+{
+  std::size_t index = hash(file, pageNo);
+  while (ht[index].file != NULL && !(ht[index].file == file && ht[index].pageNo == pageNo))
+  {
+    index = (index + 1) & (HTSIZE - 1);
+  }
+  return index;
+}
+
 BufHashTbl::BufHashTbl(int htSize)
-	: HTSIZE(htSize)
+	: HTSIZE(2), numEntries(0)
 {
-  // allocate an array of pointers to hashBuckets
-  ht = new hashBucket* [htSize];
-  for(int i=0; i < HTSIZE; i++)
-    ht[i] = NULL;
+  // at most half full, so probe runs stay short
+  while (HTSIZE < 2 * (std::size_t)std::max(htSize, 1))
+    HTSIZE *= 2;
+  ht = new hashBucket[HTSIZE];
+  for (std::size_t i = 0; i < HTSIZE; i++)
+    ht[i].file = NULL;
 }
 
 BufHashTbl::~BufHashTbl()
 {
-  for(int i = 0; i < HTSIZE; i++) {
-    hashBucket* tmpBuf = ht[i];
-    while (ht[i]) {
-      tmpBuf = ht[i];
-      ht[i] = ht[i]->next;
-      delete tmpBuf;
-    }
-  }
   delete [] ht;
 }
 
-void BufHashTbl::insert(const File* file, const PageId pageNo, const FrameId frameNo)
+void BufHashTbl::grow()
 {
-  int index = hash(file, pageNo);
-
-  hashBucket* tmpBuc = ht[index];
-  while (tmpBuc) {
-    if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
-  		throw HashAlreadyPresentException(tmpBuc->file->filename(), tmpBuc->pageNo, tmpBuc->frameNo);
-    tmpBuc = tmpBuc->next;
+  hashBucket* old = ht;
+  const std::size_t oldSize = HTSIZE;
+  HTSIZE *= 2;
+  ht = new hashBucket[HTSIZE];
+  for (std::size_t i = 0; i < HTSIZE; i++)
+    ht[i].file = NULL;
+  for (std::size_t i = 0; i < oldSize; i++)
+  {
+    if (old[i].file != NULL)
+      ht[probe(old[i].file, old[i].pageNo)] = old[i];
   }
+  delete [] old;
+}
 
-  tmpBuc = new hashBucket;
-  if (!tmpBuc)
-  	throw HashTableException();
+void BufHashTbl::insert(const File* file, const PageId pageNo, const FrameId frameNo)
+{
+  std::size_t index = probe(file, pageNo);
+  if (ht[index].file != NULL)
+  	throw HashAlreadyPresentException(ht[index].file->filename(), ht[index].pageNo, ht[index].frameNo);
+
+  if (2 * (numEntries + 1) > HTSIZE)
+  {
+    grow();
+    index = probe(file, pageNo);
+  }
 
-  tmpBuc->file = (File*) file;
-  tmpBuc->pageNo = pageNo;
-  tmpBuc->frameNo = frameNo;
-  tmpBuc->next = ht[index];
-  ht[index] = tmpBuc;
+  ht[index].file = (File*) file;
+  ht[index].pageNo = pageNo;
+  ht[index].frameNo = frameNo;
+  numEntries++;
 }
 
-void BufHashTbl::lookup(const File* file, const PageId pageNo, FrameId &frameNo) 
+bool BufHashTbl::find(const File* file, const PageId pageNo, FrameId &frameNo) const
 {
-  int index = hash(file, pageNo);
-  hashBucket* tmpBuc = ht[index];
-  while (tmpBuc) {
-    if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
-    {
-      frameNo = tmpBuc->frameNo; // return frameNo by reference
-      return;
-    }
-    tmpBuc = tmpBuc->next;
-  }
+  const std::size_t index = probe(file, pageNo);
+  if (ht[index].file == NULL)
+    return false;
+  frameNo = ht[index].frameNo; // return frameNo by reference
+  return true;
+}
 
-  throw HashNotFoundException(file->filename(), pageNo);
+void BufHashTbl::lookup(const File* file, const PageId pageNo, FrameId &frameNo) const
+{
+  if (!find(file, pageNo, frameNo))
+    throw HashNotFoundException(file->filename(), pageNo);
 }
 
 void BufHashTbl::remove(const File* file, const PageId pageNo) {
 
-  int index = hash(file, pageNo);
-  hashBucket* tmpBuc = ht[index];
-  hashBucket* prevBuc = NULL;
+  std::size_t index = probe(file, pageNo);
+  if (ht[index].file == NULL)
+    throw HashNotFoundException(file->filename(), pageNo);
 
-  while (tmpBuc)
+  // Shift back every later entry of the run that may sit in the freed slot, i.e. whose home slot is not
+  // between the freed slot and its own slot
+  std::size_t next = (index + 1) & (HTSIZE - 1);
+  while (ht[next].file != NULL)
 	{
-    if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
+    const std::size_t home = hash(ht[next].file, ht[next].pageNo);
+    if (((next - home) & (HTSIZE - 1)) >= ((next - index) & (HTSIZE - 1)))
 		{
-      if(prevBuc) 
-				prevBuc->next = tmpBuc->next;
-      else
-				ht[index] = tmpBuc->next;
-
-      delete tmpBuc;
-      return;
-    }
-		else
-		{
-      prevBuc = tmpBuc;
-      tmpBuc = tmpBuc->next;
+      ht[index] = ht[next];
+      index = next;
     }
+    next = (next + 1) & (HTSIZE - 1);
   }
-
-  throw HashNotFoundException(file->filename(), pageNo);
+  ht[index].file = NULL;
+  numEntries--;
 }
 
 }
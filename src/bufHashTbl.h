@@ -7,6 +7,9 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 #include "file.h"
 
 namespace badgerdb {
@@ -16,7 +19,7 @@ namespace badgerdb {
 */
 struct hashBucket {
 	/**
-	 * pointer a file object (more on this below)
+	 * pointer a file object (more on this below), NULL if the slot is empty
 	 */
 	File *file;
 
@@ -29,30 +32,36 @@ struct hashBucket {
 	 * frame number of page in the buffer pool
 	 */
 	FrameId frameNo;
-
-	/**
-	 * Next node in the hash table
-	 */
-	hashBucket*   next;
 };
 
 
 /**
 * @brief Hash table class to keep track of pages in the buffer pool
 *
+* The table is a flat array of slots with open addressing and linear probing. An entry sits at its home
+* slot or after it in a run of full slots, and remove() shifts the rest of the run back, so no tombstones
+* are left behind and lookups stop at the first empty slot. Entries live in the array itself: inserts and
+* removes never allocate, and the array only grows if it gets more than half full.
+*
 * @warning This class is not threadsafe.
 */
 class BufHashTbl
 {
  private:
 	/**
-	 *	Size of Hash Table
+	 *	Number of slots, a power of two
 	 */
-  int HTSIZE;
+  std::size_t HTSIZE;
+
+	/**
+	 *	Number of entries
+	 */
+  std::size_t numEntries;
+
 	/**
 	 * Actual Hash table object
 	 */
-  hashBucket**  ht;
+  hashBucket*  ht;
 
 	/**
 	 * returns hash value between 0 and HTSIZE-1 computed using file and pageNo
@@ -61,11 +70,32 @@ class BufHashTbl
 	 * @param pageNo  Page number in the file
 	 * @return  			Hash value.
 	 */
-  int	 hash(const File* file, const PageId pageNo);
+  std::size_t hash(const File* file, const PageId pageNo) const;
+
+	/**
+	 * Slot holding (file, pageNo), or the empty slot ending its probe run if there is none.
+	 */
+  std::size_t probe(const File* file, const PageId pageNo) const;
+
+	/**
+	 * Double the number of slots and insert every entry again.
+	 */
+  void grow();
 
  public:
 	/**
+	 * 64 bit hash of file and pageNo. The table uses its low bits, so callers that spread pages over several
+	 * tables should pick the table with the high bits.
+	 *
+	 * @param file   	File object
+	 * @param pageNo  Page number in the file
+	 */
+  static std::uint64_t mix(const File* file, const PageId pageNo);
+
+	/**
    * Constructor of BufHashTbl class
+	 *
+	 * @param htSize  Number of entries the table is expected to hold
 	 */
 	BufHashTbl(const int htSize);  // constructor
 
@@ -73,7 +103,7 @@ class BufHashTbl
    * Destructor of BufHashTbl class
 	 */
   ~BufHashTbl(); // destructor
-	
+
 	/**
    * Insert entry into hash table mapping (file, pageNo) to frameNo.
 	 *
@@ -81,29 +111,44 @@ class BufHashTbl
 	 * @param pageNo 	Page number in the file
 	 * @param frameNo Frame number assigned to that page of the file
    * @throws  HashAlreadyPresentException	if the corresponding page already exists in the hash table
-   * @throws  HashTableException (optional) if could not create a new bucket as running of memory
 	 */
   void insert(const File* file, const PageId pageNo, const FrameId frameNo);
 
 	/**
    * Check if (file, pageNo) is currently in the buffer pool (ie. in
+   * the hash table). Misses are the common case on a buffer miss, so they are reported without an exception.
+	 *
+	 * @param file  	File object
+	 * @param pageNo	Page number in the file
+	 * @param frameNo Frame number reference, set if the page is found
+	 * @return				True if the page is in the hash table.
+	 */
+  bool find(const File* file, const PageId pageNo, FrameId &frameNo) const;
+
+	/**
+   * Check if (file, pageNo) is currently in the buffer pool (ie. in
    * the hash table).
 	 *
 	 * @param file  	File object
 	 * @param pageNo	Page number in the file
 	 * @param frameNo Frame number reference
-   * @throws HashNotFoundException if the page entry is not found in the hash table 
+   * @throws HashNotFoundException if the page entry is not found in the hash table
 	 */
-  void lookup(const File* file, const PageId pageNo, FrameId &frameNo);
+  void lookup(const File* file, const PageId pageNo, FrameId &frameNo) const;
 
 	/**
    * Delete entry (file,pageNo) from hash table.
 	 *
 	 * @param file   	File object
 	 * @param pageNo  Page number in the file
-   * @throws HashNotFoundException if the page entry is not found in the hash table 
+   * @throws HashNotFoundException if the page entry is not found in the hash table
+	 */
+  void remove(const File* file, const PageId pageNo);
+
+	/**
+   * Number of entries in the hash table.
 	 */
-  void remove(const File* file, const PageId pageNo);  
+  std::size_t size() const { return numEntries; }
 };
 
 }
@@ -5,160 +5,657 @@
  * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
  */
 
+#include <algorithm>
+#include <chrono>
+#include <exception>
 #include <memory>
 #include <iostream>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
 #include "buffer.h"
 #include "exceptions/buffer_exceeded_exception.h"
 #include "exceptions/page_not_pinned_exception.h"
 #include "exceptions/page_pinned_exception.h"
 #include "exceptions/bad_buffer_exception.h"
-#include "exceptions/hash_not_found_exception.h"
+#include "exceptions/hash_already_present_exception.h"
+#include "exceptions/invalid_page_size_exception.h"
+#include "exceptions/log_io_exception.h"
 
 namespace badgerdb { 
 
+const std::size_t BufMgr::POOLALIGN;
+const PageId BufMgr::MINREADAHEAD;
+
 //----------------------------------------
 // Constructor of the class BufMgr
 //----------------------------------------
 
-BufMgr::BufMgr(std::uint32_t bufs)
-	: numBufs(bufs) {
-	bufDescTable = new BufDesc[bufs];
+BufMgr::BufMgr(std::uint32_t bufs, const std::size_t frameSize, const ReplacementPolicyKind policyKind,
+               const HugePageMode hugePages, const std::uint32_t maxFrames)
+	: numBufs(bufs),
+	  maxBufs(maxFrames != 0 ? std::max(bufs, maxFrames) : hugePages == EXPLICIT_HUGE_PAGES ? bufs :
+	          (std::uint32_t)std::min<std::uint64_t>((std::uint64_t)bufs * GROWTHFACTOR,
+	                                                  std::numeric_limits<std::uint32_t>::max())),
+	  frameSize(frameSize), wal(NULL), writerRunning(false), writerStop(false),
+	  prefetchRunning(false), prefetchStop(false), prefetchFile(NULL), prefetchQueued(0),
+	  maxPrefetchQueued(std::max<std::uint32_t>(bufs / 4, 1)), maxReadAhead(std::min<PageId>(32, bufs / 8)) {
+	if (!Page::isValidSize(frameSize)) {
+		throw InvalidPageSizeException(frameSize, "buffer pool");
+	}
+
+	bufDescTable = new BufDesc[maxBufs];
 
-  for (FrameId i = 0; i < bufs; i++) 
+  for (FrameId i = 0; i < maxBufs; i++) 
   {
   	bufDescTable[i].frameNo = i;
   	bufDescTable[i].valid = false;
   }
 
-  bufPool = new Page[bufs];
+  mapPool((std::size_t)maxBufs * frameSize, hugePages);
 
   int htsize = ((((int) (bufs * 1.2))*2)/2)+1;
-  hashTable = new BufHashTbl (htsize);  // allocate the buffer hash table
+  shards = new PageTableShard[NUMSHARDS];
+  for (int i = 0; i < NUMSHARDS; i++)
+  {
+    shards[i].table = new BufHashTbl (htsize / NUMSHARDS + 1);  // allocate the buffer hash tables
+  }
 
-  clockHand = bufs - 1;
+  policy = ReplacementPolicy::create(policyKind, maxBufs);
+  if (bufs < maxBufs)
+    policy->resize(bufs);
 }
 
 
 BufMgr::~BufMgr() {
-  //Flush out all unwritten pages
+  stopPrefetcher();
+  stopWriter();
+
+  // With a log, leave nothing behind in it that a later recovery could replay over newer writes
+  if (wal != NULL)
+  {
+    commit();
+    checkpoint();
+  }
+
+  //Flush out all unwritten pages. A failed sync can not be reported from here.
+  std::vector<FrameId> frames;
   for (std::uint32_t i = 0; i < numBufs; i++) 
   {
-  	BufDesc* tmpbuf = &bufDescTable[i];
-  	if (tmpbuf->valid == true && tmpbuf->dirty == true)
-		{
-			tmpbuf->file->writePage(tmpbuf->pageNo, bufPool[i]);
-  	}
+  	if (bufDescTable[i].valid == true)
+      frames.push_back(i);
   }
+  writeSorted(frames);
 
+  for (int i = 0; i < NUMSHARDS; i++)
+  {
+    delete shards[i].table;
+  }
+  delete [] shards;
+  delete policy;
   delete [] bufDescTable;
-  delete [] bufPool;
+  munmap(bufPool, poolBytes);
 }
 
-void BufMgr::allocBuf(FrameId & frame) 
+void BufMgr::mapPool(const std::size_t bytes, const HugePageMode mode)
 {
-  // perform first part of clock algorithm to search for 
-  // open buffer frame
-  // Assumes non-concurrent access to buffer manager
-  std::uint32_t numScanned = 0;
-  bool found = 0;
+  poolBytes = std::max<std::size_t>((bytes + POOLALIGN - 1) / POOLALIGN * POOLALIGN, POOLALIGN);
+  poolPages = mode;
 
-  while (numScanned < 2*numBufs)	//Need to scn twice
+#ifdef MAP_HUGETLB
+  if (mode == EXPLICIT_HUGE_PAGES)
   {
-    // advance the clock
-    advanceClock();
-    numScanned++;
-
-    // if invalid, use frame
-    if (! bufDescTable[clockHand].valid)
+    // Huge pages are aligned to their size. They are reserved for the whole mapping, a fault on a huge page
+    // that is not there would kill the process.
+    void* memory = mmap(NULL, poolBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (memory != MAP_FAILED)
     {
-      break;
+      bufPool = static_cast<char*>(memory);
+      return;
     }
+  }
+#endif
+  if (mode == EXPLICIT_HUGE_PAGES)
+    poolPages = TRANSPARENT_HUGE_PAGES;
 
-    // is valid, check referenced bit
-    if (! bufDescTable[clockHand].refbit)
-    {
-      // check to see if someone has it pinned
-      if (bufDescTable[clockHand].pinCnt == 0)
-      {
-        // hasn't been referenced and is not pinned, use it
-        // remove previous entry from hash table
-        hashTable->remove(bufDescTable[clockHand].file, bufDescTable[clockHand].pageNo);
-        found = true;
-        break;
-      }
-    }
-    else
+  // Map an extra huge page and unmap what lies outside the aligned range
+  void* memory = mmap(NULL, poolBytes + POOLALIGN, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                      -1, 0);
+  if (memory == MAP_FAILED)
+    throw std::bad_alloc();
+  char* start = static_cast<char*>(memory);
+  char* aligned = start + (POOLALIGN - (std::uintptr_t)start % POOLALIGN) % POOLALIGN;
+  if (aligned > start)
+    munmap(start, aligned - start);
+  munmap(aligned + poolBytes, start + POOLALIGN - aligned);
+  bufPool = aligned;
+
+#ifdef MADV_HUGEPAGE
+  if (poolPages == TRANSPARENT_HUGE_PAGES && madvise(bufPool, poolBytes, MADV_HUGEPAGE) != 0)
+    poolPages = NORMAL_PAGES;
+#else
+  poolPages = NORMAL_PAGES;
+#endif
+}
+
+bool BufMgr::evictFrame(const FrameId frameNo)
+{
+  BufDesc* tmpbuf = &bufDescTable[frameNo];
+  // if invalid, use frame
+  if (!tmpbuf->valid)
+    return true;
+
+  // check to see if someone has it pinned, or changed it without committing yet. Pages allocated
+  // by the running operation are not referenced by committed pages, so they may go.
+  if (tmpbuf->pinCnt > 0 || tmpbuf->ioPending || (tmpbuf->uncommitted && !tmpbuf->fresh))
+    return false;
+
+  // Pins are only taken under the shard latch, so check again under it. A clean page leaves the hash table
+  // before anyone can pin it. A dirty one stays there until it is written, with its frame ioPending, so nobody
+  // pins it or reads the old contents from disk meanwhile. A frame that is ioPending already has I/O of its own
+  // under way; only the ioPending set here tells takeFrame() that the page is left to be written.
+  PageTableShard& shard = shardOf(tmpbuf->file, tmpbuf->pageNo);
+  std::lock_guard<std::mutex> guard(shard.latch);
+  if (tmpbuf->pinCnt > 0 || tmpbuf->ioPending)
+    return false;
+  if (tmpbuf->dirty)
+    tmpbuf->ioPending = true;
+  else
+    shard.table->remove(tmpbuf->file, tmpbuf->pageNo);
+  return true;
+}
+
+bool BufMgr::moveFrame(const FrameId from, const FrameId to)
+{
+  BufDesc* tmpbuf = &bufDescTable[from];
+  BufDesc* target = &bufDescTable[to];
+  {
+    // Pins are only taken under the shard latch, so nobody reaches the page while it moves
+    PageTableShard& shard = shardOf(tmpbuf->file, tmpbuf->pageNo);
+    std::lock_guard<std::mutex> guard(shard.latch);
+    if (tmpbuf->pinCnt > 0)
+      return false;
+    std::memcpy(bufPool + (std::size_t)to * frameSize, bufPool + (std::size_t)from * frameSize, tmpbuf->file->pageSize());
+    target->Set(tmpbuf->file, tmpbuf->pageNo);
+    target->pinCnt = 0;
+    target->dirty = tmpbuf->dirty.load();
+    target->uncommitted = tmpbuf->uncommitted;
+    target->fresh = tmpbuf->fresh;
+    target->logGroup = tmpbuf->logGroup;
+    target->readAheadMark = tmpbuf->readAheadMark.load();
+    shard.table->remove(tmpbuf->file, tmpbuf->pageNo);
+    shard.table->insert(tmpbuf->file, tmpbuf->pageNo, to);
+    tmpbuf->Clear();
+  }
+
+  // the policy is told without the shard latch
+  policy->moved(from, to);
+  if (target->uncommitted)
+    std::replace(uncommittedFrames.begin(), uncommittedFrames.end(), from, to);
+  return true;
+}
+
+void BufMgr::sortByPage(std::vector<FrameId>& frames)
+{
+  std::sort(frames.begin(), frames.end(), [this](const FrameId a, const FrameId b)
+  {
+    const BufDesc & x = bufDescTable[a];
+    const BufDesc & y = bufDescTable[b];
+    return x.file != y.file ? x.file < y.file : x.pageNo < y.pageNo;
+  });
+}
+
+bool BufMgr::writeSorted(const std::vector<FrameId>& frames)
+{
+  std::vector<FrameId> dirtyFrames;
+  for (std::size_t i = 0; i < frames.size(); i++)
+  {
+    if (bufDescTable[frames[i]].dirty)
+      dirtyFrames.push_back(frames[i]);
+  }
+  sortByPage(dirtyFrames);
+
+  std::set<std::string> files;
+  std::vector<const Page*> run;
+  for (std::size_t i = 0; i < dirtyFrames.size(); )
+  {
+    BufDesc* first = &bufDescTable[dirtyFrames[i]];
+    run.clear();
+    std::size_t end = i;
+    while (end < dirtyFrames.size() && run.size() < MAXWRITERUN && bufDescTable[dirtyFrames[end]].file == first->file &&
+           bufDescTable[dirtyFrames[end]].pageNo == first->pageNo + run.size())
     {
-      // has been referenced, clear the bit
-      bufStats.accesses++;
-      bufDescTable[clockHand].refbit = false;
+      run.push_back(framePage(dirtyFrames[end]));
+      end++;
     }
+    first->file->writePages(first->pageNo, run);
+    for (; i < end; i++)
+      bufDescTable[dirtyFrames[i]].dirty = false;
+    files.insert(first->file->filename());
   }
-  
-  // check for full buffer pool
-  if (!found && numScanned >= 2*numBufs)
+
+  bool synced = true;
+  for (std::set<std::string>::iterator it = files.begin(); it != files.end(); ++it)
+    synced = File::sync(*it) && synced;
+  return synced;
+}
+
+void BufMgr::allocBuf(FrameId & frame, const File* file, const PageId pageNo, EvictedPage& evicted)
+{
+  // Called with the pool latch held, readPage() hits and unPinPage() may run at the same time
+  FrameId frameNo = 0;
+  if (!policy->pickVictim(file, pageNo, [this](const FrameId victim) { return evictFrame(victim); }, frameNo))
   {
     throw BufferExceededException();
   }
-  
-  // flush any existing changes to disk if necessary
-  if (bufDescTable[clockHand].dirty)
+
+  // a dirty page in the frame is written by the caller once the pool latch is released
+  takeFrame(frameNo, evicted);
+
+  // return new frame number
+  frame = frameNo;
+} // end allocBuf
+
+void BufMgr::takeFrame(const FrameId frameNo, EvictedPage& evicted)
+{
+  BufDesc* tmpbuf = &bufDescTable[frameNo];
+  evicted.file = NULL;
+  if (tmpbuf->valid && tmpbuf->ioPending)
   {
+    // evictFrame() left the dirty page in the page table; log it now, and have the background writer catch up
+    tmpbuf->dirty = false;
     bufStats.diskwrites++;
-    //status = bufDescTable[clockHand].file->writePage(bufDescTable[clockHand].pageNo,
-    bufDescTable[clockHand].file->writePage(bufDescTable[clockHand].pageNo, bufPool[clockHand]);
+    evicted.file = tmpbuf->file;
+    evicted.pageNo = tmpbuf->pageNo;
+    evicted.logGroup = logForWrite(frameNo);
+    {
+      std::lock_guard<std::mutex> guard(ioLatch);
+      filesWriting.insert(evicted.file);
+    }
+    if (writerRunning)
+      writerWake.notify_one();
   }
 
 	//Reset all the BufDesc entry for the frame before returning the frame
-  bufDescTable[clockHand].Clear();
+  tmpbuf->Clear();
+}
 
-  // return new frame number
-  frame = clockHand;
-} // end allocBuf
+void BufMgr::writeEvicted(const FrameId frameNo, const EvictedPage& evicted)
+{
+  if (evicted.file == NULL)
+    return;
+  std::exception_ptr error;
+  try
+  {
+    writeLogged(evicted.file, evicted.pageNo, *framePage(frameNo), evicted.logGroup);
+  }
+  catch (...)
+  {
+    error = std::current_exception();
+  }
+
+  // the page can be read from disk again; threads waiting for it look again once the frame is filled
+  {
+    PageTableShard& shard = shardOf(evicted.file, evicted.pageNo);
+    std::lock_guard<std::mutex> shardGuard(shard.latch);
+    shard.table->remove(evicted.file, evicted.pageNo);
+  }
+  {
+    std::lock_guard<std::mutex> guard(ioLatch);
+    filesWriting.erase(filesWriting.find(evicted.file));
+  }
+  ioDone.notify_all();
+  if (error)
+    std::rethrow_exception(error);
+}
+
+void BufMgr::endIo(const FrameId frameNo)
+{
+  {
+    std::lock_guard<std::mutex> guard(ioLatch);
+    bufDescTable[frameNo].ioPending = false;
+  }
+  ioDone.notify_all();
+}
+
+void BufMgr::unpinEndIo(const FrameId frameNo)
+{
+  BufDesc* tmpbuf = &bufDescTable[frameNo];
+  {
+    PageTableShard& shard = shardOf(tmpbuf->file, tmpbuf->pageNo);
+    std::lock_guard<std::mutex> shardGuard(shard.latch);
+    std::lock_guard<std::mutex> guard(ioLatch);
+    tmpbuf->pinCnt = 0;
+    tmpbuf->ioPending = false;
+  }
+  ioDone.notify_all();
+}
+
+void BufMgr::waitForIo(const FrameId frameNo)
+{
+  std::unique_lock<std::mutex> guard(ioLatch);
+  while (bufDescTable[frameNo].ioPending)
+    ioDone.wait(guard);
+}
+
+void BufMgr::waitForWrites(const File* file)
+{
+  std::unique_lock<std::mutex> guard(ioLatch);
+  while (file == NULL ? !filesWriting.empty() : filesWriting.count(file) > 0)
+    ioDone.wait(guard);
+}
+
+void BufMgr::allocRingBuf(FrameId & frame, const File* file, const PageId pageNo, BufferRing & ring,
+                          EvictedPage& evicted)
+{
+  if (ring.slots.size() < ring.numFrames)
+  {
+    // The ring is still filling up. The page is read once, so a ghost of it must not make it look hot.
+    allocBuf(frame, file, Page::INVALID_NUMBER, evicted);
+    FrameSlot slot = {frame, file, pageNo};
+    ring.slots.push_back(slot);
+    return;
+  }
+
+  FrameSlot & slot = ring.slots[ring.next];
+  ring.next = (ring.next + 1) % ring.numFrames;
+  BufDesc* tmpbuf = &bufDescTable[slot.frameNo];
+
+  // Recycle the frame only if it still holds the page the ring read into it; the policy may have
+  // given it to another page since
+  if (tmpbuf->valid && tmpbuf->file == slot.file && tmpbuf->pageNo == slot.pageNo && evictFrame(slot.frameNo))
+  {
+    takeFrame(slot.frameNo, evicted);
+    frame = slot.frameNo;
+  }
+  else
+  {
+    allocBuf(frame, file, Page::INVALID_NUMBER, evicted);
+    slot.frameNo = frame;
+  }
+  slot.file = file;
+  slot.pageNo = pageNo;
+}
+
+void BufMgr::writeFrame(const FrameId frameNo)
+{
+  BufDesc* tmpbuf = &bufDescTable[frameNo];
+  writeLogged(tmpbuf->file, tmpbuf->pageNo, *framePage(frameNo), logForWrite(frameNo));
+}
+
+std::uint64_t BufMgr::logForWrite(const FrameId frameNo)
+{
+  BufDesc* tmpbuf = &bufDescTable[frameNo];
+  if (wal == NULL)
+    return 0;
+  std::lock_guard<std::mutex> guard(logLatch);
+  if (tmpbuf->uncommitted)
+  {
+    // A page allocated by the running operation is about to leave the pool, so log it now
+    tmpbuf->logGroup = wal->logPage(*tmpbuf->file, tmpbuf->pageNo, *framePage(frameNo));
+    tmpbuf->uncommitted = false;
+  }
+  unsyncedFiles.insert(tmpbuf->file->filename());
+  return tmpbuf->logGroup;
+}
+
+void BufMgr::writeLogged(File* file, const PageId pageNo, const Page& page, const std::uint64_t logGroup)
+{
+  if (logGroup != 0)
+  {
+    // Write-ahead rule: the image has to be in the log on disk before the page is overwritten
+    std::lock_guard<std::mutex> guard(logLatch);
+    if (!wal->isDurable(logGroup))
+      wal->flush();
+  }
+  file->writePage(pageNo, page);
+}
+
+void BufMgr::markUncommitted(const FrameId frameNo)
+{
+  if (!bufDescTable[frameNo].uncommitted)
+  {
+    bufDescTable[frameNo].uncommitted = true;
+    uncommittedFrames.push_back(frameNo);
+  }
+}
+
+void BufMgr::checkPageSize(const File* file) const
+{
+  if (file->pageSize() > frameSize)
+  {
+    throw InvalidPageSizeException(file->pageSize(), file->filename());
+  }
+}
 
 	
-void BufMgr::readPage(File* file, const PageId pageNo, Page*& page)
+bool BufMgr::pinResident(File* file, const PageId pageNo, FrameId& frameNo, const bool touch)
+{
+  PageTableShard& shard = shardOf(file, pageNo);
+  while (true)
+  {
+    {
+      std::lock_guard<std::mutex> guard(shard.latch);
+	    if (!shard.table->find(file, pageNo, frameNo))
+        return false;
+      if (!bufDescTable[frameNo].ioPending)
+      {
+        bufDescTable[frameNo].pinCnt++;
+        break;
+      }
+    }
+    // the page is on its way into or out of the frame, wait for the frame and look again
+    waitForIo(frameNo);
+  }
+
+  // the page is pinned, so it stays in the frame while the policy takes note without the shard latch
+  if (touch)
+    policy->accessed(frameNo);
+  return true;
+}
+
+void BufMgr::insertFrame(File* file, const PageId pageNo, const FrameId frameNo)
+{
+  std::exception_ptr error;
+  {
+    PageTableShard& shard = shardOf(file, pageNo);
+    std::lock_guard<std::mutex> shardGuard(shard.latch);
+    try
+    {
+      shard.table->insert(file, pageNo, frameNo);
+      return;
+    }
+    catch (...)
+    {
+      // nobody can reach the frame, so it is emptied without writing what was put in it
+      bufDescTable[frameNo].Clear();
+      error = std::current_exception();
+    }
+  }
+  // the policy is told without the shard latch
+  policy->freed(frameNo);
+  std::rethrow_exception(error);
+}
+
+void BufMgr::readPage(File* file, const PageId pageNo, Page*& page, BufferRing* ring)
 {
-  // check to see if it is already in the buffer pool
+  bufStats.accesses++;
+  // check to see if it is already in the buffer pool, which only needs the shard latch
   // std::cout << "readPage called on file.page " << file << "." << pageNo << endl;
   FrameId frameNo = 0;
-	try
-	{
-  	hashTable->lookup(file, pageNo, frameNo);
+	while (!pinResident(file, pageNo, frameNo, ring == NULL))
+  {
+    //not in the buffer pool, reserve a frame for the page under the pool latch
+    EvictedPage evicted;
+    {
+      std::lock_guard<std::recursive_mutex> guard(latch);
+      // another thread may have started to read it in while we waited for the pool latch
+      {
+        PageTableShard& shard = shardOf(file, pageNo);
+        std::lock_guard<std::mutex> shardGuard(shard.latch);
+        if (shard.table->find(file, pageNo, frameNo))
+          continue;
+      }
+
+      checkPageSize(file);
 
-    // set the referenced bit
-    bufDescTable[frameNo].refbit = true;
-    bufDescTable[frameNo].pinCnt++;
-    page = &bufPool[frameNo];
+      // alloc a new frame
+      if (ring != NULL)
+        allocRingBuf(frameNo, file, pageNo, *ring, evicted);
+      else
+        allocBuf(frameNo, file, pageNo, evicted);
+
+      // set up the entry properly, pinned for us and ioPending, and insert it in the hash table. The policy has
+      // to know the page before anyone else can find it.
+      bufDescTable[frameNo].Set(file, pageNo);
+      bufDescTable[frameNo].ioPending = true;
+      policy->loaded(frameNo, file, pageNo, ring != NULL);
+      insertFrame(file, pageNo, frameNo);
+      readAhead(file, pageNo, false);
+    }
+
+    // write the page evicted from the frame and read ours in, threads asking for it wait for the frame
+    loadFrame(file, pageNo, frameNo, evicted);
+    page = framePage(frameNo);
+    return;
   }
-  catch(HashNotFoundException e) //not in the buffer pool, must allocate a new page
-  {
-    // alloc a new frame
-    allocBuf(frameNo);
 
-    // read the page into the new frame
+  // the reader got to a window read ahead, time to read the one after it
+  if (bufDescTable[frameNo].readAheadMark.load() && bufDescTable[frameNo].readAheadMark.exchange(false))
+    readAhead(file, pageNo, true);
+  page = framePage(frameNo);
+}
+
+void BufMgr::loadFrame(File* file, const PageId pageNo, const FrameId frameNo, const EvictedPage& evicted)
+{
+  try
+  {
+    writeEvicted(frameNo, evicted);
     bufStats.diskreads++;
-    //status = file->readPage(pageNo, &bufPool[frameNo]);
-    bufPool[frameNo] = file->readPage(pageNo);
+    file->readPage(pageNo, *framePage(frameNo));
+  }
+  catch (...)
+  {
+    abandonFrame(file, pageNo, frameNo);
+    throw;
+  }
+  endIo(frameNo);
+}
 
-    // set up the entry properly
-    bufDescTable[frameNo].Set(file, pageNo);
-    page = &bufPool[frameNo];
+void BufMgr::abandonFrame(File* file, const PageId pageNo, const FrameId frameNo)
+{
+  {
+    PageTableShard& shard = shardOf(file, pageNo);
+    std::lock_guard<std::mutex> shardGuard(shard.latch);
+    shard.table->remove(file, pageNo);
+  }
+  endIo(frameNo);
+
+  // the frame stays pinned, so nobody takes it before it is handed back to the policy
+  std::lock_guard<std::recursive_mutex> guard(latch);
+  bufDescTable[frameNo].Clear();
+  policy->freed(frameNo);
+}
 
-    // insert in the hash table
-    hashTable->insert(file, pageNo, frameNo);
+
+void BufMgr::readPage(File* file, const PageId pageNo, PageHandle& handle, BufferRing* ring)
+{
+  Page* page;
+  readPage(file, pageNo, page, ring);
+  attachHandle(handle, page);
+}
+
+void BufMgr::allocPage(File* file, PageId &pageNo, PageHandle& handle)
+{
+  Page* page;
+  allocPage(file, pageNo, page);
+  attachHandle(handle, page);
+}
+
+void BufMgr::attachHandle(PageHandle& handle, Page* page)
+{
+  handle.release();
+  handle.pool = this;
+  handle.frameNo = (FrameId)(((char*)page - bufPool) / frameSize);
+  handle.framePage = page;
+  handle.pageNum = bufDescTable[handle.frameNo].pageNo;
+  handle.dirty = false;
+}
+
+void BufMgr::unPinFrame(const FrameId frameNo, const bool dirty)
+{
+  // a page dirtied under a log is recorded under the pool latch, otherwise the shard latch is enough
+  std::unique_lock<std::recursive_mutex> guard(latch, std::defer_lock);
+  if (dirty == true && wal != NULL)
+    guard.lock();
+  // the page is pinned, so the frame keeps it and names its shard
+  BufDesc* tmpbuf = &bufDescTable[frameNo];
+  PageTableShard& shard = shardOf(tmpbuf->file, tmpbuf->pageNo);
+  std::lock_guard<std::mutex> shardGuard(shard.latch);
+
+  if (dirty == true)
+  {
+    tmpbuf->dirty = dirty;
+    if (wal != NULL) markUncommitted(frameNo);
+  }
+
+  if (tmpbuf->pinCnt == 0)
+  {
+  	throw PageNotPinnedException(tmpbuf->file->filename(), tmpbuf->pageNo, frameNo);
+  }
+  else tmpbuf->pinCnt--;
+}
+
+PageHandle::PageHandle(PageHandle&& other)
+	: pool(other.pool), frameNo(other.frameNo), framePage(other.framePage), pageNum(other.pageNum), dirty(other.dirty)
+{
+  other.pool = NULL;
+}
+
+PageHandle& PageHandle::operator=(PageHandle&& other)
+{
+  if (this != &other)
+  {
+    release();
+    pool = other.pool;
+    frameNo = other.frameNo;
+    framePage = other.framePage;
+    pageNum = other.pageNum;
+    dirty = other.dirty;
+    other.pool = NULL;
   }
+  return *this;
 }
 
+void PageHandle::release()
+{
+  if (pool == NULL)
+    return;
+  BufMgr* holder = pool;
+  pool = NULL;
+  holder->unPinFrame(frameNo, dirty);
+}
 
 void BufMgr::unPinPage(File* file, const PageId pageNo, 
 			     const bool dirty) 
 {
+  // a page dirtied under a log is recorded under the pool latch, otherwise the shard latch is enough
+  std::unique_lock<std::recursive_mutex> guard(latch, std::defer_lock);
+  if (dirty == true && wal != NULL)
+    guard.lock();
+  PageTableShard& shard = shardOf(file, pageNo);
+  std::lock_guard<std::mutex> shardGuard(shard.latch);
   // lookup in hashtable
   FrameId frameNo = 0;
-  hashTable->lookup(file, pageNo, frameNo);
+  shard.table->lookup(file, pageNo, frameNo);
 
-  if (dirty == true) bufDescTable[frameNo].dirty = dirty;
+  if (dirty == true)
+  {
+    bufDescTable[frameNo].dirty = dirty;
+    if (wal != NULL) markUncommitted(frameNo);
+  }
 
   // make sure the page is actually pinned
   if (bufDescTable[frameNo].pinCnt == 0)
@@ -170,40 +667,202 @@ void BufMgr::unPinPage(File* file, const PageId pageNo,
 
 void BufMgr::flushFile(const File* file) 
 {
-  for (std::uint32_t i = 0; i < numBufs; i++)
+  std::unique_lock<std::recursive_mutex> guard(latch);
+  if (wal != NULL)
+  {
+    commit();
+    checkpoint();
+  }
+
+  // Drop the file's pages waiting for the prefetcher. The one it may be loading is waited for without the pool
+  // latch, which the prefetcher needs; no page of the file is on its way in after that.
+  {
+    std::lock_guard<std::mutex> prefetchGuard(prefetchMutex);
+    for (std::deque<PrefetchRequest>::iterator it = prefetchQueue.begin(); it != prefetchQueue.end(); )
+    {
+      if (it->file == file)
+      {
+        prefetchQueued -= it->end - it->next;
+        it = prefetchQueue.erase(it);
+      }
+      else
+        ++it;
+    }
+    readAheads.erase(file);
+    if (prefetchQueue.empty())
+      prefetchIdle.notify_all();
+  }
+  guard.unlock();
+  {
+    std::unique_lock<std::mutex> prefetchGuard(prefetchMutex);
+    while (prefetchFile == file)
+      prefetchIdle.wait(prefetchGuard);
+  }
+  guard.lock();
+
+  // pages of the file evicted by misses are written without the pool latch, let them get to the file first
+  waitForWrites(file);
+
+  // Hold the file's pages, up to a pinned page or a bad frame. They stay in the page table while they are
+  // written without the pool latch, and threads asking for one of them wait until it is gone.
+  std::vector<FrameId> frames;
+  std::exception_ptr failure;
+  for (std::uint32_t i = 0; i < numBufs && !failure; i++)
 	{
   	BufDesc* tmpbuf = &(bufDescTable[i]);
   	if(tmpbuf->valid == true && tmpbuf->file == file)
 		{
+	    PageTableShard& shard = shardOf(file, tmpbuf->pageNo);
+	    std::lock_guard<std::mutex> shardGuard(shard.latch);
 	    if (tmpbuf->pinCnt > 0)
-  			throw PagePinnedException(file->filename(), tmpbuf->pageNo, tmpbuf->frameNo);
-
-	    if (tmpbuf->dirty == true)
-			{
-				//if ((status = tmpbuf->file->writePage(tmpbuf->pageNo, &(bufPool[i]))) != OK)
-				tmpbuf->file->writePage(tmpbuf->pageNo, bufPool[i]);
-				tmpbuf->dirty = false;
-    	}
-
-    	hashTable->remove(file,tmpbuf->pageNo);
-    	tmpbuf->Clear();
+  			failure = std::make_exception_ptr(PagePinnedException(file->filename(), tmpbuf->pageNo, tmpbuf->frameNo));
+	    else
+	    {
+    	  tmpbuf->pinCnt = 1;
+    	  tmpbuf->ioPending = true;
+    	  frames.push_back(i);
+	    }
   	}
 		else if (tmpbuf->valid == false && tmpbuf->file == file)
-  		throw BadBufferException(tmpbuf->frameNo, tmpbuf->dirty, tmpbuf->valid, tmpbuf->refbit);
+  		failure = std::make_exception_ptr(BadBufferException(tmpbuf->frameNo, tmpbuf->dirty, tmpbuf->valid, false));
+  }
+  guard.unlock();
+
+  // write the dirty ones in page order, then take the frames out of the page table
+  bool synced = true;
+  std::exception_ptr error;
+  try
+  {
+    synced = writeSorted(frames);
+  }
+  catch (...)
+  {
+    error = std::current_exception();
   }
+  for (std::size_t i = 0; i < frames.size(); i++)
+	{
+    const PageId pageNo = bufDescTable[frames[i]].pageNo;
+    {
+      PageTableShard& shard = shardOf(file, pageNo);
+      std::lock_guard<std::mutex> shardGuard(shard.latch);
+      shard.table->remove(file, pageNo);
+    }
+    endIo(frames[i]);
+  }
+
+  // the frames stay pinned, so nobody takes them before they are handed back to the policy
+  guard.lock();
+  for (std::size_t i = 0; i < frames.size(); i++)
+	{
+    bufDescTable[frames[i]].Clear();
+    policy->freed(frames[i]);
+  }
+
+  if (error)
+    std::rethrow_exception(error);
+  if (failure)
+    std::rethrow_exception(failure);
+  if (!synced)
+    throw LogIOException(file->filename(), "sync");
+}
+
+std::uint32_t BufMgr::resize(std::uint32_t newFrames)
+{
+  std::lock_guard<std::recursive_mutex> guard(latch);
+  newFrames = std::max<std::uint32_t>(std::min(newFrames, maxBufs), 1);
+  const std::uint32_t oldFrames = numBufs;
+
+  // Empty frames from the end of the pool down, up to one that has to stay. Pages move to the empty frames
+  // the pool keeps while there are any, so the pages it holds are not thrown out for the ones it drops.
+  std::vector<FrameId> emptyFrames;
+  for (FrameId i = 0; i < newFrames && newFrames < oldFrames; i++)
+  {
+    if (!bufDescTable[i].valid)
+      emptyFrames.push_back(i);
+  }
+  std::uint32_t keep = oldFrames;
+  while (keep > newFrames)
+  {
+    const FrameId frameNo = keep - 1;
+    if (bufDescTable[frameNo].valid && !emptyFrames.empty() && moveFrame(frameNo, emptyFrames.back()))
+      emptyFrames.pop_back();
+    else if (!evictFrame(frameNo))
+      break;
+    keep--;
+  }
+  std::vector<FrameId> frames;
+  for (FrameId i = keep; i < oldFrames; i++)
+  {
+    if (bufDescTable[i].valid)
+      frames.push_back(i);
+  }
+
+  // write what is dirty in page order, logging it first like an eviction does
+  sortByPage(frames);
+  for (std::size_t i = 0; i < frames.size(); i++)
+  {
+    EvictedPage evicted;
+    takeFrame(frames[i], evicted);
+    writeEvicted(frames[i], evicted);
+    endIo(frames[i]);
+  }
+  for (FrameId i = keep; i < oldFrames; i++)
+  {
+    bufDescTable[i].Clear();
+    policy->freed(i);
+  }
+
+  if (newFrames > keep)
+    keep = newFrames;
+  numBufs = keep;
+  policy->resize(numBufs);
+  {
+    std::lock_guard<std::mutex> prefetchGuard(prefetchMutex);
+    maxPrefetchQueued = std::max<std::uint32_t>(numBufs / 4, 1);
+  }
+
+  // Hand the memory of the frames given up back to the system; it comes back zeroed if the pool grows again
+  if (numBufs < oldFrames)
+  {
+    const std::size_t pageSize = poolPages == EXPLICIT_HUGE_PAGES ? POOLALIGN : (std::size_t)sysconf(_SC_PAGESIZE);
+    const std::size_t start = ((std::size_t)numBufs * frameSize + pageSize - 1) / pageSize * pageSize;
+    const std::size_t end = std::min(((std::size_t)oldFrames * frameSize + pageSize - 1) / pageSize * pageSize, poolBytes);
+    if (start < end)
+      madvise(bufPool + start, end - start, MADV_DONTNEED);
+  }
+  return numBufs;
+}
+
+std::uint32_t BufMgr::getNumBufs()
+{
+  std::lock_guard<std::recursive_mutex> guard(latch);
+  return numBufs;
 }
 
 void BufMgr::disposePage(File* file, const PageId pageNo) 
 {
+  std::lock_guard<std::recursive_mutex> guard(latch);
 	//Deallocate from file altogether
   //See if it is in the buffer pool
-  FrameId frameNo = 0;
-  hashTable->lookup(file, pageNo, frameNo);
+  {
+    PageTableShard& shard = shardOf(file, pageNo);
+    std::unique_lock<std::mutex> shardGuard(shard.latch);
+    FrameId frameNo = 0;
+    // a page being written out of its frame by a miss is gone once the write is done
+    while (shard.table->find(file, pageNo, frameNo) && bufDescTable[frameNo].ioPending)
+    {
+      shardGuard.unlock();
+      waitForIo(frameNo);
+      shardGuard.lock();
+    }
+    shard.table->lookup(file, pageNo, frameNo);
 
-	// clear the page
-	bufDescTable[frameNo].Clear();
+	  // clear the page
+	  bufDescTable[frameNo].Clear();
 
-	hashTable->remove(file, pageNo);
+	  shard.table->remove(file, pageNo);
+	  policy->freed(frameNo);
+  }
 
   // deallocate it in the file	
   file->deletePage(pageNo);
@@ -213,24 +872,535 @@ void BufMgr::disposePage(File* file, const PageId pageNo)
 void BufMgr::allocPage(File* file, PageId &pageNo, Page*& page) 
 {
   FrameId frameNo;
+  EvictedPage evicted;
+  {
+    std::lock_guard<std::recursive_mutex> guard(latch);
+    checkPageSize(file);
 
-  // alloc a new frame
-  allocBuf(frameNo);
+    // alloc a new frame, held pinned and out of the page table while the file grows without the pool latch
+    allocBuf(frameNo, file, Page::INVALID_NUMBER, evicted);
+    bufDescTable[frameNo].Set(file, Page::INVALID_NUMBER);
+  }
 
-  // allocate a new page in the file
-	//std::cerr << "buffer data size:" << bufPool[frameNo].data_.length() << "\n";
-  bufPool[frameNo] = file->allocatePage(pageNo);
-  page = &bufPool[frameNo];
+  // allocate a new page in the file, it is set up straight in the frame
+  page = framePage(frameNo);
+  try
+  {
+    writeEvicted(frameNo, evicted);
+    file->allocatePage(pageNo, *page);
+  }
+  catch (...)
+  {
+    endIo(frameNo);
+    std::lock_guard<std::recursive_mutex> guard(latch);
+    bufDescTable[frameNo].Clear();
+    policy->freed(frameNo);
+    throw;
+  }
+  endIo(frameNo);
 
   // set up the entry properly
+  std::lock_guard<std::recursive_mutex> guard(latch);
   bufDescTable[frameNo].Set(file, pageNo);
+  policy->loaded(frameNo, file, pageNo, false);
+  if (wal != NULL)
+  {
+    bufDescTable[frameNo].fresh = true;
+    uncommittedFrames.push_back(frameNo);
+    allocatedFiles.insert(file);
+  }
 
   // insert in the hash table
-  hashTable->insert(file, pageNo, frameNo);
+  insertFrame(file, pageNo, frameNo);
+}
+
+void BufMgr::claimPage(File* file, const PageId pageNo, Page*& page) 
+{
+  FrameId frameNo;
+  EvictedPage evicted;
+  {
+    std::lock_guard<std::recursive_mutex> guard(latch);
+    checkPageSize(file);
+    {
+      PageTableShard& shard = shardOf(file, pageNo);
+      std::lock_guard<std::mutex> shardGuard(shard.latch);
+      if (shard.table->find(file, pageNo, frameNo))
+        throw HashAlreadyPresentException(file->filename(), pageNo, frameNo);
+    }
+
+    // alloc a new frame
+    allocBuf(frameNo, file, pageNo, evicted);
+
+    // set up the entry properly, pinned for us and ioPending until the frame is emptied, and insert it in the
+    // hash table
+    bufDescTable[frameNo].Set(file, pageNo);
+    bufDescTable[frameNo].ioPending = true;
+    policy->loaded(frameNo, file, pageNo, false);
+    insertFrame(file, pageNo, frameNo);
+  }
+
+  // the page has no contents on disk yet, start from an empty page once the evicted one is written
+  try
+  {
+    writeEvicted(frameNo, evicted);
+  }
+  catch (...)
+  {
+    abandonFrame(file, pageNo, frameNo);
+    throw;
+  }
+  page = framePage(frameNo);
+  page->initialize(file->pageSize());
+
+  // it has to be written out before the frame is reused
+  {
+    std::lock_guard<std::recursive_mutex> guard(latch);
+    bufDescTable[frameNo].dirty = true;
+    if (wal != NULL)
+    {
+      bufDescTable[frameNo].fresh = true;
+      markUncommitted(frameNo);
+    }
+  }
+  endIo(frameNo);
+}
+
+PageId BufMgr::allocateExtent(BlobFile* file, const PageId numPages)
+{
+  // the file serializes its allocations itself, the pool latch only guards the note for the log
+  const PageId firstPageNo = file->allocateExtent(numPages);
+  std::lock_guard<std::recursive_mutex> guard(latch);
+  if (wal != NULL)
+    allocatedFiles.insert(file);
+  return firstPageNo;
+}
+
+void BufMgr::attachLog(WriteAheadLog* walIn)
+{
+  std::lock_guard<std::recursive_mutex> guard(latch);
+  wal = walIn;
+}
+
+void BufMgr::commit()
+{
+  {
+    std::lock_guard<std::recursive_mutex> guard(latch);
+    if (wal == NULL)
+      return;
+    std::lock_guard<std::mutex> logGuard(logLatch);
+
+    // Log the operation's pages; from here on none of them is fresh any more
+    for (std::size_t i = 0; i < uncommittedFrames.size(); i++)
+    {
+      BufDesc* tmpbuf = &bufDescTable[uncommittedFrames[i]];
+      if (tmpbuf->valid && tmpbuf->uncommitted)
+      {
+        tmpbuf->logGroup = wal->logPage(*tmpbuf->file, tmpbuf->pageNo, *framePage(tmpbuf->frameNo));
+        tmpbuf->uncommitted = false;
+      }
+      tmpbuf->fresh = false;
+    }
+    uncommittedFrames.clear();
+
+    // The allocations are part of the operation, recovery writes these headers back with its pages
+    for (std::set<const File*>::iterator it = allocatedFiles.begin(); it != allocatedFiles.end(); ++it)
+      wal->logHeader(**it);
+    allocatedFiles.clear();
+
+    if (!wal->commit())
+      return;
+  }
+
+  // Force the group under the log latch alone, misses and hits go on meanwhile. Whatever else is in the log
+  // buffer by then belongs to operations that committed, or to fresh pages no committed page points at.
+  bool checkpointDue = false;
+  {
+    std::lock_guard<std::mutex> logGuard(logLatch);
+    wal->flush();
+    checkpointDue = wal->needsCheckpoint();
+  }
+  if (checkpointDue)
+    checkpoint();
+}
+
+void BufMgr::checkpoint()
+{
+  std::lock_guard<std::recursive_mutex> guard(latch);
+  if (wal == NULL)
+    return;
+
+  {
+    std::lock_guard<std::mutex> logGuard(logLatch);
+    wal->flush();
+  }
+  // pages evicted by misses are written without the pool latch, they have to be in their files before the sync
+  waitForWrites(NULL);
+  for (std::uint32_t i = 0; i < numBufs; i++)
+  {
+    BufDesc* tmpbuf = &bufDescTable[i];
+    // clear the dirty bit before the write, so a change unpinned meanwhile is written next time
+    if (tmpbuf->valid == true && !tmpbuf->uncommitted && tmpbuf->dirty.exchange(false))
+    {
+      bufStats.diskwrites++;
+      writeFrame(i);
+    }
+  }
+
+  for (std::set<std::string>::iterator it = unsyncedFiles.begin(); it != unsyncedFiles.end(); ++it)
+  {
+    if (!File::sync(*it))
+      throw LogIOException(*it, "sync");
+  }
+  unsyncedFiles.clear();
+  std::lock_guard<std::mutex> logGuard(logLatch);
+  wal->truncate();
+}
+
+std::uint32_t BufMgr::writeAhead(const double dirtyRatio, const std::uint32_t maxPages)
+{
+  std::vector<FrameSlot> pages;
+  {
+    std::lock_guard<std::recursive_mutex> guard(latch);
+    std::uint32_t dirtyFrames = 0;
+    for (std::uint32_t i = 0; i < numBufs; i++)
+    {
+      if (bufDescTable[i].valid && bufDescTable[i].dirty)
+        dirtyFrames++;
+    }
+    if (dirtyFrames <= dirtyRatio * numBufs)
+      return 0;
+
+    // Dirty pages among the next victims, up to maxPages of them
+    std::vector<FrameId> victims;
+    policy->nextVictims(numBufs, victims);
+    for (std::size_t i = 0; i < victims.size() && pages.size() < maxPages; i++)
+    {
+      const BufDesc* tmpbuf = &bufDescTable[victims[i]];
+      if (tmpbuf->valid && tmpbuf->dirty && tmpbuf->pinCnt == 0 && !tmpbuf->uncommitted)
+      {
+        FrameSlot page = {victims[i], tmpbuf->file, tmpbuf->pageNo};
+        pages.push_back(page);
+      }
+    }
+  }
+
+  // Write in file and page order, one page at a time, so misses get in between
+  std::sort(pages.begin(), pages.end(), [](const FrameSlot & a, const FrameSlot & b)
+  {
+    return a.file != b.file ? a.file < b.file : a.pageNo < b.pageNo;
+  });
+  std::uint32_t written = 0;
+  for (std::size_t i = 0; i < pages.size(); i++)
+  {
+    const FrameId frameNo = pages[i].frameNo;
+    BufDesc* tmpbuf = &bufDescTable[frameNo];
+    File* file = NULL;
+    std::uint64_t logGroup = 0;
+    {
+      std::lock_guard<std::recursive_mutex> guard(latch);
+      if (!tmpbuf->valid || tmpbuf->file != pages[i].file || tmpbuf->pageNo != pages[i].pageNo || tmpbuf->uncommitted)
+        continue;
+
+      // Hold the page pinned and ioPending while it is written. Nobody can pin it and change it halfway through
+      // the write, and it is not evicted; threads asking for it wait for the write.
+      {
+        PageTableShard& shard = shardOf(tmpbuf->file, tmpbuf->pageNo);
+        std::lock_guard<std::mutex> shardGuard(shard.latch);
+        if (tmpbuf->pinCnt > 0 || !tmpbuf->dirty.exchange(false))
+          continue;
+        tmpbuf->pinCnt = 1;
+        tmpbuf->ioPending = true;
+      }
+      logGroup = logForWrite(frameNo);
+      file = tmpbuf->file;
+      std::lock_guard<std::mutex> ioGuard(ioLatch);
+      filesWriting.insert(file);
+    }
+
+    // write without the pool latch, a failed write leaves the page dirty
+    std::exception_ptr error;
+    try
+    {
+      writeLogged(file, pages[i].pageNo, *framePage(frameNo), logGroup);
+      bufStats.diskwrites++;
+      bufStats.aheadwrites++;
+      written++;
+    }
+    catch (...)
+    {
+      tmpbuf->dirty = true;
+      error = std::current_exception();
+    }
+    {
+      std::lock_guard<std::mutex> ioGuard(ioLatch);
+      filesWriting.erase(filesWriting.find(file));
+    }
+    unpinEndIo(frameNo);
+    if (error)
+      std::rethrow_exception(error);
+  }
+  return written;
+}
+
+void BufMgr::startWriter(const double dirtyRatio, const std::uint32_t pagesPerRound, const std::uint32_t intervalMillis)
+{
+  stopWriter();
+  writerDirtyRatio = dirtyRatio;
+  writerPagesPerRound = pagesPerRound;
+  writerIntervalMillis = intervalMillis;
+  writerStop = false;
+  writerRunning = true;
+  writerThread = std::thread(&BufMgr::writerLoop, this);
+}
+
+void BufMgr::stopWriter()
+{
+  if (!writerRunning)
+    return;
+  {
+    std::lock_guard<std::mutex> guard(writerMutex);
+    writerStop = true;
+  }
+  writerWake.notify_one();
+  writerThread.join();
+  writerRunning = false;
+}
+
+void BufMgr::writerLoop()
+{
+  std::unique_lock<std::mutex> guard(writerMutex);
+  while (!writerStop)
+  {
+    writerWake.wait_for(guard, std::chrono::milliseconds(writerIntervalMillis));
+    if (writerStop)
+      break;
+    guard.unlock();
+    writeAhead(writerDirtyRatio, writerPagesPerRound);
+    guard.lock();
+  }
+}
+
+void BufMgr::prefetch(File* file, PageId first, PageId count)
+{
+  // pages in the pool already need no work, which spares the prefetcher a wakeup for a scan of cached pages
+  while (count > 0)
+  {
+    PageTableShard& shard = shardOf(file, first);
+    std::lock_guard<std::mutex> shardGuard(shard.latch);
+    FrameId frameNo = 0;
+    if (!shard.table->find(file, first, frameNo))
+      break;
+    first++;
+    count--;
+  }
+  if (count == 0)
+    return;
+
+  std::lock_guard<std::mutex> guard(prefetchMutex);
+  queuePrefetch(file, first, count, Page::INVALID_NUMBER);
+}
+
+void BufMgr::waitForPrefetch()
+{
+  std::unique_lock<std::mutex> guard(prefetchMutex);
+  while (!prefetchQueue.empty() || prefetchFile != NULL)
+    prefetchIdle.wait(guard);
+}
+
+void BufMgr::setReadAhead(const PageId maxPages)
+{
+  std::lock_guard<std::mutex> guard(prefetchMutex);
+  maxReadAhead = maxPages;
+  readAheads.clear();
+}
+
+PageId BufMgr::queuePrefetch(File* file, const PageId first, PageId count, const PageId markAt)
+{
+  if (prefetchQueued >= maxPrefetchQueued)
+    return 0;
+  count = std::min<PageId>(count, maxPrefetchQueued - prefetchQueued);
+  if (count == 0)
+    return 0;
+
+  PrefetchRequest request = {file, first, first + count, markAt};
+  prefetchQueue.push_back(request);
+  prefetchQueued += count;
+  if (!prefetchRunning)
+  {
+    prefetchStop = false;
+    prefetchRunning = true;
+    prefetchThread = std::thread(&BufMgr::prefetchLoop, this);
+  }
+  prefetchWake.notify_one();
+  return count;
+}
+
+void BufMgr::readAhead(File* file, const PageId pageNo, const bool markHit)
+{
+  std::lock_guard<std::mutex> guard(prefetchMutex);
+  if (maxReadAhead == 0)
+    return;
+
+  ReadAheadState& state = readAheads[file];
+  if (markHit)
+  {
+    // Keep a window ahead of the reader, growing it while the file is read on
+    if (state.window > 0 && pageNo < state.next)
+    {
+      state.window = std::min<PageId>(2 * state.window, maxReadAhead);
+      state.next += queuePrefetch(file, state.next, state.window, state.next);
+    }
+    state.last = pageNo;
+    return;
+  }
+
+  // A miss on the page after the last one, or on a page the prefetcher has not got to yet, is sequential
+  const bool sequential = state.last != Page::INVALID_NUMBER && pageNo > state.last &&
+                          pageNo <= std::max<PageId>(state.last + 1, state.next);
+  if (!sequential)
+  {
+    state.window = 0;
+    state.next = 0;
+  }
+  else if (pageNo >= state.next)
+  {
+    state.window = state.window == 0 ? std::min<PageId>(MINREADAHEAD, maxReadAhead)
+                                     : std::min<PageId>(2 * state.window, maxReadAhead);
+    state.next = pageNo + 1 + queuePrefetch(file, pageNo + 1, state.window, pageNo + 1);
+  }
+  state.last = pageNo;
+}
+
+void BufMgr::prefetchLoop()
+{
+  std::unique_lock<std::mutex> guard(prefetchMutex);
+  while (true)
+  {
+    while (!prefetchStop && prefetchQueue.empty())
+      prefetchWake.wait(guard);
+    if (prefetchStop)
+      break;
+
+    // flushFile() finds every page of its file still queued, or waits for the one being loaded
+    PrefetchRequest& request = prefetchQueue.front();
+    File* file = request.file;
+    const PageId pageNo = request.next++;
+    const bool mark = pageNo == request.markAt;
+    if (request.next == request.end)
+      prefetchQueue.pop_front();
+    prefetchQueued--;
+    prefetchFile = file;
+    guard.unlock();
+
+    prefetchPage(file, pageNo, mark);
+
+    guard.lock();
+    prefetchFile = NULL;
+    prefetchIdle.notify_all();
+  }
+}
+
+void BufMgr::prefetchPage(File* file, const PageId pageNo, const bool mark)
+{
+  // Reading past the end of a file would leave its stream failed
+  if (file->pageSize() > frameSize || pageNo >= file->numPages())
+    return;
+
+  FrameId frameNo = 0;
+  EvictedPage evicted;
+  {
+    std::lock_guard<std::recursive_mutex> guard(latch);
+    {
+      PageTableShard& shard = shardOf(file, pageNo);
+      std::lock_guard<std::mutex> shardGuard(shard.latch);
+      if (shard.table->find(file, pageNo, frameNo))
+        return;
+    }
+
+    try
+    {
+      allocBuf(frameNo, file, Page::INVALID_NUMBER, evicted);
+    }
+    catch (...)
+    {
+      return;
+    }
+
+    // reserve the frame like a miss does, threads asking for the page meanwhile wait for it
+    bufDescTable[frameNo].Set(file, pageNo);
+    bufDescTable[frameNo].ioPending = true;
+    policy->loaded(frameNo, file, pageNo, true);
+    insertFrame(file, pageNo, frameNo);
+  }
+
+  try
+  {
+    writeEvicted(frameNo, evicted);
+    file->readPage(pageNo, *framePage(frameNo));
+  }
+  catch (...)
+  {
+    // not a page of the file, such as a free one
+    abandonFrame(file, pageNo, frameNo);
+    return;
+  }
+  bufStats.diskreads++;
+  bufStats.prefetches++;
+
+  // hand the page over unpinned
+  bufDescTable[frameNo].readAheadMark = mark;
+  unpinEndIo(frameNo);
+}
+
+void BufMgr::stopPrefetcher()
+{
+  {
+    std::lock_guard<std::mutex> guard(prefetchMutex);
+    if (!prefetchRunning)
+      return;
+    prefetchStop = true;
+  }
+  prefetchWake.notify_one();
+  prefetchThread.join();
+  prefetchRunning = false;
+  prefetchQueue.clear();
+  prefetchQueued = 0;
+}
+
+void BufMgr::latchPage(File* file, const PageId pageNo, const bool exclusive)
+{
+  FrameId frameNo = 0;
+  {
+    PageTableShard& shard = shardOf(file, pageNo);
+    std::lock_guard<std::mutex> shardGuard(shard.latch);
+    shard.table->lookup(file, pageNo, frameNo);
+  }
+
+  // the page is pinned, so the frame keeps it while we wait
+  if (exclusive)
+    bufDescTable[frameNo].pageLatch.lockExclusive();
+  else
+    bufDescTable[frameNo].pageLatch.lockShared();
+}
+
+void BufMgr::unlatchPage(File* file, const PageId pageNo, const bool exclusive)
+{
+  FrameId frameNo = 0;
+  {
+    PageTableShard& shard = shardOf(file, pageNo);
+    std::lock_guard<std::mutex> shardGuard(shard.latch);
+    shard.table->lookup(file, pageNo, frameNo);
+  }
+
+  if (exclusive)
+    bufDescTable[frameNo].pageLatch.unlockExclusive();
+  else
+    bufDescTable[frameNo].pageLatch.unlockShared();
 }
 
 void BufMgr::printSelf(void) 
 {
+  std::lock_guard<std::recursive_mutex> guard(latch);
   BufDesc* tmpbuf;
 	int validFrames = 0;
   
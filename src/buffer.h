@@ -9,7 +9,18 @@
 
 #include "file.h"
 #include "bufHashTbl.h"
+#include "wal.h"
+#include "replacementPolicy.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
 
 namespace badgerdb {
 
@@ -18,6 +29,114 @@ namespace badgerdb {
 */
 class BufMgr;
 
+/**
+* @brief Reader/writer latch of a buffer pool frame. Any number of threads may hold it shared, or a single
+* thread exclusive. Waiting writers keep new readers out, so a stream of readers can not starve them.
+*/
+class PageLatch {
+
+ private:
+	/**
+   * Guards the counters below
+	 */
+  std::mutex mutex;
+
+	/**
+   * Signalled whenever the latch is released
+	 */
+  std::condition_variable released;
+
+	/**
+   * Number of threads holding the latch shared
+	 */
+  int readers;
+
+	/**
+   * Number of threads waiting for the latch exclusive
+	 */
+  int waitingWriters;
+
+	/**
+   * True if a thread holds the latch exclusive
+	 */
+  bool writer;
+
+ public:
+	/**
+   * Constructor of PageLatch class
+	 */
+  PageLatch()
+		: readers(0), waitingWriters(0), writer(false)
+	{
+  }
+
+	/**
+   * Wait until the latch can be held shared and take it
+	 */
+  void lockShared()
+	{
+		std::unique_lock<std::mutex> guard(mutex);
+		while (writer || waitingWriters > 0)
+			released.wait(guard);
+		readers++;
+  }
+
+	/**
+   * Release a shared hold of the latch
+	 */
+  void unlockShared()
+	{
+		std::lock_guard<std::mutex> guard(mutex);
+		if (--readers == 0)
+			released.notify_all();
+  }
+
+	/**
+   * Wait until no other thread holds the latch and take it exclusive
+	 */
+  void lockExclusive()
+	{
+		std::unique_lock<std::mutex> guard(mutex);
+		waitingWriters++;
+		while (writer || readers > 0)
+			released.wait(guard);
+		waitingWriters--;
+		writer = true;
+  }
+
+	/**
+   * Release an exclusive hold of the latch
+	 */
+  void unlockExclusive()
+	{
+		std::lock_guard<std::mutex> guard(mutex);
+		writer = false;
+		released.notify_all();
+  }
+};
+
+/**
+* @brief Pages of memory backing the frames of a buffer pool
+*/
+enum HugePageMode
+{
+	/**
+   * Pages of the normal size
+	 */
+  NORMAL_PAGES,
+
+	/**
+   * Normal pages the kernel is asked to merge into transparent huge pages
+	 */
+  TRANSPARENT_HUGE_PAGES,
+
+	/**
+   * Huge pages reserved by the administrator, see /proc/sys/vm/nr_hugepages
+	 */
+  EXPLICIT_HUGE_PAGES
+};
+
+
 /**
 * @brief Class for maintaining information about buffer pool frames
 */
@@ -42,14 +161,14 @@ class BufDesc {
   FrameId	frameNo;
 
 	/**
-   * Number of times this page has been pinned
+   * Number of times this page has been pinned. Only changed under the latch of the page's shard.
 	 */
-  int pinCnt;
+  std::atomic<int> pinCnt;
 
 	/**
    * True if page is dirty;  false otherwise
 	 */
-  bool dirty;
+  std::atomic<bool> dirty;
 
 	/**
    * True if page is valid
@@ -57,9 +176,33 @@ class BufDesc {
   bool valid;
 
 	/**
-   * Has this buffer frame been reference recently
+   * True if the page was dirtied since the last commit and its image is not in the log yet
+	 */
+  bool uncommitted;
+
+	/**
+   * True if the page was allocated since the last commit. No committed page points at it yet,
+   * so it may be written out before the operation commits.
 	 */
-  bool refbit;
+  bool fresh;
+
+	/**
+   * Log group holding the latest image of the page, 0 if it was never logged
+	 */
+  std::uint64_t logGroup;
+
+	/**
+   * True if the page was read ahead and a hit on it should read the next window ahead, see BufMgr::prefetch()
+	 */
+  std::atomic<bool> readAheadMark;
+
+	/**
+   * True while a page is read into the frame, or the page evicted from it is written out. Pages the page
+   * table maps to the frame can not be pinned until then, see BufMgr::pinResident(). Left alone by Clear()
+   * and Set(), cleared by BufMgr::endIo() or BufMgr::unpinEndIo(). A valid frame is only ioPending and
+   * unpinned between BufMgr::evictFrame() and BufMgr::takeFrame(), which take that as a dirty page evicted.
+	 */
+  std::atomic<bool> ioPending;
 
 	/**
    * Initialize buffer frame for a new user
@@ -70,8 +213,11 @@ class BufDesc {
 		file = NULL;
 		pageNo = Page::INVALID_NUMBER;
     dirty = false;
-    refbit = false;
 		valid = false;
+    uncommitted = false;
+    fresh = false;
+    logGroup = 0;
+    readAheadMark = false;
   };
 
 	/**
@@ -88,9 +234,17 @@ class BufDesc {
     pinCnt = 1;
     dirty = false;
     valid = true;
-    refbit = true;
+    uncommitted = false;
+    fresh = false;
+    logGroup = 0;
+    readAheadMark = false;
   }
 
+	/**
+   * Latch held by threads reading or changing the page in the frame, see BufMgr::latchPage()
+	 */
+  PageLatch pageLatch;
+
   void Print()
 	{
 		if(file != NULL)
@@ -102,9 +256,8 @@ class BufDesc {
 			std::cout << "file:NULL ";
 
 		std::cout << "valid:" << valid << " ";
-		std::cout << "pinCnt:" << pinCnt << " ";
-		std::cout << "dirty:" << dirty << " ";
-		std::cout << "refbit:" << refbit << "\n";
+		std::cout << "pinCnt:" << pinCnt.load() << " ";
+		std::cout << "dirty:" << dirty.load() << "\n";
   }
 
 	/**
@@ -112,6 +265,7 @@ class BufDesc {
 	 */
   BufDesc()
 	{
+  	ioPending = false;
   	Clear();
   }
 };
@@ -123,26 +277,40 @@ class BufDesc {
 struct BufStats
 {
 	/**
-   * Total number of accesses to buffer pool
+   * Total number of accesses to buffer pool, one per readPage() call
 	 */
-  int accesses;
+  std::atomic<int> accesses;
 
 	/**
    * Number of pages read from disk (including allocs)
 	 */
-  int diskreads;
+  std::atomic<int> diskreads;
 
 	/**
    * Number of pages written back to disk
 	 */
-  int diskwrites;
+  std::atomic<int> diskwrites;
+
+	/**
+   * Number of the pages written back that the background writer wrote ahead of their eviction
+	 */
+  std::atomic<int> aheadwrites;
+
+	/**
+   * Number of the pages read from disk that were prefetched or read ahead before they were requested
+	 */
+  std::atomic<int> prefetches;
 
 	/**
    * Clear all values 
 	 */
   void clear()
   {
-		accesses = diskreads = diskwrites = 0;
+		accesses = 0;
+		diskreads = 0;
+		diskwrites = 0;
+		aheadwrites = 0;
+		prefetches = 0;
   }
       
 	/**
@@ -155,26 +323,249 @@ struct BufStats
 };
 
 
+/**
+* @brief A frame and the page it held when the pool last looked at it
+*/
+struct FrameSlot
+{
+  FrameId frameNo;
+  const File* file;
+  PageId pageNo;
+};
+
+
+/**
+* @brief Access strategy of an operation that reads many pages once, such as a sequential scan or an index
+* build. Pages the operation misses are read into a small ring of frames that is recycled as the operation
+* moves on, instead of pushing other pages out of the pool. Pages are loaded at the cold end of the
+* replacement policy, and hits through the ring do not make a page look hot.
+*
+* A ring belongs to one operation and is used by one thread at a time.
+*/
+class BufferRing
+{
+	friend class BufMgr;
+
+ private:
+	/**
+   * Number of frames the ring recycles
+	 */
+  std::size_t numFrames;
+
+	/**
+   * Frames of the ring and the pages the ring read into them, filled up to numFrames as the operation misses pages
+	 */
+  std::vector<FrameSlot> slots;
+
+	/**
+   * Slot to recycle next once the ring is full
+	 */
+  std::size_t next;
+
+ public:
+	/**
+   * Constructor of BufferRing class
+	 *
+	 * @param numFrames   Number of frames to recycle, at least 2 so the page being read is not the one recycled
+	 */
+  BufferRing(const std::size_t numFrames = 16)
+		: numFrames(numFrames < 2 ? 2 : numFrames), next(0)
+  {
+  }
+};
+
+
+/**
+* @brief A pin of a page in a buffer pool. The handle remembers the frame, so releasing the pin needs no page table
+* lookup, and the pin is released when the handle goes out of scope, also when an exception passes. Handles can be
+* moved but not copied, so every pin has exactly one owner.
+*/
+class PageHandle
+{
+	friend class BufMgr;
+
+ private:
+	/**
+   * Pool holding the pin, NULL if the handle holds none
+	 */
+  BufMgr* pool;
+
+	/**
+   * Frame of the page and the page in it
+	 */
+  FrameId frameNo;
+  Page* framePage;
+  PageId pageNum;
+
+	/**
+   * True if the page is to be marked dirty when the pin is released
+	 */
+  bool dirty;
+
+ public:
+	/**
+   * Constructor of PageHandle class, for a handle that holds no pin yet
+	 */
+  PageHandle()
+		: pool(NULL), frameNo(0), framePage(NULL), pageNum(Page::INVALID_NUMBER), dirty(false)
+  {
+  }
+
+  PageHandle(const PageHandle&) = delete;
+  PageHandle& operator=(const PageHandle&) = delete;
+
+	/**
+   * Take over the pin of another handle, which is left holding none
+	 */
+  PageHandle(PageHandle&& other);
+  PageHandle& operator=(PageHandle&& other);
+
+	/**
+   * Destructor of PageHandle class, releases the pin
+	 */
+  ~PageHandle()
+  {
+		release();
+  }
+
+	/**
+   * True if the handle holds a pin
+	 */
+  bool valid() const
+  {
+		return pool != NULL;
+  }
+
+	/**
+   * The pinned page
+	 */
+  Page* page() const
+  {
+		return framePage;
+  }
+
+  Page* operator->() const
+  {
+		return framePage;
+  }
+
+	/**
+   * Number of the pinned page in its file
+	 */
+  PageId pageNo() const
+  {
+		return pageNum;
+  }
+
+	/**
+   * Mark the page dirty when the pin is released
+	 */
+  void markDirty()
+  {
+		dirty = true;
+  }
+
+	/**
+   * Release the pin now, the handle holds none afterwards. Does nothing if it holds none.
+	 */
+  void release();
+};
+
+
+/**
+* @brief One part of the page table of a buffer pool, with its own latch.
+*/
+struct PageTableShard
+{
+	/**
+   * Held while the table or the pin count of one of its pages is read or changed
+	 */
+  std::mutex latch;
+
+	/**
+   * Hash table mapping (File, page) to frame for the pages of this shard
+	 */
+  BufHashTbl* table;
+
+	/**
+   * Constructor of PageTableShard class
+	 */
+  PageTableShard()
+		: table(NULL)
+  {
+  }
+};
+
+
 /**
 * @brief The central class which manages the buffer pool including frame allocation and deallocation to pages in the file 
+*
+* The page table is split into shards with a latch each. readPage() of a page in the pool and unPinPage() only
+* hold the latch of the page's shard, so threads working on different pages do not wait for each other. A page
+* is only evicted under the latch of its shard once its pin count is zero, so a pinned page stays put. Misses,
+* allocation and flushes pick their frames under the pool latch, which serializes them; the pool latch is always
+* taken before a shard latch. Their disk I/O happens after the pool latch is released: the frame is held pinned
+* and marked ioPending, and a page on its way in or out stays in the page table, so threads asking for it wait
+* for its frame instead of the pool. The log has a latch of its own and is forced without the pool latch;
+* checkpoints still write under it, so nothing is logged between their writes and the truncation of the log.
+* Threads that share a page take its frame latch with latchPage() while they use it.
+* A prefetcher thread loads pages ahead of requests the way misses do, see prefetch().
+* attachLog() has to be called before the pool is shared.
 */
 class BufMgr 
 {
+	friend class PageHandle;
+
  private:
 	/**
-   * Current position of clockhand in our buffer pool
+   * Number of shards of the page table, a power of two
 	 */
-  FrameId clockHand;
+  static const int NUMSHARDS = 16;
 
 	/**
-   * Number of frames in the buffer pool
+   * Decides which frame is reused when a page is brought in
+	 */
+  ReplacementPolicy* policy;
+
+	/**
+   * Number of frames in the buffer pool, changed by resize() under the pool latch
 	 */
   std::uint32_t numBufs;
+
+	/**
+   * Number of frames the pool has room for, the most resize() grows it to
+	 */
+  std::uint32_t maxBufs;
+
+	/**
+   * Frames a pool has room for unless it is told otherwise, as a multiple of the frames it starts with
+	 */
+  static const std::uint32_t GROWTHFACTOR = 4;
+
+	/**
+   * Size in bytes of every frame in the buffer pool, the largest page size the pool can hold
+	 */
+  std::size_t frameSize;
+
+	/**
+   * Alignment and size granularity of the memory of the buffer pool, the size of a huge page
+	 */
+  static const std::size_t POOLALIGN = 2 * 1024 * 1024;
+
+	/**
+   * Size in bytes of the memory mapped for bufPool
+	 */
+  std::size_t poolBytes;
+
+	/**
+   * Pages backing bufPool
+	 */
+  HugePageMode poolPages;
 	
 	/**
-   * Hash table mapping (File, page) to frame
+   * Shards of the page table mapping (File, page) to frame
 	 */
-  BufHashTbl *hashTable;
+  PageTableShard *shards;
 
 	/**
    * Array of BufDesc objects to hold information corresponding to every frame allocation from 'bufPool' (the buffer pool)
@@ -187,32 +578,446 @@ class BufMgr
   BufStats bufStats;
 
 	/**
-	 * Allocate a free frame.  
+   * Write-ahead log of the pool, NULL if changes are not logged
+	 */
+  WriteAheadLog* wal;
+
+	/**
+   * Frames marked uncommitted since the last commit, possibly with repeats or frames reused since
+	 */
+  std::vector<FrameId> uncommittedFrames;
+
+	/**
+   * Files pages or extents were allocated in since the last commit, whose headers are logged with the operation
+	 */
+  std::set<const File*> allocatedFiles;
+
+	/**
+   * Names of files written to since the last checkpoint, whose writes may not be on disk yet
+	 */
+  std::set<std::string> unsyncedFiles;
+
+	/**
+   * Pool latch, held by every public method but the ones that only look at one page, see the class comment
+	 */
+  std::recursive_mutex latch;
+
+	/**
+   * Guards the write-ahead log, which is not threadsafe. Taken after the pool latch, and never held with a
+   * shard latch.
+	 */
+  std::mutex logLatch;
+
+	/**
+   * Guards filesWriting and the end of a frame's pending I/O, and wakes the threads waiting for either.
+   * Taken last, nothing is taken while it is held.
+	 */
+  std::mutex ioLatch;
+  std::condition_variable ioDone;
+
+	/**
+   * File of every page written out without the pool latch right now, once per page
+	 */
+  std::multiset<const File*> filesWriting;
+
+	/**
+   * A dirty page evicted from a frame, to be written out before the frame is filled again
+	 */
+  struct EvictedPage
+  {
+    File* file;
+    PageId pageNo;
+    std::uint64_t logGroup;
+  };
+
+	/**
+   * Background writer thread, see startWriter()
+	 */
+  std::thread writerThread;
+
+	/**
+   * True while the background writer runs
+	 */
+  std::atomic<bool> writerRunning;
+
+	/**
+   * Guards writerStop, and wakes the background writer before its interval is over
+	 */
+  std::mutex writerMutex;
+  std::condition_variable writerWake;
+
+	/**
+   * Set to make the background writer return
+	 */
+  bool writerStop;
+
+	/**
+   * Settings of the running background writer, see startWriter()
+	 */
+  double writerDirtyRatio;
+  std::uint32_t writerPagesPerRound;
+  std::uint32_t writerIntervalMillis;
+
+	/**
+   * Thread body of the background writer
+	 */
+  void writerLoop();
+
+	/**
+   * Largest number of consecutive pages written with one write when pages are flushed
+	 */
+  static const std::size_t MAXWRITERUN = 64;
+
+	/**
+   * Size of the first window read ahead when a file is read sequentially
+	 */
+  static const PageId MINREADAHEAD = 4;
+
+	/**
+   * Pages prefetch() queued for the prefetcher: next up to end, excluding end. A hit on markAt reads the
+   * next window ahead, Page::INVALID_NUMBER if there is no such page.
+	 */
+  struct PrefetchRequest
+  {
+    File* file;
+    PageId next;
+    PageId end;
+    PageId markAt;
+  };
+
+	/**
+   * How a file has been read lately: last page missed or hit on a read ahead mark, size of the last window
+   * read ahead, 0 if the file is not read sequentially, and the page after that window
+	 */
+  struct ReadAheadState
+  {
+    PageId last;
+    PageId window;
+    PageId next;
+  };
+
+	/**
+   * Prefetcher thread, started by the first request it gets
+	 */
+  std::thread prefetchThread;
+
+	/**
+   * Guards the prefetcher state below. Taken after the pool latch, and never held with a shard latch.
+	 */
+  std::mutex prefetchMutex;
+
+	/**
+   * Wakes the prefetcher when pages are queued, and prefetch waiters when the queue is done
+	 */
+  std::condition_variable prefetchWake;
+  std::condition_variable prefetchIdle;
+
+	/**
+   * True while the prefetcher runs, and set to make it return
+	 */
+  bool prefetchRunning;
+  bool prefetchStop;
+
+	/**
+   * File of the page the prefetcher is loading, NULL while it loads none
+	 */
+  const File* prefetchFile;
+
+	/**
+   * Pages waiting for the prefetcher, and their number, which is kept below maxPrefetchQueued
+	 */
+  std::deque<PrefetchRequest> prefetchQueue;
+  std::uint32_t prefetchQueued;
+  std::uint32_t maxPrefetchQueued;
+
+	/**
+   * Largest window read ahead, 0 if sequential reads are not detected
+	 */
+  PageId maxReadAhead;
+
+	/**
+   * Read ahead state of every file read through the pool since it was last flushed
+	 */
+  std::map<const File*, ReadAheadState> readAheads;
+
+	/**
+   * Queue pages for the prefetcher, as many as fit below maxPrefetchQueued. Called with prefetchMutex held.
 	 *
-	 * @param frame   	Frame reference, frame ID of allocated frame returned via this variable
-	 * @throws BufferExceededException If no such buffer is found which can be allocated
+	 * @return  Number of pages queued
+	 */
+  PageId queuePrefetch(File* file, const PageId first, const PageId count, const PageId markAt);
+
+	/**
+   * Follow the reads of a file and read ahead of them once they are sequential. Called for every miss, with
+   * the pool latch held, and for every hit on a read ahead mark.
+	 *
+	 * @param file   	File object
+	 * @param pageNo  Page number of the miss or hit
+	 * @param markHit True for a hit on a read ahead mark
+	 */
+  void readAhead(File* file, const PageId pageNo, const bool markHit);
+
+	/**
+   * Thread body of the prefetcher
+	 */
+  void prefetchLoop();
+
+	/**
+   * Read a page into a frame, unpinned and at the cold end of the replacement policy, unless it is in the
+   * pool already. The frame is reserved under the pool latch and the page read without it, like a miss does.
+   * Errors are swallowed; the page is read when it is requested.
 	 */
-  void allocBuf(FrameId & frame);
+  void prefetchPage(File* file, const PageId pageNo, const bool mark);
 
 	/**
-   * Advance clock to next frame in the buffer pool
+   * Stop the prefetcher and wait for it. Queued pages are dropped.
 	 */
-  void advanceClock()
+  void stopPrefetcher();
+
+	/**
+   * Shard of the page table holding (file, pageNo)
+	 */
+  PageTableShard& shardOf(const File* file, const PageId pageNo)
   {
-		clockHand = (clockHand + 1) % numBufs;
+		return shards[(BufHashTbl::mix(file, pageNo) >> 48) & (NUMSHARDS - 1)];
   }
 
+	/**
+   * Mark a frame as dirtied by the running operation.
+	 *
+	 * @param frameNo   	Frame number
+	 */
+  void markUncommitted(const FrameId frameNo);
+
+	/**
+   * Write a dirty frame to its file, flushing the log first if the frame's image is not durable yet.
+	 *
+	 * @param frameNo   	Frame number
+	 */
+  void writeFrame(const FrameId frameNo);
+
+	/**
+   * Log a dirty frame that is about to be written, if it was allocated by the running operation, and note its
+   * file for the next checkpoint. Called with the pool latch held.
+	 *
+	 * @param frameNo   	Frame number
+	 * @return  Log group that has to be durable before the page is written, 0 if there is none
+	 */
+  std::uint64_t logForWrite(const FrameId frameNo);
+
+	/**
+   * Write a page, flushing the log first unless the group holding its image is durable already. Needs no
+   * pool latch.
+	 *
+	 * @param file   	File object
+	 * @param pageNo  Page number in the file
+	 * @param page  	Contents to write
+	 * @param logGroup  Log group returned by logForWrite()
+	 */
+  void writeLogged(File* file, const PageId pageNo, const Page& page, const std::uint64_t logGroup);
+
+	/**
+   * Empty a frame the replacement policy or a ring gave up. A dirty page evictFrame() left in it is logged and
+   * described in evicted, to be written with writeEvicted(); evicted.file is NULL otherwise. Called with the
+   * pool latch held.
+	 *
+	 * @param frameNo   	Frame number
+	 * @param evicted   	Page to write before the frame is filled
+	 */
+  void takeFrame(const FrameId frameNo, EvictedPage& evicted);
+
+	/**
+   * Write a page takeFrame() evicted from a frame, and take it out of the page table once it is on its way to
+   * disk. The frame stays ioPending. Needs no pool latch. Does nothing if no page was evicted.
+	 *
+	 * @param frameNo   	Frame number
+	 * @param evicted   	Page returned by takeFrame()
+	 */
+  void writeEvicted(const FrameId frameNo, const EvictedPage& evicted);
+
+	/**
+   * Write the evicted page of a frame reserved for (file, pageNo) and read the page in, without the pool
+   * latch. If either fails, the page is taken out of the pool again before the exception is passed on.
+	 *
+	 * @param file   	File object
+	 * @param pageNo  Page number in the file
+	 * @param frameNo Frame reserved for the page, pinned, ioPending and in the page table
+	 * @param evicted Page evicted from the frame
+	 */
+  void loadFrame(File* file, const PageId pageNo, const FrameId frameNo, const EvictedPage& evicted);
+
+	/**
+   * Take a page that never got into its reserved frame out of the pool again. Its waiters look again and
+   * miss. Takes the pool latch only once the frame is no longer ioPending.
+	 *
+	 * @param file   	File object
+	 * @param pageNo  Page number in the file
+	 * @param frameNo Frame reserved for the page
+	 */
+  void abandonFrame(File* file, const PageId pageNo, const FrameId frameNo);
+
+	/**
+   * End the pending I/O of a frame and wake the threads waiting for it.
+	 */
+  void endIo(const FrameId frameNo);
+
+	/**
+   * End the pending I/O of a frame and drop the pin held across it, both under the latch of the page's shard,
+   * so the frame is never seen unpinned while still ioPending. Used where the page stays in the pool unpinned.
+	 */
+  void unpinEndIo(const FrameId frameNo);
+
+	/**
+   * Wait until the pending I/O of a frame has ended. May be called with the pool latch held, as no pending
+   * I/O needs it to end.
+	 */
+  void waitForIo(const FrameId frameNo);
+
+	/**
+   * Wait until no page of the file is written out without the pool latch, any file if file is NULL. May be
+   * called with the pool latch held.
+	 */
+  void waitForWrites(const File* file);
+
+	/**
+	 * Sort frames by the file and page number of their pages
+	 */
+  void sortByPage(std::vector<FrameId>& frames);
+
+	/**
+	 * Write the dirty pages among the frames in file and page order, a run of consecutive pages of a file with
+	 * one write, and sync every file written once at the end. Called for frames no one can pin, which need not
+	 * hold the pool latch.
+	 *
+	 * @param frames  	Frames to write
+	 * @return  False if a file written to could not be synced
+	 */
+  bool writeSorted(const std::vector<FrameId>& frames);
+
+	/**
+	 * Allocate a free frame, evicting the page the replacement policy picks if there is none. Called with the
+	 * pool latch held.
+	 *
+	 * @param frame   	Frame reference, frame ID of allocated frame returned via this variable
+	 * @param file   	File of the page the frame is for
+	 * @param pageNo  Page number of the page the frame is for, Page::INVALID_NUMBER if not known yet
+	 * @param evicted Dirty page evicted from the frame, see takeFrame()
+	 * @throws BufferExceededException If no such buffer is found which can be allocated
+	 */
+  void allocBuf(FrameId & frame, const File* file, const PageId pageNo, EvictedPage& evicted);
+
+	/**
+	 * Offered a frame by the replacement policy: take it if it is empty, or evict its page if the page is
+	 * neither pinned, nor ioPending, nor changed by an operation that has not committed. A clean page is removed
+	 * from the page table. A dirty page stays in it with the frame ioPending, so nobody reads the page from disk
+	 * before it is written out, see writeEvicted().
+	 *
+	 * @param frameNo   	Frame number
+	 * @return  True if the frame can be reused
+	 */
+  bool evictFrame(const FrameId frameNo);
+
+	/**
+	 * Move the page of a frame into an empty frame, unless the page is pinned. The page keeps its contents, its
+	 * dirty and uncommitted state and its place in the replacement policy. Called with the pool latch held.
+	 *
+	 * @param from   	Frame holding the page
+	 * @param to     	Empty frame to move the page to
+	 * @return  True if the page was moved
+	 */
+  bool moveFrame(const FrameId from, const FrameId to);
+
+	/**
+	 * Allocate a frame for a page read through a ring: recycle the next frame of the ring if it still holds
+	 * the page the ring read into it and that page can be evicted, otherwise take a frame with allocBuf().
+	 *
+	 * @param frame   	Frame reference, frame ID of allocated frame returned via this variable
+	 * @param file   	File of the page the frame is for
+	 * @param pageNo  Page number of the page the frame is for
+	 * @param ring  	Ring of the operation
+	 * @param evicted Dirty page evicted from the frame, see takeFrame()
+	 * @throws BufferExceededException If no such buffer is found which can be allocated
+	 */
+  void allocRingBuf(FrameId & frame, const File* file, const PageId pageNo, BufferRing & ring, EvictedPage& evicted);
+
+	/**
+	 * Pin a page if it is in the buffer pool, holding only the latch of its shard. A page whose frame is
+	 * ioPending is waited for.
+	 *
+	 * @param file   	File object
+	 * @param pageNo  Page number in the file
+	 * @param frameNo Frame number of the page, set if it is in the pool
+	 * @param touch  	True to tell the replacement policy about the request
+	 * @return  True if the page was in the pool
+	 */
+  bool pinResident(File* file, const PageId pageNo, FrameId& frameNo, const bool touch);
+
+	/**
+	 * Make a frame that was just filled with a page findable in the page table. If the insert fails, nobody can
+	 * have reached the frame, so it is emptied and handed back to the replacement policy before the exception
+	 * is passed on. Called with the pool latch held.
+	 *
+	 * @param file   	File object
+	 * @param pageNo  Page number in the file
+	 * @param frameNo Frame number holding the page
+   * @throws  HashAlreadyPresentException If the page is in the pool already
+	 */
+  void insertFrame(File* file, const PageId pageNo, const FrameId frameNo);
+
+	/**
+	 * Map memory for bufPool, aligned to POOLALIGN, falling back from explicit to transparent huge pages if
+	 * none are reserved. The memory is not touched, the kernel provides zeroed pages as frames are first used.
+	 *
+	 * @param bytes   	Size in bytes of the frames
+	 * @param mode    	Pages to back the memory with
+   * @throws  std::bad_alloc If the memory can not be mapped
+	 */
+  void mapPool(const std::size_t bytes, const HugePageMode mode);
+
+	/**
+	 * Unpin the page in a frame, like unPinPage() but without looking the page up.
+	 *
+	 * @param frameNo   	Frame number of a pinned page
+	 * @param dirty		True if the page needs to be marked dirty
+   * @throws  PageNotPinnedException If the page is not pinned
+	 */
+  void unPinFrame(const FrameId frameNo, const bool dirty);
+
+	/**
+	 * Let a handle hold the pin of the page in a frame, releasing the pin it held before.
+	 */
+  void attachHandle(PageHandle& handle, Page* page);
+
+	/**
+	 * Make sure the pages of the file fit in a frame.
+	 *
+	 * @param file   	File object
+   * @throws  InvalidPageSizeException If the page size of the file exceeds frameSize
+	 */
+  void checkPageSize(const File* file) const;
+
 
  public:
 	/**
-   * Actual buffer pool from which frames are allocated
+   * Actual buffer pool from which frames are allocated, numBufs frames of frameSize bytes each, mapped
+   * at a POOLALIGN boundary with room for maxBufs frames. Use framePage() to get at the Page in a frame.
 	 */
-  Page* bufPool;
+  char* bufPool;
 
 	/**
    * Constructor of BufMgr class
+   *
+   * @param bufs      Number of frames in the buffer pool
+   * @param frameSize Size in bytes of every frame. Files with pages up to this size can be used with the pool.
+   * @param policyKind  Replacement policy picking the page to evict when a frame is needed
+   * @param hugePages  Pages to back the frames with. Large pools see fewer TLB misses on huge pages.
+   * @param maxFrames  Most frames resize() may grow the pool to, bufs if smaller. 0 leaves room for GROWTHFACTOR
+   *                   times bufs, or just bufs on explicit huge pages, which are reserved for all the room up
+   *                   front. Only address space is set aside for frames beyond bufs otherwise.
+   * @throws  InvalidPageSizeException If frameSize is not a supported page size
 	 */
-  BufMgr(std::uint32_t bufs);
+  BufMgr(std::uint32_t bufs, const std::size_t frameSize = Page::SIZE, const ReplacementPolicyKind policyKind = CLOCK,
+         const HugePageMode hugePages = TRANSPARENT_HUGE_PAGES, const std::uint32_t maxFrames = 0);
 	
 	/**
    * Destructor of BufMgr class
@@ -222,13 +1027,27 @@ class BufMgr
 	/**
 	 * Reads the given page from the file into a frame and returns the pointer to page.
 	 * If the requested page is already present in the buffer pool pointer to that frame is returned
-	 * otherwise a new frame is allocated from the buffer pool for reading the page.
+	 * otherwise a new frame is allocated from the buffer pool for reading the page. The page is read without the
+	 * pool latch; threads asking for it meanwhile wait until it is in.
 	 *
 	 * @param file   	File object
 	 * @param PageNo  Page number in the file to be read
 	 * @param page  	Reference to page pointer. Used to fetch the Page object in which requested page from file is read in.
+	 * @param ring  	Access strategy of an operation reading many pages once, NULL for a normal request
+   * @throws  InvalidPageSizeException If the pages of the file do not fit in a frame
 	 */
-  void readPage(File* file, const PageId PageNo, Page*& page);
+  void readPage(File* file, const PageId PageNo, Page*& page, BufferRing* ring = NULL);
+
+	/**
+	 * Reads the given page like readPage() above, and returns its pin in a handle that releases it without a page
+	 * table lookup. A pin the handle held before is released first.
+	 *
+	 * @param file   	File object
+	 * @param PageNo  Page number in the file to be read
+	 * @param handle  Handle receiving the pin
+	 * @param ring  	Access strategy of an operation reading many pages once, NULL for a normal request
+	 */
+  void readPage(File* file, const PageId PageNo, PageHandle& handle, BufferRing* ring = NULL);
 
 	/**
 	 * Unpin a page from memory since it is no longer required for it to remain in memory.
@@ -240,6 +1059,27 @@ class BufMgr
 	 */
   void unPinPage(File* file, const PageId PageNo, const bool dirty);
 
+	/**
+	 * Take the latch of the frame holding a pinned page, shared to read the page or exclusive to change it.
+	 * Threads that only use pages they alone have pinned need no frame latch.
+	 *
+	 * @param file   	File object
+	 * @param PageNo  Page number
+	 * @param exclusive		True to take the latch exclusive
+   * @throws  HashNotFoundException If the page is not in the buffer pool
+	 */
+  void latchPage(File* file, const PageId PageNo, const bool exclusive);
+
+	/**
+	 * Release the latch taken with latchPage().
+	 *
+	 * @param file   	File object
+	 * @param PageNo  Page number
+	 * @param exclusive		True if the latch is held exclusive
+   * @throws  HashNotFoundException If the page is not in the buffer pool
+	 */
+  void unlatchPage(File* file, const PageId PageNo, const bool exclusive);
+
 	/**
 	 * Allocates a new, empty page in the file and returns the Page object.
 	 * The newly allocated page is also assigned a frame in the buffer pool.
@@ -251,16 +1091,161 @@ class BufMgr
   void allocPage(File* file, PageId &PageNo, Page*& page); 
 
 	/**
-	 * Writes out all dirty pages of the file to disk.
+	 * Allocates a new page like allocPage() above, and returns its pin in a handle. A pin the handle held before is
+	 * released first.
+	 *
+	 * @param file   	File object
+	 * @param PageNo  Page number. The number assigned to the page in the file is returned via this reference.
+	 * @param handle  Handle receiving the pin
+	 */
+  void allocPage(File* file, PageId &PageNo, PageHandle& handle);
+
+	/**
+	 * Assigns a frame to a page that already exists in the file but has never been written, such as a page
+	 * reserved with BlobFile::allocateExtent(). The frame starts out as an empty, dirty page and nothing is
+	 * read from disk. The page is returned pinned, like allocPage().
+	 *
+	 * @param file   	File object
+	 * @param PageNo  Page number of the reserved page
+	 * @param page  	Reference to page pointer. The in-memory Page object is returned via this reference.
+   * @throws  HashAlreadyPresentException If the page is already in the buffer pool
+	 */
+  void claimPage(File* file, const PageId PageNo, Page*& page);
+
+	/**
+	 * Reserves a run of consecutive pages at the end of the file with BlobFile::allocateExtent(). Goes through
+	 * the pool so that, with a log attached, the grown file header is logged when the operation commits.
+	 *
+	 * @param file   	File object
+	 * @param numPages  Number of pages to reserve
+	 * @return  Number of the first page of the run, whose pages are handed out with claimPage()
+	 */
+  PageId allocateExtent(BlobFile* file, const PageId numPages);
+
+	/**
+	 * Writes out all dirty pages of the file to disk, in page order and with one write per run of consecutive
+	 * pages, and syncs the file.
 	 * All the frames assigned to the file need to be unpinned from buffer pool before this function can be successfully called.
 	 * Otherwise Error returned.
+	 * With a log attached, pending changes are committed and a checkpoint is taken first, so the file is on disk
+	 * and no longer needs the log once this returns. Pages of the file waiting to be prefetched are dropped, and
+	 * one the prefetcher is loading is waited for.
 	 *
 	 * @param file   	File object
    * @throws  PagePinnedException If any page of the file is pinned in the buffer pool 
    * @throws BadBufferException If any frame allocated to the file is found to be invalid
+   * @throws LogIOException If the file could not be synced
 	 */
   void flushFile(const File* file);
 
+	/**
+	 * Log every change made through the pool to the given write-ahead log from now on. The log must outlive
+	 * the pool. Pages dirtied by an operation stay in the pool until the operation calls commit(), and the
+	 * log is flushed before a page whose image is not durable yet is written out.
+	 *
+	 * @param walIn   	Write-ahead log, already recovered
+	 */
+  void attachLog(WriteAheadLog* walIn);
+
+	/**
+   * True if a write-ahead log is attached
+	 */
+  bool hasLog() const
+  {
+		return wal != NULL;
+  }
+
+	/**
+	 * Mark the end of an operation. Every page dirtied since the last commit is logged as one unit, together with
+	 * the headers of the files pages were allocated in, and the log
+	 * is flushed once enough operations have committed to fill a group. Does nothing without a log.
+	 * A checkpoint is taken when the log has grown past its checkpoint size.
+	 */
+  void commit();
+
+	/**
+	 * Write every committed dirty page to its file, sync the files written since the last checkpoint and empty
+	 * the log. Pages of an operation that has not committed yet stay in the pool. Does nothing without a log.
+	 */
+  void checkpoint();
+
+	/**
+	 * Write dirty pages that are next in line for eviction, so the pages picked later can be dropped without
+	 * a write. Does nothing while at most dirtyRatio of the frames are dirty. Pages are written in file and
+	 * page order, without the pool latch. Pinned pages and pages changed by an operation that has not committed
+	 * are skipped. A page is held pinned and ioPending while it is written, so it is neither changed halfway
+	 * through the write nor evicted; threads asking for it wait for the write.
+	 *
+	 * @param dirtyRatio  Fraction of the frames that may stay dirty
+	 * @param maxPages  	Largest number of pages to write
+	 * @return  Number of pages written
+	 */
+  std::uint32_t writeAhead(const double dirtyRatio, const std::uint32_t maxPages);
+
+	/**
+	 * Start a background writer, a thread that calls writeAhead() every intervalMillis milliseconds, and
+	 * as soon as a miss had to write a dirty page first. It keeps frames at the cold end of the replacement
+	 * policy clean, so misses cost a read but no write. The writer stops with stopWriter() or when the pool
+	 * is destroyed.
+	 *
+	 * @param dirtyRatio  Fraction of the frames that may stay dirty
+	 * @param pagesPerRound  Largest number of pages written per round, which with intervalMillis limits the write rate
+	 * @param intervalMillis  Milliseconds between rounds
+	 */
+  void startWriter(const double dirtyRatio = 0.1, const std::uint32_t pagesPerRound = 32,
+                   const std::uint32_t intervalMillis = 10);
+
+	/**
+	 * Stop the background writer and wait for it. Does nothing if none runs.
+	 */
+  void stopWriter();
+
+	/**
+	 * Start reading pages of the file into the pool in the background, without pinning them, so a later
+	 * readPage() of them is a hit. Pages are loaded at the cold end of the replacement policy, so prefetched
+	 * pages nobody reads go first. Pages in the pool already and pages past the end of the file are skipped,
+	 * and pages beyond what the prefetcher may have queued (a quarter of the pool) are dropped.
+	 *
+	 * The pool also reads ahead on its own: once a file's misses are consecutive pages, the pages after them
+	 * are prefetched in windows doubling up to the size set with setReadAhead(), and a hit on the first page
+	 * of a window prefetches the next one.
+	 *
+	 * @param file   	File object, which must stay open until it is flushed or the pool is destroyed
+	 * @param first  	Number of the first page
+	 * @param count  	Number of consecutive pages
+	 */
+  void prefetch(File* file, const PageId first, const PageId count);
+
+	/**
+	 * Wait until the prefetcher has loaded or dropped every page queued so far.
+	 */
+  void waitForPrefetch();
+
+	/**
+	 * Set the largest number of pages read ahead of a sequential reader at once, 0 to turn read ahead off.
+	 * The default is 32, or an eighth of the pool if that is smaller.
+	 *
+	 * @param maxPages  Largest window read ahead
+	 */
+  void setReadAhead(const PageId maxPages);
+
+	/**
+	 * Grow or shrink the pool while it is in use. The pool grows up to the maxFrames it was built with. Shrinking
+	 * empties the frames at the end of the pool and hands their memory back to the system. Their pages move to
+	 * empty frames the pool keeps while there are any; the rest are evicted, writing the dirty ones. It stops at
+	 * a frame holding a pinned page, or a page changed by an operation that has not committed once no empty
+	 * frame is left for it, so the pool may keep more frames than asked for.
+	 *
+	 * @param newFrames  Number of frames wanted, at least 1
+	 * @return  Number of frames the pool has now
+	 */
+  std::uint32_t resize(const std::uint32_t newFrames);
+
+	/**
+	 * Number of frames in the pool
+	 */
+  std::uint32_t getNumBufs();
+
 	/**
 	 * Delete page from file and also from buffer pool if present.
 	 * Since the page is entirely deleted from file, its unnecessary to see if the page is dirty.
@@ -270,6 +1255,30 @@ class BufMgr
 	 */
   void disposePage(File* file, const PageId PageNo);
 
+	/**
+   * Page held in a frame. Only the first frameSize bytes of the Page belong to the frame.
+	 */
+  Page* framePage(const FrameId frameNo)
+  {
+		return reinterpret_cast<Page*>(bufPool + (std::size_t)frameNo * frameSize);
+  }
+
+	/**
+   * Pages the frames are backed with, which are normal pages if huge ones were asked for but not available
+	 */
+  HugePageMode getHugePageMode() const
+  {
+		return poolPages;
+  }
+
+	/**
+   * Size in bytes of every frame in the buffer pool
+	 */
+  std::size_t getFrameSize() const
+  {
+		return frameSize;
+  }
+
 	/**
    * Print member variable values. 
 	 */
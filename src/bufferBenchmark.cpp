@@ -0,0 +1,193 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "buffer.h"
+#include "file.h"
+#include "page.h"
+#include "exceptions/file_not_found_exception.h"
+
+/**
+ * Compares the hit ratios of the buffer replacement policies on page request traces of a B+ tree shaped file:
+ * a root page, a level of inner pages and leaves below them. Usage: badgerdb_bufbench [frames] [requests]
+ */
+
+using namespace badgerdb;
+
+namespace {
+
+const std::string benchFileName = "bufbench.0";
+const PageId numInner = 32;
+const PageId numLeaves = 4096;
+const PageId firstLeaf = 2 + numInner;
+const PageId numPages = firstLeaf + numLeaves - 1;
+
+/**
+ * Leaves of point lookups, skewed so a few leaves are hot (Zipf with s = 1)
+ */
+class LookupKeys
+{
+ public:
+  LookupKeys(std::mt19937 & rng)
+    : rng(rng), ranks(numLeaves), weights(numLeaves)
+  {
+    double total = 0;
+    for (PageId i = 0; i < numLeaves; i++)
+    {
+      total += 1.0 / (i + 1);
+      weights[i] = total;
+      ranks[i] = firstLeaf + i;
+    }
+    std::shuffle(ranks.begin(), ranks.end(), rng);
+  }
+
+  PageId next()
+  {
+    std::uniform_real_distribution<double> uniform(0, weights.back());
+    const std::size_t rank = std::lower_bound(weights.begin(), weights.end(), uniform(rng)) - weights.begin();
+    return ranks[std::min<std::size_t>(rank, numLeaves - 1)];
+  }
+
+ private:
+  std::mt19937 & rng;
+  std::vector<PageId> ranks;
+  std::vector<double> weights;
+};
+
+/**
+ * Pages of a lookup of a leaf: root, inner page, leaf
+ */
+void addLookup(std::vector<PageId> & trace, const PageId leaf)
+{
+  trace.push_back(1);
+  trace.push_back(2 + (leaf - firstLeaf) * numInner / numLeaves);
+  trace.push_back(leaf);
+}
+
+std::vector<PageId> lookupTrace(const int requests)
+{
+  std::mt19937 rng(42);
+  LookupKeys keys(rng);
+  std::vector<PageId> trace;
+  while ((int)trace.size() < requests)
+    addLookup(trace, keys.next());
+  return trace;
+}
+
+/**
+ * Range scans over runs of leaves, each reading its leaves once
+ */
+std::vector<PageId> scanTrace(const int requests)
+{
+  std::mt19937 rng(43);
+  std::uniform_int_distribution<PageId> start(firstLeaf, numPages);
+  std::vector<PageId> trace;
+  while ((int)trace.size() < requests)
+  {
+    const PageId first = start(rng);
+    trace.push_back(1);
+    trace.push_back(2 + (first - firstLeaf) * numInner / numLeaves);
+    for (PageId leaf = first; leaf < std::min(first + 512, numPages + 1); leaf++)
+      trace.push_back(leaf);
+  }
+  return trace;
+}
+
+/**
+ * Point lookups while a reporting query scans every leaf, one scanned leaf per lookup
+ */
+std::vector<PageId> mixedTrace(const int requests)
+{
+  std::mt19937 rng(44);
+  LookupKeys keys(rng);
+  std::vector<PageId> trace;
+  PageId scanned = firstLeaf;
+  while ((int)trace.size() < requests)
+  {
+    addLookup(trace, keys.next());
+    trace.push_back(scanned);
+    scanned = scanned == numPages ? firstLeaf : scanned + 1;
+  }
+  return trace;
+}
+
+/**
+ * Replay a trace through a pool with the policy and return its hit ratio
+ */
+double replay(File & file, const std::uint32_t frames, const ReplacementPolicyKind kind,
+              const std::vector<PageId> & trace, double & millis)
+{
+  BufMgr pool(frames, Page::SIZE, kind);
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < trace.size(); i++)
+  {
+    Page* page;
+    pool.readPage(&file, trace[i], page);
+    pool.unPinPage(&file, trace[i], false);
+  }
+  millis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  BufStats & stats = pool.getBufStats();
+  return 1.0 - (double)stats.diskreads / stats.accesses;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+  const std::uint32_t frames = argc > 1 ? std::atoi(argv[1]) : 128;
+  const int requests = argc > 2 ? std::atoi(argv[2]) : 200000;
+
+  try
+  {
+    File::remove(benchFileName);
+  }
+  catch(FileNotFoundException)
+  {
+  }
+
+  {
+    PageFile file = PageFile::create(benchFileName);
+    for (PageId i = 0; i < numPages; i++)
+    {
+      PageId pageNo;
+      Page page = file.allocatePage(pageNo);
+      file.writePage(pageNo, page);
+    }
+
+    const char* traceNames[] = {"index-lookup", "scan", "mixed"};
+    std::vector<PageId> traces[] = {lookupTrace(requests), scanTrace(requests), mixedTrace(requests)};
+    const char* policyNames[] = {"clock", "lru-k", "2q", "arc"};
+    const ReplacementPolicyKind policies[] = {CLOCK, LRU_K, TWO_Q, ARC};
+
+    std::cout << frames << " frames, " << numPages << " pages, " << requests << " requests per trace" << std::endl;
+    std::printf("%-14s", "hit ratio");
+    for (int p = 0; p < 4; p++)
+      std::printf("%16s", policyNames[p]);
+    std::printf("\n");
+    for (int t = 0; t < 3; t++)
+    {
+      std::printf("%-14s", traceNames[t]);
+      for (int p = 0; p < 4; p++)
+      {
+        double millis;
+        const double ratio = replay(file, frames, policies[p], traces[t], millis);
+        std::printf("%8.4f %5.0fms", ratio, millis);
+      }
+      std::printf("\n");
+    }
+  }
+  File::remove(benchFileName);
+  return 0;
+}
@@ -0,0 +1,62 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "badgerdb_exception.h"
+
+namespace badgerdb {
+
+/**
+ * @brief An exception that is thrown when a file is created with an
+ *        unsupported page size, or when a file's pages do not fit in the
+ *        frames of a buffer pool.
+ */
+class InvalidPageSizeException : public BadgerDbException {
+ public:
+  /**
+   * Constructs an invalid page size exception for the given page size and
+   * filename.
+   *
+   * @param page_size  Page size that was rejected.
+   * @param file       Name of file that request was made to.
+   */
+  InvalidPageSizeException(const std::size_t page_size,
+                           const std::string& file);
+
+  /**
+   * Destroys the exception.  Does nothing special; just included to make the
+   * compiler happy.
+   */
+  virtual ~InvalidPageSizeException() throw() {}
+
+  /**
+   * Returns the page size that caused this exception.
+   */
+  virtual std::size_t page_size() const { return page_size_; }
+
+  /**
+   * Returns name of the file that caused this exception.
+   */
+  virtual const std::string& filename() const { return filename_; }
+
+ protected:
+  /**
+   * Page size which caused this exception.
+   */
+  const std::size_t page_size_;
+
+  /**
+   * Name of file which caused this exception.
+   */
+  const std::string filename_;
+};
+
+}
@@ -0,0 +1,26 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "log_io_exception.h"
+
+#include <sstream>
+#include <string>
+
+namespace badgerdb {
+
+LogIOException::LogIOException(const std::string& file,
+                               const std::string& operation)
+    : BadgerDbException(""),
+      filename_(file),
+      operation_(operation) {
+  std::stringstream ss;
+  ss << "Log I/O failed: cannot " << operation_ << " file '" << filename_
+     << "'";
+  message_.assign(ss.str());
+}
+
+}
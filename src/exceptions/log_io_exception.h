@@ -0,0 +1,58 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "badgerdb_exception.h"
+
+namespace badgerdb {
+
+/**
+ * @brief An exception that is thrown when the write-ahead log, or a data file
+ *        it recovers, cannot be opened, written or synced to disk.
+ */
+class LogIOException : public BadgerDbException {
+ public:
+  /**
+   * Constructs a log I/O exception for the given file and operation.
+   *
+   * @param file       Name of file the operation was made on.
+   * @param operation  Operation that failed, such as "write" or "sync".
+   */
+  LogIOException(const std::string& file, const std::string& operation);
+
+  /**
+   * Destroys the exception.  Does nothing special; just included to make the
+   * compiler happy.
+   */
+  virtual ~LogIOException() throw() {}
+
+  /**
+   * Returns name of the file that caused this exception.
+   */
+  virtual const std::string& filename() const { return filename_; }
+
+  /**
+   * Returns the operation that failed.
+   */
+  virtual const std::string& operation() const { return operation_; }
+
+ protected:
+  /**
+   * Name of file which caused this exception.
+   */
+  const std::string filename_;
+
+  /**
+   * Operation which failed.
+   */
+  const std::string operation_;
+};
+
+}
@@ -12,19 +12,28 @@
 #include <memory>
 #include <string>
 #include <cstdio>
+#include <cstring>
 #include <cassert>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "exceptions/file_exists_exception.h"
 #include "exceptions/file_not_found_exception.h"
 #include "exceptions/file_open_exception.h"
 #include "exceptions/invalid_page_exception.h"
+#include "exceptions/invalid_page_size_exception.h"
 #include "file_iterator.h"
 #include "page.h"
 
 namespace badgerdb {
 
+const std::uint32_t FileHeader::FORMAT;
+const std::uint32_t FileHeader::LEGACY_PAGE_SIZE;
+
 File::StreamMap File::open_streams_;
 File::CountMap File::open_counts_;
+std::mutex File::stream_latch_;
+std::mutex File::list_latch_;
 
 void File::remove(const std::string& filename) {
   if (!exists(filename)) {
@@ -54,6 +63,21 @@ bool File::exists(const std::string& filename) {
 	return false;
 }
 
+bool File::sync(const std::string& filename) {
+  StreamMap::iterator it = open_streams_.find(filename);
+  if (it != open_streams_.end()) {
+    std::lock_guard<std::mutex> guard(stream_latch_);
+    it->second->flush();
+  }
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return !exists(filename);
+  }
+  const bool synced = ::fsync(fd) == 0;
+  ::close(fd);
+  return synced;
+}
+
 File::~File() {
   close();
 }
@@ -64,14 +88,57 @@ PageId File::getFirstPageNo() {
   return header.first_used_page;
 }
 
-File::File(const std::string& name, const bool create_new) : filename_(name) {
+PageId File::numPages() const {
+  return readHeader().num_pages;
+}
+
+Page File::allocatePage(PageId &new_page_number) {
+  if (page_size_ > Page::SIZE) {
+    throw InvalidPageSizeException(page_size_, filename_);
+  }
+  Page new_page;
+  allocatePage(new_page_number, new_page);
+  return new_page;
+}
+
+Page File::readPage(const PageId page_number) const {
+  if (page_size_ > Page::SIZE) {
+    throw InvalidPageSizeException(page_size_, filename_);
+  }
+  Page page;
+  readPage(page_number, page);
+  return page;
+}
+
+File::File(const std::string& name, const bool create_new,
+           const std::size_t page_size)
+    : filename_(name), page_size_(page_size),
+      header_size_(sizeof(FileHeader)) {
+  if (create_new && !Page::isValidSize(page_size)) {
+    throw InvalidPageSizeException(page_size, name);
+  }
   openIfNeeded(create_new);
 
   if (create_new) {
     // File starts with 1 page (the header).
     FileHeader header = {1 /* num_pages */, 0 /* first_used_page */,
-                         0 /* num_free_pages */, 0 /* first_free_page */};
+                         0 /* num_free_pages */, 0 /* first_free_page */,
+                         FileHeader::FORMAT,
+                         static_cast<std::uint32_t>(page_size)};
     writeHeader(header);
+  } else {
+    const FileHeader header = readHeader();
+    if (header.format != FileHeader::FORMAT) {
+      // Written before the header had a format; it is kept in that layout
+      header_size_ = offsetof(FileHeader, format);
+      page_size_ = FileHeader::LEGACY_PAGE_SIZE;
+    } else {
+      page_size_ = header.page_size;
+    }
+    if (!Page::isValidSize(page_size_)) {
+      close();
+      throw InvalidPageSizeException(page_size_, name);
+    }
   }
 }
 
@@ -116,15 +183,23 @@ void File::close() {
 }
 
 FileHeader File::readHeader() const {
-  FileHeader header;
+  FileHeader header = FileHeader();
+  std::lock_guard<std::mutex> guard(stream_latch_);
   stream_->seekg(0 /* pos */, std::ios::beg);
-  stream_->read(reinterpret_cast<char*>(&header), sizeof(FileHeader));
+  stream_->read(reinterpret_cast<char*>(&header), header_size_);
+  // A legacy file without pages ends before the full header
+  stream_->clear();
+  if (header_size_ < sizeof(FileHeader)) {
+    header.format = 0;
+    header.page_size = FileHeader::LEGACY_PAGE_SIZE;
+  }
   return header;
 }
 
 void File::writeHeader(const FileHeader& header) {
+  std::lock_guard<std::mutex> guard(stream_latch_);
   stream_->seekp(0 /* pos */, std::ios::beg);
-  stream_->write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
+  stream_->write(reinterpret_cast<const char*>(&header), header_size_);
   stream_->flush();
 }
 
@@ -132,16 +207,18 @@ void File::writeHeader(const FileHeader& header) {
 
 
 
-PageFile PageFile::create(const std::string& filename) {
-  return PageFile(filename, true /* create_new */);
+PageFile PageFile::create(const std::string& filename,
+                          const std::size_t page_size) {
+  return PageFile(filename, true /* create_new */, page_size);
 }
 
 PageFile PageFile::open(const std::string& filename) {
   return PageFile(filename, false /* create_new */);
 }
 
-PageFile::PageFile(const std::string& name, const bool create_new)
-: File(name, create_new)
+PageFile::PageFile(const std::string& name, const bool create_new,
+                   const std::size_t page_size)
+: File(name, create_new, page_size)
 {
 }
 
@@ -159,15 +236,18 @@ PageFile& PageFile::operator=(const PageFile& rhs) {
   close();	//close my file and associate me with the new one
   filename_ = rhs.filename_;
   openIfNeeded(false /* create_new */);
+  page_size_ = rhs.page_size_;
+  header_size_ = rhs.header_size_;
   return *this;
 }
 
-Page PageFile::allocatePage(PageId &new_page_number) {
+void PageFile::allocatePage(PageId &new_page_number, Page& new_page) {
+  std::lock_guard<std::mutex> guard(list_latch_);
   FileHeader header = readHeader();
-  Page new_page;
-  Page existing_page;
+  PageBuffer existing_page(page_size_);
+  new_page.initialize(page_size_);
   if (header.num_free_pages > 0) {
-    new_page = readPage(header.first_free_page, true /* allow_free */);
+    readPage(header.first_free_page, true /* allow_free */, new_page);
     new_page.set_page_number(header.first_free_page);
 		new_page_number = new_page.page_number();
     header.first_free_page = new_page.next_page_number();
@@ -185,15 +265,16 @@ Page PageFile::allocatePage(PageId &new_page_number) {
       // New page is reused from somewhere after the beginning, so we need to
       // find where in the used list to insert it.
       PageId next_page_number = Page::INVALID_NUMBER;
-      for (FileIterator iter = begin(); iter != end(); ++iter) {
-        next_page_number = (*iter).next_page_number();
+      for (PageId used = header.first_used_page; used != Page::INVALID_NUMBER;
+           used = next_page_number) {
+        next_page_number = readPageHeader(used).next_page_number;
         if (next_page_number > new_page.page_number() ||
             next_page_number == Page::INVALID_NUMBER) {
-          existing_page = *iter;
+          readPage(used, *existing_page);
           break;
         }
       }
-      existing_page.set_next_page_number(new_page.page_number());
+      existing_page->set_next_page_number(new_page.page_number());
       new_page.set_next_page_number(next_page_number);
     }
 
@@ -213,51 +294,51 @@ Page PageFile::allocatePage(PageId &new_page_number) {
 		{
       // If we have pages allocated, we need to add the new page to the tail
       // of the linked list.
-      for (FileIterator iter = begin(); iter != end(); ++iter) {
-        if ((*iter).next_page_number() == Page::INVALID_NUMBER) {
-          existing_page = *iter;
-          break;
-        }
+      PageId last_page_number = header.first_used_page;
+      for (PageId next_page_number = readPageHeader(last_page_number).next_page_number;
+           next_page_number != Page::INVALID_NUMBER;
+           next_page_number = readPageHeader(next_page_number).next_page_number) {
+        last_page_number = next_page_number;
       }
-      assert(existing_page.isUsed());
-      existing_page.set_next_page_number(new_page.page_number());
+      readPage(last_page_number, *existing_page);
+      assert(existing_page->isUsed());
+      existing_page->set_next_page_number(new_page.page_number());
     }
     ++header.num_pages;
   }
   writePage(new_page_number, new_page.header_, new_page);
-  if (existing_page.page_number() != Page::INVALID_NUMBER) {
+  if (existing_page->page_number() != Page::INVALID_NUMBER) {
     // If we updated an existing page by inserting the new page into the
     // used list, we need to write it out.
-    writePage(existing_page.page_number(), existing_page.header_, existing_page);
+    writePage(existing_page->page_number(), existing_page->header_, *existing_page);
   }
   writeHeader(header);
-
-  return new_page;
 }
 
-Page PageFile::readPage(const PageId page_number) const {
+void PageFile::readPage(const PageId page_number, Page& page) const {
   FileHeader header = readHeader();
 
 	if (page_number >= header.num_pages)
 	{
 		throw InvalidPageException(page_number, filename_);
 	}
-	return readPage(page_number, false /* allow_free */);
+	readPage(page_number, false /* allow_free */, page);
 }
 
-Page PageFile::readPage(const PageId page_number, const bool allow_free) const {
-  Page page;
+void PageFile::readPage(const PageId page_number, const bool allow_free,
+                        Page& page) const {
+  std::lock_guard<std::mutex> guard(stream_latch_);
   stream_->seekg(pagePosition(page_number), std::ios::beg);
   stream_->read(reinterpret_cast<char*>(&page.header_), sizeof(PageHeader));
-  stream_->read(reinterpret_cast<char*>(&page.data_[0]), Page::DATA_SIZE);
+  stream_->read(reinterpret_cast<char*>(&page.data_[0]),
+                page_size_ - sizeof(PageHeader));
   if (!allow_free && !page.isUsed()) {
     throw InvalidPageException(page_number, filename_);
   }
-
-  return page;
 }
 
 void PageFile::writePage(const PageId new_page_number, const Page& new_page) {
+	std::lock_guard<std::mutex> guard(list_latch_);
 	PageHeader header = readPageHeader(new_page_number);
 	if (header.current_page_number == Page::INVALID_NUMBER)
 	{
@@ -273,34 +354,67 @@ void PageFile::writePage(const PageId new_page_number, const Page& new_page) {
 	writePage(new_page_number, header, new_page);
 }
 
+void PageFile::writePages(const PageId first_page_number,
+                          const std::vector<const Page*>& pages) {
+  if (pages.empty()) {
+    return;
+  }
+  std::lock_guard<std::mutex> list_guard(list_latch_);
+  // Lay the pages out as they are on disk, keeping the next page pointers
+  // there like writePage() does.
+  std::vector<char> run(pages.size() * page_size_);
+  for (std::size_t i = 0; i < pages.size(); ++i) {
+    const PageId page_number = first_page_number + i;
+    PageHeader header = readPageHeader(page_number);
+    if (header.current_page_number == Page::INVALID_NUMBER) {
+      throw InvalidPageException(page_number, filename_);
+    }
+    const PageId next_page_number = header.next_page_number;
+    header = pages[i]->header_;
+    header.next_page_number = next_page_number;
+    char* image = &run[i * page_size_];
+    std::memcpy(image, &header, sizeof(PageHeader));
+    std::memcpy(image + sizeof(PageHeader), &pages[i]->data_[0],
+                page_size_ - sizeof(PageHeader));
+  }
+  std::lock_guard<std::mutex> guard(stream_latch_);
+  stream_->seekp(pagePosition(first_page_number), std::ios::beg);
+  stream_->write(&run[0], run.size());
+}
+
 void PageFile::deletePage(const PageId page_number) {
+  std::lock_guard<std::mutex> guard(list_latch_);
   FileHeader header = readHeader();
 
-  Page existing_page = readPage(page_number);
-  Page previous_page;
+  PageBuffer existing_page(page_size_);
+  readPage(page_number, *existing_page);
+  PageBuffer previous_page(page_size_);
   // If this page is the head of the used list, update the header to point to
   // the next page in line.
   if (page_number == header.first_used_page) {
-    header.first_used_page = existing_page.next_page_number();
+    header.first_used_page = existing_page->next_page_number();
   } else {
     // Walk the used list so we can update the page that points to this one.
-    for (FileIterator iter = begin(); iter != end(); ++iter) {
-      previous_page = *iter;
-      if (previous_page.next_page_number() == existing_page.page_number()) {
-        previous_page.set_next_page_number(existing_page.next_page_number());
+    PageId next_page_number = Page::INVALID_NUMBER;
+    for (PageId previous = header.first_used_page;
+         previous != Page::INVALID_NUMBER; previous = next_page_number) {
+      next_page_number = readPageHeader(previous).next_page_number;
+      if (next_page_number == page_number) {
+        readPage(previous, *previous_page);
+        previous_page->set_next_page_number(existing_page->next_page_number());
         break;
       }
     }
   }
   // Clear the page and add it to the head of the free list.
-  existing_page.initialize();
-  existing_page.set_next_page_number(header.first_free_page);
+  existing_page->initialize(page_size_);
+  existing_page->set_next_page_number(header.first_free_page);
   header.first_free_page = page_number;
   ++header.num_free_pages;
-  if (previous_page.isUsed()) {
-    writePage(previous_page.page_number(), previous_page.header_, previous_page);
+  if (previous_page->isUsed()) {
+    writePage(previous_page->page_number(), previous_page->header_, *previous_page);
   }
-  writePage(page_number, existing_page.header_, existing_page);
+  writePage(page_number, existing_page->header_, *existing_page);
   writeHeader(header);
 }
 
@@ -315,15 +429,16 @@ FileIterator PageFile::end() {
 
 void PageFile::writePage(const PageId page_number, const PageHeader& header,
                      const Page& new_page) {
+  std::lock_guard<std::mutex> guard(stream_latch_);
   stream_->seekp(pagePosition(page_number), std::ios::beg);
   stream_->write(reinterpret_cast<const char*>(&header), sizeof(PageHeader));
   stream_->write(reinterpret_cast<const char*>(&new_page.data_[0]),
-                 Page::DATA_SIZE);
-  stream_->flush();
+                 page_size_ - sizeof(PageHeader));
 }
 
 PageHeader PageFile::readPageHeader(PageId page_number) const {
   PageHeader header;
+  std::lock_guard<std::mutex> guard(stream_latch_);
   stream_->seekg(pagePosition(page_number), std::ios::beg);
   stream_->read(reinterpret_cast<char*>(&header), sizeof(PageHeader));
   return header;
@@ -332,16 +447,18 @@ PageHeader PageFile::readPageHeader(PageId page_number) const {
 
 
 
-BlobFile BlobFile::create(const std::string& filename) {
-  return BlobFile(filename, true /* create_new */);
+BlobFile BlobFile::create(const std::string& filename,
+                          const std::size_t page_size) {
+  return BlobFile(filename, true /* create_new */, page_size);
 }
 
 BlobFile BlobFile::open(const std::string& filename) {
   return BlobFile(filename, false /* create_new */);
 }
 
-BlobFile::BlobFile(const std::string& name, const bool create_new)
-: File(name, create_new) {
+BlobFile::BlobFile(const std::string& name, const bool create_new,
+                   const std::size_t page_size)
+: File(name, create_new, page_size) {
 }
 
 BlobFile::~BlobFile() {
@@ -358,12 +475,15 @@ BlobFile& BlobFile::operator=(const BlobFile& rhs) {
   close();	//close my file and associate me with the new one
   filename_ = rhs.filename_;
   openIfNeeded(false /* create_new */);
+  page_size_ = rhs.page_size_;
+  header_size_ = rhs.header_size_;
   return *this;
 }
 
-Page BlobFile::allocatePage(PageId &new_page_number) {
+void BlobFile::allocatePage(PageId &new_page_number, Page& new_page) {
+  std::lock_guard<std::mutex> guard(list_latch_);
   FileHeader header = readHeader();
-	Page new_page;
+	new_page.initialize(page_size_);
 
 	new_page_number = header.num_pages;
 
@@ -375,21 +495,52 @@ Page BlobFile::allocatePage(PageId &new_page_number) {
 
 	writePage(new_page_number, new_page);
 	writeHeader(header);
+}
 
-	return new_page;
+PageId BlobFile::allocateExtent(const PageId num_pages) {
+  std::lock_guard<std::mutex> guard(list_latch_);
+  FileHeader header = readHeader();
+	PageId first_page_number = header.num_pages;
+
+	if (header.first_used_page == Page::INVALID_NUMBER) {
+		header.first_used_page = header.num_pages;
+	}
+
+	header.num_pages += num_pages;
+
+	// Writing the last page extends the file over the whole run; the pages in
+	// between are left as a hole.
+	PageBuffer new_page(page_size_);
+	writePage(first_page_number + num_pages - 1, *new_page);
+	writeHeader(header);
+
+	return first_page_number;
 }
 
-Page BlobFile::readPage(const PageId page_number) const {
-	Page page;
+void BlobFile::readPage(const PageId page_number, Page& page) const {
+	std::lock_guard<std::mutex> guard(stream_latch_);
 	stream_->seekg(pagePosition(page_number), std::ios::beg);
-	stream_->read(reinterpret_cast<char*>(&page), Page::SIZE);
-	return page;
+	stream_->read(reinterpret_cast<char*>(&page), page_size_);
 }
 
 void BlobFile::writePage(const PageId new_page_number, const Page& new_page) {
+	std::lock_guard<std::mutex> guard(stream_latch_);
 	stream_->seekp(pagePosition(new_page_number), std::ios::beg);
-	stream_->write(reinterpret_cast<const char*>(&new_page), Page::SIZE);
-	stream_->flush();
+	stream_->write(reinterpret_cast<const char*>(&new_page), page_size_);
+}
+
+void BlobFile::writePages(const PageId first_page_number,
+                          const std::vector<const Page*>& pages) {
+	if (pages.empty()) {
+		return;
+	}
+	std::vector<char> run(pages.size() * page_size_);
+	for (std::size_t i = 0; i < pages.size(); ++i) {
+		std::memcpy(&run[i * page_size_], pages[i], page_size_);
+	}
+	std::lock_guard<std::mutex> guard(stream_latch_);
+	stream_->seekp(pagePosition(first_page_number), std::ios::beg);
+	stream_->write(&run[0], run.size());
 }
 
 //delePage should not be called for a blob_file, not supported
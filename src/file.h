@@ -7,10 +7,13 @@
 
 #pragma once
 
+#include <cstddef>
 #include <fstream>
 #include <string>
+#include <vector>
 #include <map>
 #include <memory>
+#include <mutex>
 
 #include "page.h"
 
@@ -42,6 +45,30 @@ struct FileHeader {
    */
   PageId first_free_page;
 
+  /**
+   * FORMAT in files whose header records the page size.  Headers of files
+   * written before end at this field, and their pages are LEGACY_PAGE_SIZE
+   * bytes.
+   */
+  std::uint32_t format;
+
+  /**
+   * Size in bytes of every page in the file, chosen when the file is created.
+   */
+  std::uint32_t page_size;
+
+  /**
+   * Value of format in files whose header records the page size.  A legacy
+   * file has its first page where format is; no page of a legacy PageFile or
+   * BlobFile starts with these bytes.
+   */
+  static const std::uint32_t FORMAT = 0xBADBDB01;
+
+  /**
+   * Page size of files without a format.
+   */
+  static const std::uint32_t LEGACY_PAGE_SIZE = 8192;
+
   /**
    * Returns true if this file header is equal to the other.
    *
@@ -52,7 +79,9 @@ struct FileHeader {
     return num_pages == rhs.num_pages &&
         num_free_pages == rhs.num_free_pages &&
         first_used_page == rhs.first_used_page &&
-        first_free_page == rhs.first_free_page;
+        first_free_page == rhs.first_free_page &&
+        format == rhs.format &&
+        page_size == rhs.page_size;
   }
 };
 
@@ -61,7 +90,7 @@ struct FileHeader {
  *        pages.
  *
  * The File class wraps a stream to an underlying file on disk.  Files contain
- * fixed-sized pages, and they never deallocate space (though they do reuse
+ * fixed-sized pages whose size is chosen per file at creation, and they never deallocate space (though they do reuse
  * deleted pages if possible).  If multiple File objects refer to the same
  * underlying file, they will share the stream in memory.
  * If a file that has already been opened (possibly by another query), then the File class
@@ -80,12 +109,19 @@ class File {
    *
    * @param name        Name of file.
    * @param create_new  Whether to create a new file.
+   * @param page_size   Page size in bytes of a new file.  Ignored when opening
+   *                    an existing file, whose page size is read from its
+   *                    header, or is FileHeader::LEGACY_PAGE_SIZE for a file
+   *                    written before the header recorded it.
    * @throws  FileExistsException     If the underlying file exists and
    *                                  create_new is true.
    * @throws  FileNotFoundException   If the underlying file doesn't exist and
    *                                  create_new is false.
+   * @throws  InvalidPageSizeException  If page_size, or the page size stored
+   *                                    in an existing file, is not supported.
    */
-  File(const std::string& name, const bool create_new);
+  File(const std::string& name, const bool create_new,
+       const std::size_t page_size = Page::SIZE);
 
   /**
    * Deletes an existing file.
@@ -111,6 +147,16 @@ class File {
    */
   static bool exists(const std::string& filename);
 
+  /**
+   * Forces the contents of a file to disk, flushing its stream first if the
+   * file is open.  Page writes only reach the operating system; this is what
+   * makes them survive a machine crash.
+   *
+   * @param filename  Name of the file.
+   * @return  False if the file exists but could not be synced.
+   */
+  static bool sync(const std::string& filename);
+
   /**
    * Destructor that automatically closes the underlying file if no other
    * File objects are using it.
@@ -120,9 +166,23 @@ class File {
   /**
    * Allocates a new page in the file.
    *
+   * @param new_page_number Set to the number of the new page.
    * @return The new page.
+   * @throws  InvalidPageSizeException  If the pages of the file are larger
+   *                                    than a Page value has room for.  Use
+   *                                    the overload below with a PageBuffer.
+   */
+  Page allocatePage(PageId &new_page_number);
+
+  /**
+   * Allocates a new page in the file and sets up the given page as its
+   * contents.  Only pageSize() bytes of the page are written, so it may be a
+   * buffer frame.
+   *
+   * @param new_page_number Set to the number of the new page.
+   * @param new_page        Page to set up.
    */
-  virtual Page allocatePage(PageId &new_page_number) = 0;
+  virtual void allocatePage(PageId &new_page_number, Page& new_page) = 0;
 
   /**
    * Reads an existing page from the file.
@@ -131,8 +191,22 @@ class File {
    * @return  The page.
    * @throws  InvalidPageException  If the page doesn't exist in the file or is
    *                                not currently used.
+   * @throws  InvalidPageSizeException  If the pages of the file are larger
+   *                                    than a Page value has room for.  Use
+   *                                    the overload below with a PageBuffer.
+   */
+  Page readPage(const PageId page_number) const;
+
+  /**
+   * Reads an existing page from the file into the given page.  Only
+   * pageSize() bytes of the page are written, so it may be a buffer frame.
+   *
+   * @param page_number   Number of page to read.
+   * @param page          Page to read into.
+   * @throws  InvalidPageException  If the page doesn't exist in the file or is
+   *                                not currently used.
    */
-  virtual Page readPage(const PageId page_number) const = 0;
+  virtual void readPage(const PageId page_number, Page& page) const = 0;
 
   /**
    * Writes a page into the file at the given page number.
@@ -143,6 +217,16 @@ class File {
    */
   virtual void writePage(const PageId page_number, const Page& new_page) = 0;
 
+  /**
+   * Writes consecutive pages into the file with a single write, as if each
+   * were written with writePage().
+   *
+   * @param first_page_number Number of the page to replace with pages[0].
+   * @param pages             Pages to write, one per page number.
+   */
+  virtual void writePages(const PageId first_page_number,
+                          const std::vector<const Page*>& pages) = 0;
+
   /**
    * Deletes a page from the file.
    *
@@ -157,6 +241,11 @@ class File {
    */
   const std::string& filename() const { return filename_; }
 
+  /**
+   * Returns the size in bytes of every page in the file.
+   */
+  std::size_t pageSize() const { return page_size_; }
+
  	/**
    * Returns pageid of first page in the file.
    *
@@ -164,6 +253,12 @@ class File {
    */
 	PageId getFirstPageNo();
 
+  /**
+   * Returns the number of pages in the file, counting the header and free
+   * pages.  Every page of the file has a smaller number.
+   */
+  PageId numPages() const;
+
  protected:
   /**
    * Returns the position of the page with the given number in the file (as an
@@ -172,8 +267,8 @@ class File {
    * @param page_number   Number of page.
    * @return  Position of page in file.
    */
-  static std::streampos pagePosition(const PageId page_number) {
-    return sizeof(FileHeader) + ((page_number - 1) * Page::SIZE);
+  std::streampos pagePosition(const PageId page_number) const {
+    return header_size_ + ((page_number - 1) * page_size_);
   }
 
   /**
@@ -223,6 +318,20 @@ class File {
    */
   static CountMap open_counts_;
 
+  /**
+   * Held while a stream is positioned and read or written, so threads using
+   * the same stream through different File objects do not move its position
+   * under each other.
+   */
+  static std::mutex stream_latch_;
+
+  /**
+   * Held while the header and the page lists of a file are read and changed,
+   * so allocations do not race each other or a write that keeps the next page
+   * pointer found on disk. Taken before stream_latch_.
+   */
+  static std::mutex list_latch_;
+
   /**
    * Name of the file this object represents.
    */
@@ -233,7 +342,19 @@ class File {
    */
   std::shared_ptr<std::fstream> stream_;
 
+  /**
+   * Size in bytes of every page in the file, as recorded in its header.
+   */
+  std::size_t page_size_;
+
+  /**
+   * Size in bytes of the header on disk, shorter than sizeof(FileHeader) for
+   * a file without a format.
+   */
+  std::size_t header_size_;
+
   friend class FileIterator;
+  friend class WriteAheadLog;
 };
 
 class PageFile : public File {
@@ -243,9 +364,12 @@ class PageFile : public File {
    * Creates a new file.
    *
    * @param filename  Name of the file.
+   * @param page_size Page size in bytes.
    * @throws  FileExistsException     If the requested file already exists.
+   * @throws  InvalidPageSizeException  If page_size is not supported.
    */
-  static PageFile create(const std::string& filename);
+  static PageFile create(const std::string& filename,
+                         const std::size_t page_size = Page::SIZE);
 
   /**
    * Opens the file named fileName and returns the corresponding File object.
@@ -264,12 +388,14 @@ class PageFile : public File {
    *
    * @param name        Name of file.
    * @param create_new  Whether to create a new file.
+   * @param page_size   Page size in bytes of a new file.
    * @throws  FileExistsException     If the underlying file exists and
    *                                  create_new is true.
    * @throws  FileNotFoundException   If the underlying file doesn't exist and
    *                                  create_new is false.
    */
-  PageFile(const std::string& name, const bool create_new);
+  PageFile(const std::string& name, const bool create_new,
+           const std::size_t page_size = Page::SIZE);
 
   /**
    * Copy constructor.
@@ -293,22 +419,27 @@ class PageFile : public File {
    */
   ~PageFile();
 
+  using File::allocatePage;
+  using File::readPage;
+
   /**
-   * Allocates a new page in the file.
+   * Allocates a new page in the file and sets up the given page as its
+   * contents.
    *
-   * @return The new page.
+   * @param new_page_number Set to the number of the new page.
+   * @param new_page        Page to set up.
    */
-  Page allocatePage(PageId &new_page_number);
+  void allocatePage(PageId &new_page_number, Page& new_page);
 
   /**
-   * Reads an existing page from the file.
+   * Reads an existing page from the file into the given page.
    *
    * @param page_number   Number of page to read.
-   * @return  The page.
+   * @param page          Page to read into.
    * @throws  InvalidPageException  If the page doesn't exist in the file or is
    *                                not currently used.
    */
-  Page readPage(const PageId page_number) const;
+  void readPage(const PageId page_number, Page& page) const;
 
   /**
    * Writes a page into the file at the given page number.
@@ -319,6 +450,18 @@ class PageFile : public File {
    */
   void writePage(const PageId page_number, const Page& new_page);
 
+  /**
+   * Writes consecutive pages into the file with a single write.  Like
+   * writePage(), the next page numbers on disk are kept.
+   *
+   * @param first_page_number Number of the page to replace with pages[0].
+   * @param pages             Pages to write, one per page number.
+   * @throws  InvalidPageException  If one of the pages has been deleted; then
+   *                                none of them is written.
+   */
+  void writePages(const PageId first_page_number,
+                  const std::vector<const Page*>& pages);
+
   /**
    * Deletes a page from the file.
    *
@@ -344,19 +487,18 @@ class PageFile : public File {
  private:
 
   /**
-   * Reads a page from the file.  If <allow_free> is not set, an exception
-   * will be thrown if the page read from disk is not currently in use.
-   *
-   * No bounds checking is performed; the underlying file stream will throw
-   * an exception if the page is past the end of the file.
+   * Reads a page from the file into the given page.  If <allow_free> is not
+   * set, an exception will be thrown if the page read from disk is not
+   * currently in use.  No bounds checking is performed.
    *
    * @param page_number   Number of page to read.
    * @param allow_free    Whether to allow reading a free (unused) page.
-   * @return  The page.
+   * @param page          Page to read into.
    * @throws  InvalidPageException  If the page is free (unused) and
    *                                allow_free is false.
    */
-  Page readPage(const PageId page_number, const bool allow_free) const;
+  void readPage(const PageId page_number, const bool allow_free,
+                Page& page) const;
 
   /**
    * Writes a page into the file at the given page number with the given header.
@@ -389,9 +531,12 @@ class BlobFile : public File {
    * Creates a new BlobFile.
    *
    * @param filename  Name of the file.
+   * @param page_size Page size in bytes.
    * @throws  FileExistsException     If the requested file already exists.
+   * @throws  InvalidPageSizeException  If page_size is not supported.
    */
-  static BlobFile create(const std::string& filename);
+  static BlobFile create(const std::string& filename,
+                         const std::size_t page_size = Page::SIZE);
 
   /**
    * Opens the file named fileName and returns the corresponding File object.
@@ -412,12 +557,14 @@ class BlobFile : public File {
    * @see File::open()
    * @param name        Name of file.
    * @param create_new  Whether to create a new file.
+   * @param page_size   Page size in bytes of a new file.
    * @throws  FileExistsException     If the underlying file exists and
    *                                  create_new is true.
    * @throws  FileNotFoundException   If the underlying file doesn't exist and
    *                                  create_new is false.
    */
-  BlobFile(const std::string& name, const bool create_new);
+  BlobFile(const std::string& name, const bool create_new,
+           const std::size_t page_size = Page::SIZE);
 
   /**
    * Copy constructor.
@@ -441,22 +588,37 @@ class BlobFile : public File {
    */
   ~BlobFile();
 
+  using File::allocatePage;
+  using File::readPage;
+
   /**
-   * Allocates a new page in the file.
+   * Allocates a new page in the file and sets up the given page as its
+   * contents.
    *
-   * @return The new page.
+   * @param new_page_number Set to the number of the new page.
+   * @param new_page        Page to set up.
    */
-  Page allocatePage(PageId &new_page_number);
+  void allocatePage(PageId &new_page_number, Page& new_page);
 
   /**
-   * Reads an existing page from the file.
+   * Reserves a run of consecutive pages at the end of the file in one step.
+   * The pages read back as zeros until they are written.  Callers hand them
+   * out themselves, e.g. through BufMgr::claimPage().
+   *
+   * @param num_pages   Number of pages to reserve.
+   * @return  Number of the first page of the run.
+   */
+  PageId allocateExtent(const PageId num_pages);
+
+  /**
+   * Reads an existing page from the file into the given page.
    *
    * @param page_number   Number of page to read.
-   * @return  The page.
+   * @param page          Page to read into.
    * @throws  InvalidPageException  If the page doesn't exist in the file or is
    *                                not currently used.
    */
-  Page readPage(const PageId page_number) const;
+  void readPage(const PageId page_number, Page& page) const;
 
   /**
    * Writes a page into the file at the given page number.
@@ -467,6 +629,15 @@ class BlobFile : public File {
    */
   void writePage(const PageId page_number, const Page& new_page);
 
+  /**
+   * Writes consecutive pages into the file with a single write.
+   *
+   * @param first_page_number Number of the page to replace with pages[0].
+   * @param pages             Pages to write, one per page number.
+   */
+  void writePages(const PageId first_page_number,
+                  const std::vector<const Page*>& pages);
+
   /**
    * Deletes a page from the file.
    *
@@ -53,7 +53,7 @@ void FileScan::scanNext(RecordId& outRid)
 		}
 	 
 		// read the first page of the file
-    bufMgr->readPage(file, (*filePageIter).page_number(), curPage); 
+    bufMgr->readPage(file, (*filePageIter).page_number(), curPage, &ring); 
 		curDirtyFlag = false;
 
 		// get the first record off the page
@@ -88,7 +88,7 @@ void FileScan::scanNext(RecordId& outRid)
     }
 
     // read the next page of the file
-    bufMgr->readPage(file, (*filePageIter).page_number(), curPage);
+    bufMgr->readPage(file, (*filePageIter).page_number(), curPage, &ring);
 
     // get the first record off the page
     pageRecordIter = curPage->begin(); 
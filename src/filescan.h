@@ -60,6 +60,11 @@ class FileScan
    * True if page has been updated
    */
   bool  	      curDirtyFlag;
+
+  /**
+   * Frames the scan recycles, so scanning a large relation leaves the rest of the pool alone.
+   */
+  BufferRing    ring;
 };
 
 }
@@ -0,0 +1,386 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include "frozenIndex.h"
+#include "exceptions/bad_index_info_exception.h"
+#include "exceptions/bad_opcodes_exception.h"
+#include "exceptions/bad_scanrange_exception.h"
+#include "exceptions/no_such_key_found_exception.h"
+#include "exceptions/scan_not_initialized_exception.h"
+#include "exceptions/index_scan_completed_exception.h"
+#include "exceptions/file_not_found_exception.h"
+#include "exceptions/invalid_page_size_exception.h"
+
+namespace badgerdb
+{
+
+static_assert(sizeof(FrozenIndexMetaInfo) <= Page::MIN_SIZE, "FrozenIndexMetaInfo must fit in the meta page.");
+
+// -----------------------------------------------------------------------------
+// FrozenIndexWriter
+// -----------------------------------------------------------------------------
+
+template <class T, std::size_t PAGESIZE>
+FrozenIndexWriter<T, PAGESIZE>::FrozenIndexWriter(const std::string & indexName,
+		BufMgr *bufMgrIn,
+		const std::string & relationName,
+		const int attrByteOffset,
+		const Datatype attrType)
+{
+	static_assert(sizeof(FrozenLeafNode<T, PAGESIZE>) <= PAGESIZE, "Leaf node must fit in a page.");
+
+	bufMgr = bufMgrIn;
+	try {
+		File::remove(indexName);
+	} catch(FileNotFoundException e) {
+	}
+	file = new BlobFile(indexName, true, PAGESIZE);
+
+	memset(&meta, 0, sizeof(meta));
+	strncpy(meta.relationName, relationName.c_str(), sizeof(meta.relationName));
+	meta.attrByteOffset = attrByteOffset;
+	meta.attrType = attrType;
+
+	PageId metaPageNo;
+	Page *metaPage;
+	bufMgr->allocPage(file, metaPageNo, metaPage);
+	bufMgr->unPinPage(file, metaPageNo, true);
+
+	leaf = NULL;
+	leafPageNo = 0;
+	leafEntries = 0;
+}
+
+template <class T, std::size_t PAGESIZE>
+FrozenIndexWriter<T, PAGESIZE>::~FrozenIndexWriter()
+{
+	if (leaf != NULL) {
+		bufMgr->unPinPage(file, leafPageNo, true);
+	}
+	bufMgr->commit();
+	bufMgr->flushFile(file);
+	delete file;
+}
+
+template <class T, std::size_t PAGESIZE>
+void FrozenIndexWriter<T, PAGESIZE>::append(const T & key, const RecordId rid)
+{
+	if (leaf == NULL || leafEntries == FrozenNodeCapacity<T, PAGESIZE>::LEAF) {
+		// Nothing else allocates pages of the file while the leaves are written, so they are consecutive
+		if (leaf != NULL) {
+			bufMgr->unPinPage(file, leafPageNo, true);
+		}
+		Page *page;
+		bufMgr->allocPage(file, leafPageNo, page);
+		leaf = (FrozenLeafNode<T, PAGESIZE>*)page;
+		leafEntries = 0;
+		if (meta.numLeaves == 0) {
+			meta.leafFirstPageNo = leafPageNo;
+		}
+		meta.numLeaves++;
+		leafKeys.push_back(key);
+	}
+	leaf->keyArray[leafEntries] = key;
+	leaf->ridArray[leafEntries] = rid;
+	leafEntries++;
+	meta.numEntries++;
+}
+
+template <class T, std::size_t PAGESIZE>
+void FrozenIndexWriter<T, PAGESIZE>::finish()
+{
+	if (leaf != NULL) {
+		bufMgr->unPinPage(file, leafPageNo, true);
+		leaf = NULL;
+	}
+
+	// Each level holds the smallest key of every node below, until one node is left
+	const std::size_t NONLEAF = FrozenNodeCapacity<T, PAGESIZE>::NONLEAF;
+	std::vector<T> keys;
+	keys.swap(leafKeys);
+	while (keys.size() > 1) {
+		std::vector<T> upper;
+		for (std::size_t first = 0; first < keys.size(); first += NONLEAF) {
+			PageId pageNo;
+			Page *page;
+			bufMgr->allocPage(file, pageNo, page);
+			if (first == 0) {
+				meta.levelFirstPageNo[meta.numLevels] = pageNo;
+			}
+			FrozenNonLeafNode<T, PAGESIZE> *node = (FrozenNonLeafNode<T, PAGESIZE>*)page;
+			const std::size_t count = std::min(NONLEAF, keys.size() - first);
+			std::copy(keys.begin() + first, keys.begin() + first + count, node->keyArray);
+			bufMgr->unPinPage(file, pageNo, true);
+			upper.push_back(keys[first]);
+		}
+		meta.levelNumPages[meta.numLevels] = upper.size();
+		meta.numLevels++;
+		keys.swap(upper);
+	}
+
+	Page *metaPage;
+	bufMgr->readPage(file, 1, metaPage);
+	memcpy((void*)metaPage, &meta, sizeof(meta));
+	bufMgr->unPinPage(file, 1, true);
+}
+
+template class FrozenIndexWriter<int, 4096>;
+template class FrozenIndexWriter<int, 8192>;
+template class FrozenIndexWriter<int, 16384>;
+template class FrozenIndexWriter<int, 32768>;
+template class FrozenIndexWriter<int, 65536>;
+template class FrozenIndexWriter<double, 4096>;
+template class FrozenIndexWriter<double, 8192>;
+template class FrozenIndexWriter<double, 16384>;
+template class FrozenIndexWriter<double, 32768>;
+template class FrozenIndexWriter<double, 65536>;
+template class FrozenIndexWriter<StringKey, 4096>;
+template class FrozenIndexWriter<StringKey, 8192>;
+template class FrozenIndexWriter<StringKey, 16384>;
+template class FrozenIndexWriter<StringKey, 32768>;
+template class FrozenIndexWriter<StringKey, 65536>;
+
+// -----------------------------------------------------------------------------
+// FrozenIndex::FrozenIndex -- Constructor
+// -----------------------------------------------------------------------------
+
+FrozenIndex::FrozenIndex(const std::string & indexName, BufMgr *bufMgrIn)
+{
+	bufMgr = bufMgrIn;
+	scanExecuting = false;
+	currentPageNum = 0;
+	currentPageData = NULL;
+	nextPos = 0;
+	endPos = 0;
+
+	file = new BlobFile(indexName, false);
+	try {
+		if (file->pageSize() > bufMgr->getFrameSize()) {
+			throw InvalidPageSizeException(file->pageSize(), indexName);
+		}
+
+		Page *metaPage;
+		bufMgr->readPage(file, 1, metaPage);
+		memcpy(&meta, metaPage, sizeof(meta));
+		bufMgr->unPinPage(file, 1, false);
+
+		switch (meta.attrType) {
+		case INTEGER:
+			bindKernelsForPageSize<int>(file->pageSize());
+			break;
+		case DOUBLE:
+			bindKernelsForPageSize<double>(file->pageSize());
+			break;
+		case STRING:
+			bindKernelsForPageSize<StringKey>(file->pageSize());
+			break;
+		default:
+			throw BadIndexInfoException("Unsupported attribute type.");
+		}
+	} catch(BadgerDbException & e) {
+		bufMgr->flushFile(file);
+		delete file;
+		throw;
+	}
+}
+
+template <class T>
+void FrozenIndex::bindKernelsForPageSize(const std::size_t pageSize)
+{
+	switch (pageSize) {
+	case 4096:
+		bindKernels<T, 4096>();
+		break;
+	case 8192:
+		bindKernels<T, 8192>();
+		break;
+	case 16384:
+		bindKernels<T, 16384>();
+		break;
+	case 32768:
+		bindKernels<T, 32768>();
+		break;
+	case 65536:
+		bindKernels<T, 65536>();
+		break;
+	default:
+		throw InvalidPageSizeException(pageSize, file->filename());
+	}
+}
+
+template <class T, std::size_t PAGESIZE>
+void FrozenIndex::bindKernels()
+{
+	typedef FrozenLeafNode<T, PAGESIZE> Leaf;
+	leafCapacity = FrozenNodeCapacity<T, PAGESIZE>::LEAF;
+	ridOffset = offsetof(Leaf, ridArray);
+	positionFn = &FrozenIndex::positionKernel<T, PAGESIZE>;
+	keyGreaterFn = &FrozenIndex::keyGreaterKernel<T>;
+}
+
+// -----------------------------------------------------------------------------
+// FrozenIndex::~FrozenIndex -- destructor
+// -----------------------------------------------------------------------------
+
+FrozenIndex::~FrozenIndex()
+{
+	if (scanExecuting) {
+		endScan();
+	}
+	bufMgr->flushFile(file);
+	delete file;
+}
+
+// -----------------------------------------------------------------------------
+// FrozenIndex::positionKernel
+// -----------------------------------------------------------------------------
+
+template <class T, std::size_t PAGESIZE>
+std::uint64_t FrozenIndex::positionKernel(const void *keyPtr, const bool strict)
+{
+	const T key = keyFromPtr<T>(keyPtr);
+	const std::uint64_t NONLEAF = FrozenNodeCapacity<T, PAGESIZE>::NONLEAF;
+	const std::uint64_t LEAF = FrozenNodeCapacity<T, PAGESIZE>::LEAF;
+	if (meta.numEntries == 0) {
+		return 0;
+	}
+
+	// The entries wanted start in the last child whose smallest key is below the key (or not above it if
+	// strict), or in the first child. The child of key i in node j is node j * NONLEAF + i of the next level.
+	std::uint64_t child = 0;
+	for (int level = meta.numLevels - 1; level >= 0; level--) {
+		const std::uint64_t below = level == 0 ? meta.numLeaves : meta.levelNumPages[level - 1];
+		const std::uint64_t count = std::min(NONLEAF, below - child * NONLEAF);
+		const PageId pageNo = meta.levelFirstPageNo[level] + child;
+		Page *page;
+		bufMgr->readPage(file, pageNo, page);
+		const T *keys = ((FrozenNonLeafNode<T, PAGESIZE>*)page)->keyArray;
+		const T *bound = strict ? std::upper_bound(keys, keys + count, key) : std::lower_bound(keys, keys + count, key);
+		const std::uint64_t i = bound - keys;
+		bufMgr->unPinPage(file, pageNo, false);
+		child = child * NONLEAF + (i == 0 ? 0 : i - 1);
+	}
+
+	// Every leaf but the last is full
+	const std::uint64_t count = std::min(LEAF, meta.numEntries - child * LEAF);
+	const PageId pageNo = meta.leafFirstPageNo + child;
+	Page *page;
+	bufMgr->readPage(file, pageNo, page);
+	const T *keys = ((FrozenLeafNode<T, PAGESIZE>*)page)->keyArray;
+	const T *bound = strict ? std::upper_bound(keys, keys + count, key) : std::lower_bound(keys, keys + count, key);
+	const std::uint64_t pos = child * LEAF + (bound - keys);
+	bufMgr->unPinPage(file, pageNo, false);
+	return pos;
+}
+
+template <class T>
+bool FrozenIndex::keyGreaterKernel(const void *a, const void *b)
+{
+	return keyFromPtr<T>(b) < keyFromPtr<T>(a);
+}
+
+// -----------------------------------------------------------------------------
+// FrozenIndex::lookup
+// -----------------------------------------------------------------------------
+
+void FrozenIndex::lookup(const void *key, std::vector<RecordId> & outRids)
+{
+	outRids.clear();
+	std::uint64_t pos = (this->*positionFn)(key, false);
+	const std::uint64_t end = (this->*positionFn)(key, true);
+	while (pos < end) {
+		const PageId pageNo = meta.leafFirstPageNo + pos / leafCapacity;
+		Page *page;
+		bufMgr->readPage(file, pageNo, page);
+		const RecordId *rids = (const RecordId*)((const char*)page + ridOffset);
+		for (; pos < end && meta.leafFirstPageNo + pos / leafCapacity == pageNo; pos++) {
+			outRids.push_back(rids[pos % leafCapacity]);
+		}
+		bufMgr->unPinPage(file, pageNo, false);
+	}
+	if (outRids.empty()) {
+		throw NoSuchKeyFoundException();
+	}
+}
+
+// -----------------------------------------------------------------------------
+// FrozenIndex::startScan
+// -----------------------------------------------------------------------------
+
+void FrozenIndex::startScan(const void* lowVal,
+		const Operator lowOp,
+		const void* highVal,
+		const Operator highOp)
+{
+	if (scanExecuting) {
+		endScan();
+	}
+	if ((lowOp != GTE && lowOp != GT) || (highOp != LT && highOp != LTE)) {
+		throw BadOpcodesException();
+	}
+	if ((this->*keyGreaterFn)(lowVal, highVal)) {
+		throw BadScanrangeException();
+	}
+
+	// The range is the positions from the first entry in it to the first one past it
+	nextPos = (this->*positionFn)(lowVal, lowOp == GT);
+	endPos = (this->*positionFn)(highVal, highOp == LTE);
+	if (nextPos >= endPos) {
+		throw NoSuchKeyFoundException();
+	}
+	scanExecuting = true;
+	currentPageNum = 0;
+}
+
+// -----------------------------------------------------------------------------
+// FrozenIndex::scanNext
+// -----------------------------------------------------------------------------
+
+void FrozenIndex::scanNext(RecordId& outRid)
+{
+	if (!scanExecuting) {
+		throw ScanNotInitializedException();
+	}
+	if (nextPos >= endPos) {
+		throw IndexScanCompletedException();
+	}
+
+	// The next leaf is the next page
+	const PageId pageNo = meta.leafFirstPageNo + nextPos / leafCapacity;
+	if (pageNo != currentPageNum) {
+		if (currentPageNum != 0) {
+			bufMgr->unPinPage(file, currentPageNum, false);
+		}
+		currentPageNum = 0;
+		bufMgr->readPage(file, pageNo, currentPageData);
+		currentPageNum = pageNo;
+	}
+	memcpy(&outRid, (const char*)currentPageData + ridOffset + (nextPos % leafCapacity) * sizeof(RecordId), sizeof(RecordId));
+	nextPos++;
+}
+
+// -----------------------------------------------------------------------------
+// FrozenIndex::endScan
+// -----------------------------------------------------------------------------
+
+void FrozenIndex::endScan()
+{
+	if (!scanExecuting) {
+		throw ScanNotInitializedException();
+	}
+	if (currentPageNum != 0) {
+		bufMgr->unPinPage(file, currentPageNum, false);
+		currentPageNum = 0;
+	}
+	scanExecuting = false;
+}
+
+}
@@ -0,0 +1,367 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "types.h"
+#include "page.h"
+#include "file.h"
+#include "buffer.h"
+#include "btree.h"
+
+namespace badgerdb
+{
+
+/**
+ * @brief Largest number of non-leaf levels of a FrozenIndex. Even with the smallest fanout this covers
+ * far more entries than a file can hold.
+ */
+const int MAXFROZENLEVELS = 8;
+
+/**
+ * @brief The meta page, which holds metadata for a FrozenIndex, is always the first page of the index file.
+*/
+struct FrozenIndexMetaInfo{
+  /**
+   * Name of base relation.
+   */
+	char relationName[20];
+
+  /**
+   * Offset of attribute, over which index is built, inside the record stored in pages.
+   */
+	int attrByteOffset;
+
+  /**
+   * Type of the attribute over which index is built.
+   */
+	Datatype attrType;
+
+  /**
+   * Number of entries in the index.
+   */
+	std::uint64_t numEntries;
+
+  /**
+   * Page number of the first leaf. The leaves follow it back to back.
+   */
+	PageId leafFirstPageNo;
+
+  /**
+   * Number of leaves.
+   */
+	std::uint32_t numLeaves;
+
+  /**
+   * Number of non-leaf levels, 0 if there is at most one leaf.
+   */
+	int numLevels;
+
+  /**
+   * Page number of the first page of every non-leaf level, from the one above the leaves up to the root.
+   */
+	PageId levelFirstPageNo[MAXFROZENLEVELS];
+
+  /**
+   * Number of pages of every non-leaf level.
+   */
+	std::uint32_t levelNumPages[MAXFROZENLEVELS];
+};
+
+/**
+ * @brief Number of entries in the pages of a FrozenIndex with keys of type T on pages of PAGESIZE bytes.
+ */
+template <class T, std::size_t PAGESIZE>
+struct FrozenNodeCapacity{
+  /**
+   * Entries of a leaf, which holds keys and record ids only.
+   */
+	static const int LEAF = PAGESIZE / ( sizeof( T ) + sizeof( RecordId ) );
+
+  /**
+   * Keys of a non-leaf node, which holds keys only.
+   */
+	static const int NONLEAF = PAGESIZE / sizeof( T );
+};
+
+/**
+ * @brief Structure for the leaves of a FrozenIndex. Every leaf but the last is full, so the number of entries
+ * follows from the position of the leaf, and the next leaf is the next page.
+*/
+template <class T, std::size_t PAGESIZE>
+struct FrozenLeafNode{
+  /**
+   * Stores keys.
+   */
+	T keyArray[ FrozenNodeCapacity< T, PAGESIZE >::LEAF ];
+
+  /**
+   * Stores RecordIds.
+   */
+	RecordId ridArray[ FrozenNodeCapacity< T, PAGESIZE >::LEAF ];
+};
+
+/**
+ * @brief Structure for the non-leaf nodes of a FrozenIndex. Key i of node j of a level is the smallest key below
+ * child j * NONLEAF + i of the level underneath, so no page numbers are stored. Every node but the last of its level
+ * is full.
+*/
+template <class T, std::size_t PAGESIZE>
+struct FrozenNonLeafNode{
+  /**
+   * Stores keys.
+   */
+	T keyArray[ FrozenNodeCapacity< T, PAGESIZE >::NONLEAF ];
+};
+
+/**
+ * @brief Writes a FrozenIndex with pages of PAGESIZE bytes from entries handed over in key order. Leaves are
+ * written as the entries come, the non-leaf levels when the last entry is in.
+*/
+template <class T, std::size_t PAGESIZE>
+class FrozenIndexWriter {
+
+ private:
+
+  /**
+   * File object for the index file.
+   */
+	BlobFile	*file;
+
+  /**
+   * Buffer Manager Instance.
+   */
+	BufMgr	*bufMgr;
+
+  /**
+   * Meta information of the index, written by finish().
+   */
+	FrozenIndexMetaInfo	meta;
+
+  /**
+   * Leaf being filled, pinned while it has entries.
+   */
+	FrozenLeafNode<T, PAGESIZE>	*leaf;
+
+  /**
+   * Page number of the leaf being filled.
+   */
+	PageId	leafPageNo;
+
+  /**
+   * Number of entries in the leaf being filled.
+   */
+	int			leafEntries;
+
+  /**
+   * Smallest key of every leaf, the keys of the level above the leaves.
+   */
+	std::vector<T>	leafKeys;
+
+ public:
+
+  /**
+   * Create the index file, replacing any file of the same name.
+   *
+   * @param indexName         Name of the index file.
+   * @param bufMgrIn          Buffer Manager Instance
+   * @param relationName      Name of the base relation.
+   * @param attrByteOffset    Offset of the indexed attribute in the records.
+   * @param attrType          Datatype of the indexed attribute.
+   */
+	FrozenIndexWriter(const std::string & indexName, BufMgr *bufMgrIn, const std::string & relationName,
+										const int attrByteOffset, const Datatype attrType);
+
+  /**
+   * Flush the index file and close it.
+   */
+	~FrozenIndexWriter();
+
+  /**
+   * Add an entry. Entries must come in key order.
+   */
+	void append(const T & key, const RecordId rid);
+
+  /**
+   * Write the non-leaf levels and the meta page once every entry was appended.
+   */
+	void finish();
+};
+
+/**
+ * @brief FrozenIndex class. A read-only index written by BTreeIndex::freeze().
+ *
+ * The index is a static B+ tree with an implicit layout. Every node is full, each level is stored in a
+ * run of consecutive pages, and the child of a key is found by arithmetic on its position instead of a
+ * stored page number. Leaves hold no sibling link and non-leaf nodes hold no page numbers, so a non-leaf
+ * node has about twice the fanout of a BTreeIndex node and the tree is as small and shallow as the keys
+ * allow. A scan walks the leaves as consecutive pages.
+*/
+class FrozenIndex {
+
+ private:
+
+  /**
+   * File object for the index file.
+   */
+	BlobFile	*file;
+
+  /**
+   * Buffer Manager Instance.
+   */
+	BufMgr	*bufMgr;
+
+  /**
+   * Meta information of the index, read when it is opened.
+   */
+	FrozenIndexMetaInfo	meta;
+
+  /**
+   * Number of entries in a leaf.
+   */
+	int			leafCapacity;
+
+  /**
+   * Offset of the record ids in a leaf.
+   */
+	std::size_t	ridOffset;
+
+  /**
+   * True if an index scan has been started.
+   */
+	bool		scanExecuting;
+
+  /**
+   * Position, in key order, of the next entry to be scanned.
+   */
+	std::uint64_t	nextPos;
+
+  /**
+   * Position of the first entry past the scan range.
+   */
+	std::uint64_t	endPos;
+
+  /**
+   * Page number of the leaf being scanned, 0 if no leaf is pinned.
+   */
+	PageId	currentPageNum;
+
+  /**
+   * Leaf being scanned.
+   */
+	Page		*currentPageData;
+
+  /**
+   * Position of the first entry whose key is not less than the given one, or, if strict, greater than it.
+   */
+	template <class T, std::size_t PAGESIZE>
+	std::uint64_t positionKernel(const void* key, const bool strict);
+
+  /**
+   * True if the first key is greater than the second one.
+   */
+	template <class T>
+	bool keyGreaterKernel(const void* a, const void* b);
+
+  /**
+   * Point the kernels below at the instantiations for keys of type T on pages of PAGESIZE bytes and set
+   * leafCapacity and ridOffset.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void bindKernels();
+
+  /**
+   * Call bindKernels() for keys of type T with the PAGESIZE matching the page size of the index file.
+   *
+   * @param pageSize    Page size of the index file in bytes.
+   */
+	template <class T>
+	void bindKernelsForPageSize(const std::size_t pageSize);
+
+  /**
+   * Instantiation of positionKernel() chosen for the attribute type and the page size.
+   */
+	std::uint64_t (FrozenIndex::*positionFn)(const void*, const bool);
+
+  /**
+   * Instantiation of keyGreaterKernel() chosen for the attribute type.
+   */
+	bool (FrozenIndex::*keyGreaterFn)(const void*, const void*);
+
+ public:
+
+  /**
+   * FrozenIndex Constructor. Open an index file written by BTreeIndex::freeze().
+   *
+   * @param indexName         Name of the index file.
+   * @param bufMgrIn          Buffer Manager Instance
+   * @throws  FileNotFoundException     If the index file does not exist.
+   * @throws  InvalidPageSizeException  If the page size of the index file is not supported, or its pages do not
+   *                                    fit in the frames of bufMgrIn.
+   */
+	FrozenIndex(const std::string & indexName, BufMgr *bufMgrIn);
+
+  /**
+   * FrozenIndex Destructor. End any initialized scan and close the index file.
+   */
+	~FrozenIndex();
+
+  /**
+	 * Find the record ids of all entries with the given key.
+   * @param key			Key to look up, pointer to integer/double/char string
+   * @param outRids	Record ids of the entries returned in this, in the order they were in the BTreeIndex.
+	 * @throws  NoSuchKeyFoundException If no entry has the key.
+	**/
+	void lookup(const void* key, std::vector<RecordId> & outRids);
+
+  /**
+	 * Begin a filtered scan of the index, like BTreeIndex::startScan().
+   * @param lowVal	Low value of range, pointer to integer / double / char string
+   * @param lowOp		Low operator (GT/GTE)
+   * @param highVal	High value of range, pointer to integer / double / char string
+   * @param highOp	High operator (LT/LTE)
+   * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values
+   * @throws  BadScanrangeException If lowVal > highval
+	 * @throws  NoSuchKeyFoundException If there is no key in the index that satisfies the scan criteria.
+	**/
+	void startScan(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
+
+  /**
+	 * Fetch the record id of the next index entry that matches the scan.
+   * @param outRid	RecordId of next record found that satisfies the scan criteria returned in this
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	 * @throws IndexScanCompletedException If no more records, satisfying the scan criteria, are left to be scanned.
+	**/
+	void scanNext(RecordId& outRid);
+
+  /**
+	 * Terminate the current scan and unpin the leaf being scanned.
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	**/
+	void endScan();
+
+  /**
+   * Number of entries in the index.
+   */
+	std::uint64_t size() const { return meta.numEntries; }
+
+  /**
+   * Number of leaves.
+   */
+	std::uint32_t numLeaves() const { return meta.numLeaves; }
+
+  /**
+   * Number of levels of the tree, leaves included.
+   */
+	int height() const { return meta.numLevels + 1; }
+};
+
+}
@@ -0,0 +1,566 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include "hashIndex.h"
+#include "filescan.h"
+#include "exceptions/bad_index_info_exception.h"
+#include "exceptions/no_such_key_found_exception.h"
+#include "exceptions/file_not_found_exception.h"
+#include "exceptions/end_of_file_exception.h"
+#include "exceptions/invalid_page_size_exception.h"
+
+namespace badgerdb
+{
+
+static_assert(sizeof(HashIndexMetaInfo) <= Page::MIN_SIZE, "HashIndexMetaInfo must fit in the meta page.");
+
+// -----------------------------------------------------------------------------
+// HashIndex::HashIndex -- Constructor
+// -----------------------------------------------------------------------------
+
+HashIndex::HashIndex(const std::string & relationName,
+		std::string & outIndexName,
+		BufMgr *bufMgrIn,
+		const int attrByteOffset,
+		const Datatype attrType,
+		const std::size_t pageSize)
+{
+	bufMgr = bufMgrIn;
+	headerPageNum = 1;
+
+	std::ostringstream idxStr;
+	idxStr << relationName << '.' << attrByteOffset << ".hash";
+	outIndexName = idxStr.str();
+
+	attributeType = attrType;
+	this->attrByteOffset = attrByteOffset;
+	globalDepth = 0;
+	dirFirstPageNo = 0;
+	dirNumPages = 0;
+	freePageNo = 0;
+	numEntries = 0;
+	metaDirty = true;
+	directoryDirty = true;
+
+	if (attributeType != INTEGER && attributeType != DOUBLE && attributeType != STRING) {
+		throw BadIndexInfoException("Unsupported attribute type.");
+	}
+
+	bool created = false;
+	try {
+		file = new BlobFile(outIndexName, false);
+	} catch(FileNotFoundException e) {
+		file = new BlobFile(outIndexName, true, pageSize);
+		created = true;
+	}
+
+	try {
+		if (file->pageSize() > bufMgr->getFrameSize()) {
+			throw InvalidPageSizeException(file->pageSize(), outIndexName);
+		}
+		dirEntriesPerPage = file->pageSize() / sizeof(PageId);
+
+		// Pick the kernels for the key type and page size once, every later call goes straight to them
+		switch (attributeType) {
+		case INTEGER:
+			bindKernelsForPageSize<int>(file->pageSize());
+			break;
+		case DOUBLE:
+			bindKernelsForPageSize<double>(file->pageSize());
+			break;
+		default:
+			bindKernelsForPageSize<StringKey>(file->pageSize());
+			break;
+		}
+
+		if (!created) {
+			Page *metaPage;
+			bufMgr->readPage(file, headerPageNum, metaPage);
+			HashIndexMetaInfo *meta = (HashIndexMetaInfo*)metaPage;
+			if (meta->attrType != attributeType || meta->attrByteOffset != attrByteOffset) {
+				bufMgr->unPinPage(file, headerPageNum, false);
+				bufMgr->flushFile(file);
+				throw BadIndexInfoException("Index file " + outIndexName + " was built over a different attribute.");
+			}
+			globalDepth = meta->globalDepth;
+			dirFirstPageNo = meta->dirFirstPageNo;
+			dirNumPages = meta->dirNumPages;
+			freePageNo = meta->freePageNo;
+			numEntries = meta->numEntries;
+			bufMgr->unPinPage(file, headerPageNum, false);
+
+			directory.resize(std::size_t(1) << globalDepth);
+			for (int i = 0; i < dirNumPages; i++) {
+				const std::size_t first = i * dirEntriesPerPage;
+				const std::size_t count = std::min(dirEntriesPerPage, directory.size() - first);
+				Page *dirPage;
+				bufMgr->readPage(file, dirFirstPageNo + i, dirPage);
+				memcpy(&directory[first], dirPage, count * sizeof(PageId));
+				bufMgr->unPinPage(file, dirFirstPageNo + i, false);
+			}
+			metaDirty = false;
+			directoryDirty = false;
+		}
+	} catch(BadgerDbException & e) {
+		delete file;
+		if (created) {
+			File::remove(outIndexName);
+		}
+		throw;
+	}
+
+	if (created) {
+		Page *metaPage;
+		bufMgr->allocPage(file, headerPageNum, metaPage);
+		HashIndexMetaInfo *meta = (HashIndexMetaInfo*)metaPage;
+		strncpy(meta->relationName, relationName.c_str(), sizeof(meta->relationName));
+		bufMgr->unPinPage(file, headerPageNum, true);
+
+		// A single bucket of depth 0 takes every key until it fills
+		PageId bucketPageNo;
+		Page *bucketPage;
+		allocBucketPage(bucketPageNo, bucketPage);
+		memset((void*)bucketPage, 0, file->pageSize());
+		bufMgr->unPinPage(file, bucketPageNo, true);
+		directory.push_back(bucketPageNo);
+
+		FileScan fscan(relationName, bufMgr);
+		try
+		{
+			RecordId scanRid;
+			while(1)
+			{
+				fscan.scanNext(scanRid);
+				std::string recordStr = fscan.getRecord();
+				const char *record = recordStr.c_str();
+				insertEntry(record + attrByteOffset, scanRid);
+			}
+		}
+		catch(EndOfFileException e)
+		{
+		}
+		writeMeta();
+	}
+	commitChanges();
+}
+
+template <class T>
+void HashIndex::bindKernelsForPageSize(const std::size_t pageSize)
+{
+	switch (pageSize) {
+	case 4096:
+		bindKernels<T, 4096>();
+		break;
+	case 8192:
+		bindKernels<T, 8192>();
+		break;
+	case 16384:
+		bindKernels<T, 16384>();
+		break;
+	case 32768:
+		bindKernels<T, 32768>();
+		break;
+	case 65536:
+		bindKernels<T, 65536>();
+		break;
+	default:
+		throw InvalidPageSizeException(pageSize, file->filename());
+	}
+}
+
+template <class T, std::size_t PAGESIZE>
+void HashIndex::bindKernels()
+{
+	static_assert(sizeof(HashBucket<T, PAGESIZE>) <= PAGESIZE, "Bucket must fit in a page.");
+
+	insertEntryFn = &HashIndex::insertEntryKernel<T, PAGESIZE>;
+	deleteEntryFn = &HashIndex::deleteEntryKernel<T, PAGESIZE>;
+	lookupFn = &HashIndex::lookupKernel<T, PAGESIZE>;
+}
+
+// -----------------------------------------------------------------------------
+// HashIndex::~HashIndex -- destructor
+// -----------------------------------------------------------------------------
+
+HashIndex::~HashIndex()
+{
+	writeMeta();
+	bufMgr->commit();
+	bufMgr->flushFile(file);
+	delete file;
+}
+
+// -----------------------------------------------------------------------------
+// HashIndex::writeMeta
+// -----------------------------------------------------------------------------
+
+void HashIndex::writeMeta()
+{
+	if (directoryDirty) {
+		const int numPages = (directory.size() + dirEntriesPerPage - 1) / dirEntriesPerPage;
+		if (numPages > dirNumPages) {
+			// The old run becomes bucket pages. Nothing else allocates in between, so the new run is contiguous.
+			for (int i = 0; i < dirNumPages; i++) {
+				freeBucketPage(dirFirstPageNo + i);
+			}
+			for (int i = 0; i < numPages; i++) {
+				PageId newPageNo;
+				Page *newPage;
+				bufMgr->allocPage(file, newPageNo, newPage);
+				if (i == 0) {
+					dirFirstPageNo = newPageNo;
+				}
+				bufMgr->unPinPage(file, newPageNo, true);
+			}
+			dirNumPages = numPages;
+		}
+
+		for (int i = 0; i < numPages; i++) {
+			const std::size_t first = i * dirEntriesPerPage;
+			const std::size_t count = std::min(dirEntriesPerPage, directory.size() - first);
+			Page *dirPage;
+			bufMgr->readPage(file, dirFirstPageNo + i, dirPage);
+			memcpy((void*)dirPage, &directory[first], count * sizeof(PageId));
+			bufMgr->unPinPage(file, dirFirstPageNo + i, true);
+		}
+		directoryDirty = false;
+		metaDirty = true;
+	}
+
+	if (metaDirty) {
+		Page *metaPage;
+		bufMgr->readPage(file, headerPageNum, metaPage);
+		HashIndexMetaInfo *meta = (HashIndexMetaInfo*)metaPage;
+		meta->attrByteOffset = attrByteOffset;
+		meta->attrType = attributeType;
+		meta->globalDepth = globalDepth;
+		meta->dirFirstPageNo = dirFirstPageNo;
+		meta->dirNumPages = dirNumPages;
+		meta->freePageNo = freePageNo;
+		meta->numEntries = numEntries;
+		bufMgr->unPinPage(file, headerPageNum, true);
+		metaDirty = false;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// HashIndex::commitChanges
+// -----------------------------------------------------------------------------
+
+void HashIndex::commitChanges()
+{
+	if (!bufMgr->hasLog()) {
+		return;
+	}
+	writeMeta();
+	bufMgr->commit();
+}
+
+// -----------------------------------------------------------------------------
+// HashIndex::allocBucketPage
+// -----------------------------------------------------------------------------
+
+void HashIndex::allocBucketPage(PageId & pageNo, Page *& page)
+{
+	if (freePageNo == 0) {
+		bufMgr->allocPage(file, pageNo, page);
+		return;
+	}
+	pageNo = freePageNo;
+	bufMgr->readPage(file, pageNo, page);
+	memcpy(&freePageNo, page, sizeof(PageId));
+	metaDirty = true;
+}
+
+void HashIndex::freeBucketPage(const PageId pageNo)
+{
+	Page *page;
+	bufMgr->readPage(file, pageNo, page);
+	memcpy((void*)page, &freePageNo, sizeof(PageId));
+	bufMgr->unPinPage(file, pageNo, true);
+	freePageNo = pageNo;
+	metaDirty = true;
+}
+
+// -----------------------------------------------------------------------------
+// HashIndex::insertEntry
+// -----------------------------------------------------------------------------
+
+void HashIndex::insertEntry(const void *key, const RecordId rid)
+{
+	(this->*insertEntryFn)(key, rid);
+	commitChanges();
+}
+
+template <class T, std::size_t PAGESIZE>
+void HashIndex::insertEntryKernel(const void *keyPtr, const RecordId rid)
+{
+	const int CAPACITY = HashBucketCapacity<T, PAGESIZE>::ENTRIES;
+	const T key = keyFromPtr<T>(keyPtr);
+	const std::uint64_t hash = keyHash(key);
+
+	while (true) {
+		PageId pageNo = directory[hash & (directory.size() - 1)];
+		Page *page;
+		bufMgr->readPage(file, pageNo, page);
+		HashBucket<T, PAGESIZE> *bucket = (HashBucket<T, PAGESIZE>*)page;
+		if (bucket->numEntries < CAPACITY) {
+			bucket->keyArray[bucket->numEntries] = key;
+			bucket->ridArray[bucket->numEntries] = rid;
+			bucket->numEntries++;
+			bufMgr->unPinPage(file, pageNo, true);
+			break;
+		}
+		const int localDepth = bucket->localDepth;
+		bufMgr->unPinPage(file, pageNo, false);
+
+		if (localDepth < MAXGLOBALDEPTH && !chainSharesHash<T, PAGESIZE>(pageNo, hash)) {
+			splitBucket<T, PAGESIZE>(hash);
+			continue;
+		}
+
+		// No split can make room, so the entry goes on the first overflow page with room, or a new one
+		while (true) {
+			bufMgr->readPage(file, pageNo, page);
+			bucket = (HashBucket<T, PAGESIZE>*)page;
+			if (bucket->numEntries < CAPACITY) {
+				bucket->keyArray[bucket->numEntries] = key;
+				bucket->ridArray[bucket->numEntries] = rid;
+				bucket->numEntries++;
+				bufMgr->unPinPage(file, pageNo, true);
+				break;
+			}
+			PageId nextPageNo = bucket->overflowPageNo;
+			if (nextPageNo == 0) {
+				Page *newPage;
+				allocBucketPage(nextPageNo, newPage);
+				HashBucket<T, PAGESIZE> *overflow = (HashBucket<T, PAGESIZE>*)newPage;
+				overflow->keyArray[0] = key;
+				overflow->ridArray[0] = rid;
+				overflow->numEntries = 1;
+				overflow->overflowPageNo = 0;
+				overflow->localDepth = 0;
+				bufMgr->unPinPage(file, nextPageNo, true);
+				bucket->overflowPageNo = nextPageNo;
+				bufMgr->unPinPage(file, pageNo, true);
+				break;
+			}
+			bufMgr->unPinPage(file, pageNo, false);
+			pageNo = nextPageNo;
+		}
+		break;
+	}
+
+	numEntries++;
+	metaDirty = true;
+}
+
+template <class T, std::size_t PAGESIZE>
+bool HashIndex::chainSharesHash(const PageId firstPageNo, const std::uint64_t hash)
+{
+	PageId pageNo = firstPageNo;
+	while (pageNo != 0) {
+		Page *page;
+		bufMgr->readPage(file, pageNo, page);
+		HashBucket<T, PAGESIZE> *bucket = (HashBucket<T, PAGESIZE>*)page;
+		bool shared = true;
+		for (int i = 0; i < bucket->numEntries && shared; i++) {
+			shared = keyHash(bucket->keyArray[i]) == hash;
+		}
+		PageId nextPageNo = bucket->overflowPageNo;
+		bufMgr->unPinPage(file, pageNo, false);
+		if (!shared) {
+			return false;
+		}
+		pageNo = nextPageNo;
+	}
+	return true;
+}
+
+template <class T, std::size_t PAGESIZE>
+void HashIndex::splitBucket(const std::uint64_t hash)
+{
+	const PageId oldPageNo = directory[hash & (directory.size() - 1)];
+	Page *oldPage;
+	bufMgr->readPage(file, oldPageNo, oldPage);
+	HashBucket<T, PAGESIZE> *bucket = (HashBucket<T, PAGESIZE>*)oldPage;
+	const int localDepth = bucket->localDepth;
+
+	// Take every entry out of the chain; the overflow pages are rebuilt as needed
+	std::vector< RIDKeyPair<T> > entries(bucket->numEntries);
+	for (int i = 0; i < bucket->numEntries; i++) {
+		entries[i].set(bucket->ridArray[i], bucket->keyArray[i]);
+	}
+	PageId pageNo = bucket->overflowPageNo;
+	while (pageNo != 0) {
+		Page *page;
+		bufMgr->readPage(file, pageNo, page);
+		HashBucket<T, PAGESIZE> *overflow = (HashBucket<T, PAGESIZE>*)page;
+		for (int i = 0; i < overflow->numEntries; i++) {
+			RIDKeyPair<T> entry;
+			entry.set(overflow->ridArray[i], overflow->keyArray[i]);
+			entries.push_back(entry);
+		}
+		PageId nextPageNo = overflow->overflowPageNo;
+		bufMgr->unPinPage(file, pageNo, false);
+		freeBucketPage(pageNo);
+		pageNo = nextPageNo;
+	}
+
+	if (localDepth == globalDepth) {
+		const std::size_t size = directory.size();
+		directory.resize(2 * size);
+		std::copy(directory.begin(), directory.begin() + size, directory.begin() + size);
+		globalDepth++;
+	}
+
+	std::vector< RIDKeyPair<T> > stay;
+	std::vector< RIDKeyPair<T> > move;
+	for (std::size_t i = 0; i < entries.size(); i++) {
+		if ((keyHash(entries[i].key) >> localDepth) & 1) {
+			move.push_back(entries[i]);
+		} else {
+			stay.push_back(entries[i]);
+		}
+	}
+
+	PageId newPageNo;
+	Page *newPage;
+	allocBucketPage(newPageNo, newPage);
+	writeChain<T, PAGESIZE>(oldPageNo, oldPage, localDepth + 1, stay);
+	writeChain<T, PAGESIZE>(newPageNo, newPage, localDepth + 1, move);
+
+	// The directory entries that shared the old bucket and have the new bit set now lead to the new one
+	const std::size_t step = std::size_t(1) << localDepth;
+	for (std::size_t i = (hash & (step - 1)) | step; i < directory.size(); i += 2 * step) {
+		directory[i] = newPageNo;
+	}
+	directoryDirty = true;
+}
+
+template <class T, std::size_t PAGESIZE>
+void HashIndex::writeChain(const PageId firstPageNo, Page *firstPage, const int localDepth, const std::vector< RIDKeyPair<T> > & entries)
+{
+	const int CAPACITY = HashBucketCapacity<T, PAGESIZE>::ENTRIES;
+	PageId pageNo = firstPageNo;
+	HashBucket<T, PAGESIZE> *bucket = (HashBucket<T, PAGESIZE>*)firstPage;
+	bucket->localDepth = localDepth;
+	std::size_t next = 0;
+	while (true) {
+		bucket->numEntries = 0;
+		bucket->overflowPageNo = 0;
+		while (next < entries.size() && bucket->numEntries < CAPACITY) {
+			bucket->keyArray[bucket->numEntries] = entries[next].key;
+			bucket->ridArray[bucket->numEntries] = entries[next].rid;
+			bucket->numEntries++;
+			next++;
+		}
+		if (next == entries.size()) {
+			bufMgr->unPinPage(file, pageNo, true);
+			return;
+		}
+
+		PageId overflowPageNo;
+		Page *overflowPage;
+		allocBucketPage(overflowPageNo, overflowPage);
+		bucket->overflowPageNo = overflowPageNo;
+		bufMgr->unPinPage(file, pageNo, true);
+		pageNo = overflowPageNo;
+		bucket = (HashBucket<T, PAGESIZE>*)overflowPage;
+		bucket->localDepth = 0;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// HashIndex::deleteEntry
+// -----------------------------------------------------------------------------
+
+void HashIndex::deleteEntry(const void *key, const RecordId rid)
+{
+	(this->*deleteEntryFn)(key, rid);
+	commitChanges();
+}
+
+template <class T, std::size_t PAGESIZE>
+void HashIndex::deleteEntryKernel(const void *keyPtr, const RecordId rid)
+{
+	const T key = keyFromPtr<T>(keyPtr);
+	PageId pageNo = directory[keyHash(key) & (directory.size() - 1)];
+	PageId prevPageNo = 0;
+	while (pageNo != 0) {
+		Page *page;
+		bufMgr->readPage(file, pageNo, page);
+		HashBucket<T, PAGESIZE> *bucket = (HashBucket<T, PAGESIZE>*)page;
+		for (int i = 0; i < bucket->numEntries; i++) {
+			if (bucket->keyArray[i] == key && bucket->ridArray[i] == rid) {
+				// Entries are unordered, the last one fills the gap
+				const int last = bucket->numEntries - 1;
+				bucket->keyArray[i] = bucket->keyArray[last];
+				bucket->ridArray[i] = bucket->ridArray[last];
+				bucket->numEntries--;
+				const bool emptyOverflow = bucket->numEntries == 0 && prevPageNo != 0;
+				const PageId nextPageNo = bucket->overflowPageNo;
+				bufMgr->unPinPage(file, pageNo, true);
+
+				if (emptyOverflow) {
+					Page *prevPage;
+					bufMgr->readPage(file, prevPageNo, prevPage);
+					((HashBucket<T, PAGESIZE>*)prevPage)->overflowPageNo = nextPageNo;
+					bufMgr->unPinPage(file, prevPageNo, true);
+					freeBucketPage(pageNo);
+				}
+				numEntries--;
+				metaDirty = true;
+				return;
+			}
+		}
+		PageId nextPageNo = bucket->overflowPageNo;
+		bufMgr->unPinPage(file, pageNo, false);
+		prevPageNo = pageNo;
+		pageNo = nextPageNo;
+	}
+	throw NoSuchKeyFoundException();
+}
+
+// -----------------------------------------------------------------------------
+// HashIndex::lookup
+// -----------------------------------------------------------------------------
+
+void HashIndex::lookup(const void *key, std::vector<RecordId> & outRids)
+{
+	(this->*lookupFn)(key, outRids);
+}
+
+template <class T, std::size_t PAGESIZE>
+void HashIndex::lookupKernel(const void *keyPtr, std::vector<RecordId> & outRids)
+{
+	const T key = keyFromPtr<T>(keyPtr);
+	outRids.clear();
+	PageId pageNo = directory[keyHash(key) & (directory.size() - 1)];
+	while (pageNo != 0) {
+		Page *page;
+		bufMgr->readPage(file, pageNo, page);
+		HashBucket<T, PAGESIZE> *bucket = (HashBucket<T, PAGESIZE>*)page;
+		for (int i = 0; i < bucket->numEntries; i++) {
+			if (bucket->keyArray[i] == key) {
+				outRids.push_back(bucket->ridArray[i]);
+			}
+		}
+		PageId nextPageNo = bucket->overflowPageNo;
+		bufMgr->unPinPage(file, pageNo, false);
+		pageNo = nextPageNo;
+	}
+	if (outRids.empty()) {
+		throw NoSuchKeyFoundException();
+	}
+}
+
+}
@@ -0,0 +1,359 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "types.h"
+#include "page.h"
+#include "file.h"
+#include "buffer.h"
+#include "btree.h"
+
+namespace badgerdb
+{
+
+/**
+ * @brief Largest global depth of a HashIndex directory. A bucket that is full at this depth, or whose
+ * entries all share one hash value, grows a chain of overflow pages instead of splitting.
+ */
+const int MAXGLOBALDEPTH = 20;
+
+/**
+ * @brief The meta page, which holds metadata for a HashIndex, is always the first page of the index file.
+ * The directory is kept in a separate run of pages.
+*/
+struct HashIndexMetaInfo{
+  /**
+   * Name of base relation.
+   */
+	char relationName[20];
+
+  /**
+   * Offset of attribute, over which index is built, inside the record stored in pages.
+   */
+	int attrByteOffset;
+
+  /**
+   * Type of the attribute over which index is built.
+   */
+	Datatype attrType;
+
+  /**
+   * Number of low hash bits that select a directory entry. The directory has 2^globalDepth entries.
+   */
+	int globalDepth;
+
+  /**
+   * Page number of the first page of the directory run.
+   */
+	PageId dirFirstPageNo;
+
+  /**
+   * Number of consecutive pages reserved for the directory.
+   */
+	int dirNumPages;
+
+  /**
+   * First page of the list of pages freed by splits and deletes, 0 if the list is empty.
+   */
+	PageId freePageNo;
+
+  /**
+   * Number of entries in the index.
+   */
+	std::uint64_t numEntries;
+};
+
+/**
+ * @brief Number of entries in a HashBucket for key type T on pages of PAGESIZE bytes. A bucket is laid out
+ * like a leaf of a BTreeIndex with one more int.
+ */
+template <class T, std::size_t PAGESIZE>
+struct HashBucketCapacity{
+	static const int ENTRIES = NodeCapacity< T, PAGESIZE - sizeof( std::uint64_t ) >::LEAF;
+};
+
+/**
+ * @brief Structure for the bucket pages of a HashIndex with keys of type T on pages of PAGESIZE bytes, and
+ * for the overflow pages chained to them. Entries are kept in insertion order.
+*/
+template <class T, std::size_t PAGESIZE>
+struct HashBucket{
+  /**
+   * Stores keys.
+   */
+	T keyArray[ HashBucketCapacity< T, PAGESIZE >::ENTRIES ];
+
+  /**
+   * Stores RecordIds.
+   */
+	RecordId ridArray[ HashBucketCapacity< T, PAGESIZE >::ENTRIES ];
+
+  /**
+   * Page number of the next overflow page of the bucket, 0 for the last page of the chain.
+   */
+	PageId overflowPageNo;
+
+  /**
+   * Stores number of entries in this page.
+   */
+	int numEntries;
+
+  /**
+   * Number of low hash bits shared by every key of the bucket. Only kept in the first page of a chain.
+   */
+	int localDepth;
+};
+
+/**
+ * @brief HashIndex class. An extendible hash index on a single attribute of a relation, for equality
+ * lookups only. A directory of 2^globalDepth bucket page numbers, kept in memory while the index is
+ * open, is indexed by the low bits of the key hash, so a lookup reads a single bucket page. A full bucket
+ * is split in two on the next hash bit, doubling the directory when the bucket was the only one at its
+ * depth. Emptied buckets are not merged.
+*/
+class HashIndex {
+
+ private:
+
+  /**
+   * File object for the index file.
+   */
+	BlobFile	*file;
+
+  /**
+   * Buffer Manager Instance.
+   */
+	BufMgr	*bufMgr;
+
+  /**
+   * Page number of meta page.
+   */
+	PageId	headerPageNum;
+
+  /**
+   * Datatype of attribute over which index is built.
+   */
+	Datatype	attributeType;
+
+  /**
+   * Offset of attribute, over which index is built, inside records.
+   */
+	int 		attrByteOffset;
+
+  /**
+   * Number of low hash bits that select a directory entry.
+   */
+	int			globalDepth;
+
+  /**
+   * Page number of the first bucket page for every value of the low globalDepth hash bits.
+   */
+	std::vector<PageId>	directory;
+
+  /**
+   * Page number of the first page of the directory run on disk, 0 before the directory was first written.
+   */
+	PageId	dirFirstPageNo;
+
+  /**
+   * Number of pages in the directory run.
+   */
+	int			dirNumPages;
+
+  /**
+   * Number of directory entries held by one directory page.
+   */
+	std::size_t	dirEntriesPerPage;
+
+  /**
+   * First page of the free list. Free pages hold the page number of the next one in their first bytes.
+   */
+	PageId	freePageNo;
+
+  /**
+   * Number of entries in the index.
+   */
+	std::uint64_t	numEntries;
+
+  /**
+   * True if the meta page is out of date.
+   */
+	bool		metaDirty;
+
+  /**
+   * True if the directory pages are out of date.
+   */
+	bool		directoryDirty;
+
+  /**
+   * Allocate a page for a bucket or an overflow page, from the free list if it is not empty.
+   *
+   * @param pageNo      Page number returned via this reference.
+   * @param page        Pinned page returned via this reference.
+   */
+	void allocBucketPage(PageId & pageNo, Page *& page);
+
+  /**
+   * Put an unpinned page on the free list.
+   *
+   * @param pageNo      Page number.
+   */
+	void freeBucketPage(const PageId pageNo);
+
+  /**
+   * Bring the meta page, and the directory pages if they changed, up to date.
+   */
+	void writeMeta();
+
+  /**
+   * End of a public operation. If the buffer manager logs its changes, bring the meta page up to date and
+   * commit, so the operation is replayed as a whole or not at all after a crash.
+   */
+	void commitChanges();
+
+  /**
+   * Body of insertEntry() for keys of type T on pages of PAGESIZE bytes.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void insertEntryKernel(const void* key, const RecordId rid);
+
+  /**
+   * Body of deleteEntry() for keys of type T on pages of PAGESIZE bytes.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void deleteEntryKernel(const void* key, const RecordId rid);
+
+  /**
+   * Body of lookup() for keys of type T on pages of PAGESIZE bytes.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void lookupKernel(const void* key, std::vector<RecordId> & outRids);
+
+  /**
+   * True if every entry in the chain starting at pageNo has the given hash, so no split can separate them.
+   *
+   * @param pageNo      First page of the chain.
+   * @param hash        Hash to compare with.
+   */
+	template <class T, std::size_t PAGESIZE>
+	bool chainSharesHash(const PageId pageNo, const std::uint64_t hash);
+
+  /**
+   * Split the bucket the given hash selects on its next hash bit, doubling the directory first if needed.
+   *
+   * @param hash        Hash of the key that did not fit.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void splitBucket(const std::uint64_t hash);
+
+  /**
+   * Fill a pinned, empty bucket page with entries, chaining overflow pages as needed, and unpin it.
+   *
+   * @param pageNo      Page number of the bucket.
+   * @param page        The pinned bucket page.
+   * @param localDepth  Local depth of the bucket.
+   * @param entries     Entries to store.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void writeChain(const PageId pageNo, Page *page, const int localDepth, const std::vector< RIDKeyPair<T> > & entries);
+
+  /**
+   * Point the kernels below at the instantiations for keys of type T on pages of PAGESIZE bytes.
+   */
+	template <class T, std::size_t PAGESIZE>
+	void bindKernels();
+
+  /**
+   * Call bindKernels() for keys of type T with the PAGESIZE matching the page size of the index file.
+   *
+   * @param pageSize    Page size of the index file in bytes.
+   */
+	template <class T>
+	void bindKernelsForPageSize(const std::size_t pageSize);
+
+  /**
+   * Instantiation of insertEntryKernel() chosen for attributeType and the page size.
+   */
+	void (HashIndex::*insertEntryFn)(const void*, const RecordId);
+
+  /**
+   * Instantiation of deleteEntryKernel() chosen for attributeType and the page size.
+   */
+	void (HashIndex::*deleteEntryFn)(const void*, const RecordId);
+
+  /**
+   * Instantiation of lookupKernel() chosen for attributeType and the page size.
+   */
+	void (HashIndex::*lookupFn)(const void*, std::vector<RecordId>&);
+
+ public:
+
+  /**
+   * HashIndex Constructor.
+	 * Open the index file if it exists. If not, create it and insert entries for every tuple in the base
+	 * relation using FileScan class. The index file is named relationName.attrByteOffset.hash.
+   *
+   * @param relationName        Name of file.
+   * @param outIndexName        Return the name of index file.
+   * @param bufMgrIn						Buffer Manager Instance
+   * @param attrByteOffset			Offset of attribute, over which index is to be built, in the record
+   * @param attrType						Datatype of attribute over which index is built
+   * @param pageSize						Page size of a new index file, which sets the bucket size. Ignored if the index file exists.
+   * @throws  BadIndexInfoException     If the index file already exists for a different attribute.
+   * @throws  InvalidPageSizeException  If pageSize is not supported, or the pages of the index file do not fit in
+   *                                    the frames of bufMgrIn.
+   */
+	HashIndex(const std::string & relationName, std::string & outIndexName,
+						BufMgr *bufMgrIn,	const int attrByteOffset,	const Datatype attrType,
+						const std::size_t pageSize = Page::SIZE);
+
+  /**
+   * HashIndex Destructor.
+	 * Write the meta page and the directory, flush the index file and close it.
+	 */
+	~HashIndex();
+
+  /**
+	 * Insert a new entry using the pair <value,rid>.
+   * @param key			Key to insert, pointer to integer/double/char string
+   * @param rid			Record ID of a record whose entry is getting inserted into the index.
+	**/
+	void insertEntry(const void* key, const RecordId rid);
+
+  /**
+	 * Delete the entry <value,rid>.
+   * @param key			Key of the entry, pointer to integer/double/char string
+   * @param rid			Record ID of the entry.
+	 * @throws  NoSuchKeyFoundException If the index holds no such entry.
+	**/
+	void deleteEntry(const void* key, const RecordId rid);
+
+  /**
+	 * Find the record ids of all entries with the given key.
+   * @param key			Key to look up, pointer to integer/double/char string
+   * @param outRids	Record ids of the entries returned in this, in no particular order.
+	 * @throws  NoSuchKeyFoundException If no entry has the key.
+	**/
+	void lookup(const void* key, std::vector<RecordId> & outRids);
+
+  /**
+   * Number of entries in the index.
+   */
+	std::uint64_t size() const { return numEntries; }
+
+  /**
+   * Number of low hash bits that select a directory entry.
+   */
+	int depth() const { return globalDepth; }
+};
+
+}
@@ -0,0 +1,138 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "leafModel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace badgerdb
+{
+
+LeafModel::LeafModel(const int maxErrorIn)
+	: maxError(std::max(maxErrorIn, 1)),
+	  drift(0)
+{
+}
+
+void LeafModel::build(const std::vector<double> & lowerKeysIn, const std::vector<PageId> & pageNosIn)
+{
+	lowerKeys = lowerKeysIn;
+	pageNos = pageNosIn;
+	fit();
+}
+
+void LeafModel::fit()
+{
+	// Greedy shrinking cone: extend each piece while some slope through its first point keeps every
+	// point within maxError positions.
+	segments.clear();
+	drift = 0;
+	const std::size_t n = lowerKeys.size();
+	std::size_t first = 0;
+	while (first < n) {
+		double lowSlope = -std::numeric_limits<double>::infinity();
+		double highSlope = std::numeric_limits<double>::infinity();
+		std::size_t next = first + 1;
+		for (; next < n; next++) {
+			const double dx = lowerKeys[next] - lowerKeys[first];
+			const double dy = (double)( next - first );
+			if (dx <= 0) {
+				// Equal keys are all predicted at the position of the first one
+				if (dy > maxError) {
+					break;
+				}
+				continue;
+			}
+			const double low = std::max(lowSlope, ( dy - maxError ) / dx);
+			const double high = std::min(highSlope, ( dy + maxError ) / dx);
+			if (low > high) {
+				break;
+			}
+			lowSlope = low;
+			highSlope = high;
+		}
+
+		Segment segment;
+		segment.firstKey = lowerKeys[first];
+		segment.firstPos = (double)first;
+		segment.slope = std::isinf(highSlope) ? 0 : std::max(( lowSlope + highSlope ) / 2, 0.0);
+		segments.push_back(segment);
+		first = next;
+	}
+}
+
+double LeafModel::predict(const double key) const
+{
+	std::size_t lo = 0;
+	std::size_t hi = segments.size();
+	while (hi - lo > 1) {
+		const std::size_t mid = ( lo + hi ) / 2;
+		if (segments[mid].firstKey <= key) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	const Segment & segment = segments[lo];
+	return segment.firstPos + segment.slope * std::max(key - segment.firstKey, 0.0);
+}
+
+PageId LeafModel::findLeaf(const double key, const bool strict) const
+{
+	const std::vector<double>::const_iterator begin = lowerKeys.begin();
+	const std::vector<double>::const_iterator end = lowerKeys.end();
+	const long n = lowerKeys.size();
+
+	// Search the positions the prediction can be off by; fall back to the whole range if the answer is outside
+	const double p = std::floor(predict(key));
+	const long lo = (long)std::max(0.0, std::min((double)n, p - maxError - 1));
+	const long hi = (long)std::max(0.0, std::min((double)n, p + maxError + drift + 2));
+	std::vector<double>::const_iterator bound;
+	if (strict) {
+		const bool inside = ( lo == 0 || lowerKeys[lo - 1] <= key ) && ( hi == n || key < lowerKeys[hi] );
+		bound = inside ? std::upper_bound(begin + lo, begin + hi, key) : std::upper_bound(begin, end, key);
+	} else {
+		const bool inside = ( lo == 0 || lowerKeys[lo - 1] < key ) && ( hi == n || key <= lowerKeys[hi] );
+		bound = inside ? std::lower_bound(begin + lo, begin + hi, key) : std::lower_bound(begin, end, key);
+	}
+	return bound == begin ? pageNos[0] : pageNos[bound - begin - 1];
+}
+
+void LeafModel::splitLeaf(const PageId leftPageNo, const PageId rightPageNo, const double rightKey)
+{
+	// The split leaf is near the predicted position of its new separator
+	const long n = pageNos.size();
+	const long p = std::min(std::max((long)predict(rightKey), 0L), n - 1);
+	long left = -1;
+	for (long d = 0; left < 0 && ( p - d >= 0 || p + d < n ); d++) {
+		if (p - d >= 0 && pageNos[p - d] == leftPageNo) {
+			left = p - d;
+		} else if (p + d < n && pageNos[p + d] == leftPageNo) {
+			left = p + d;
+		}
+	}
+	if (left < 0) {
+		// The model missed a change to the leaf chain, drop it so it is built again
+		lowerKeys.clear();
+		pageNos.clear();
+		segments.clear();
+		return;
+	}
+
+	// The lower half may hold keys below the old lower key, but none below the new separator
+	lowerKeys[left] = std::min(lowerKeys[left], rightKey);
+	lowerKeys.insert(lowerKeys.begin() + left + 1, rightKey);
+	pageNos.insert(pageNos.begin() + left + 1, rightPageNo);
+	drift++;
+	if (drift > maxError) {
+		fit();
+	}
+}
+
+}
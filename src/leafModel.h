@@ -0,0 +1,140 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "types.h"
+
+namespace badgerdb
+{
+
+/**
+ * @brief Learned map from a key to the leaf of a BTreeIndex where a scan for it starts.
+ *
+ * The model keeps the leaves in key order, each with a lower key: the smallest key of the leaf when
+ * the model was built, or the separator the leaf got when it was split off. A piecewise-linear
+ * function, fitted so that it is off by at most maxError positions for every lower key, predicts the
+ * position of a key among the lower keys, and a binary search over the few positions around the
+ * prediction finds the leaf. No non-leaf page is read.
+ *
+ * Lower keys never fall below the separator of their leaf, so the leaf found never lies to the right of
+ * the first entry wanted; at worst the scan starts one leaf early and walks right. Leaf splits are applied
+ * as they happen. Each widens the search by a position until the function is refitted, after maxError splits.
+ *
+ * @warning This class is not threadsafe.
+ */
+class LeafModel
+{
+ public:
+  /**
+   * Constructor of LeafModel class. The model is empty until build() is called.
+   *
+   * @param maxError    Largest distance between the predicted and the actual position of a lower key.
+   */
+	LeafModel(const int maxError);
+
+  /**
+   * Replace the leaves of the model and fit the function to them.
+   *
+   * @param lowerKeys   Lower key of every leaf, in leaf chain order.
+   * @param pageNos     Page number of every leaf, in leaf chain order.
+   */
+	void build(const std::vector<double> & lowerKeys, const std::vector<PageId> & pageNos);
+
+  /**
+   * Leaf where a scan for keys from key onwards starts: the last leaf whose lower key is below key, or not above it
+   * if strict, and the first leaf if there is none.
+   *
+   * @param key         Low end of the scan.
+   * @param strict      True for scans of keys greater than key, false for keys not less than key.
+   * @return            Page number of the leaf.
+   */
+	PageId findLeaf(const double key, const bool strict) const;
+
+  /**
+   * Record that a leaf was split.
+   *
+   * @param leftPageNo    Page number of the leaf that was split, which keeps the lower half.
+   * @param rightPageNo   Page number of the new leaf right of it.
+   * @param rightKey      Smallest key of the new leaf, its separator in the parent.
+   *
+   * If the split leaf is not in the model, the model is emptied and has to be built again.
+   */
+	void splitLeaf(const PageId leftPageNo, const PageId rightPageNo, const double rightKey);
+
+  /**
+   * Number of leaves in the model.
+   */
+	std::size_t numLeaves() const { return pageNos.size(); }
+
+  /**
+   * Number of linear pieces of the function.
+   */
+	std::size_t numSegments() const { return segments.size(); }
+
+ private:
+  /**
+   * @brief One piece of the function, used from its first key up to the first key of the next piece.
+   */
+	struct Segment {
+	  /**
+	   * Lower key the piece starts at.
+	   */
+		double firstKey;
+
+	  /**
+	   * Position of firstKey.
+	   */
+		double firstPos;
+
+	  /**
+	   * Positions per key unit.
+	   */
+		double slope;
+	};
+
+  /**
+   * Largest error of the fitted function.
+   */
+	int maxError;
+
+  /**
+   * Number of splits since the function was fitted.
+   */
+	int drift;
+
+  /**
+   * Lower key of every leaf, in leaf chain order.
+   */
+	std::vector<double> lowerKeys;
+
+  /**
+   * Page number of every leaf, in leaf chain order.
+   */
+	std::vector<PageId> pageNos;
+
+  /**
+   * Pieces of the function, ordered by first key.
+   */
+	std::vector<Segment> segments;
+
+  /**
+   * Fit the function to the lower keys.
+   */
+	void fit();
+
+  /**
+   * Predicted position of a key among the lower keys.
+   */
+	double predict(const double key) const;
+};
+
+}
@@ -8,7 +8,16 @@
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <thread>
+#include <functional>
+#include <utility>
 #include "btree.h"
+#include "memBTree.h"
+#include "hashIndex.h"
+#include "bitmapIndex.h"
+#include "frozenIndex.h"
+#include "partitionedIndex.h"
+#include "wal.h"
 #include "page.h"
 #include "filescan.h"
 #include "page_iterator.h"
@@ -21,6 +30,12 @@
 #include "exceptions/bad_opcodes_exception.h"
 #include "exceptions/scan_not_initialized_exception.h"
 #include "exceptions/end_of_file_exception.h"
+#include "exceptions/invalid_page_size_exception.h"
+#include "exceptions/bad_index_info_exception.h"
+#include "exceptions/hash_already_present_exception.h"
+#include "exceptions/hash_not_found_exception.h"
+#include "exceptions/page_pinned_exception.h"
+#include "exceptions/buffer_exceeded_exception.h"
 
 #define checkPassFail(a, b) 																				\
 {																																		\
@@ -70,7 +85,53 @@ void createRelationForward();
 void createRelationBackward();
 void createRelationRandom();
 void intTests();
-int intScan(BTreeIndex *index, int lowVal, Operator lowOp, int highVal, Operator highOp);
+void doubleTests();
+void stringTests();
+void bloomFilterTests();
+void pageSizeTests();
+void legacyFileTests();
+void memIndexTests();
+void walTests();
+void bufferedTests();
+void memtableTests();
+void hashIndexTests();
+void bitmapIndexTests();
+void frozenIndexTests();
+void leafModelTests();
+void partitionedIndexTests();
+void ridUpdateTests();
+void bufHashTblTests();
+void concurrentBufferTests();
+void concurrentBufferTask(BufMgr *pool, File *file, const int thread, int *errors);
+void concurrentMissTask(BufMgr *pool, File *file, int *errors);
+void concurrentScanTask(BufMgr *pool, File *file, int *errors);
+void concurrentAllocTask(BufMgr *pool, File *file, std::vector<PageId> *pages);
+void forEachPolicy(const std::string & fileName, const int numPages,
+                   const std::function<void(PageFile & file, ReplacementPolicyKind policy, const char* policyName)> & test);
+void replacementPolicyTests();
+void bufferRingTests();
+void backgroundWriterTests();
+void prefetchTests();
+void sortedFlushTests();
+void poolMemoryTests();
+void poolResizeTests();
+void pageHandleTests();
+bool flushUnpinned(BufMgr *pool, File *file);
+void claimPageTests();
+void keyRids(BTreeIndex *index, int key, std::vector<RecordId> & outRids);
+void copyFile(const std::string & from, const std::string & to);
+void defragmentTests(BTreeIndex * index);
+void nonLeafSplitTests();
+void reopenAttributeTests();
+void rootLeafTests();
+template <class Index>
+int intScan(Index *index, int lowVal, Operator lowOp, int highVal, Operator highOp);
+template <class Index>
+int doubleScan(Index *index, double lowVal, Operator lowOp, double highVal, Operator highOp);
+template <class Index>
+int stringScan(Index *index, int lowVal, Operator lowOp, int highVal, Operator highOp);
+template <class Index>
+int countScan(Index *index, const void* lowVal, Operator lowOp, const void* highVal, Operator highOp);
 void indexTests();
 void test1();
 void test2();
@@ -352,6 +413,7 @@ void indexTests()
   if(testNum == 1)
   {
     intTests();
+    reopenAttributeTests();
 		try
 		{
 			File::remove(intIndexName);
@@ -359,6 +421,90 @@ void indexTests()
   	catch(FileNotFoundException e)
   	{
   	}
+
+    nonLeafSplitTests();
+		try
+		{
+			File::remove(intIndexName);
+		}
+  	catch(FileNotFoundException e)
+  	{
+  	}
+
+    rootLeafTests();
+
+    doubleTests();
+		try
+		{
+			File::remove(doubleIndexName);
+		}
+  	catch(FileNotFoundException e)
+  	{
+  	}
+
+    stringTests();
+		try
+		{
+			File::remove(stringIndexName);
+		}
+  	catch(FileNotFoundException e)
+  	{
+  	}
+
+    bloomFilterTests();
+		try
+		{
+			File::remove(intIndexName);
+		}
+  	catch(FileNotFoundException e)
+  	{
+  	}
+
+    memIndexTests();
+
+    pageSizeTests();
+
+    legacyFileTests();
+
+    walTests();
+
+    bufferedTests();
+
+    memtableTests();
+
+    hashIndexTests();
+
+    bitmapIndexTests();
+
+    frozenIndexTests();
+
+    leafModelTests();
+
+    partitionedIndexTests();
+
+    ridUpdateTests();
+
+    bufHashTblTests();
+
+    concurrentBufferTests();
+
+    replacementPolicyTests();
+
+    bufferRingTests();
+
+    backgroundWriterTests();
+
+    prefetchTests();
+
+    sortedFlushTests();
+
+    poolMemoryTests();
+
+    poolResizeTests();
+
+    pageHandleTests();
+
+    claimPageTests();
   }
 }
 
@@ -380,26 +526,2236 @@ void intTests()
 	checkPassFail(intScan(&index,300,GT,400,LT), 99)
 	checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
 
+	// Scans that run off the last leaf, endScan() unpins it once
+	checkPassFail(intScan(&index,relationSize-5,GTE,relationSize+5,LT), 5)
+	checkPassFail(intScan(&index,0,GTE,relationSize,LTE), relationSize)
+
 	// additional tests
 	additionalTests(&index,25,GT,40,LT);
+
+	defragmentTests(&index);
 }
 
-int intScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operator highOp)
+// -----------------------------------------------------------------------------
+// doubleTests
+// -----------------------------------------------------------------------------
+
+void doubleTests()
 {
-  RecordId scanRid;
-	Page *curPage;
+  std::cout << "Create a B+ Tree index on the double field" << std::endl;
+  BTreeIndex index(relationName, doubleIndexName, bufMgr, offsetof(tuple,d), DOUBLE);
 
-  std::cout << "Scan for ";
-  if( lowOp == GT ) { std::cout << "("; } else { std::cout << "["; }
-  std::cout << lowVal << "," << highVal;
-  if( highOp == LT ) { std::cout << ")"; } else { std::cout << "]"; }
-  std::cout << std::endl;
+	// run some tests
+	checkPassFail(doubleScan(&index,25,GT,40,LT), 14)
+	checkPassFail(doubleScan(&index,20,GTE,35,LTE), 16)
+	checkPassFail(doubleScan(&index,-3,GT,3,LT), 3)
+	checkPassFail(doubleScan(&index,996,GT,1001,LT), 4)
+	checkPassFail(doubleScan(&index,0,GT,1,LT), 0)
+	checkPassFail(doubleScan(&index,300,GT,400,LT), 99)
+	checkPassFail(doubleScan(&index,3000,GTE,4000,LT), 1000)
+	checkPassFail(doubleScan(&index,24.5,GT,25.5,LT), 1)
+}
+
+// -----------------------------------------------------------------------------
+// stringTests
+// -----------------------------------------------------------------------------
+
+void stringTests()
+{
+  std::cout << "Create a B+ Tree index on the string field" << std::endl;
+  BTreeIndex index(relationName, stringIndexName, bufMgr, offsetof(tuple,s), STRING, true);
+
+	// run some tests
+	checkPassFail(stringScan(&index,10,GT,20,LT), 9)
+	checkPassFail(stringScan(&index,20,GTE,35,LTE), 16)
+	checkPassFail(stringScan(&index,996,GT,1001,LT), 4)
+	checkPassFail(stringScan(&index,0,GT,1,LT), 0)
+	checkPassFail(stringScan(&index,300,GT,400,LT), 99)
+	checkPassFail(stringScan(&index,3000,GTE,4000,LT), 1000)
+	checkPassFail(stringScan(&index,4321,GTE,4321,LTE), 1)
+	checkPassFail(stringScan(&index,relationSize+10,GTE,relationSize+10,LTE), 0)
+
+	// Defragmentation rewrites string leaves just like integer ones
+	while (!index.defragment(0.8, 1))
+	{
+	}
+	checkPassFail(stringScan(&index,300,GT,400,LT), 99)
+	checkPassFail(stringScan(&index,0,GTE,relationSize,LT), relationSize)
+}
+
+// -----------------------------------------------------------------------------
+// defragmentTests
+// -----------------------------------------------------------------------------
+
+void defragmentTests(BTreeIndex * index)
+{
+	std::cout << "Defragment the leaf level while a scan is open" << std::endl;
+
+	int lowVal = 0;
+	int highVal = relationSize;
+	RecordId scanRid;
+	int numResults = 0;
+	index->startScan(&lowVal, GTE, &highVal, LT);
+	for (; numResults < 700; numResults++)
+	{
+		index->scanNext(scanRid);
+	}
+
+	// Interleave defragmentation steps with the open scan
+	int steps = 0;
+	bool done = false;
+	while (!done)
+	{
+		done = index->defragment(0.8, 2);
+		steps++;
+		try
+		{
+			index->scanNext(scanRid);
+			numResults++;
+		}
+		catch(IndexScanCompletedException e)
+		{
+		}
+	}
+	while (1)
+	{
+		try
+		{
+			index->scanNext(scanRid);
+		}
+		catch(IndexScanCompletedException e)
+		{
+			break;
+		}
+		numResults++;
+	}
+	index->endScan();
+	std::cout << "Defragmented in " << steps << " steps" << std::endl;
+	checkPassFail(numResults, relationSize)
+
+	checkPassFail(intScan(index,25,GT,40,LT), 14)
+	checkPassFail(intScan(index,996,GT,1001,LT), 4)
+	checkPassFail(intScan(index,3000,GTE,4000,LT), 1000)
+}
+
+// -----------------------------------------------------------------------------
+// reopenAttributeTests
+// -----------------------------------------------------------------------------
+
+void reopenAttributeTests()
+{
+  std::cout << "Reopen the integer index file as an index on the double field" << std::endl;
+	// The file name only records the offset, the meta page records the type the keys were built with
+	bool refused = false;
+	try
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), DOUBLE);
+	}
+	catch(BadIndexInfoException e)
+	{
+		refused = true;
+	}
+	checkPassFail(refused, true)
+
+	// The refused open leaves the file usable by the right attribute
+	BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+	checkPassFail(intScan(&index,25,GT,40,LT), 14)
+}
+
+// -----------------------------------------------------------------------------
+// nonLeafSplitTests
+// -----------------------------------------------------------------------------
+
+void nonLeafSplitTests()
+{
+  std::cout << "Grow a B+ Tree index past two levels, so full non-leaf nodes split" << std::endl;
+	// A non-leaf node of small pages holds more entries than a leaf, and its split copies them all out
+	BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, false, Page::MIN_SIZE);
+	const int numInserts = 150000;
+	RecordId newRid = {1, 1};
+	for (int key = relationSize; key < relationSize + numInserts; key++)
+	{
+		index.insertEntry(&key, newRid);
+	}
+
+	checkPassFail(intScan(&index,300,GT,400,LT), 99)
+	checkPassFail(intScan(&index,relationSize-10,GTE,relationSize+10,LT), 20)
+	checkPassFail(intScan(&index,0,GTE,relationSize+numInserts,LT), relationSize+numInserts)
+}
+
+// -----------------------------------------------------------------------------
+// rootLeafTests
+// -----------------------------------------------------------------------------
+
+void rootLeafTests()
+{
+  std::cout << "Scan a B+ Tree index whose root is its only leaf" << std::endl;
+	// Small pages in the default pool leave the rest of each frame behind the leaf, past numEntries the
+	// scan would find rids and stale bytes it must not take for keys
+	std::string relName = "rootLeaf.rel";
+	std::string indexName;
+	{
+		PageFile relFile = PageFile::create(relName);
+	}
+	{
+		BTreeIndex index(relName, indexName, bufMgr, 0, INTEGER, false, Page::MIN_SIZE);
+		RecordId newRid = {50, 7};
+		for (int key = -5; key < 0; key++)
+		{
+			index.insertEntry(&key, newRid);
+		}
+
+		checkPassFail(intScan(&index,-3,GTE,-1,LTE), 3)
+		checkPassFail(intScan(&index,-10,GT,10,LT), 5)
+		checkPassFail(intScan(&index,-1,GT,100,LT), 0)
+		checkPassFail(intScan(&index,0,GT,100,LT), 0)
+	}
+	File::remove(indexName);
+	File::remove(relName);
+}
+
+// -----------------------------------------------------------------------------
+// bloomFilterTests
+// -----------------------------------------------------------------------------
+
+void bloomFilterTests()
+{
+  std::cout << "Create a B+ Tree index with a Bloom filter on the integer field" << std::endl;
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, true);
+
+		// Range scans are unaffected, equality probes still find present keys
+		checkPassFail(intScan(&index,25,GT,40,LT), 14)
+		checkPassFail(intScan(&index,0,GTE,0,LTE), 1)
+		checkPassFail(intScan(&index,4321,GTE,4321,LTE), 1)
+		checkPassFail(intScan(&index,relationSize-1,GTE,relationSize-1,LTE), 1)
+
+		// Probes for keys that were never inserted
+		checkPassFail(intScan(&index,-7,GTE,-7,LTE), 0)
+		checkPassFail(intScan(&index,relationSize+10,GTE,relationSize+10,LTE), 0)
+
+		// The filter is maintained on insert
+		int newKey = relationSize + 100;
+		RecordId newRid = {1, 1};
+		index.insertEntry(&newKey, newRid);
+		RecordId outRid;
+		index.startScan(&newKey, GTE, &newKey, LTE);
+		index.scanNext(outRid);
+		index.endScan();
+		bool found = (outRid == newRid);
+		checkPassFail(found, true)
+	}
+
+	// Reopen the index file without asking for a filter, the filter is read back from it and turns the
+	// negative probe away before any node is read
+	BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+	checkPassFail(intScan(&index,1234,GTE,1234,LTE), 1)
+	bufMgr->clearBufStats();
+	checkPassFail(intScan(&index,-7,GTE,-7,LTE), 0)
+	checkPassFail(bufMgr->getBufStats().accesses.load(), 0)
+}
+
+// -----------------------------------------------------------------------------
+// claimPageTests
+// -----------------------------------------------------------------------------
+
+void claimPageTests()
+{
+	std::cout << "Claim reserved pages in the buffer pool" << std::endl;
+	{
+		BlobFile file = BlobFile::create("claim.0");
+		BufMgr *pool = new BufMgr(4);
+		const PageId first = file.allocateExtent(8);
+
+		// A claimed page starts empty and is written when it leaves the pool
+		Page *page;
+		pool->claimPage(&file, first, page);
+		*(int*)page = 4321;
+		pool->unPinPage(&file, first, true);
+
+		// Claiming a page that is in the pool already fails, and leaves no frame behind
+		bool refused = false;
+		try
+		{
+			pool->claimPage(&file, first, page);
+		}
+		catch(HashAlreadyPresentException e)
+		{
+			refused = true;
+		}
+		checkPassFail(refused, true)
+		checkPassFail(flushUnpinned(pool, &file), true)
+
+		// All four frames can still be pinned at once
+		bool exceeded = false;
+		try
+		{
+			for (PageId pageNo = first + 1; pageNo <= first + 4; pageNo++)
+				pool->claimPage(&file, pageNo, page);
+		}
+		catch(BufferExceededException e)
+		{
+			exceeded = true;
+		}
+		checkPassFail(exceeded, false)
+		for (PageId pageNo = first + 1; pageNo <= first + 4; pageNo++)
+			pool->unPinPage(&file, pageNo, false);
+
+		pool->readPage(&file, first, page);
+		const bool kept = *(const int*)page == 4321;
+		pool->unPinPage(&file, first, false);
+		checkPassFail(kept, true)
+		pool->flushFile(&file);
+		delete pool;
+	}
+	File::remove("claim.0");
+}
+
+// -----------------------------------------------------------------------------
+// pageSizeTests
+// -----------------------------------------------------------------------------
+
+void pageSizeTests()
+{
+	// A pool with frames of the largest page size holds index files of any page size
+	BufMgr *largeBufMgr = new BufMgr(64, Page::MAX_SIZE);
+	const std::size_t pageSizes[] = {Page::MIN_SIZE, Page::MAX_SIZE};
+
+	for (int p = 0; p < 2; p++)
+	{
+		std::cout << "Create a B+ Tree index with " << pageSizes[p] << " byte pages" << std::endl;
+		{
+			BTreeIndex index(relationName, intIndexName, largeBufMgr, offsetof(tuple,i), INTEGER, false, pageSizes[p]);
+			checkPassFail(intScan(&index,25,GT,40,LT), 14)
+			checkPassFail(intScan(&index,300,GT,400,LT), 99)
+			checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+		}
+
+		// The page size is read back from the file header, the argument is ignored
+		{
+			BTreeIndex index(relationName, intIndexName, largeBufMgr, offsetof(tuple,i), INTEGER);
+			checkPassFail(intScan(&index,996,GT,1001,LT), 4)
+		}
+
+		// Pages larger than the frames of the default pool are refused
+		bool refused = false;
+		try
+		{
+			BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		}
+		catch(InvalidPageSizeException e)
+		{
+			refused = true;
+		}
+		bool tooLarge = pageSizes[p] > Page::SIZE;
+		checkPassFail(refused, tooLarge)
+
+		File::remove(intIndexName);
+	}
+
+	delete largeBufMgr;
+}
+
+// -----------------------------------------------------------------------------
+// legacyFileTests
+// -----------------------------------------------------------------------------
+
+void legacyFileTests()
+{
+  std::cout << "Open a file written before the header recorded the page size" << std::endl;
+	const std::string name = "legacy.0";
+	const std::string legacyName = "legacy.1";
+	{
+		PageFile file = PageFile::create(name, FileHeader::LEGACY_PAGE_SIZE);
+		PageId pageNo;
+		Page page = file.allocatePage(pageNo);
+		page.insertRecord("legacy record");
+		file.writePage(pageNo, page);
+	}
+
+	// Drop the format and page size from the header, the pages follow right after the legacy fields
+	{
+		std::ifstream in(name.c_str(), std::ios::binary);
+		std::ofstream out(legacyName.c_str(), std::ios::binary | std::ios::trunc);
+		std::vector<char> header(sizeof(FileHeader));
+		in.read(&header[0], header.size());
+		out.write(&header[0], offsetof(FileHeader, format));
+		out << in.rdbuf();
+	}
+	File::remove(name);
+
+	{
+		PageFile file = PageFile::open(legacyName);
+		checkPassFail(file.pageSize(), FileHeader::LEGACY_PAGE_SIZE)
+		const bool read = file.readPage(1).getRecord(RecordId{1, 1}) == "legacy record";
+		checkPassFail(read, true)
+
+		PageId pageNo;
+		Page page = file.allocatePage(pageNo);
+		page.insertRecord("new record");
+		file.writePage(pageNo, page);
+	}
+
+	// The file keeps its legacy layout, and both pages read back
+	{
+		std::ifstream in(legacyName.c_str(), std::ios::binary | std::ios::ate);
+		checkPassFail((std::size_t)in.tellg(), offsetof(FileHeader, format) + 2 * FileHeader::LEGACY_PAGE_SIZE)
+	}
+	{
+		PageFile file = PageFile::open(legacyName);
+		const bool kept = file.readPage(1).getRecord(RecordId{1, 1}) == "legacy record";
+		checkPassFail(kept, true)
+		const bool added = file.readPage(2).getRecord(RecordId{2, 1}) == "new record";
+		checkPassFail(added, true)
+	}
+	File::remove(legacyName);
+}
+
+// -----------------------------------------------------------------------------
+// walTests
+// -----------------------------------------------------------------------------
+
+void walTests()
+{
+	const std::string logName = relationName + ".log";
+	const std::string savedIndexName = relationName + ".crash.idx";
+	const std::string savedLogName = relationName + ".crash.log";
+	std::remove(logName.c_str());
+
+  std::cout << "Create a B+ Tree index whose changes go through a write-ahead log" << std::endl;
+	{
+		WriteAheadLog wal(logName, 16);
+		BufMgr *walBufMgr = new BufMgr(100);
+		walBufMgr->attachLog(&wal);
+		{
+			BTreeIndex index(relationName, intIndexName, walBufMgr, offsetof(tuple,i), INTEGER);
+			checkPassFail(intScan(&index,25,GT,40,LT), 14)
+
+			// Every insert commits, but a whole group of them shares one sync
+			bool grouped = wal.numSyncs() * 8 < wal.numCommits();
+			checkPassFail(grouped, true)
+
+			RecordId newRid = {1, 1};
+			for (int key = relationSize; key < relationSize + 500; key++)
+			{
+				index.insertEntry(&key, newRid);
+			}
+
+			// Keep the files as a crash right after this sync would leave them on disk
+			wal.flush();
+			copyFile(intIndexName, savedIndexName);
+			copyFile(logName, savedLogName);
+
+			for (int key = relationSize + 1000; key < relationSize + 1100; key++)
+			{
+				index.insertEntry(&key, newRid);
+			}
+		}
+		delete walBufMgr;
+	}
+
+	File::remove(intIndexName);
+	std::rename(savedIndexName.c_str(), intIndexName.c_str());
+	std::rename(savedLogName.c_str(), logName.c_str());
+
+  std::cout << "Recover the index from the write-ahead log" << std::endl;
+	{
+		WriteAheadLog wal(logName);
+		bool replayed = wal.numRecovered() > 0;
+		checkPassFail(replayed, true)
+
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		checkPassFail(intScan(&index,25,GT,40,LT), 14)
+		checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+		checkPassFail(intScan(&index,relationSize,GTE,relationSize+1000,LT), 500)
+		checkPassFail(intScan(&index,relationSize+1000,GTE,relationSize+1100,LT), 0)
+	}
+
+	std::remove(logName.c_str());
+	File::remove(intIndexName);
+
+  std::cout << "Recover an extent whose grown file header never reached the disk" << std::endl;
+	const std::string extentName = "walExtent.0";
+	const std::string savedExtentName = "walExtent.crash";
+	{
+		BlobFile file = BlobFile::create(extentName);
+	}
+	copyFile(extentName, savedExtentName);
+	PageId first;
+	{
+		WriteAheadLog wal(logName);
+		BufMgr *walBufMgr = new BufMgr(16);
+		walBufMgr->attachLog(&wal);
+		BlobFile file = BlobFile::open(extentName);
+
+		// Only the first page of the extent is written in the operation
+		first = walBufMgr->allocateExtent(&file, 8);
+		Page *page;
+		walBufMgr->claimPage(&file, first, page);
+		*(int*)page = 4321;
+		walBufMgr->unPinPage(&file, first, true);
+		walBufMgr->commit();
+		wal.flush();
+		copyFile(logName, savedLogName);
+		delete walBufMgr;
+	}
+
+	File::remove(extentName);
+	std::rename(savedExtentName.c_str(), extentName.c_str());
+	std::rename(savedLogName.c_str(), logName.c_str());
+	{
+		WriteAheadLog wal(logName);
+		BlobFile file = BlobFile::open(extentName);
+		checkPassFail(file.numPages(), first + 8)
+		const Page page = file.readPage(first);
+		const bool written = *(const int*)&page == 4321;
+		checkPassFail(written, true)
+	}
+
+	std::remove(logName.c_str());
+	File::remove(extentName);
+}
+
+void copyFile(const std::string & from, const std::string & to)
+{
+	std::ifstream in(from.c_str(), std::ios::binary);
+	std::ofstream out(to.c_str(), std::ios::binary | std::ios::trunc);
+	out << in.rdbuf();
+}
+
+// -----------------------------------------------------------------------------
+// bufferedTests
+// -----------------------------------------------------------------------------
+
+void bufferedTests()
+{
+  std::cout << "Create a B+ Tree index that buffers inserts in its non-leaf nodes" << std::endl;
+	{
+		// Small pages keep the buffers small, so they flush often and the tree grows several levels
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, false, Page::MIN_SIZE, true);
+		checkPassFail(intScan(&index,25,GT,40,LT), 14)
+		checkPassFail(intScan(&index,20,GTE,35,LTE), 16)
+		checkPassFail(intScan(&index,-3,GT,3,LT), 3)
+		checkPassFail(intScan(&index,996,GT,1001,LT), 4)
+		checkPassFail(intScan(&index,0,GT,1,LT), 0)
+		checkPassFail(intScan(&index,300,GT,400,LT), 99)
+		checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+
+		RecordId newRid = {1, 1};
+		for (int i = 0; i < 20000; i++)
+		{
+			int key = relationSize + (i * 7919) % 20000;
+			index.insertEntry(&key, newRid);
+		}
+		checkPassFail(intScan(&index,relationSize,GTE,relationSize+20000,LT), 20000)
+		checkPassFail(intScan(&index,relationSize-10,GT,relationSize+10,LTE), 20)
+
+		bool done = index.defragment();
+		checkPassFail(done, true)
+	}
+
+	// The layout is read back from the meta page, along with the messages still buffered
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+		checkPassFail(intScan(&index,relationSize+100,GT,relationSize+200,LTE), 100)
+		checkPassFail(intScan(&index,relationSize+20000,GTE,relationSize+30000,LT), 0)
+	}
+
+	File::remove(intIndexName);
+}
+
+// -----------------------------------------------------------------------------
+// memtableTests
+// -----------------------------------------------------------------------------
+
+void memtableTests()
+{
+  std::cout << "Create a B+ Tree index that collects inserts in a memtable" << std::endl;
+	{
+		// Scans see the entries of the build still in memory as well as those merged already
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, false, Page::SIZE, false, 1000);
+		checkPassFail(intScan(&index,25,GT,40,LT), 14)
+		checkPassFail(intScan(&index,20,GTE,35,LTE), 16)
+		checkPassFail(intScan(&index,-3,GT,3,LT), 3)
+		checkPassFail(intScan(&index,996,GT,1001,LT), 4)
+		checkPassFail(intScan(&index,0,GT,1,LT), 0)
+		checkPassFail(intScan(&index,300,GT,400,LT), 99)
+		checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+
+		RecordId newRid = {1, 1};
+		for (int i = 0; i < 20000; i++)
+		{
+			int key = relationSize + (i * 7919) % 20000;
+			index.insertEntry(&key, newRid);
+		}
+		checkPassFail(intScan(&index,relationSize,GTE,relationSize+20000,LT), 20000)
+
+		index.flushMemtable();
+		checkPassFail(intScan(&index,relationSize-10,GT,relationSize+10,LTE), 20)
+	}
+
+	// Closing the index merged the rest of the memtable
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+		checkPassFail(intScan(&index,relationSize,GTE,relationSize+20000,LT), 20000)
+	}
+	File::remove(intIndexName);
+
+  std::cout << "Report a memtable merge that failed in the background" << std::endl;
+	{
+		BufMgr *pool = new BufMgr(16);
+		pool->setReadAhead(0);
+		BlobFile other = BlobFile::create("mergeError.0");
+		const PageId first = pool->allocateExtent(&other, 16);
+		{
+			BTreeIndex index(relationName, intIndexName, pool, offsetof(tuple,i), INTEGER, false, Page::SIZE, false, 4);
+			index.flushMemtable();
+
+			// With every frame pinned the merge cannot read the tree
+			Page *page;
+			for (PageId pageNo = first; pageNo < first + 16; pageNo++)
+				pool->claimPage(&other, pageNo, page);
+			RecordId newRid = {1, 1};
+			for (int key = relationSize; key < relationSize + 4; key++)
+				index.insertEntry(&key, newRid);
+
+			bool failed = false;
+			try
+			{
+				index.flushMemtable();
+			}
+			catch(BufferExceededException e)
+			{
+				failed = true;
+			}
+			checkPassFail(failed, true)
+
+			// The merge thread is gone, so later inserts fail as well instead of waiting for it
+			failed = false;
+			try
+			{
+				int key = relationSize + 4;
+				index.insertEntry(&key, newRid);
+			}
+			catch(BufferExceededException e)
+			{
+				failed = true;
+			}
+			checkPassFail(failed, true)
+
+			for (PageId pageNo = first; pageNo < first + 16; pageNo++)
+				pool->unPinPage(&other, pageNo, false);
+		}
+		pool->flushFile(&other);
+		delete pool;
+	}
+	File::remove("mergeError.0");
+	File::remove(intIndexName);
+}
+
+// -----------------------------------------------------------------------------
+// hashIndexTests
+// -----------------------------------------------------------------------------
+
+void hashIndexTests()
+{
+	std::string hashIndexName;
+	std::vector<RecordId> rids;
+	int key;
+
+  std::cout << "Create a hash index on the integer field" << std::endl;
+	{
+		HashIndex index(relationName, hashIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		checkPassFail((int)index.size(), relationSize)
+
+		key = 25;
+		index.lookup(&key, rids);
+		checkPassFail((int)rids.size(), 1)
+
+		bool missing = false;
+		key = -7;
+		try
+		{
+			index.lookup(&key, rids);
+		}
+		catch(NoSuchKeyFoundException e)
+		{
+			missing = true;
+		}
+		checkPassFail(missing, true)
+
+		// Copies of one key cannot be split apart, they go on overflow pages
+		RecordId newRid = {1, 0};
+		key = relationSize;
+		for (int i = 0; i < 2000; i++)
+		{
+			newRid.slot_number = i;
+			index.insertEntry(&key, newRid);
+		}
+		index.lookup(&key, rids);
+		checkPassFail((int)rids.size(), 2000)
+
+		for (int i = 0; i < 2000; i += 2)
+		{
+			newRid.slot_number = i;
+			index.deleteEntry(&key, newRid);
+		}
+		index.lookup(&key, rids);
+		checkPassFail((int)rids.size(), 1000)
+
+		key = 25;
+		index.lookup(&key, rids);
+		index.deleteEntry(&key, rids[0]);
+		missing = false;
+		try
+		{
+			index.lookup(&key, rids);
+		}
+		catch(NoSuchKeyFoundException e)
+		{
+			missing = true;
+		}
+		checkPassFail(missing, true)
+	}
+
+	// The directory and the entries are read back from the file
+	{
+		HashIndex index(relationName, hashIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		checkPassFail((int)index.size(), relationSize - 1 + 1000)
+		bool split = index.depth() > 0;
+		checkPassFail(split, true)
+
+		for (key = 3000; key < 4000; key++)
+		{
+			index.lookup(&key, rids);
+			if (rids.size() != 1)
+				break;
+		}
+		checkPassFail(key, 4000)
+	}
+	File::remove(hashIndexName);
+
+  std::cout << "Create a hash index with small pages" << std::endl;
+	{
+		HashIndex index(relationName, hashIndexName, bufMgr, offsetof(tuple,i), INTEGER, Page::MIN_SIZE);
+		checkPassFail((int)index.size(), relationSize)
+	}
+
+	// The page size is read back from the file, and sets the bucket layout
+	{
+		HashIndex index(relationName, hashIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		checkPassFail((int)index.size(), relationSize)
+		for (key = 0; key < relationSize; key++)
+		{
+			index.lookup(&key, rids);
+			if (rids.size() != 1)
+				break;
+		}
+		checkPassFail(key, relationSize)
+	}
+
+	File::remove(hashIndexName);
+}
+
+// -----------------------------------------------------------------------------
+// bitmapIndexTests
+// -----------------------------------------------------------------------------
+
+void bitmapIndexTests()
+{
+	std::string bitmapIndexName;
+	RoaringBitmap saved;
+	int key;
+
+  std::cout << "Create a bitmap index on the integer field" << std::endl;
+	{
+		BitmapIndex index(relationName, bitmapIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		checkPassFail((int)index.size(), relationSize)
+		checkPassFail((int)index.numValues(), relationSize)
+
+		RoaringBitmap a, b;
+		key = 25;
+		index.lookup(&key, a);
+		key = 40;
+		index.lookup(&key, b);
+		checkPassFail((int)a.cardinality(), 1)
+		checkPassFail((int)(a | b).cardinality(), 2)
+		bool disjoint = (a & b).empty();
+		checkPassFail(disjoint, true)
+		checkPassFail((int)index.complement(a).cardinality(), relationSize - 1)
+
+		key = -7;
+		index.lookup(&key, a);
+		checkPassFail(a.empty(), true)
+
+		// A full page of one value is kept as a bitmap container, a few slots as an array
+		RecordId newRid;
+		newRid.page_number = 100000;
+		key = -1;
+		for (int i = 0; i < 5000; i++)
+		{
+			newRid.slot_number = i;
+			index.insertEntry(&key, newRid);
+		}
+		newRid.page_number = 100001;
+		key = -2;
+		for (int i = 0; i < 100; i++)
+		{
+			newRid.slot_number = i;
+			index.insertEntry(&key, newRid);
+		}
+		key = -1;
+		index.lookup(&key, a);
+		key = -2;
+		index.lookup(&key, b);
+		checkPassFail((int)a.cardinality(), 5000)
+		checkPassFail((int)(a | b).cardinality(), 5100)
+		disjoint = (a & b).empty();
+		checkPassFail(disjoint, true)
+		checkPassFail((int)index.complement(a | b).cardinality(), relationSize)
+
+		newRid.page_number = 100000;
+		key = -1;
+		for (int i = 0; i < 1000; i++)
+		{
+			newRid.slot_number = i;
+			index.deleteEntry(&key, newRid);
+		}
+		index.lookup(&key, a);
+		checkPassFail((int)a.cardinality(), 4000)
+		newRid.slot_number = 999;
+		checkPassFail(a.contains(newRid), false)
+		newRid.slot_number = 1000;
+		checkPassFail(a.contains(newRid), true)
+
+		RoaringBitmap evens;
+		for (int i = 0; i < 5000; i += 2)
+		{
+			newRid.slot_number = i;
+			evens.add(newRid);
+		}
+		checkPassFail((int)(a & evens).cardinality(), 2000)
+		checkPassFail((int)(a - evens).cardinality(), 2000)
+
+		bool missing = false;
+		newRid.slot_number = 0;
+		try
+		{
+			index.deleteEntry(&key, newRid);
+		}
+		catch(NoSuchKeyFoundException e)
+		{
+			missing = true;
+		}
+		checkPassFail(missing, true)
+		saved = a;
+	}
+
+	// The bitmaps are read back from the file
+	{
+		BitmapIndex index(relationName, bitmapIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		checkPassFail((int)index.size(), relationSize + 4100)
+		checkPassFail((int)index.numValues(), relationSize + 2)
+
+		RoaringBitmap a;
+		key = -1;
+		index.lookup(&key, a);
+		bool same = a == saved;
+		checkPassFail(same, true)
+
+		std::vector<RecordId> rids;
+		a.toRecordIds(rids);
+		checkPassFail((int)rids.size(), 4000)
+		checkPassFail((int)rids[0].slot_number, 1000)
+	}
+
+	File::remove(bitmapIndexName);
+}
+
+// -----------------------------------------------------------------------------
+// frozenIndexTests
+// -----------------------------------------------------------------------------
+
+void frozenIndexTests()
+{
+	std::string frozenIndexName;
+	std::vector<RecordId> rids;
+	int key;
+
+  std::cout << "Freeze a B+ Tree index on the integer field" << std::endl;
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+
+		// Copies of one key span several frozen leaves
+		RecordId newRid = {1, 0};
+		key = relationSize;
+		for (int i = 0; i < 2000; i++)
+		{
+			newRid.slot_number = i;
+			index.insertEntry(&key, newRid);
+		}
+		index.freeze(frozenIndexName);
+	}
+
+	{
+		FrozenIndex index(frozenIndexName, bufMgr);
+		checkPassFail((int)index.size(), relationSize + 2000)
+		const int leafCapacity = FrozenNodeCapacity<int, Page::SIZE>::LEAF;
+		checkPassFail((int)index.numLeaves(), (relationSize + 2000 + leafCapacity - 1) / leafCapacity)
+		checkPassFail(index.height(), 2)
+
+		checkPassFail(intScan(&index,25,GT,40,LT), 14)
+		checkPassFail(intScan(&index,20,GTE,35,LTE), 16)
+		checkPassFail(intScan(&index,-3,GT,3,LT), 3)
+		checkPassFail(intScan(&index,996,GT,1001,LT), 4)
+		checkPassFail(intScan(&index,0,GT,1,LT), 0)
+		checkPassFail(intScan(&index,300,GT,400,LT), 99)
+		checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+		checkPassFail(intScan(&index,relationSize,GT,relationSize+5,LTE), 0)
+
+		key = relationSize;
+		index.lookup(&key, rids);
+		checkPassFail((int)rids.size(), 2000)
+		checkPassFail((int)rids[1999].slot_number, 1999)
+
+		key = 25;
+		index.lookup(&key, rids);
+		checkPassFail((int)rids.size(), 1)
+
+		bool missing = false;
+		key = -7;
+		try
+		{
+			index.lookup(&key, rids);
+		}
+		catch(NoSuchKeyFoundException e)
+		{
+			missing = true;
+		}
+		checkPassFail(missing, true)
+	}
+	File::remove(frozenIndexName);
+	File::remove(intIndexName);
+
+  std::cout << "Freeze a B+ Tree index with small pages" << std::endl;
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, false, Page::MIN_SIZE);
+		index.freeze(frozenIndexName);
+	}
+
+	{
+		FrozenIndex index(frozenIndexName, bufMgr);
+		const int leafCapacity = FrozenNodeCapacity<int, Page::MIN_SIZE>::LEAF;
+		checkPassFail((int)index.numLeaves(), (relationSize + leafCapacity - 1) / leafCapacity)
+		checkPassFail(intScan(&index,25,GT,40,LT), 14)
+		checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+
+		key = relationSize - 1;
+		index.lookup(&key, rids);
+		checkPassFail((int)rids.size(), 1)
+	}
+
+	File::remove(frozenIndexName);
+	File::remove(intIndexName);
+}
+
+// -----------------------------------------------------------------------------
+// leafModelTests
+// -----------------------------------------------------------------------------
+
+void leafModelTests()
+{
+  std::cout << "Find leaves of a B+ Tree index on the integer field with a leaf model" << std::endl;
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		index.useLeafModel(2);
+		const std::size_t builtLeaves = index.getLeafModel()->numLeaves();
+		bool hasLeaves = builtLeaves > 1;
+		checkPassFail(hasLeaves, true)
+
+		checkPassFail(intScan(&index,25,GT,40,LT), 14)
+		checkPassFail(intScan(&index,20,GTE,35,LTE), 16)
+		checkPassFail(intScan(&index,-3,GT,3,LT), 3)
+		checkPassFail(intScan(&index,996,GT,1001,LT), 4)
+		checkPassFail(intScan(&index,0,GT,1,LT), 0)
+		checkPassFail(intScan(&index,300,GT,400,LT), 99)
+		checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+
+		// Splits past the last real key, more of them than the model tolerates before it is refitted
+		RecordId newRid = {1, 0};
+		for (int i = 0; i < 20000; i++)
+		{
+			int key = relationSize + i;
+			newRid.slot_number = i;
+			index.insertEntry(&key, newRid);
+		}
+		bool grew = index.getLeafModel()->numLeaves() > builtLeaves + 2;
+		checkPassFail(grew, true)
+
+		checkPassFail(intScan(&index,25,GT,40,LT), 14)
+		checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+		checkPassFail(intScan(&index,4990,GT,relationSize,LT), 9)
+	}
+	File::remove(intIndexName);
+
+	bool rejected = false;
+	{
+		BTreeIndex index(relationName, stringIndexName, bufMgr, offsetof(tuple,s), STRING);
+		try
+		{
+			index.useLeafModel();
+		}
+		catch(BadIndexInfoException e)
+		{
+			rejected = true;
+		}
+	}
+	checkPassFail(rejected, true)
+	File::remove(stringIndexName);
+}
+
+// -----------------------------------------------------------------------------
+// partitionedIndexTests
+// -----------------------------------------------------------------------------
+
+void partitionedIndexTests()
+{
+	std::string partitionedIndexName;
+	std::vector<RecordId> rids;
+
+  std::cout << "Create a partitioned index on the integer field" << std::endl;
+	{
+		PartitionedIndex index(relationName, partitionedIndexName, bufMgr, offsetof(tuple,i), INTEGER, 4);
+		checkPassFail(index.numPartitions(), 4)
+
+		checkPassFail(intScan(&index,25,GT,40,LT), 14)
+		checkPassFail(intScan(&index,20,GTE,35,LTE), 16)
+		checkPassFail(intScan(&index,-3,GT,3,LT), 3)
+		checkPassFail(intScan(&index,996,GT,1001,LT), 4)
+		checkPassFail(intScan(&index,0,GT,1,LT), 0)
+		checkPassFail(intScan(&index,300,GT,400,LT), 99)
+		checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+		checkPassFail(intScan(&index,-10,GTE,relationSize,LT), relationSize)
+
+		int lowVal = 1000;
+		int highVal = 4000;
+		index.parallelScan(&lowVal, GTE, &highVal, LT, rids);
+		checkPassFail((int)rids.size(), 3000)
+
+		bool split = index.splitPartition(0);
+		checkPassFail(split, true)
+		checkPassFail(index.numPartitions(), 5)
+		bool merged = index.mergePartitions(2) && index.mergePartitions(0);
+		checkPassFail(merged, true)
+		checkPassFail(index.numPartitions(), 3)
+		bool mergedLast = index.mergePartitions(2);
+		checkPassFail(mergedLast, false)
+
+		checkPassFail(intScan(&index,996,GT,1001,LT), 4)
+		checkPassFail(intScan(&index,-10,GTE,relationSize,LT), relationSize)
+
+		// Entries inserted since the build are not in the relation, a merge keeps them
+		RecordId newRid = {1, 1};
+		for (int key = relationSize + 1; key <= relationSize + 100; key++)
+			index.insertEntry(&key, newRid);
+		merged = index.mergePartitions(1);
+		checkPassFail(merged, true)
+		checkPassFail(index.numPartitions(), 2)
+		checkPassFail(intScan(&index,relationSize,GT,relationSize+100,LTE), 100)
+	}
+
+  std::cout << "Open the partitioned index again" << std::endl;
+	{
+		PartitionedIndex index(relationName, partitionedIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		checkPassFail(index.numPartitions(), 2)
+		checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+		checkPassFail(intScan(&index,relationSize,GT,relationSize+100,LTE), 100)
+
+		int lowVal = -10;
+		int highVal = relationSize;
+		index.parallelScan(&lowVal, GT, &highVal, LTE, rids);
+		checkPassFail((int)rids.size(), relationSize)
+	}
+
+	for (int i = 0; i < MAXPARTITIONS; i++)
+	{
+		std::ostringstream partitionName;
+		partitionName << partitionedIndexName << '.' << i;
+		if (File::exists(partitionName.str()))
+		{
+			File::remove(partitionName.str());
+		}
+	}
+	File::remove(partitionedIndexName);
+}
+
+// -----------------------------------------------------------------------------
+// ridUpdateTests
+// -----------------------------------------------------------------------------
+
+void ridUpdateTests()
+{
+	std::vector<RecordId> rids;
+	int key;
+
+  std::cout << "Move records under a B+ Tree index on the integer field" << std::endl;
+	{
+		BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+		key = 25;
+		keyRids(&index, key, rids);
+		const RecordId oldRid = rids[0];
+		RecordId newRid = {oldRid.page_number, 777};
+		index.updateRid(&key, oldRid, newRid);
+		keyRids(&index, key, rids);
+		checkPassFail((int)rids.size(), 1)
+		checkPassFail((int)rids[0].slot_number, 777)
+
+		bool missing = false;
+		try
+		{
+			index.updateRid(&key, oldRid, newRid);
+		}
+		catch(NoSuchKeyFoundException e)
+		{
+			missing = true;
+		}
+		checkPassFail(missing, true)
+
+		// Move it back in a batch with an entry the index does not hold
+		int otherKey = 26;
+		std::vector<RidUpdate> updates(2);
+		updates[0].key = &key;
+		updates[0].oldRid = newRid;
+		updates[0].newRid = oldRid;
+		updates[1].key = &otherKey;
+		updates[1].oldRid = newRid;
+		updates[1].newRid = oldRid;
+		checkPassFail((int)index.updateRids(updates), 1)
+		checkPassFail(intScan(&index,25,GTE,25,LTE), 1)
+
+		// Copies of one key span several leaves
+		key = relationSize;
+		for (int i = 0; i < 2000; i++)
+		{
+			newRid.page_number = 1;
+			newRid.slot_number = i;
+			index.insertEntry(&key, newRid);
+		}
+		updates.resize(2000);
+		for (int i = 0; i < 2000; i++)
+		{
+			updates[i].key = &key;
+			updates[i].oldRid.page_number = 1;
+			updates[i].oldRid.slot_number = 1999 - i;
+			updates[i].newRid.page_number = 2;
+			updates[i].newRid.slot_number = 1999 - i;
+		}
+		checkPassFail((int)index.updateRids(updates), 2000)
+		keyRids(&index, key, rids);
+		int moved = 0;
+		for (std::size_t i = 0; i < rids.size(); i++)
+		{
+			moved += rids[i].page_number == 2;
+		}
+		checkPassFail(moved, 2000)
+		checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+	}
+	File::remove(intIndexName);
+
+  std::cout << "Move records under B+ Tree indexes with buffered inserts and a memtable" << std::endl;
+	for (int variant = 0; variant < 2; variant++)
+	{
+		{
+			BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, false, Page::MIN_SIZE,
+											variant == 0, variant == 0 ? 0 : 1000);
+			key = relationSize;
+			RecordId oldRid = {1, 5};
+			index.insertEntry(&key, oldRid);
+			RecordId newRid = {2, 5};
+			index.updateRid(&key, oldRid, newRid);
+			keyRids(&index, key, rids);
+			checkPassFail((int)rids.size(), 1)
+			checkPassFail((int)rids[0].page_number, 2)
+			checkPassFail(intScan(&index,996,GT,1001,LT), 4)
+		}
+		File::remove(intIndexName);
+	}
+}
+
+void keyRids(BTreeIndex *index, int key, std::vector<RecordId> & outRids)
+{
+	outRids.clear();
+	RecordId rid;
+	try
+	{
+		index->startScan(&key, GTE, &key, LTE);
+		while (true)
+		{
+			index->scanNext(rid);
+			outRids.push_back(rid);
+		}
+	}
+	catch(NoSuchKeyFoundException e)
+	{
+		return;
+	}
+	catch(IndexScanCompletedException e)
+	{
+	}
+	index->endScan();
+}
+
+// -----------------------------------------------------------------------------
+// bufHashTblTests
+// -----------------------------------------------------------------------------
+
+void bufHashTblTests()
+{
+  std::cout << "Map pages of two files to frames in the buffer pool hash table" << std::endl;
+	{
+		PageFile file0 = PageFile::create("hashTbl.0");
+		PageFile file1 = PageFile::create("hashTbl.1");
+		File *files[2] = {&file0, &file1};
+
+		// Far more entries than the table was sized for, so it grows
+		BufHashTbl table(8);
+		for (int i = 0; i < 1000; i++)
+		{
+			table.insert(files[0], i, 2 * i);
+			table.insert(files[1], i, 2 * i + 1);
+		}
+		checkPassFail((int)table.size(), 2000)
+
+		int found = 0;
+		FrameId frameNo;
+		for (int i = 0; i < 1000; i++)
+		{
+			found += table.find(files[0], i, frameNo) && frameNo == (FrameId)(2 * i);
+			found += table.find(files[1], i, frameNo) && frameNo == (FrameId)(2 * i + 1);
+		}
+		checkPassFail(found, 2000)
+		bool missing = !table.find(files[0], 1000, frameNo);
+		checkPassFail(missing, true)
+
+		// Removing entries shifts later ones of their probe runs back
+		for (int i = 0; i < 1000; i += 2)
+		{
+			table.remove(files[0], i);
+			table.remove(files[1], i + 1);
+		}
+		checkPassFail((int)table.size(), 1000)
+		found = 0;
+		for (int i = 0; i < 1000; i++)
+		{
+			const FrameId expected = i % 2 == 0 ? 2 * i + 1 : 2 * i;
+			const bool present = table.find(files[i % 2 == 0 ? 1 : 0], i, frameNo) && frameNo == expected;
+			const bool removed = !table.find(files[i % 2 == 0 ? 0 : 1], i, frameNo);
+			found += present && removed;
+		}
+		checkPassFail(found, 1000)
+
+		bool duplicate = false;
+		try
+		{
+			table.insert(files[1], 0, 7);
+		}
+		catch(HashAlreadyPresentException e)
+		{
+			duplicate = true;
+		}
+		checkPassFail(duplicate, true)
+
+		bool notFound = false;
+		try
+		{
+			table.remove(files[0], 0);
+		}
+		catch(HashNotFoundException e)
+		{
+			notFound = true;
+		}
+		checkPassFail(notFound, true)
+	}
+	File::remove("hashTbl.0");
+	File::remove("hashTbl.1");
+}
+
+// -----------------------------------------------------------------------------
+// concurrentBufferTests
+// -----------------------------------------------------------------------------
+
+const int concurrentPages = 200;
+const int concurrentThreads = 8;
+const int concurrentReads = 4000;
+const int concurrentScanPages = 64;
+const int concurrentScans = 10;
+
+void concurrentBufferTests()
+{
+  std::cout << "Read and change pages from several threads through a small buffer pool" << std::endl;
+	{
+		// Page 1 holds a counter, every page knows its own number
+		PageFile file = PageFile::create("concurrent.0");
+		for (int i = 0; i < concurrentPages; i++)
+		{
+			PageId pageNo;
+			Page page = file.allocatePage(pageNo);
+			int counter = 0;
+			page.insertRecord(std::string((const char*)&counter, sizeof(int)));
+			file.writePage(pageNo, page);
+		}
+
+		// Far fewer frames than pages, so pages are evicted while other threads pin them. The background writer
+		// writes the counter page out between changes.
+		BufMgr *pool = new BufMgr(16);
+		pool->startWriter(0.0, 16, 1);
+		int errors[concurrentThreads] = {0};
+		std::vector<std::thread> threads;
+		for (int t = 0; t < concurrentThreads; t++)
+			threads.push_back(std::thread(concurrentBufferTask, pool, &file, t, &errors[t]));
+		for (int t = 0; t < concurrentThreads; t++)
+			threads[t].join();
+		pool->stopWriter();
+
+		int totalErrors = 0;
+		for (int t = 0; t < concurrentThreads; t++)
+			totalErrors += errors[t];
+		checkPassFail(totalErrors, 0)
+
+		// Every increment survived eviction and no pin was left behind
+		Page *page;
+		pool->readPage(&file, 1, page);
+		int counter = *(const int*)page->getRecord(RecordId{1, 1}).c_str();
+		pool->unPinPage(&file, 1, false);
+		checkPassFail(counter, concurrentThreads * concurrentReads / 10)
+
+		bool flushed = true;
+		try
+		{
+			pool->flushFile(&file);
+		}
+		catch(PagePinnedException e)
+		{
+			flushed = false;
+		}
+		checkPassFail(flushed, true)
+		const int written = *(const int*)file.readPage(1).getRecord(RecordId{1, 1}).c_str();
+		checkPassFail(written, concurrentThreads * concurrentReads / 10)
+		delete pool;
+	}
+	File::remove("concurrent.0");
+
+  std::cout << "Scan and change files from several threads with read ahead and the background writer on" << std::endl;
+	{
+		// Every thread scans a file of its own, so its misses are sequential and read ahead
+		std::vector<PageFile> files;
+		for (int t = 0; t < concurrentThreads; t++)
+		{
+			char name[32];
+			sprintf(name, "concurrent.scan.%d", t);
+			files.push_back(PageFile::create(name));
+			for (int i = 0; i < concurrentScanPages; i++)
+			{
+				PageId pageNo;
+				Page page = files[t].allocatePage(pageNo);
+				int counter = 0;
+				page.insertRecord(std::string((const char*)&counter, sizeof(int)));
+				files[t].writePage(pageNo, page);
+			}
+		}
+
+		// Prefetched pages are handed over and written pages unpinned while misses look for frames to evict
+		BufMgr *pool = new BufMgr(32);
+		pool->setReadAhead(8);
+		pool->startWriter(0.0, 16, 1);
+		int errors[concurrentThreads] = {0};
+		std::vector<std::thread> threads;
+		for (int t = 0; t < concurrentThreads; t++)
+			threads.push_back(std::thread(concurrentScanTask, pool, &files[t], &errors[t]));
+		for (int t = 0; t < concurrentThreads; t++)
+			threads[t].join();
+		pool->stopWriter();
+		pool->waitForPrefetch();
+
+		int totalErrors = 0;
+		for (int t = 0; t < concurrentThreads; t++)
+			totalErrors += errors[t];
+		checkPassFail(totalErrors, 0)
+		const bool overlapped = pool->getBufStats().prefetches.load() > 0 && pool->getBufStats().aheadwrites.load() > 0;
+		checkPassFail(overlapped, true)
+
+		// Every change survived the writes and evictions
+		int correct = 0;
+		for (int t = 0; t < concurrentThreads; t++)
+		{
+			pool->flushFile(&files[t]);
+			for (PageId pageNo = 1; pageNo <= (PageId)concurrentScanPages; pageNo++)
+				correct += *(const int*)files[t].readPage(pageNo).getRecord(RecordId{pageNo, 1}).c_str() == concurrentScans;
+		}
+		checkPassFail(correct, concurrentThreads * concurrentScanPages)
+		delete pool;
+	}
+	for (int t = 0; t < concurrentThreads; t++)
+	{
+		char name[32];
+		sprintf(name, "concurrent.scan.%d", t);
+		File::remove(name);
+	}
+
+  std::cout << "Miss on the same pages and allocate pages from several threads at once" << std::endl;
+	{
+		PageFile file = PageFile::create("concurrent.1");
+		for (int i = 0; i < concurrentPages; i++)
+		{
+			PageId pageNo;
+			Page page = file.allocatePage(pageNo);
+			file.writePage(pageNo, page);
+		}
+
+		// Every thread asks for every page in the same order; the pool holds them all
+		BufMgr *pool = new BufMgr(concurrentPages + 16);
+		pool->setReadAhead(0);
+		int errors[concurrentThreads] = {0};
+		std::vector<std::thread> threads;
+		for (int t = 0; t < concurrentThreads; t++)
+			threads.push_back(std::thread(concurrentMissTask, pool, &file, &errors[t]));
+		for (int t = 0; t < concurrentThreads; t++)
+			threads[t].join();
+
+		int totalErrors = 0;
+		for (int t = 0; t < concurrentThreads; t++)
+			totalErrors += errors[t];
+		checkPassFail(totalErrors, 0)
+
+		// A page was read from disk once, threads that missed on it meanwhile waited for its frame
+		const int reads = pool->getBufStats().diskreads.load();
+		checkPassFail(reads, concurrentPages)
+
+		// Pages allocated at the same time, evicting dirty pages to make room, get numbers of their own
+		const int pagesBefore = file.numPages();
+		std::vector<PageId> allocated[concurrentThreads];
+		threads.clear();
+		for (int t = 0; t < concurrentThreads; t++)
+			threads.push_back(std::thread(concurrentAllocTask, pool, &file, &allocated[t]));
+		for (int t = 0; t < concurrentThreads; t++)
+			threads[t].join();
+
+		std::set<PageId> distinct;
+		for (int t = 0; t < concurrentThreads; t++)
+			distinct.insert(allocated[t].begin(), allocated[t].end());
+		const int numAllocated = distinct.size();
+		checkPassFail(numAllocated, concurrentThreads * 20)
+		pool->flushFile(&file);
+		const int numPages = file.numPages();
+		checkPassFail(numPages, pagesBefore + concurrentThreads * 20)
+
+		// Every page written by the pool carries its own number
+		int mismatched = 0;
+		for (std::set<PageId>::iterator it = distinct.begin(); it != distinct.end(); ++it)
+			mismatched += file.readPage(*it).page_number() != *it;
+		checkPassFail(mismatched, 0)
+		delete pool;
+	}
+	File::remove("concurrent.1");
+}
+
+void concurrentMissTask(BufMgr *pool, File *file, int *errors)
+{
+	for (PageId pageNo = 1; pageNo <= (PageId)concurrentPages; pageNo++)
+	{
+		Page *page;
+		pool->readPage(file, pageNo, page);
+		if (page->page_number() != pageNo)
+			(*errors)++;
+		pool->unPinPage(file, pageNo, false);
+	}
+}
+
+void concurrentScanTask(BufMgr *pool, File *file, int *errors)
+{
+	for (int scan = 0; scan < concurrentScans; scan++)
+	{
+		for (PageId pageNo = 1; pageNo <= (PageId)concurrentScanPages; pageNo++)
+		{
+			Page *page;
+			pool->readPage(file, pageNo, page);
+			if (page->page_number() != pageNo)
+				(*errors)++;
+			int counter = *(const int*)page->getRecord(RecordId{pageNo, 1}).c_str() + 1;
+			page->updateRecord(RecordId{pageNo, 1}, std::string((const char*)&counter, sizeof(int)));
+			pool->unPinPage(file, pageNo, true);
+		}
+	}
+}
+
+void concurrentAllocTask(BufMgr *pool, File *file, std::vector<PageId> *pages)
+{
+	for (int i = 0; i < 20; i++)
+	{
+		PageId pageNo;
+		Page *page;
+		pool->allocPage(file, pageNo, page);
+		pages->push_back(pageNo);
+		pool->unPinPage(file, pageNo, true);
+	}
+}
+
+void concurrentBufferTask(BufMgr *pool, File *file, const int thread, int *errors)
+{
+	for (int i = 0; i < concurrentReads; i++)
+	{
+		const PageId pageNo = (i * 7 + thread * 31) % concurrentPages + 1;
+		Page *page;
+		pool->readPage(file, pageNo, page);
+		if (page->page_number() != pageNo)
+			(*errors)++;
+		pool->unPinPage(file, pageNo, false);
+
+		if (i % 10 == 0)
+		{
+			pool->readPage(file, 1, page);
+			pool->latchPage(file, 1, true);
+			int counter = *(const int*)page->getRecord(RecordId{1, 1}).c_str() + 1;
+			page->updateRecord(RecordId{1, 1}, std::string((const char*)&counter, sizeof(int)));
+			pool->unlatchPage(file, 1, true);
+			pool->unPinPage(file, 1, true);
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+// replacementPolicyTests
+// -----------------------------------------------------------------------------
+
+void forEachPolicy(const std::string & fileName, const int numPages,
+                   const std::function<void(PageFile & file, ReplacementPolicyKind policy, const char* policyName)> & test)
+{
+	const ReplacementPolicyKind policies[] = {CLOCK, LRU_K, TWO_Q, ARC};
+	const char* policyNames[] = {"clock", "LRU-K", "2Q", "ARC"};
+	for (int p = 0; p < 4; p++)
+	{
+		// Every run starts from a file of empty pages, numbered 1 to numPages
+		{
+			PageFile file = PageFile::create(fileName);
+			for (int i = 0; i < numPages; i++)
+			{
+				PageId pageNo;
+				Page page = file.allocatePage(pageNo);
+				file.writePage(pageNo, page);
+			}
+			test(file, policies[p], policyNames[p]);
+		}
+		File::remove(fileName);
+	}
+}
+
+void replacementPolicyTests()
+{
+	forEachPolicy("policy.0", 200, [](PageFile & file, ReplacementPolicyKind policy, const char* policyName)
+	{
+		std::cout << "Read pages through a buffer pool with " << policyName << " replacement" << std::endl;
+		BufMgr *pool = new BufMgr(16, Page::SIZE, policy);
+		// Only the requests below decide what stays in the pool
+		pool->setReadAhead(0);
+		Page *page;
+
+		// Every request gets its own page, however often frames are reused
+		int correct = 0;
+		for (int i = 0; i < 1000; i++)
+		{
+			const PageId pageNo = (i * 37 % 101) % (i % 3 == 0 ? 10 : 200) + 1;
+			pool->readPage(&file, pageNo, page);
+			correct += page->page_number() == pageNo;
+			pool->unPinPage(&file, pageNo, false);
+		}
+		checkPassFail(correct, 1000)
+
+		// Pinned pages are never evicted
+		for (PageId pageNo = 1; pageNo <= 16; pageNo++)
+			pool->readPage(&file, pageNo, page);
+		bool exceeded = false;
+		try
+		{
+			pool->readPage(&file, 17, page);
+		}
+		catch(BufferExceededException e)
+		{
+			exceeded = true;
+		}
+		checkPassFail(exceeded, true)
+		for (PageId pageNo = 1; pageNo <= 16; pageNo++)
+			pool->unPinPage(&file, pageNo, false);
+		pool->flushFile(&file);
+
+		// Pages read in every round outlast scans of pages read once, except under clock
+		PageId scanned = 20;
+		for (int round = 0; round < 10; round++)
+		{
+			for (PageId pageNo = 1; pageNo <= 4; pageNo++)
+			{
+				pool->readPage(&file, pageNo, page);
+				pool->unPinPage(&file, pageNo, false);
+			}
+			for (int i = 0; i < 8; i++, scanned++)
+			{
+				pool->readPage(&file, scanned, page);
+				pool->unPinPage(&file, scanned, false);
+			}
+		}
+		pool->clearBufStats();
+		for (PageId pageNo = 1; pageNo <= 4; pageNo++)
+		{
+			pool->readPage(&file, pageNo, page);
+			pool->unPinPage(&file, pageNo, false);
+		}
+		const int expectedMisses = policy == CLOCK ? 4 : 0;
+		checkPassFail(pool->getBufStats().diskreads.load(), expectedMisses)
+
+		delete pool;
+	});
+}
+
+// -----------------------------------------------------------------------------
+// bufferRingTests
+// -----------------------------------------------------------------------------
+
+void bufferRingTests()
+{
+	forEachPolicy("ring.0", 300, [](PageFile & file, ReplacementPolicyKind policy, const char* policyName)
+	{
+		// Clock also scans without a ring once
+		for (int pass = 0; pass < (policy == CLOCK ? 2 : 1); pass++)
+		{
+			const bool useRing = pass == 0;
+			std::cout << "Scan past hot pages " << (useRing ? "through a ring" : "without a ring") << std::endl;
+			BufMgr *pool = new BufMgr(32, Page::SIZE, policy);
+			// Count every page the scan itself reads
+			pool->setReadAhead(0);
+			Page *page;
+			for (int round = 0; round < 2; round++)
+			{
+				for (PageId pageNo = 1; pageNo <= 8; pageNo++)
+				{
+					pool->readPage(&file, pageNo, page);
+					pool->unPinPage(&file, pageNo, false);
+				}
+			}
+
+			// Scanned pages are read correctly, each one from disk
+			BufferRing ring(4);
+			pool->clearBufStats();
+			int correct = 0;
+			for (PageId pageNo = 20; pageNo < 300; pageNo++)
+			{
+				pool->readPage(&file, pageNo, page, useRing ? &ring : NULL);
+				correct += page->page_number() == pageNo;
+				pool->unPinPage(&file, pageNo, false);
+			}
+			checkPassFail(correct, 280)
+			checkPassFail(pool->getBufStats().diskreads.load(), 280)
+
+			// The hot pages are still in the pool only if the scan kept to its ring
+			pool->clearBufStats();
+			for (PageId pageNo = 1; pageNo <= 8; pageNo++)
+			{
+				pool->readPage(&file, pageNo, page);
+				pool->unPinPage(&file, pageNo, false);
+			}
+			const int expectedMisses = useRing ? 0 : 8;
+			checkPassFail(pool->getBufStats().diskreads.load(), expectedMisses)
+
+			delete pool;
+		}
+	});
+}
+
+// -----------------------------------------------------------------------------
+// backgroundWriterTests
+// -----------------------------------------------------------------------------
+
+void backgroundWriterTests()
+{
+	forEachPolicy("writer.0", 64, [](PageFile & file, ReplacementPolicyKind policy, const char* policyName)
+	{
+		std::cout << "Write dirty pages ahead of eviction with " << policyName << " replacement" << std::endl;
+		{
+			BufMgr *pool = new BufMgr(32, Page::SIZE, policy);
+			// Only misses and the writer write, no pages read ahead push dirty ones out
+			pool->setReadAhead(0);
+			Page *page;
+
+			for (PageId pageNo = 1; pageNo <= 32; pageNo++)
+			{
+				pool->readPage(&file, pageNo, page);
+				pool->unPinPage(&file, pageNo, true);
+			}
+			// Nothing is written while few enough frames are dirty, and no more than asked for
+			checkPassFail((int)pool->writeAhead(1.0, 100), 0)
+			checkPassFail((int)pool->writeAhead(0.0, 8), 8)
+			checkPassFail((int)pool->writeAhead(0.0, 100), 24)
+
+			// Misses now evict clean pages only
+			pool->clearBufStats();
+			for (PageId pageNo = 33; pageNo <= 64; pageNo++)
+			{
+				pool->readPage(&file, pageNo, page);
+				pool->unPinPage(&file, pageNo, false);
+			}
+			checkPassFail(pool->getBufStats().diskwrites.load(), 0)
+
+			// The writer thread cleans pages changed while it runs
+			pool->startWriter(0.0, 64, 1);
+			for (PageId pageNo = 1; pageNo <= 32; pageNo++)
+			{
+				pool->readPage(&file, pageNo, page);
+				char data[16];
+				sprintf(data, "page %d", pageNo);
+				page->insertRecord(data);
+				pool->unPinPage(&file, pageNo, true);
+			}
+			for (int wait = 0; wait < 2000 && pool->getBufStats().aheadwrites < 32; wait++)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			pool->stopWriter();
+			checkPassFail(pool->getBufStats().aheadwrites.load(), 32)
+			const int foregroundWrites = pool->getBufStats().diskwrites - pool->getBufStats().aheadwrites;
+			checkPassFail(foregroundWrites, 0)
+
+			// What the writer wrote is on disk
+			int correct = 0;
+			for (PageId pageNo = 1; pageNo <= 32; pageNo++)
+			{
+				char data[16];
+				sprintf(data, "page %d", pageNo);
+				correct += file.readPage(pageNo).getRecord(RecordId{pageNo, 1}) == data;
+			}
+			checkPassFail(correct, 32)
+			delete pool;
+		}
+	});
+}
+
+// -----------------------------------------------------------------------------
+// prefetchTests
+// -----------------------------------------------------------------------------
+
+void prefetchTests()
+{
+	{
+		PageFile file = PageFile::create("prefetch.0");
+		for (int i = 0; i < 64; i++)
+		{
+			PageId pageNo;
+			Page page = file.allocatePage(pageNo);
+			file.writePage(pageNo, page);
+		}
+		BufMgr *pool = new BufMgr(64);
+		Page *page;
+
+		std::cout << "Prefetch pages before they are read" << std::endl;
+		pool->prefetch(&file, 1, 8);
+		pool->waitForPrefetch();
+		checkPassFail(pool->getBufStats().prefetches.load(), 8)
+		pool->clearBufStats();
+		int correct = 0;
+		for (PageId pageNo = 1; pageNo <= 8; pageNo++)
+		{
+			pool->readPage(&file, pageNo, page);
+			correct += page->page_number() == pageNo;
+			pool->unPinPage(&file, pageNo, false);
+		}
+		checkPassFail(correct, 8)
+		checkPassFail(pool->getBufStats().diskreads.load(), 0)
+
+		// Pages in the pool and pages past the end of the file are skipped
+		pool->clearBufStats();
+		pool->prefetch(&file, 5, 8);
+		pool->prefetch(&file, 60, 10);
+		pool->waitForPrefetch();
+		checkPassFail(pool->getBufStats().prefetches.load(), 9)
+		pool->flushFile(&file);
+
+		std::cout << "Read ahead of a sequential reader" << std::endl;
+		// Once two misses are consecutive, every later page is read ahead before it is requested
+		pool->clearBufStats();
+		correct = 0;
+		for (PageId pageNo = 1; pageNo <= 64; pageNo++)
+		{
+			pool->readPage(&file, pageNo, page);
+			correct += page->page_number() == pageNo;
+			pool->unPinPage(&file, pageNo, false);
+			pool->waitForPrefetch();
+		}
+		checkPassFail(correct, 64)
+		checkPassFail(pool->getBufStats().prefetches.load(), 62)
+		checkPassFail(pool->getBufStats().diskreads.load(), 64)
+		pool->flushFile(&file);
+
+		// Reads out of order, or with read ahead turned off, read no more than they request
+		pool->clearBufStats();
+		const PageId scattered[] = {10, 30, 20, 50, 61, 40};
+		for (int i = 0; i < 6; i++)
+		{
+			pool->readPage(&file, scattered[i], page);
+			pool->unPinPage(&file, scattered[i], false);
+			pool->waitForPrefetch();
+		}
+		checkPassFail(pool->getBufStats().prefetches.load(), 0)
+		pool->flushFile(&file);
+		pool->setReadAhead(0);
+		for (PageId pageNo = 1; pageNo <= 16; pageNo++)
+		{
+			pool->readPage(&file, pageNo, page);
+			pool->unPinPage(&file, pageNo, false);
+			pool->waitForPrefetch();
+		}
+		checkPassFail(pool->getBufStats().prefetches.load(), 0)
+		checkPassFail(pool->getBufStats().diskreads.load(), 22)
+		pool->flushFile(&file);
+
+		std::cout << "Read pages while the prefetcher loads them" << std::endl;
+		// A page on its way in is waited for, not read a second time
+		pool->clearBufStats();
+		pool->prefetch(&file, 1, 16);
+		correct = 0;
+		for (PageId pageNo = 1; pageNo <= 16; pageNo++)
+		{
+			pool->readPage(&file, pageNo, page);
+			correct += page->page_number() == pageNo;
+			pool->unPinPage(&file, pageNo, false);
+		}
+		pool->waitForPrefetch();
+		checkPassFail(correct, 16)
+		checkPassFail(pool->getBufStats().diskreads.load(), 16)
+
+		// A flush leaves no page of the file behind, whether it was queued or being loaded
+		pool->prefetch(&file, 20, 16);
+		const bool flushed = flushUnpinned(pool, &file);
+		checkPassFail(flushed, true)
+		pool->waitForPrefetch();
+		pool->clearBufStats();
+		pool->readPage(&file, 20, page);
+		pool->unPinPage(&file, 20, false);
+		checkPassFail(pool->getBufStats().diskreads.load(), 1)
+		delete pool;
+	}
+	File::remove("prefetch.0");
+}
+
+// -----------------------------------------------------------------------------
+// sortedFlushTests
+// -----------------------------------------------------------------------------
+
+void sortedFlushTests()
+{
+	for (int round = 0; round < 2; round++)
+	{
+		// The first round flushes the file, the second leaves it to the pool's destructor
+		std::cout << (round == 0 ? "Flush a file" : "Destroy a pool") << " with dirty pages in scattered frames" << std::endl;
+		{
+			PageFile file = PageFile::create("flush.0");
+			for (int i = 0; i < 48; i++)
+			{
+				PageId pageNo;
+				Page page = file.allocatePage(pageNo);
+				file.writePage(pageNo, page);
+			}
+			BufMgr *pool = new BufMgr(64);
+			pool->setReadAhead(0);
+			// Runs of consecutive pages, in no particular frame order, with gaps between them
+			for (int i = 0; i < 48; i++)
+			{
+				const PageId pageNo = (i * 29) % 48 + 1;
+				Page *page;
+				pool->readPage(&file, pageNo, page);
+				if (pageNo % 8 != 0)
+				{
+					char data[16];
+					sprintf(data, "page %d", pageNo);
+					page->insertRecord(data);
+				}
+				pool->unPinPage(&file, pageNo, pageNo % 8 != 0);
+			}
+			if (round == 0)
+				pool->flushFile(&file);
+			else
+				delete pool;
+
+			int correct = 0;
+			for (PageId pageNo = 1; pageNo <= 48; pageNo++)
+			{
+				Page page = file.readPage(pageNo);
+				char data[16];
+				sprintf(data, "page %d", pageNo);
+				const bool expected = pageNo % 8 != 0 ? page.getRecord(RecordId{pageNo, 1}) == data
+				                                      : page.begin() == page.end();
+				correct += expected;
+			}
+			checkPassFail(correct, 48)
+
+			// The pages are still linked in the file
+			int linked = 0;
+			for (FileIterator it = file.begin(); it != file.end(); it++)
+				linked++;
+			checkPassFail(linked, 48)
+			if (round == 0)
+				delete pool;
+		}
+		File::remove("flush.0");
+	}
+}
+
+// -----------------------------------------------------------------------------
+// poolMemoryTests
+// -----------------------------------------------------------------------------
+
+void poolMemoryTests()
+{
+	{
+		PageFile file = PageFile::create("poolmem.0");
+		for (int i = 0; i < 16; i++)
+		{
+			PageId pageNo;
+			Page page = file.allocatePage(pageNo);
+			file.writePage(pageNo, page);
+		}
+
+		const HugePageMode modes[] = {NORMAL_PAGES, TRANSPARENT_HUGE_PAGES, EXPLICIT_HUGE_PAGES};
+		for (int m = 0; m < 3; m++)
+		{
+			std::cout << "Map a buffer pool with huge page mode " << m << std::endl;
+			BufMgr *pool = new BufMgr(8, Page::SIZE, CLOCK, modes[m]);
+			// Huge pages are only used when asked for, and only as far as the system has them
+			const bool asked = modes[m] != NORMAL_PAGES || pool->getHugePageMode() == NORMAL_PAGES;
+			checkPassFail(asked, true)
+			const bool aligned = (std::uintptr_t)pool->bufPool % (2 * 1024 * 1024) == 0;
+			checkPassFail(aligned, true)
+
+			// Every frame is usable
+			int correct = 0;
+			for (PageId pageNo = 1; pageNo <= 16; pageNo++)
+			{
+				Page *page;
+				pool->readPage(&file, pageNo, page);
+				correct += page->page_number() == pageNo;
+				pool->unPinPage(&file, pageNo, false);
+			}
+			checkPassFail(correct, 16)
+			delete pool;
+		}
+	}
+	File::remove("poolmem.0");
+}
+
+// -----------------------------------------------------------------------------
+// poolResizeTests
+// -----------------------------------------------------------------------------
+
+void poolResizeTests()
+{
+	forEachPolicy("resize.0", 32, [](PageFile & file, ReplacementPolicyKind policy, const char* policyName)
+	{
+		std::cout << "Resize a buffer pool with " << policyName << " replacement" << std::endl;
+		BufMgr *pool = new BufMgr(8, Page::SIZE, policy, TRANSPARENT_HUGE_PAGES, 32);
+		pool->setReadAhead(0);
+		Page *page;
+		for (PageId pageNo = 1; pageNo <= 8; pageNo++)
+		{
+			pool->readPage(&file, pageNo, page);
+			pool->unPinPage(&file, pageNo, false);
+		}
+
+		// The pool grows up to the frames it was built with room for, and then holds every page
+		checkPassFail((int)pool->resize(100), 32)
+		pool->clearBufStats();
+		for (PageId pageNo = 1; pageNo <= 32; pageNo++)
+		{
+			pool->readPage(&file, pageNo, page);
+			char data[16];
+			sprintf(data, "page %d", pageNo);
+			page->insertRecord(data);
+			pool->unPinPage(&file, pageNo, true);
+		}
+		checkPassFail(pool->getBufStats().diskreads.load(), 24)
+
+		// A pinned page keeps its frame, the ones after it stay in the pool too
+		pool->readPage(&file, 32, page);
+		const std::uint32_t shrunk = pool->resize(4);
+		const bool kept = shrunk >= 4 && shrunk == pool->getNumBufs();
+		checkPassFail(kept, true)
+		pool->clearBufStats();
+		pool->readPage(&file, 32, page);
+		checkPassFail(pool->getBufStats().diskreads.load(), 0)
+		pool->unPinPage(&file, 32, false);
+		pool->unPinPage(&file, 32, false);
+
+		// Once unpinned the pool shrinks all the way, writing the pages it drops
+		checkPassFail((int)pool->resize(4), 4)
+		int correct = 0;
+		for (PageId pageNo = 1; pageNo <= 32; pageNo++)
+		{
+			pool->readPage(&file, pageNo, page);
+			char data[16];
+			sprintf(data, "page %d", pageNo);
+			correct += page->getRecord(RecordId{pageNo, 1}) == data;
+			pool->unPinPage(&file, pageNo, false);
+		}
+		checkPassFail(correct, 32)
+
+		// Pages in the frames given up move to the empty frames the pool keeps, and are not read again
+		pool->flushFile(&file);
+		checkPassFail((int)pool->resize(8), 8)
+		{
+			PageFile other = PageFile::create("resize.1");
+			for (int i = 0; i < 4; i++)
+			{
+				PageId pageNo;
+				Page otherPage = other.allocatePage(pageNo);
+				other.writePage(pageNo, otherPage);
+			}
+
+			// Fill the pool, then have the other file take the first four frames and leave them empty again
+			FrameId frames[9];
+			for (PageId pageNo = 1; pageNo <= 8; pageNo++)
+			{
+				pool->readPage(&file, pageNo, page);
+				frames[pageNo] = (FrameId)(((char*)page - pool->bufPool) / Page::SIZE);
+			}
+			for (PageId pageNo = 1; pageNo <= 8; pageNo++)
+			{
+				if (frames[pageNo] < 4)
+					pool->unPinPage(&file, pageNo, false);
+			}
+			for (PageId pageNo = 1; pageNo <= 4; pageNo++)
+			{
+				pool->readPage(&other, pageNo, page);
+				pool->unPinPage(&other, pageNo, false);
+			}
+			for (PageId pageNo = 1; pageNo <= 8; pageNo++)
+			{
+				if (frames[pageNo] >= 4)
+					pool->unPinPage(&file, pageNo, false);
+			}
+			pool->flushFile(&other);
+
+			checkPassFail((int)pool->resize(4), 4)
+			pool->clearBufStats();
+			correct = 0;
+			for (PageId pageNo = 1; pageNo <= 8; pageNo++)
+			{
+				if (frames[pageNo] < 4)
+					continue;
+				pool->readPage(&file, pageNo, page);
+				char data[16];
+				sprintf(data, "page %d", pageNo);
+				correct += page->getRecord(RecordId{pageNo, 1}) == data;
+				pool->unPinPage(&file, pageNo, false);
+			}
+			checkPassFail(correct, 4)
+			checkPassFail(pool->getBufStats().diskreads.load(), 0)
+		}
+		File::remove("resize.1");
+		pool->flushFile(&file);
+		delete pool;
+	});
+
+	std::cout << "Grow a buffer pool built without a frame limit" << std::endl;
+	{
+		// Room is left for a few times the frames the pool starts with
+		BufMgr pool(8);
+		checkPassFail((int)pool.resize(100), 32)
+		checkPassFail((int)pool.resize(8), 8)
+	}
+}
+
+// -----------------------------------------------------------------------------
+// pageHandleTests
+// -----------------------------------------------------------------------------
+
+bool flushUnpinned(BufMgr *pool, File *file)
+{
+	try
+	{
+		pool->flushFile(file);
+	}
+	catch(PagePinnedException e)
+	{
+		return false;
+	}
+	return true;
+}
+
+void pageHandleTests()
+{
+	std::cout << "Pin pages with handles" << std::endl;
+	{
+		PageFile file = PageFile::create("handle.0");
+		BufMgr *pool = new BufMgr(8);
+		pool->setReadAhead(0);
+
+		// A dirty handle writes its page when it goes out of scope, and leaves no pin behind
+		PageId pageNo;
+		{
+			PageHandle handle;
+			pool->allocPage(&file, pageNo, handle);
+			handle->insertRecord("handle page");
+			handle.markDirty();
+			const bool pinned = handle.valid() && handle.pageNo() == pageNo && !flushUnpinned(pool, &file);
+			checkPassFail(pinned, true)
+		}
+		checkPassFail(flushUnpinned(pool, &file), true)
+		bool written = file.readPage(pageNo).getRecord(RecordId{pageNo, 1}) == "handle page";
+		checkPassFail(written, true)
+
+		// Moving a handle moves the pin, the handle moved from holds none
+		{
+			PageHandle first;
+			pool->readPage(&file, pageNo, first);
+			PageHandle second(std::move(first));
+			const bool moved = !first.valid() && second.valid() && second.pageNo() == pageNo;
+			checkPassFail(moved, true)
+			first = std::move(second);
+			first.release();
+			const bool released = !first.valid() && !second.valid();
+			checkPassFail(released, true)
+		}
+		checkPassFail(flushUnpinned(pool, &file), true)
+
+		// An exception thrown while the page is pinned unpins it on its way out
+		bool caught = false;
+		try
+		{
+			PageHandle handle;
+			pool->readPage(&file, pageNo, handle);
+			throw NoSuchKeyFoundException();
+		}
+		catch(NoSuchKeyFoundException e)
+		{
+			caught = true;
+		}
+		checkPassFail(caught && flushUnpinned(pool, &file), true)
+
+		// Reading another page into a handle unpins the page it held
+		PageId otherPageNo;
+		bool switched;
+		{
+			PageHandle handle;
+			pool->allocPage(&file, otherPageNo, handle);
+			handle->insertRecord("other page");
+			handle.markDirty();
+			pool->readPage(&file, pageNo, handle);
+			switched = handle.pageNo() == pageNo && otherPageNo != pageNo;
+		}
+		checkPassFail(switched, true)
+		checkPassFail(flushUnpinned(pool, &file), true)
+		written = file.readPage(otherPageNo).getRecord(RecordId{otherPageNo, 1}) == "other page";
+		checkPassFail(written, true)
+		delete pool;
+	}
+	File::remove("handle.0");
+}
+
+// -----------------------------------------------------------------------------
+// memIndexTests
+// -----------------------------------------------------------------------------
+
+void memIndexTests()
+{
+  std::cout << "Create an in-memory B+ Tree index on the integer field" << std::endl;
+	MemBTreeIndex index(relationName, bufMgr, offsetof(tuple,i), INTEGER);
+	checkPassFail((int)index.size(), relationSize)
+
+	checkPassFail(intScan(&index,25,GT,40,LT), 14)
+	checkPassFail(intScan(&index,20,GTE,35,LTE), 16)
+	checkPassFail(intScan(&index,-3,GT,3,LT), 3)
+	checkPassFail(intScan(&index,996,GT,1001,LT), 4)
+	checkPassFail(intScan(&index,0,GT,1,LT), 0)
+	checkPassFail(intScan(&index,300,GT,400,LT), 99)
+	checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+	checkPassFail(intScan(&index,relationSize,GTE,relationSize+5,LTE), 0)
+
+  std::cout << "Create an in-memory B+ Tree index on the double field" << std::endl;
+	MemBTreeIndex doubleIndex(relationName, bufMgr, offsetof(tuple,d), DOUBLE);
+	checkPassFail((int)doubleIndex.size(), relationSize)
+
+	checkPassFail(doubleScan(&doubleIndex,25,GT,40,LT), 14)
+	checkPassFail(doubleScan(&doubleIndex,24.5,GT,25.5,LT), 1)
+	checkPassFail(doubleScan(&doubleIndex,-3,GT,3,LT), 3)
+	checkPassFail(doubleScan(&doubleIndex,3000,GTE,4000,LT), 1000)
+
+  std::cout << "Create an in-memory B+ Tree index on the string field" << std::endl;
+	MemBTreeIndex stringIndex(relationName, bufMgr, offsetof(tuple,s), STRING);
+	checkPassFail((int)stringIndex.size(), relationSize)
+
+	checkPassFail(stringScan(&stringIndex,10,GT,20,LT), 9)
+	checkPassFail(stringScan(&stringIndex,4321,GTE,4321,LTE), 1)
+	checkPassFail(stringScan(&stringIndex,3000,GTE,4000,LT), 1000)
+
+	bool badType = false;
+	try
+	{
+		MemBTreeIndex unknown((Datatype)(STRING + 1));
+	}
+	catch(BadIndexInfoException e)
+	{
+		badType = true;
+	}
+	checkPassFail(badType, true)
+}
+
+template <class Index>
+int intScan(Index * index, int lowVal, Operator lowOp, int highVal, Operator highOp)
+{
+  std::cout << "Scan for ";
+  if( lowOp == GT ) { std::cout << "("; } else { std::cout << "["; }
+  std::cout << lowVal << "," << highVal;
+  if( highOp == LT ) { std::cout << ")"; } else { std::cout << "]"; }
+  std::cout << std::endl;
+
+	return countScan(index, &lowVal, lowOp, &highVal, highOp);
+}
+
+template <class Index>
+int doubleScan(Index * index, double lowVal, Operator lowOp, double highVal, Operator highOp)
+{
+  std::cout << "Scan for ";
+  if( lowOp == GT ) { std::cout << "("; } else { std::cout << "["; }
+  std::cout << lowVal << "," << highVal;
+  if( highOp == LT ) { std::cout << ")"; } else { std::cout << "]"; }
+  std::cout << std::endl;
+
+	return countScan(index, &lowVal, lowOp, &highVal, highOp);
+}
+
+template <class Index>
+int stringScan(Index * index, int lowVal, Operator lowOp, int highVal, Operator highOp)
+{
+  char lowValStr[100];
+  char highValStr[100];
+  sprintf(lowValStr,"%05d string record",lowVal);
+  sprintf(highValStr,"%05d string record",highVal);
+
+  std::cout << "Scan for ";
+  if( lowOp == GT ) { std::cout << "("; } else { std::cout << "["; }
+  std::cout << lowValStr << "," << highValStr;
+  if( highOp == LT ) { std::cout << ")"; } else { std::cout << "]"; }
+  std::cout << std::endl;
+
+	return countScan(index, lowValStr, lowOp, highValStr, highOp);
+}
+
+template <class Index>
+int countScan(Index * index, const void* lowVal, Operator lowOp, const void* highVal, Operator highOp)
+{
+  RecordId scanRid;
+	Page *curPage;
 
   int numResults = 0;
 	
 	try
 	{
-  	index->startScan(&lowVal, lowOp, &highVal, highOp);
+  	index->startScan(lowVal, lowOp, highVal, highOp);
 	}
 	catch(NoSuchKeyFoundException e)
 	{
@@ -0,0 +1,391 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#include "memBTree.h"
+#include "filescan.h"
+#include "exceptions/bad_index_info_exception.h"
+#include "exceptions/bad_opcodes_exception.h"
+#include "exceptions/bad_scanrange_exception.h"
+#include "exceptions/no_such_key_found_exception.h"
+#include "exceptions/scan_not_initialized_exception.h"
+#include "exceptions/index_scan_completed_exception.h"
+#include "exceptions/end_of_file_exception.h"
+
+namespace badgerdb
+{
+
+/**
+ * Deepest tree insertEntry() keeps a path for. With a fanout of 65 this is far beyond any index that fits in memory.
+ */
+static const int MAXDEPTH = 16;
+
+// -----------------------------------------------------------------------------
+// NodeArena
+// -----------------------------------------------------------------------------
+
+NodeArena::NodeArena()
+	: used(BLOCKSIZE)
+{
+}
+
+NodeArena::~NodeArena()
+{
+	for (std::size_t i = 0; i < blocks.size(); i++) {
+		std::free(blocks[i]);
+	}
+}
+
+void* NodeArena::allocate(const std::size_t size)
+{
+	const std::size_t align = alignof(std::max_align_t);
+	std::size_t offset = (used + align - 1) & ~(align - 1);
+	if (offset + size > BLOCKSIZE) {
+		char *block = (char*)std::malloc(BLOCKSIZE);
+		if (block == NULL) {
+			throw std::bad_alloc();
+		}
+		blocks.push_back(block);
+		offset = 0;
+	}
+	used = offset + size;
+	return blocks.back() + offset;
+}
+
+// -----------------------------------------------------------------------------
+// MemBTreeIndex::MemBTreeIndex -- Constructors
+// -----------------------------------------------------------------------------
+
+MemBTreeIndex::MemBTreeIndex(const Datatype attrType)
+{
+	attributeType = attrType;
+	numEntries = 0;
+	scanExecuting = false;
+	bindKernelsForType();
+}
+
+MemBTreeIndex::MemBTreeIndex(const std::string & relationName, BufMgr *bufMgrIn,
+		const int attrByteOffset, const Datatype attrType)
+{
+	attributeType = attrType;
+	numEntries = 0;
+	scanExecuting = false;
+	bindKernelsForType();
+
+	FileScan fscan(relationName, bufMgrIn);
+	try
+	{
+		RecordId scanRid;
+		while(1)
+		{
+			fscan.scanNext(scanRid);
+			std::string recordStr = fscan.getRecord();
+			const char *record = recordStr.c_str();
+			insertEntry(record + attrByteOffset, scanRid);
+		}
+	}
+	catch(EndOfFileException &e)
+	{
+	}
+}
+
+void MemBTreeIndex::bindKernelsForType()
+{
+	switch (attributeType) {
+		case INTEGER:
+			bindKernels<int>();
+			break;
+		case DOUBLE:
+			bindKernels<double>();
+			break;
+		case STRING:
+			bindKernels<StringKey>();
+			break;
+		default:
+			throw BadIndexInfoException("Unsupported attribute type for an in-memory index.");
+	}
+}
+
+template <class T>
+void MemBTreeIndex::bindKernels()
+{
+	insertEntryFn = &MemBTreeIndex::insertEntryKernel<T>;
+	startScanFn = &MemBTreeIndex::startScanKernel<T>;
+	scanNextFn = &MemBTreeIndex::scanNextKernel<T>;
+	leafRoot = true;
+	root = newLeaf<T>();
+}
+
+template <>
+int& MemBTreeIndex::highVal<int>()
+{
+	return highValInt;
+}
+
+template <>
+double& MemBTreeIndex::highVal<double>()
+{
+	return highValDouble;
+}
+
+template <>
+StringKey& MemBTreeIndex::highVal<StringKey>()
+{
+	return highValString;
+}
+
+template <class T>
+MemLeafNode<T>* MemBTreeIndex::newLeaf()
+{
+	MemLeafNode<T> *leaf = (MemLeafNode<T>*)arena.allocate(sizeof(MemLeafNode<T>));
+	leaf->numEntries = 0;
+	leaf->rightSib = NULL;
+	return leaf;
+}
+
+template <class T>
+MemNonLeafNode<T>* MemBTreeIndex::newNonLeaf(const int level)
+{
+	MemNonLeafNode<T> *node = (MemNonLeafNode<T>*)arena.allocate(sizeof(MemNonLeafNode<T>));
+	node->level = level;
+	node->numEntries = 0;
+	return node;
+}
+
+// -----------------------------------------------------------------------------
+// MemBTreeIndex::insertEntry
+// -----------------------------------------------------------------------------
+
+void MemBTreeIndex::insertEntry(const void *keyPtr, const RecordId rid)
+{
+	(this->*insertEntryFn)(keyPtr, rid);
+}
+
+template <class T>
+void MemBTreeIndex::insertEntryKernel(const void *keyPtr, const RecordId rid)
+{
+	const T key = keyFromPtr<T>(keyPtr);
+
+	// Descend to the leaf, remembering the path for split propagation
+	MemNonLeafNode<T> *path[MAXDEPTH];
+	int pathIdx[MAXDEPTH];
+	int depth = 0;
+	void *node = root;
+	if (!leafRoot) {
+		MemNonLeafNode<T> *cur = (MemNonLeafNode<T>*)root;
+		while (true) {
+			int idx = std::upper_bound(cur->keyArray, cur->keyArray + cur->numEntries, key) - cur->keyArray;
+			path[depth] = cur;
+			pathIdx[depth] = idx;
+			depth++;
+			node = cur->childArray[idx];
+			if (cur->level == 1) {
+				break;
+			}
+			cur = (MemNonLeafNode<T>*)node;
+		}
+	}
+	numEntries++;
+
+	MemLeafNode<T> *leaf = (MemLeafNode<T>*)node;
+	int pos = std::upper_bound(leaf->keyArray, leaf->keyArray + leaf->numEntries, key) - leaf->keyArray;
+
+	// Leaf Node is not full
+	if (leaf->numEntries < MEMLEAFSIZE) {
+		std::copy_backward(leaf->keyArray + pos, leaf->keyArray + leaf->numEntries, leaf->keyArray + leaf->numEntries + 1);
+		std::copy_backward(leaf->ridArray + pos, leaf->ridArray + leaf->numEntries, leaf->ridArray + leaf->numEntries + 1);
+		leaf->keyArray[pos] = key;
+		leaf->ridArray[pos] = rid;
+		leaf->numEntries++;
+		return;
+	}
+
+	// Leaf Node is full, split it
+	T tempKeyArray[ MEMLEAFSIZE + 1 ];
+	RecordId tempRidArray[ MEMLEAFSIZE + 1 ];
+	std::copy(leaf->keyArray, leaf->keyArray + pos, tempKeyArray);
+	std::copy(leaf->ridArray, leaf->ridArray + pos, tempRidArray);
+	tempKeyArray[pos] = key;
+	tempRidArray[pos] = rid;
+	std::copy(leaf->keyArray + pos, leaf->keyArray + MEMLEAFSIZE, tempKeyArray + pos + 1);
+	std::copy(leaf->ridArray + pos, leaf->ridArray + MEMLEAFSIZE, tempRidArray + pos + 1);
+
+	MemLeafNode<T> *rightLeaf = newLeaf<T>();
+	leaf->numEntries = (MEMLEAFSIZE + 1) / 2;
+	rightLeaf->numEntries = (MEMLEAFSIZE + 1) - leaf->numEntries;
+	std::copy(tempKeyArray, tempKeyArray + leaf->numEntries, leaf->keyArray);
+	std::copy(tempRidArray, tempRidArray + leaf->numEntries, leaf->ridArray);
+	std::copy(tempKeyArray + leaf->numEntries, tempKeyArray + MEMLEAFSIZE + 1, rightLeaf->keyArray);
+	std::copy(tempRidArray + leaf->numEntries, tempRidArray + MEMLEAFSIZE + 1, rightLeaf->ridArray);
+	rightLeaf->rightSib = leaf->rightSib;
+	leaf->rightSib = rightLeaf;
+
+	// Propagate the split up the remembered path
+	T middleKey = rightLeaf->keyArray[0];
+	void *rightChild = rightLeaf;
+	for (int d = depth - 1; d >= 0; d--) {
+		MemNonLeafNode<T> *parent = path[d];
+		int idx = pathIdx[d];
+
+		// Nonleaf node is not full
+		if (parent->numEntries < MEMNONLEAFSIZE) {
+			std::copy_backward(parent->keyArray + idx, parent->keyArray + parent->numEntries, parent->keyArray + parent->numEntries + 1);
+			std::copy_backward(parent->childArray + idx + 1, parent->childArray + parent->numEntries + 1, parent->childArray + parent->numEntries + 2);
+			parent->keyArray[idx] = middleKey;
+			parent->childArray[idx + 1] = rightChild;
+			parent->numEntries++;
+			return;
+		}
+
+		// Nonleaf node is full, split it and push the middle key up
+		T tempKeys[ MEMNONLEAFSIZE + 1 ];
+		void *tempChildren[ MEMNONLEAFSIZE + 2 ];
+		std::copy(parent->keyArray, parent->keyArray + idx, tempKeys);
+		tempKeys[idx] = middleKey;
+		std::copy(parent->keyArray + idx, parent->keyArray + MEMNONLEAFSIZE, tempKeys + idx + 1);
+		std::copy(parent->childArray, parent->childArray + idx + 1, tempChildren);
+		tempChildren[idx + 1] = rightChild;
+		std::copy(parent->childArray + idx + 1, parent->childArray + MEMNONLEAFSIZE + 1, tempChildren + idx + 2);
+
+		MemNonLeafNode<T> *rightNode = newNonLeaf<T>(parent->level);
+		int leftCount = (MEMNONLEAFSIZE + 1) / 2;
+		parent->numEntries = leftCount;
+		rightNode->numEntries = MEMNONLEAFSIZE - leftCount;
+		std::copy(tempKeys, tempKeys + leftCount, parent->keyArray);
+		std::copy(tempChildren, tempChildren + leftCount + 1, parent->childArray);
+		std::copy(tempKeys + leftCount + 1, tempKeys + MEMNONLEAFSIZE + 1, rightNode->keyArray);
+		std::copy(tempChildren + leftCount + 1, tempChildren + MEMNONLEAFSIZE + 2, rightNode->childArray);
+
+		middleKey = tempKeys[leftCount];
+		rightChild = rightNode;
+	}
+
+	// Root is splitted, grow the tree by one level
+	int level = leafRoot ? 1 : ((MemNonLeafNode<T>*)root)->level + 1;
+	MemNonLeafNode<T> *newRoot = newNonLeaf<T>(level);
+	newRoot->numEntries = 1;
+	newRoot->keyArray[0] = middleKey;
+	newRoot->childArray[0] = root;
+	newRoot->childArray[1] = rightChild;
+	root = newRoot;
+	leafRoot = false;
+}
+
+// -----------------------------------------------------------------------------
+// MemBTreeIndex::startScan
+// -----------------------------------------------------------------------------
+
+void MemBTreeIndex::startScan(const void* lowValParm,
+   const Operator lowOpParm,
+   const void* highValParm,
+   const Operator highOpParm)
+{
+	(this->*startScanFn)(lowValParm, lowOpParm, highValParm, highOpParm);
+}
+
+template <class T>
+void MemBTreeIndex::startScanKernel(const void* lowValParm,
+   const Operator lowOpParm,
+   const void* highValParm,
+   const Operator highOpParm)
+{
+	if (scanExecuting) {
+		endScan();
+	}
+
+	if ((lowOpParm != GTE && lowOpParm != GT) || (highOpParm != LT && highOpParm != LTE)) {
+		throw BadOpcodesException();
+	}
+
+	const T lowVal = keyFromPtr<T>(lowValParm);
+	highVal<T>() = keyFromPtr<T>(highValParm);
+	highOp = highOpParm;
+	if (highVal<T>() < lowVal) {
+		throw BadScanrangeException();
+	}
+
+	// Descend towards the leftmost leaf that can hold lowVal. Keys equal to a separator may sit on
+	// both sides of it, so take the left child and let the sibling walk below move right.
+	void *node = root;
+	if (!leafRoot) {
+		MemNonLeafNode<T> *cur = (MemNonLeafNode<T>*)root;
+		while (true) {
+			int idx = std::lower_bound(cur->keyArray, cur->keyArray + cur->numEntries, lowVal) - cur->keyArray;
+			node = cur->childArray[idx];
+			if (cur->level == 1) {
+				break;
+			}
+			cur = (MemNonLeafNode<T>*)node;
+		}
+	}
+
+	MemLeafNode<T> *leaf = (MemLeafNode<T>*)node;
+	while (leaf != NULL) {
+		T *end = leaf->keyArray + leaf->numEntries;
+		T *it = (lowOpParm == GT) ? std::upper_bound(leaf->keyArray, end, lowVal)
+		                          : std::lower_bound(leaf->keyArray, end, lowVal);
+		if (it != end) {
+			currentLeaf = leaf;
+			nextEntry = it - leaf->keyArray;
+			scanExecuting = true;
+			return;
+		}
+		leaf = leaf->rightSib;
+	}
+
+	throw NoSuchKeyFoundException();
+}
+
+// -----------------------------------------------------------------------------
+// MemBTreeIndex::scanNext
+// -----------------------------------------------------------------------------
+
+void MemBTreeIndex::scanNext(RecordId& outRid)
+{
+	if (!scanExecuting) {
+		throw ScanNotInitializedException();
+	}
+	(this->*scanNextFn)(outRid);
+}
+
+template <class T>
+void MemBTreeIndex::scanNextKernel(RecordId& outRid)
+{
+	MemLeafNode<T> *leaf = (MemLeafNode<T>*)currentLeaf;
+	if (nextEntry == leaf->numEntries) {
+		if (leaf->rightSib == NULL) {
+			throw IndexScanCompletedException();
+		}
+		leaf = leaf->rightSib;
+		currentLeaf = leaf;
+		nextEntry = 0;
+	}
+
+	const T& currentKey = leaf->keyArray[nextEntry];
+	if ((highOp == LT && !(currentKey < highVal<T>())) || (highOp == LTE && !(currentKey <= highVal<T>()))) {
+		throw IndexScanCompletedException();
+	}
+	outRid = leaf->ridArray[nextEntry];
+	nextEntry++;
+}
+
+// -----------------------------------------------------------------------------
+// MemBTreeIndex::endScan
+// -----------------------------------------------------------------------------
+
+void MemBTreeIndex::endScan()
+{
+	if (!scanExecuting) {
+		throw ScanNotInitializedException();
+	}
+	scanExecuting = false;
+}
+
+}
@@ -0,0 +1,332 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "types.h"
+#include "buffer.h"
+#include "btree.h"
+
+namespace badgerdb
+{
+
+/**
+ * @brief Number of key slots in an in-memory B+Tree leaf.
+ * Sized so a leaf spans a handful of cache lines rather than a disk page.
+ */
+const int MEMLEAFSIZE = 64;
+
+/**
+ * @brief Number of key slots in an in-memory B+Tree non-leaf.
+ */
+const int MEMNONLEAFSIZE = 64;
+
+/**
+ * @brief Bump allocator handing out memory from large blocks. Individual allocations are never freed;
+ * all memory is returned at once when the arena is destroyed.
+ *
+ * @warning This class is not threadsafe.
+ */
+class NodeArena
+{
+ public:
+  /**
+   * Size in bytes of every block the arena requests from the heap.
+   */
+	static const std::size_t BLOCKSIZE = 64 * 1024;
+
+  /**
+   * Constructor of NodeArena class. No memory is allocated until the first call to allocate().
+   */
+	NodeArena();
+
+  /**
+   * Destructor of NodeArena class. Frees every block.
+   */
+	~NodeArena();
+
+  /**
+   * Allocate size bytes aligned to alignof(std::max_align_t).
+   *
+   * @param size    Number of bytes. Must not exceed BLOCKSIZE.
+   * @return        Pointer to the memory.
+   */
+	void* allocate(const std::size_t size);
+
+ private:
+	NodeArena(const NodeArena&);
+	NodeArena& operator=(const NodeArena&);
+
+  /**
+   * Blocks obtained from the heap.
+   */
+	std::vector<char*> blocks;
+
+  /**
+   * Offset of the first free byte in the last block.
+   */
+	std::size_t used;
+};
+
+/**
+ * @brief Structure for all in-memory non-leaf nodes with keys of type T.
+ * Children are addressed directly instead of through page numbers.
+ */
+template <class T>
+struct MemNonLeafNode{
+  /**
+   * Level of the node in the tree, 1 if the children are leaves.
+   */
+	int level;
+
+  /**
+   * Stores number of entries in this node.
+   */
+	int numEntries;
+
+  /**
+   * Stores keys.
+   */
+	T keyArray[ MEMNONLEAFSIZE ];
+
+  /**
+   * Stores pointers to the child nodes, MemNonLeafNode or MemLeafNode depending on level.
+   */
+	void *childArray[ MEMNONLEAFSIZE + 1 ];
+};
+
+/**
+ * @brief Structure for all in-memory leaf nodes with keys of type T.
+ */
+template <class T>
+struct MemLeafNode{
+  /**
+   * Stores number of entries in this node.
+   */
+	int numEntries;
+
+  /**
+   * Stores keys.
+   */
+	T keyArray[ MEMLEAFSIZE ];
+
+  /**
+   * Stores RecordIds.
+   */
+	RecordId ridArray[ MEMLEAFSIZE ];
+
+  /**
+   * The leaf on the right side, NULL for the rightmost leaf.
+   */
+	MemLeafNode<T> *rightSib;
+};
+
+/**
+ * @brief In-memory nodes for INTEGER keys.
+ */
+typedef MemNonLeafNode< int > MemNonLeafNodeInt;
+typedef MemLeafNode< int > MemLeafNodeInt;
+
+/**
+ * @brief MemBTreeIndex class. A B+ Tree index on a single attribute of a relation that lives entirely in
+ * memory. Nodes are carved out of a NodeArena and point at each other directly, so no buffer manager,
+ * page table lookups, pinning or file I/O are involved. Meant for short-lived indexes such as per-query
+ * join indexes; the index is gone once the object is destroyed. It offers the same insert and scan
+ * interface and key types as BTreeIndex and supports only one scan at a time.
+*/
+class MemBTreeIndex {
+
+ private:
+
+  /**
+   * Datatype of attribute over which index is built.
+   */
+	Datatype	attributeType;
+
+  /**
+   * Memory for all nodes.
+   */
+	NodeArena	arena;
+
+  /**
+   * Root node, a MemLeafNode if leafRoot is true, else a MemNonLeafNode.
+   */
+	void		*root;
+
+  /**
+   * True if the root is leaf
+   */
+	bool		leafRoot;
+
+  /**
+   * Number of entries in the index.
+   */
+	std::size_t	numEntries;
+
+
+	// MEMBERS SPECIFIC TO SCANNING
+
+  /**
+   * True if an index scan has been started.
+   */
+	bool		scanExecuting;
+
+  /**
+   * Index of next entry to be scanned in current leaf being scanned.
+   */
+	int			nextEntry;
+
+  /**
+   * Current leaf being scanned, a MemLeafNode of the index's key type.
+   */
+	void		*currentLeaf;
+
+  /**
+   * High value for scan of an INTEGER, DOUBLE or STRING index.
+   */
+	int			highValInt;
+	double	highValDouble;
+	StringKey	highValString;
+
+  /**
+   * The high value member for key type T.
+   */
+	template <class T>
+	T& highVal();
+
+  /**
+   * High Operator. Can only be LT(<) or LTE(<=).
+   */
+	Operator	highOp;
+
+  /**
+   * Allocate an empty leaf from the arena.
+   */
+	template <class T>
+	MemLeafNode<T>* newLeaf();
+
+  /**
+   * Allocate an empty non-leaf from the arena.
+   *
+   * @param level   Level of the new node.
+   */
+	template <class T>
+	MemNonLeafNode<T>* newNonLeaf(const int level);
+
+  /**
+   * Body of insertEntry() for keys of type T.
+   */
+	template <class T>
+	void insertEntryKernel(const void* key, const RecordId rid);
+
+  /**
+   * Body of startScan() for keys of type T.
+   */
+	template <class T>
+	void startScanKernel(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
+
+  /**
+   * Body of scanNext() for keys of type T.
+   */
+	template <class T>
+	void scanNextKernel(RecordId& outRid);
+
+  /**
+   * Point the kernels at their instantiations for keys of type T and create the empty root.
+   */
+	template <class T>
+	void bindKernels();
+
+  /**
+   * Pick the kernels for attributeType.
+   *
+   * @throws  BadIndexInfoException If the attribute type is not supported
+   */
+	void bindKernelsForType();
+
+  /**
+   * Instantiation of insertEntryKernel() chosen for attributeType.
+   */
+	void (MemBTreeIndex::*insertEntryFn)(const void*, const RecordId);
+
+  /**
+   * Instantiation of startScanKernel() chosen for attributeType.
+   */
+	void (MemBTreeIndex::*startScanFn)(const void*, const Operator, const void*, const Operator);
+
+  /**
+   * Instantiation of scanNextKernel() chosen for attributeType.
+   */
+	void (MemBTreeIndex::*scanNextFn)(RecordId&);
+
+ public:
+
+  /**
+   * MemBTreeIndex Constructor. Creates an empty index.
+   *
+   * @param attrType		Datatype of attribute over which index is built
+   * @throws  BadIndexInfoException If the attribute type is not supported
+   */
+	MemBTreeIndex(const Datatype attrType);
+
+  /**
+   * MemBTreeIndex Constructor. Creates the index and inserts entries for every tuple in the base
+   * relation using FileScan class.
+   *
+   * @param relationName        Name of file.
+   * @param bufMgrIn						Buffer Manager Instance, used only to scan the relation
+   * @param attrByteOffset			Offset of attribute, over which index is to be built, in the record
+   * @param attrType						Datatype of attribute over which index is built
+   * @throws  BadIndexInfoException If the attribute type is not supported
+   */
+	MemBTreeIndex(const std::string & relationName, BufMgr *bufMgrIn,
+						const int attrByteOffset, const Datatype attrType);
+
+  /**
+   * Number of entries in the index.
+   */
+	std::size_t size() const { return numEntries; }
+
+  /**
+	 * Insert a new entry using the pair <value,rid>.
+   * @param key			Key to insert, pointer to integer/double/char string
+   * @param rid			Record ID of a record whose entry is getting inserted into the index.
+	**/
+	void insertEntry(const void* key, const RecordId rid);
+
+  /**
+	 * Begin a filtered scan of the index, with the same semantics as BTreeIndex::startScan().
+   * @param lowVal	Low value of range, pointer to integer / double / char string
+   * @param lowOp		Low operator (GT/GTE)
+   * @param highVal	High value of range, pointer to integer / double / char string
+   * @param highOp	High operator (LT/LTE)
+   * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values
+   * @throws  BadScanrangeException If lowVal > highval
+	 * @throws  NoSuchKeyFoundException If there is no key in the B+ tree that satisfies the scan criteria.
+	**/
+	void startScan(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
+
+  /**
+	 * Fetch the record id of the next index entry that matches the scan.
+   * @param outRid	RecordId of next record found that satisfies the scan criteria returned in this
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	 * @throws IndexScanCompletedException If no more records, satisfying the scan criteria, are left to be scanned.
+	**/
+	void scanNext(RecordId& outRid);
+
+  /**
+	 * Terminate the current scan.
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	**/
+	void endScan();
+};
+
+}
@@ -5,7 +5,9 @@
  * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
  */
 
+#include <algorithm>
 #include <cassert>
+#include <new>
 
 #include <iostream>
 #include "exceptions/insufficient_space_exception.h"
@@ -19,18 +21,28 @@
 namespace badgerdb {
 
 Page::Page() {
-  initialize();
+  initialize(SIZE);
 }
 
-void Page::initialize() {
+Page::Page(const std::size_t page_size) {
+  initialize(page_size);
+}
+
+PageBuffer::PageBuffer(const std::size_t page_size)
+    : page_size_(page_size), bytes_(std::max(page_size, sizeof(Page))) {
+  new (&bytes_[0]) Page(page_size);
+}
+
+void Page::initialize(const std::size_t page_size) {
+  const std::size_t data_size = page_size - sizeof(PageHeader);
   header_.free_space_lower_bound = 0;
-  header_.free_space_upper_bound = DATA_SIZE;
+  header_.free_space_upper_bound = data_size;
   header_.num_slots = 0;
   header_.num_free_slots = 0;
   header_.current_page_number = INVALID_NUMBER;
   header_.next_page_number = INVALID_NUMBER;
   //data_.assign(DATA_SIZE, char());
-	memset(data_, '\0', DATA_SIZE);
+	memset(data_, '\0', data_size);
 }
 
 RecordId Page::insertRecord(const std::string& record_data) {
@@ -46,7 +58,7 @@ RecordId Page::insertRecord(const std::string& record_data) {
 std::string Page::getRecord(const RecordId& record_id) const {
   validateRecordId(record_id);
   const PageSlot& slot = getSlot(record_id.slot_number);
-	std::string retStr = std::string(data_, DATA_SIZE).substr(slot.item_offset, slot.item_length);
+	std::string retStr = std::string(&data_[slot.item_offset], slot.item_length);
 
 	return retStr;
 }
@@ -99,7 +111,7 @@ void Page::deleteRecord(const RecordId& record_id,
   }
   // If we have data to move, shift it to the right.
   if (move_bytes > 0) {
-    const std::string& data_to_move = std::string(data_, DATA_SIZE).substr(move_offset, move_bytes);
+    const std::string& data_to_move = std::string(&data_[move_offset], move_bytes);
 
 		for(std::uint16_t i = 0; i < move_bytes; i++)
 			data_[i + move_offset + slot->item_length] = data_to_move[i];
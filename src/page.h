@@ -11,6 +11,7 @@
 #include <stdint.h>
 #include <memory>
 #include <string>
+#include <vector>
 
 //#include <gtest/gtest.h>
 #include "types.h"
@@ -94,6 +95,7 @@ struct PageSlot {
 };
 
 class PageIterator;
+class PageBuffer;
 
 /**
  * @brief Class which represents a fixed-size database page containing records.
@@ -103,21 +105,43 @@ class PageIterator;
  * slots and identified by a RecordId.  Although a record's actual contents may
  * be moved on the page, accessing a record by its slot is consistent.
  *
+ * A Page object has room for a page of the default size, and may be copied
+ * by value, as File::readPage() returns it.  A Page is also laid out in place
+ * over the bytes of a page of any size: a buffer pool frame or a PageBuffer.
+ * Only the first page size bytes are used, so a smaller page may live in less
+ * storage, and a larger one runs on into the storage past the object.  Copying
+ * such a Page by value would cut it off at the default size.
+ *
  * @warning This class is not threadsafe.
  */
 class Page {
  public:
   /**
-   * Page size in bytes.  If this is changed, database files created with a
-   * different page size value will be unreadable by the resulting binaries.
+   * Default page size in bytes, used for files created without an explicit
+   * page size.  The page size of every file is recorded in its FileHeader.
    */
   static const std::size_t SIZE = 8192;
 
   /**
-   * Size of page free space area in bytes.
+   * Smallest supported page size in bytes.
+   */
+  static const std::size_t MIN_SIZE = 4096;
+
+  /**
+   * Largest supported page size in bytes.
+   */
+  static const std::size_t MAX_SIZE = 65536;
+
+  /**
+   * Size of page free space area in bytes for a page of the default size.
    */
   static const std::size_t DATA_SIZE = SIZE - sizeof(PageHeader);
 
+  /**
+   * Size of page free space area in bytes for a page of the largest size.
+   */
+  static const std::size_t MAX_DATA_SIZE = MAX_SIZE - sizeof(PageHeader);
+
   /**
    * Number of page indicating that it's invalid.
    */
@@ -129,10 +153,19 @@ class Page {
   static const SlotId INVALID_SLOT = 0;
 
   /**
-   * Constructs a new, uninitialized page.
+   * Constructs a new, empty page of the default size.
    */
   Page();
 
+  /**
+   * Returns true if the given size is a power of two between MIN_SIZE and
+   * MAX_SIZE.
+   */
+  static bool isValidSize(const std::size_t page_size) {
+    return page_size >= MIN_SIZE && page_size <= MAX_SIZE &&
+        (page_size & (page_size - 1)) == 0;
+  }
+
   /**
    * Inserts a new record into the page.
    *
@@ -216,10 +249,21 @@ class Page {
   PageIterator end();
 
  private:
+  /**
+   * Constructs a new, empty page of the given size in storage of at least
+   * that size.
+   *
+   * @param page_size  Page size in bytes.  Must satisfy isValidSize().
+   */
+  explicit Page(const std::size_t page_size);
+
   /**
    * Initializes this page as a new page with no header information or data.
+   * Only the first page_size bytes of the page are touched.
+   *
+   * @param page_size  Page size in bytes.
    */
-  void initialize();
+  void initialize(const std::size_t page_size);
 
   /**
    * Sets this page's number in its file.
@@ -328,20 +372,72 @@ class Page {
 
   /**
    * Data stored on the page.  Includes bookkeeping information about slots as
-   * well as actual content.
+   * well as actual content.  Declared for the default page size, pages of a
+   * larger size continue past it.
    */
-
   char data_[DATA_SIZE];
 
   friend class File;
   friend class PageFile;
   friend class BlobFile;
   friend class PageIterator;
+  friend class BufMgr;
+  friend class PageBuffer;
+};
+
+/**
+ * @brief Storage for one page of a given size, outside of the buffer pool.
+ *
+ * Holds pages of files whose page size is larger than a Page value has room
+ * for, read with File::readPage(PageId, Page&).  Copying a PageBuffer copies
+ * the page.
+ *
+ * @warning This class is not threadsafe.
+ */
+class PageBuffer {
+ public:
+  /**
+   * Constructs storage holding a new, empty page of the given size.
+   *
+   * @param page_size  Page size in bytes.  Must satisfy Page::isValidSize().
+   */
+  explicit PageBuffer(const std::size_t page_size = Page::SIZE);
+
+  /**
+   * Returns the page.
+   */
+  Page* get() { return reinterpret_cast<Page*>(&bytes_[0]); }
+  const Page* get() const { return reinterpret_cast<const Page*>(&bytes_[0]); }
+
+  Page& operator*() { return *get(); }
+  const Page& operator*() const { return *get(); }
+  Page* operator->() { return get(); }
+  const Page* operator->() const { return get(); }
+
+  /**
+   * Returns the page size in bytes.
+   */
+  std::size_t size() const { return page_size_; }
+
+ private:
+  /**
+   * Page size in bytes.
+   */
+  std::size_t page_size_;
+
+  /**
+   * Bytes of the page, at least sizeof(Page) of them.
+   */
+  std::vector<char> bytes_;
 };
 
 static_assert(Page::SIZE > sizeof(PageHeader),
               "Page size must be large enough to hold header and data.");
 static_assert(Page::DATA_SIZE > 0,
               "Page must have some space to hold data.");
+static_assert(sizeof(Page) == Page::SIZE,
+              "A Page value must hold a page of the default size.");
+static_assert(Page::MAX_DATA_SIZE <= 0xFFFF,
+              "Free space bounds of the largest page must fit in 16 bits.");
 
 }
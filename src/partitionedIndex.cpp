@@ -0,0 +1,621 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+#include "partitionedIndex.h"
+#include "filescan.h"
+#include "exceptions/bad_index_info_exception.h"
+#include "exceptions/no_such_key_found_exception.h"
+#include "exceptions/scan_not_initialized_exception.h"
+#include "exceptions/index_scan_completed_exception.h"
+#include "exceptions/file_not_found_exception.h"
+#include "exceptions/end_of_file_exception.h"
+#include "exceptions/invalid_page_size_exception.h"
+
+namespace badgerdb
+{
+
+static_assert(sizeof(PartitionedIndexMetaInfo) + ( MAXPARTITIONS - 1 ) * sizeof(StringKey) <= Page::MIN_SIZE,
+							"The router must fit in the meta page.");
+
+template <>
+PartitionKeys<int>& PartitionedIndex::partitionKeys<int>() { return intKeys; }
+
+template <>
+PartitionKeys<double>& PartitionedIndex::partitionKeys<double>() { return doubleKeys; }
+
+template <>
+PartitionKeys<StringKey>& PartitionedIndex::partitionKeys<StringKey>() { return stringKeys; }
+
+/**
+ * Order entries by key alone, so a stable sort keeps equal keys in relation order.
+ */
+template <class T>
+static bool entryKeyLess(const RIDKeyPair<T> & a, const RIDKeyPair<T> & b)
+{
+	return a.key < b.key;
+}
+
+// -----------------------------------------------------------------------------
+// PartitionedIndex::PartitionedIndex -- Constructor
+// -----------------------------------------------------------------------------
+
+PartitionedIndex::PartitionedIndex(const std::string & relationName,
+		std::string & outIndexName,
+		BufMgr *bufMgrIn,
+		const int attrByteOffset,
+		const Datatype attrType,
+		const int numPartitions,
+		const std::size_t pageSize)
+{
+	bufMgr = bufMgrIn;
+	headerPageNum = 1;
+
+	std::ostringstream idxStr;
+	idxStr << relationName << '.' << attrByteOffset << ".parts";
+	outIndexName = idxStr.str();
+
+	this->relationName = relationName;
+	indexName = outIndexName;
+	attributeType = attrType;
+	this->attrByteOffset = attrByteOffset;
+	partitionPageSize = pageSize;
+	nextPartitionId = 0;
+	scanExecuting = false;
+	scanCompleted = false;
+
+	switch (attributeType) {
+	case INTEGER:
+		writeRouterFn = &PartitionedIndex::writeRouterKernel<int>;
+		readRouterFn = &PartitionedIndex::readRouterKernel<int>;
+		routeFn = &PartitionedIndex::routeKernel<int>;
+		inScanFn = &PartitionedIndex::inScanKernel<int>;
+		setScanRangeFn = &PartitionedIndex::setScanRangeKernel<int>;
+		openScanFn = &PartitionedIndex::openScanKernel<int>;
+		buildFn = &PartitionedIndex::buildKernel<int>;
+		splitFn = &PartitionedIndex::splitKernel<int>;
+		mergeFn = &PartitionedIndex::mergeKernel<int>;
+		break;
+	case DOUBLE:
+		writeRouterFn = &PartitionedIndex::writeRouterKernel<double>;
+		readRouterFn = &PartitionedIndex::readRouterKernel<double>;
+		routeFn = &PartitionedIndex::routeKernel<double>;
+		inScanFn = &PartitionedIndex::inScanKernel<double>;
+		setScanRangeFn = &PartitionedIndex::setScanRangeKernel<double>;
+		openScanFn = &PartitionedIndex::openScanKernel<double>;
+		buildFn = &PartitionedIndex::buildKernel<double>;
+		splitFn = &PartitionedIndex::splitKernel<double>;
+		mergeFn = &PartitionedIndex::mergeKernel<double>;
+		break;
+	case STRING:
+		writeRouterFn = &PartitionedIndex::writeRouterKernel<StringKey>;
+		readRouterFn = &PartitionedIndex::readRouterKernel<StringKey>;
+		routeFn = &PartitionedIndex::routeKernel<StringKey>;
+		inScanFn = &PartitionedIndex::inScanKernel<StringKey>;
+		setScanRangeFn = &PartitionedIndex::setScanRangeKernel<StringKey>;
+		openScanFn = &PartitionedIndex::openScanKernel<StringKey>;
+		buildFn = &PartitionedIndex::buildKernel<StringKey>;
+		splitFn = &PartitionedIndex::splitKernel<StringKey>;
+		mergeFn = &PartitionedIndex::mergeKernel<StringKey>;
+		break;
+	default:
+		throw BadIndexInfoException("Unsupported attribute type.");
+	}
+
+	if (numPartitions < 1 || numPartitions > MAXPARTITIONS) {
+		throw BadIndexInfoException("A partitioned index needs between 1 and MAXPARTITIONS partitions.");
+	}
+	if (!Page::isValidSize(pageSize) || pageSize > bufMgr->getFrameSize()) {
+		throw InvalidPageSizeException(pageSize, outIndexName);
+	}
+
+	bool created = false;
+	try {
+		file = new BlobFile(outIndexName, false);
+	} catch(FileNotFoundException e) {
+		file = new BlobFile(outIndexName, true);
+		created = true;
+	}
+
+	try {
+		if (file->pageSize() > bufMgr->getFrameSize()) {
+			throw InvalidPageSizeException(file->pageSize(), outIndexName);
+		}
+
+		if (!created) {
+			Page *metaPage;
+			bufMgr->readPage(file, headerPageNum, metaPage);
+			PartitionedIndexMetaInfo *meta = (PartitionedIndexMetaInfo*)metaPage;
+			const bool matches = meta->attrType == attributeType && meta->attrByteOffset == attrByteOffset;
+			bufMgr->unPinPage(file, headerPageNum, false);
+			if (!matches) {
+				bufMgr->flushFile(file);
+				throw BadIndexInfoException("Index file " + outIndexName + " was built over a different attribute.");
+			}
+			(this->*readRouterFn)();
+		}
+	} catch(BadgerDbException & e) {
+		delete file;
+		if (created) {
+			File::remove(outIndexName);
+		}
+		throw;
+	}
+
+	if (created) {
+		Page *metaPage;
+		bufMgr->allocPage(file, headerPageNum, metaPage);
+		bufMgr->unPinPage(file, headerPageNum, true);
+		(this->*buildFn)(numPartitions);
+	}
+}
+
+// -----------------------------------------------------------------------------
+// PartitionedIndex::~PartitionedIndex -- destructor
+// -----------------------------------------------------------------------------
+
+PartitionedIndex::~PartitionedIndex()
+{
+	if (scanExecuting) {
+		endScan();
+	}
+	(this->*writeRouterFn)();
+	for (std::size_t i = 0; i < partitions.size(); i++) {
+		delete partitions[i];
+	}
+	bufMgr->commit();
+	bufMgr->flushFile(file);
+	delete file;
+}
+
+std::string PartitionedIndex::partitionName(const int partitionId) const
+{
+	std::ostringstream nameStr;
+	nameStr << indexName << '.' << partitionId;
+	return nameStr.str();
+}
+
+// -----------------------------------------------------------------------------
+// PartitionedIndex router
+// -----------------------------------------------------------------------------
+
+template <class T>
+void PartitionedIndex::writeRouterKernel()
+{
+	const std::vector<T> & lowerKeys = partitionKeys<T>().lowerKeys;
+	Page *metaPage;
+	bufMgr->readPage(file, headerPageNum, metaPage);
+	PartitionedIndexMetaInfo *meta = (PartitionedIndexMetaInfo*)metaPage;
+	strncpy(meta->relationName, relationName.c_str(), sizeof(meta->relationName));
+	meta->attrByteOffset = attrByteOffset;
+	meta->attrType = attributeType;
+	meta->partitionPageSize = partitionPageSize;
+	meta->numPartitions = partitions.size();
+	meta->nextPartitionId = nextPartitionId;
+	std::copy(partitionIds.begin(), partitionIds.end(), meta->partitionIds);
+	if (!lowerKeys.empty()) {
+		memcpy((char*)meta + sizeof(PartitionedIndexMetaInfo), (const void*)&lowerKeys[0], lowerKeys.size() * sizeof(T));
+	}
+	bufMgr->unPinPage(file, headerPageNum, true);
+}
+
+template <class T>
+void PartitionedIndex::readRouterKernel()
+{
+	std::vector<T> & lowerKeys = partitionKeys<T>().lowerKeys;
+	Page *metaPage;
+	bufMgr->readPage(file, headerPageNum, metaPage);
+	PartitionedIndexMetaInfo *meta = (PartitionedIndexMetaInfo*)metaPage;
+	partitionPageSize = meta->partitionPageSize;
+	nextPartitionId = meta->nextPartitionId;
+	partitionIds.assign(meta->partitionIds, meta->partitionIds + meta->numPartitions);
+	lowerKeys.resize(meta->numPartitions - 1);
+	if (!lowerKeys.empty()) {
+		memcpy((void*)&lowerKeys[0], (const char*)meta + sizeof(PartitionedIndexMetaInfo), lowerKeys.size() * sizeof(T));
+	}
+	bufMgr->unPinPage(file, headerPageNum, false);
+
+	for (std::size_t i = 0; i < partitionIds.size(); i++) {
+		partitions.push_back(new BTreeIndex(partitionName(partitionIds[i]), bufMgr, attrByteOffset, attributeType,
+																				partitionPageSize));
+	}
+}
+
+template <class T>
+int PartitionedIndex::routeKernel(const void* key)
+{
+	const std::vector<T> & lowerKeys = partitionKeys<T>().lowerKeys;
+	return std::upper_bound(lowerKeys.begin(), lowerKeys.end(), keyFromPtr<T>(key)) - lowerKeys.begin();
+}
+
+// -----------------------------------------------------------------------------
+// PartitionedIndex::insertEntry
+// -----------------------------------------------------------------------------
+
+void PartitionedIndex::insertEntry(const void *key, const RecordId rid)
+{
+	partitions[(this->*routeFn)(key)]->insertEntry(key, rid);
+}
+
+// -----------------------------------------------------------------------------
+// PartitionedIndex::startScan
+// -----------------------------------------------------------------------------
+
+void PartitionedIndex::startScan(const void* lowValParm,
+		const Operator lowOpParm,
+		const void* highValParm,
+		const Operator highOpParm)
+{
+	if (scanExecuting) {
+		endScan();
+	}
+
+	// The first partition checks the operators and the range
+	lowOp = lowOpParm;
+	highOp = highOpParm;
+	scanPartition = (this->*setScanRangeFn)(lowValParm, highValParm);
+	if (!(this->*openScanFn)()) {
+		throw NoSuchKeyFoundException();
+	}
+	scanExecuting = true;
+	scanCompleted = false;
+}
+
+template <class T>
+int PartitionedIndex::setScanRangeKernel(const void* lowVal, const void* highVal)
+{
+	PartitionKeys<T> & keys = partitionKeys<T>();
+	keys.lowVal = keyFromPtr<T>(lowVal);
+	keys.highVal = keyFromPtr<T>(highVal);
+	return routeKernel<T>(lowVal);
+}
+
+template <class T>
+bool PartitionedIndex::inScanKernel(const int partition)
+{
+	const PartitionKeys<T> & keys = partitionKeys<T>();
+	if (partition >= (int)partitions.size()) {
+		return false;
+	}
+	const T & lowerKey = keys.lowerKeys[partition - 1];
+	return highOp == LT ? lowerKey < keys.highVal : lowerKey <= keys.highVal;
+}
+
+template <class T>
+bool PartitionedIndex::openScanKernel()
+{
+	PartitionKeys<T> & keys = partitionKeys<T>();
+	while (true) {
+		try {
+			partitions[scanPartition]->startScan(&keys.lowVal, lowOp, &keys.highVal, highOp);
+			return true;
+		} catch(NoSuchKeyFoundException e) {
+			// Later partitions only hold larger keys, which may still be in range
+		}
+		if (!inScanKernel<T>(scanPartition + 1)) {
+			return false;
+		}
+		scanPartition++;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// PartitionedIndex::scanNext
+// -----------------------------------------------------------------------------
+
+void PartitionedIndex::scanNext(RecordId& outRid)
+{
+	if (!scanExecuting) {
+		throw ScanNotInitializedException();
+	}
+
+	while (!scanCompleted) {
+		try {
+			partitions[scanPartition]->scanNext(outRid);
+			return;
+		} catch(IndexScanCompletedException e) {
+			if (!(this->*inScanFn)(scanPartition + 1)) {
+				throw;
+			}
+		}
+
+		// Go on in the next partition
+		partitions[scanPartition]->endScan();
+		scanPartition++;
+		scanCompleted = !(this->*openScanFn)();
+	}
+	throw IndexScanCompletedException();
+}
+
+// -----------------------------------------------------------------------------
+// PartitionedIndex::endScan
+// -----------------------------------------------------------------------------
+
+void PartitionedIndex::endScan()
+{
+	if (!scanExecuting) {
+		throw ScanNotInitializedException();
+	}
+	if (!scanCompleted) {
+		partitions[scanPartition]->endScan();
+	}
+	scanExecuting = false;
+}
+
+// -----------------------------------------------------------------------------
+// PartitionedIndex::parallelScan
+// -----------------------------------------------------------------------------
+
+void PartitionedIndex::parallelScan(const void* lowVal,
+		const Operator lowOpParm,
+		const void* highVal,
+		const Operator highOpParm,
+		std::vector<RecordId> & outRids)
+{
+	if (scanExecuting) {
+		endScan();
+	}
+
+	lowOp = lowOpParm;
+	highOp = highOpParm;
+	const int first = (this->*setScanRangeFn)(lowVal, highVal);
+	int last = first;
+	while ((this->*inScanFn)(last + 1)) {
+		last++;
+	}
+
+	std::vector< std::vector<RecordId> > rids(last - first + 1);
+	std::vector<std::exception_ptr> errors(last - first + 1);
+	std::vector<std::thread> threads;
+	for (int i = first; i <= last; i++) {
+		threads.push_back(std::thread(&PartitionedIndex::scanPartitionTask, this, i, lowVal, lowOp, highVal, highOp,
+																	&rids[i - first], &errors[i - first]));
+	}
+	for (std::size_t i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+	for (std::size_t i = 0; i < errors.size(); i++) {
+		if (errors[i]) {
+			std::rethrow_exception(errors[i]);
+		}
+	}
+
+	outRids.clear();
+	for (std::size_t i = 0; i < rids.size(); i++) {
+		outRids.insert(outRids.end(), rids[i].begin(), rids[i].end());
+	}
+}
+
+void PartitionedIndex::scanPartitionTask(const int partition,
+		const void* lowVal,
+		const Operator lowOp,
+		const void* highVal,
+		const Operator highOp,
+		std::vector<RecordId>* outRids,
+		std::exception_ptr* error)
+{
+	try {
+		partitions[partition]->startScan(lowVal, lowOp, highVal, highOp);
+		try {
+			RecordId rid;
+			while (true) {
+				partitions[partition]->scanNext(rid);
+				outRids->push_back(rid);
+			}
+		} catch(IndexScanCompletedException e) {
+		}
+		partitions[partition]->endScan();
+	} catch(NoSuchKeyFoundException e) {
+	} catch(...) {
+		*error = std::current_exception();
+	}
+}
+
+// -----------------------------------------------------------------------------
+// Building, splitting and merging partitions
+// -----------------------------------------------------------------------------
+
+template <class T>
+void PartitionedIndex::collectKernel(const int first, const int last, std::vector< RIDKeyPair<T> > & outEntries)
+{
+	// The partitions hold disjoint, ascending key ranges, so their leaves read one after the other are in key order
+	for (int i = first; i <= last; i++) {
+		partitions[i]->collectEntries<T>(outEntries);
+	}
+}
+
+template <class T>
+void PartitionedIndex::scanRelationKernel(std::vector< RIDKeyPair<T> > & outEntries)
+{
+	FileScan fscan(relationName, bufMgr);
+	try
+	{
+		RecordId scanRid;
+		while(1)
+		{
+			fscan.scanNext(scanRid);
+			std::string recordStr = fscan.getRecord();
+			RIDKeyPair<T> entry;
+			entry.set(scanRid, keyFromPtr<T>(recordStr.c_str() + attrByteOffset));
+			outEntries.push_back(entry);
+		}
+	}
+	catch(EndOfFileException e)
+	{
+	}
+	std::stable_sort(outEntries.begin(), outEntries.end(), entryKeyLess<T>);
+}
+
+template <class T>
+void PartitionedIndex::fillPartition(BTreeIndex* partition, const RIDKeyPair<T>* begin, const RIDKeyPair<T>* end,
+		std::exception_ptr* error)
+{
+	try {
+		for (const RIDKeyPair<T>* entry = begin; entry != end; entry++) {
+			partition->insertEntry(&entry->key, entry->rid);
+		}
+	} catch(...) {
+		*error = std::current_exception();
+	}
+}
+
+template <class T>
+void PartitionedIndex::replaceKernel(const int first, const int last, const std::vector< RIDKeyPair<T> > & entries,
+		const std::vector<T> & newLowerKeys)
+{
+	const int count = newLowerKeys.size();
+	std::vector<BTreeIndex*> newPartitions;
+	std::vector<int> newIds;
+	for (int i = 0; i < count; i++) {
+		// A file left behind by an earlier crash is stale
+		const std::string name = partitionName(nextPartitionId);
+		if (File::exists(name)) {
+			File::remove(name);
+		}
+		newIds.push_back(nextPartitionId++);
+		newPartitions.push_back(new BTreeIndex(name, bufMgr, attrByteOffset, attributeType, partitionPageSize));
+	}
+
+	// Every new partition is filled in key order on its own thread
+	std::vector<std::size_t> bounds(1, 0);
+	for (int i = 1; i < count; i++) {
+		std::size_t pos = bounds.back();
+		while (pos < entries.size() && entries[pos].key < newLowerKeys[i]) {
+			pos++;
+		}
+		bounds.push_back(pos);
+	}
+	bounds.push_back(entries.size());
+
+	std::vector<std::exception_ptr> errors(count);
+	std::vector<std::thread> threads;
+	for (int i = 0; i < count; i++) {
+		threads.push_back(std::thread(&PartitionedIndex::fillPartition<T>, this, newPartitions[i],
+																	entries.data() + bounds[i], entries.data() + bounds[i + 1], &errors[i]));
+	}
+	for (int i = 0; i < count; i++) {
+		threads[i].join();
+	}
+	for (int i = 0; i < count; i++) {
+		if (errors[i]) {
+			for (int j = 0; j < count; j++) {
+				delete newPartitions[j];
+				File::remove(partitionName(newIds[j]));
+			}
+			std::rethrow_exception(errors[i]);
+		}
+	}
+
+	for (int i = first; i <= last; i++) {
+		delete partitions[i];
+		File::remove(partitionName(partitionIds[i]));
+	}
+	if (last >= first) {
+		partitions.erase(partitions.begin() + first, partitions.begin() + (last + 1));
+		partitionIds.erase(partitionIds.begin() + first, partitionIds.begin() + (last + 1));
+	}
+	partitions.insert(partitions.begin() + first, newPartitions.begin(), newPartitions.end());
+	partitionIds.insert(partitionIds.begin() + first, newIds.begin(), newIds.end());
+
+	// Partitions first + 1 to last had the lower keys first to last - 1
+	std::vector<T> & lowerKeys = partitionKeys<T>().lowerKeys;
+	if (last > first) {
+		lowerKeys.erase(lowerKeys.begin() + first, lowerKeys.begin() + last);
+	}
+	lowerKeys.insert(lowerKeys.begin() + first, newLowerKeys.begin() + 1, newLowerKeys.end());
+
+	writeRouterKernel<T>();
+	bufMgr->commit();
+}
+
+template <class T>
+void PartitionedIndex::buildKernel(const int numPartitions)
+{
+	std::vector< RIDKeyPair<T> > entries;
+	scanRelationKernel<T>(entries);
+
+	// Cut at every numPartitions-th of the entries, moved right past copies of the key before the cut
+	std::vector<T> newLowerKeys(1, T());
+	for (int i = 1; i < numPartitions && !entries.empty(); i++) {
+		const T previous = i == 1 ? entries[0].key : newLowerKeys.back();
+		std::size_t pos = i * entries.size() / numPartitions;
+		while (pos < entries.size() && !(previous < entries[pos].key)) {
+			pos++;
+		}
+		if (pos == entries.size()) {
+			break;
+		}
+		newLowerKeys.push_back(entries[pos].key);
+	}
+	replaceKernel<T>(0, -1, entries, newLowerKeys);
+}
+
+// -----------------------------------------------------------------------------
+// PartitionedIndex::splitPartition
+// -----------------------------------------------------------------------------
+
+bool PartitionedIndex::splitPartition(const int partition)
+{
+	if (partition < 0 || partition >= numPartitions() || numPartitions() >= MAXPARTITIONS) {
+		return false;
+	}
+	if (scanExecuting) {
+		endScan();
+	}
+	return (this->*splitFn)(partition);
+}
+
+template <class T>
+bool PartitionedIndex::splitKernel(const int partition)
+{
+	std::vector< RIDKeyPair<T> > entries;
+	collectKernel<T>(partition, partition, entries);
+
+	// Split at the median key, or the first key above the smallest one if that is the median
+	std::size_t pos = entries.size() / 2;
+	while (pos < entries.size() && !(entries[0].key < entries[pos].key)) {
+		pos++;
+	}
+	if (pos == entries.size()) {
+		return false;
+	}
+
+	std::vector<T> newLowerKeys(1, T());
+	newLowerKeys.push_back(entries[pos].key);
+	replaceKernel<T>(partition, partition, entries, newLowerKeys);
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+// PartitionedIndex::mergePartitions
+// -----------------------------------------------------------------------------
+
+bool PartitionedIndex::mergePartitions(const int partition)
+{
+	if (partition < 0 || partition + 1 >= numPartitions()) {
+		return false;
+	}
+	if (scanExecuting) {
+		endScan();
+	}
+	return (this->*mergeFn)(partition);
+}
+
+template <class T>
+bool PartitionedIndex::mergeKernel(const int partition)
+{
+	std::vector< RIDKeyPair<T> > entries;
+	collectKernel<T>(partition, partition + 1, entries);
+	replaceKernel<T>(partition, partition + 1, entries, std::vector<T>(1, T()));
+	return true;
+}
+
+}
@@ -0,0 +1,406 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <exception>
+#include <string>
+#include <vector>
+
+#include "types.h"
+#include "page.h"
+#include "file.h"
+#include "buffer.h"
+#include "btree.h"
+
+namespace badgerdb
+{
+
+/**
+ * @brief Largest number of partitions of a PartitionedIndex.
+ */
+const int MAXPARTITIONS = 64;
+
+/**
+ * @brief The meta page, which holds the router of a PartitionedIndex, is always the first page of its file.
+ * The lower keys of partitions 1 to numPartitions - 1 follow the structure on the same page.
+*/
+struct PartitionedIndexMetaInfo{
+  /**
+   * Name of base relation.
+   */
+	char relationName[20];
+
+  /**
+   * Offset of attribute, over which index is built, inside the record stored in pages.
+   */
+	int attrByteOffset;
+
+  /**
+   * Type of the attribute over which index is built.
+   */
+	Datatype attrType;
+
+  /**
+   * Page size of new partition files.
+   */
+	std::uint32_t partitionPageSize;
+
+  /**
+   * Number of partitions.
+   */
+	int numPartitions;
+
+  /**
+   * Number of the next partition file to be created.
+   */
+	int nextPartitionId;
+
+  /**
+   * Number of the file of every partition, in key order.
+   */
+	int partitionIds[MAXPARTITIONS];
+};
+
+/**
+ * @brief Keys of a PartitionedIndex with keys of type T.
+ */
+template <class T>
+struct PartitionKeys{
+  /**
+   * Lower key of every partition but the first. Partition i holds the keys from lowerKeys[i - 1] up to,
+   * but excluding, lowerKeys[i].
+   */
+	std::vector<T> lowerKeys;
+
+  /**
+   * Low value of the running scan.
+   */
+	T lowVal;
+
+  /**
+   * High value of the running scan.
+   */
+	T highVal;
+};
+
+/**
+ * @brief PartitionedIndex class. An index on a single attribute of a relation made of several BTreeIndex
+ * partitions, each over one range of keys and in its own file.
+ *
+ * A small router, the lower key of every partition, sends each key to its partition. Every tree covers a
+ * fraction of the keys, so it stays shallow, and threads inserting into different partitions do not share a
+ * tree. Partitions are built in parallel, can be scanned in parallel, and can be split or merged as they grow
+ * or shrink. Partitions are built from the base relation, so every entry must belong to a record of it.
+ *
+ * Several threads may call insertEntry() at once as long as no two insert into the same partition. Scans, splits
+ * and merges must not run at the same time as any other call.
+*/
+class PartitionedIndex {
+
+ private:
+
+  /**
+   * File object for the router file.
+   */
+	BlobFile	*file;
+
+  /**
+   * Buffer Manager Instance.
+   */
+	BufMgr	*bufMgr;
+
+  /**
+   * Page number of the meta page.
+   */
+	PageId	headerPageNum;
+
+  /**
+   * Name of the base relation.
+   */
+	std::string	relationName;
+
+  /**
+   * Name of the router file. Partition files add their number to it.
+   */
+	std::string	indexName;
+
+  /**
+   * Datatype of attribute over which index is built.
+   */
+	Datatype	attributeType;
+
+  /**
+   * Offset of attribute, over which index is built, inside records.
+   */
+	int 		attrByteOffset;
+
+  /**
+   * Page size of new partition files.
+   */
+	std::size_t	partitionPageSize;
+
+  /**
+   * Number of the next partition file to be created.
+   */
+	int			nextPartitionId;
+
+  /**
+   * Partitions, in key order.
+   */
+	std::vector<BTreeIndex*>	partitions;
+
+  /**
+   * Number of the file of every partition, in key order.
+   */
+	std::vector<int>	partitionIds;
+
+  /**
+   * Keys, one set per key type of which only the one for attributeType is used.
+   */
+	PartitionKeys<int>	intKeys;
+	PartitionKeys<double>	doubleKeys;
+	PartitionKeys<StringKey>	stringKeys;
+
+  /**
+   * Keys for key type T.
+   */
+	template <class T>
+	PartitionKeys<T>& partitionKeys();
+
+  /**
+   * True if an index scan has been started.
+   */
+	bool		scanExecuting;
+
+  /**
+   * Partition being scanned.
+   */
+	int			scanPartition;
+
+  /**
+   * True once the running scan has passed its last entry.
+   */
+	bool		scanCompleted;
+
+  /**
+   * Low Operator of the running scan.
+   */
+	Operator	lowOp;
+
+  /**
+   * High Operator of the running scan.
+   */
+	Operator	highOp;
+
+  /**
+   * Name of the file of a partition.
+   */
+	std::string partitionName(const int partitionId) const;
+
+  /**
+   * Write the router to the meta page.
+   */
+	template <class T>
+	void writeRouterKernel();
+
+  /**
+   * Read the router from the meta page and open the partitions.
+   */
+	template <class T>
+	void readRouterKernel();
+
+  /**
+   * Partition whose range holds the key.
+   */
+	template <class T>
+	int routeKernel(const void* key);
+
+  /**
+   * True if partition holds keys at or below the high end of the running scan.
+   */
+	template <class T>
+	bool inScanKernel(const int partition);
+
+  /**
+   * Remember the scan range and return the partition holding lowVal.
+   */
+	template <class T>
+	int setScanRangeKernel(const void* lowVal, const void* highVal);
+
+  /**
+   * Start the scan of the running scan range on the first partition from scanPartition on that holds a key in it.
+   * Return false if none does.
+   */
+	template <class T>
+	bool openScanKernel();
+
+  /**
+   * Entries of partitions first to last, sorted by key, read from the leaves of the partitions.
+   */
+	template <class T>
+	void collectKernel(const int first, const int last, std::vector< RIDKeyPair<T> > & outEntries);
+
+  /**
+   * Entries of every record of the base relation, sorted by key. The source of a new index.
+   */
+	template <class T>
+	void scanRelationKernel(std::vector< RIDKeyPair<T> > & outEntries);
+
+  /**
+   * Replace partitions first to last by new partitions starting at newLowerKeys, built in parallel from
+   * the sorted entries of the old ones. newLowerKeys[0] is ignored, the first new partition keeps the lower
+   * key of partition first. A new index is built with last = first - 1, replacing no partition.
+   */
+	template <class T>
+	void replaceKernel(const int first, const int last, const std::vector< RIDKeyPair<T> > & entries,
+										const std::vector<T> & newLowerKeys);
+
+  /**
+   * Thread body of replaceKernel(). Insert entries into a new partition.
+   */
+	template <class T>
+	void fillPartition(BTreeIndex* partition, const RIDKeyPair<T>* begin, const RIDKeyPair<T>* end,
+										std::exception_ptr* error);
+
+  /**
+   * Thread body of parallelScan(). Scan one partition into outRids.
+   */
+	void scanPartitionTask(const int partition, const void* lowVal, const Operator lowOp, const void* highVal,
+												const Operator highOp, std::vector<RecordId>* outRids, std::exception_ptr* error);
+
+  /**
+   * Build numPartitions partitions of about the same number of entries from the base relation.
+   */
+	template <class T>
+	void buildKernel(const int numPartitions);
+
+  /**
+   * Split a partition at its median key.
+   */
+	template <class T>
+	bool splitKernel(const int partition);
+
+  /**
+   * Merge a partition with the one right of it.
+   */
+	template <class T>
+	bool mergeKernel(const int partition);
+
+  /**
+   * Instantiations of the kernels chosen for attributeType.
+   */
+	void (PartitionedIndex::*writeRouterFn)();
+	void (PartitionedIndex::*readRouterFn)();
+	int (PartitionedIndex::*routeFn)(const void*);
+	bool (PartitionedIndex::*inScanFn)(const int);
+	int (PartitionedIndex::*setScanRangeFn)(const void*, const void*);
+	bool (PartitionedIndex::*openScanFn)();
+	void (PartitionedIndex::*buildFn)(const int);
+	bool (PartitionedIndex::*splitFn)(const int);
+	bool (PartitionedIndex::*mergeFn)(const int);
+
+ public:
+
+  /**
+   * PartitionedIndex Constructor.
+	 * Open the index if its router file exists. If not, create numPartitions partitions of about the same size
+	 * over the tuples of the base relation. The router file is named relationName.attrByteOffset.parts and
+	 * partition files add a dot and their number to it.
+   *
+   * @param relationName        Name of file.
+   * @param outIndexName        Return the name of the router file.
+   * @param bufMgrIn						Buffer Manager Instance
+   * @param attrByteOffset			Offset of attribute, over which index is to be built, in the record
+   * @param attrType						Datatype of attribute over which index is built
+   * @param numPartitions				Number of partitions of a new index, fewer if the relation has fewer distinct keys.
+   *                          Ignored if the index exists.
+   * @param pageSize						Page size of new partition files.
+   * @throws  BadIndexInfoException     If the index already exists for a different attribute, or numPartitions is
+   *                                    not between 1 and MAXPARTITIONS.
+   * @throws  InvalidPageSizeException  If pageSize is not supported, or does not fit in the frames of bufMgrIn.
+   */
+	PartitionedIndex(const std::string & relationName, std::string & outIndexName,
+						BufMgr *bufMgrIn,	const int attrByteOffset,	const Datatype attrType,
+						const int numPartitions = 4, const std::size_t pageSize = Page::SIZE);
+
+  /**
+   * PartitionedIndex Destructor.
+	 * End any initialized scan, write the router and close every partition.
+	 */
+	~PartitionedIndex();
+
+  /**
+	 * Insert a new entry into the partition of its key.
+   * @param key			Key to insert, pointer to integer/double/char string
+   * @param rid			Record ID of a record whose entry is getting inserted into the index.
+	**/
+	void insertEntry(const void* key, const RecordId rid);
+
+  /**
+	 * Begin a filtered scan of the index, like BTreeIndex::startScan(). The scan visits the partitions in key
+	 * order, so entries come in key order.
+   * @param lowVal	Low value of range, pointer to integer / double / char string
+   * @param lowOp		Low operator (GT/GTE)
+   * @param highVal	High value of range, pointer to integer / double / char string
+   * @param highOp	High operator (LT/LTE)
+   * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values
+   * @throws  BadScanrangeException If lowVal > highval
+	 * @throws  NoSuchKeyFoundException If there is no key in the index that satisfies the scan criteria.
+	**/
+	void startScan(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
+
+  /**
+	 * Fetch the record id of the next index entry that matches the scan.
+   * @param outRid	RecordId of next record found that satisfies the scan criteria returned in this
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	 * @throws IndexScanCompletedException If no more records, satisfying the scan criteria, are left to be scanned.
+	**/
+	void scanNext(RecordId& outRid);
+
+  /**
+	 * Terminate the current scan.
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	**/
+	void endScan();
+
+  /**
+	 * Scan every partition that overlaps the range on its own thread. Ends any running scan.
+   * @param lowVal	Low value of range, pointer to integer / double / char string
+   * @param lowOp		Low operator (GT/GTE)
+   * @param highVal	High value of range, pointer to integer / double / char string
+   * @param highOp	High operator (LT/LTE)
+   * @param outRids	Record ids of the entries in the range returned in this, in key order.
+   * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values
+   * @throws  BadScanrangeException If lowVal > highval
+	**/
+	void parallelScan(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp,
+										std::vector<RecordId> & outRids);
+
+  /**
+	 * Split a partition in two at its median key. Ends any running scan.
+   * @param partition	Number of the partition, in key order.
+	 * @return	False if there is no such partition, it holds fewer than two distinct keys, or the index has
+	 *          MAXPARTITIONS partitions.
+	**/
+	bool splitPartition(const int partition);
+
+  /**
+	 * Merge a partition with the one right of it. Ends any running scan.
+   * @param partition	Number of the partition, in key order.
+	 * @return	False if there is no such partition or it is the last one.
+	**/
+	bool mergePartitions(const int partition);
+
+  /**
+   * Number of partitions.
+   */
+	int numPartitions() const { return partitions.size(); }
+};
+
+}
@@ -0,0 +1,603 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include "replacementPolicy.h"
+#include "page.h"
+
+namespace badgerdb {
+
+namespace {
+
+/**
+ * Take frames the pool stops using off a free list, or put frames it starts using on it
+ */
+void resizeFreeFrames(std::vector<FrameId>& freeFrames, const std::uint32_t oldFrames, const std::uint32_t newFrames)
+{
+  freeFrames.erase(std::remove_if(freeFrames.begin(), freeFrames.end(),
+                                  [newFrames](const FrameId frameNo) { return frameNo >= newFrames; }),
+                   freeFrames.end());
+  for (std::uint32_t i = newFrames; i > oldFrames; i--)
+    freeFrames.push_back(i - 1);
+}
+
+/**
+ * Take a frame the pool moved a page into off a free list, and put the frame the page left on it
+ */
+void moveFreeFrame(std::vector<FrameId>& freeFrames, const FrameId from, const FrameId to)
+{
+  freeFrames.erase(std::remove(freeFrames.begin(), freeFrames.end(), to), freeFrames.end());
+  if (std::find(freeFrames.begin(), freeFrames.end(), from) == freeFrames.end())
+    freeFrames.push_back(from);
+}
+
+}
+
+ReplacementPolicy* ReplacementPolicy::create(const ReplacementPolicyKind kind, const std::uint32_t numFrames)
+{
+  switch (kind)
+  {
+    case LRU_K:
+      return new LruKPolicy(numFrames);
+    case TWO_Q:
+      return new TwoQPolicy(numFrames);
+    case ARC:
+      return new ArcPolicy(numFrames);
+    default:
+      return new ClockPolicy(numFrames);
+  }
+}
+
+//----------------------------------------
+// Clock
+//----------------------------------------
+
+ClockPolicy::ClockPolicy(const std::uint32_t numFrames)
+	: numFrames(numFrames), clockHand(numFrames - 1)
+{
+  refbits = new std::atomic<bool>[numFrames];
+  for (std::uint32_t i = 0; i < numFrames; i++)
+    refbits[i] = false;
+}
+
+ClockPolicy::~ClockPolicy()
+{
+  delete [] refbits;
+}
+
+bool ClockPolicy::pickVictim(const File* file, const PageId pageNo, const EvictFn& evict, FrameId& frameNo)
+{
+  // Need to scan twice, the first round may only clear reference bits
+  for (std::uint32_t numScanned = 0; numScanned < 2 * numFrames; numScanned++)
+  {
+    // advance the clock
+    clockHand = (clockHand + 1) % numFrames;
+
+    // has been referenced, clear the bit and give it another round
+    if (refbits[clockHand].exchange(false))
+      continue;
+
+    if (evict(clockHand))
+    {
+      frameNo = clockHand;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ClockPolicy::loaded(const FrameId frameNo, const File* file, const PageId pageNo, const bool cold)
+{
+  refbits[frameNo] = !cold;
+}
+
+void ClockPolicy::accessed(const FrameId frameNo)
+{
+  refbits[frameNo] = true;
+}
+
+void ClockPolicy::freed(const FrameId frameNo)
+{
+  refbits[frameNo] = false;
+}
+
+void ClockPolicy::moved(const FrameId from, const FrameId to)
+{
+  refbits[to] = refbits[from].load();
+  refbits[from] = false;
+}
+
+void ClockPolicy::nextVictims(const std::size_t count, std::vector<FrameId>& frames)
+{
+  // Frames the hand reaches next without a reference bit go on the first sweep, the others on the second
+  for (int sweep = 0; sweep < 2; sweep++)
+  {
+    for (std::uint32_t i = 1; i <= numFrames && frames.size() < count; i++)
+    {
+      const FrameId frameNo = (clockHand + i) % numFrames;
+      if (refbits[frameNo] == (sweep == 1))
+        frames.push_back(frameNo);
+    }
+  }
+}
+
+void ClockPolicy::resize(const std::uint32_t newFrames)
+{
+  for (std::uint32_t i = newFrames; i < numFrames; i++)
+    refbits[i] = false;
+  numFrames = newFrames;
+  clockHand %= numFrames;
+}
+
+//----------------------------------------
+// LRU-K
+//----------------------------------------
+
+LruKPolicy::LruKPolicy(const std::uint32_t numFrames)
+	: numFrames(numFrames), now(0), histories(numFrames), framePages(numFrames), resident(numFrames, false)
+{
+  for (std::uint32_t i = numFrames; i > 0; i--)
+    freeFrames.push_back(i - 1);
+}
+
+LruKPolicy::OrderKey LruKPolicy::orderKey(const FrameId frameNo) const
+{
+  const History & history = histories[frameNo];
+  return OrderKey(std::make_pair(history.times[K - 1], history.times[0]), frameNo);
+}
+
+void LruKPolicy::record(const FrameId frameNo)
+{
+  History & history = histories[frameNo];
+  for (int i = K - 1; i > 0; i--)
+    history.times[i] = history.times[i - 1];
+  history.times[0] = ++now;
+}
+
+bool LruKPolicy::pickVictim(const File* file, const PageId pageNo, const EvictFn& evict, FrameId& frameNo)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  if (!freeFrames.empty())
+  {
+    frameNo = freeFrames.back();
+    freeFrames.pop_back();
+    return true;
+  }
+
+  // Pages with fewer than K requests have an infinite backward distance and sort first
+  for (std::set<OrderKey>::iterator it = order.begin(); it != order.end(); ++it)
+  {
+    const FrameId victim = it->second;
+    if (!evict(victim))
+      continue;
+
+    order.erase(it);
+    resident[victim] = false;
+
+    // Remember the history of the page in case it is requested again soon
+    if (retained.size() >= numFrames)
+    {
+      retained.erase(retainedOrder.back());
+      retainedOrder.pop_back();
+    }
+    retainedOrder.push_front(framePages[victim]);
+    retained[framePages[victim]] = std::make_pair(histories[victim], retainedOrder.begin());
+
+    frameNo = victim;
+    return true;
+  }
+  return false;
+}
+
+void LruKPolicy::loaded(const FrameId frameNo, const File* file, const PageId pageNo, const bool cold)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  if (resident[frameNo])
+    order.erase(orderKey(frameNo));
+
+  const PageKey page(file, pageNo);
+  std::map<PageKey, std::pair<History, std::list<PageKey>::iterator> >::iterator it = retained.find(page);
+  histories[frameNo] = History();
+  if (it != retained.end())
+  {
+    if (!cold)
+      histories[frameNo] = it->second.first;
+    retainedOrder.erase(it->second.second);
+    retained.erase(it);
+  }
+
+  // A cold page has no request times, so it sorts before every other page
+  framePages[frameNo] = page;
+  if (!cold)
+    record(frameNo);
+  order.insert(orderKey(frameNo));
+  resident[frameNo] = true;
+}
+
+void LruKPolicy::accessed(const FrameId frameNo)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  if (!resident[frameNo])
+    return;
+  order.erase(orderKey(frameNo));
+  record(frameNo);
+  order.insert(orderKey(frameNo));
+}
+
+void LruKPolicy::freed(const FrameId frameNo)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  if (resident[frameNo])
+  {
+    order.erase(orderKey(frameNo));
+    resident[frameNo] = false;
+  }
+  if (std::find(freeFrames.begin(), freeFrames.end(), frameNo) == freeFrames.end())
+    freeFrames.push_back(frameNo);
+}
+
+void LruKPolicy::moved(const FrameId from, const FrameId to)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  moveFreeFrame(freeFrames, from, to);
+  if (!resident[from])
+    return;
+
+  // the page keeps its request times, only the frame it is ordered by changes
+  order.erase(orderKey(from));
+  histories[to] = histories[from];
+  framePages[to] = framePages[from];
+  resident[to] = true;
+  resident[from] = false;
+  order.insert(orderKey(to));
+}
+
+void LruKPolicy::nextVictims(const std::size_t count, std::vector<FrameId>& frames)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  for (std::set<OrderKey>::iterator it = order.begin(); it != order.end() && frames.size() < count; ++it)
+    frames.push_back(it->second);
+}
+
+void LruKPolicy::resize(const std::uint32_t newFrames)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  resizeFreeFrames(freeFrames, numFrames, newFrames);
+  numFrames = newFrames;
+  while (retained.size() > numFrames)
+  {
+    retained.erase(retainedOrder.back());
+    retainedOrder.pop_back();
+  }
+}
+
+//----------------------------------------
+// 2Q
+//----------------------------------------
+
+TwoQPolicy::TwoQPolicy(const std::uint32_t numFrames)
+	: numFrames(numFrames), kin(std::max<std::size_t>(numFrames / 4, 1)), kout(std::max<std::size_t>(numFrames / 2, 1)),
+	  queues(numFrames, NONE), positions(numFrames), framePages(numFrames)
+{
+  for (std::uint32_t i = numFrames; i > 0; i--)
+    freeFrames.push_back(i - 1);
+}
+
+bool TwoQPolicy::evictFrom(std::list<FrameId>& queue, const EvictFn& evict, FrameId& frameNo)
+{
+  for (std::list<FrameId>::reverse_iterator it = queue.rbegin(); it != queue.rend(); ++it)
+  {
+    const FrameId victim = *it;
+    if (!evict(victim))
+      continue;
+
+    queue.erase(positions[victim]);
+    if (queues[victim] == A1IN)
+    {
+      // Remember the page, it enters Am if it comes back while remembered
+      a1out.push_front(framePages[victim]);
+      a1outIndex[framePages[victim]] = a1out.begin();
+      if (a1out.size() > kout)
+      {
+        a1outIndex.erase(a1out.back());
+        a1out.pop_back();
+      }
+    }
+    queues[victim] = NONE;
+    frameNo = victim;
+    return true;
+  }
+  return false;
+}
+
+bool TwoQPolicy::pickVictim(const File* file, const PageId pageNo, const EvictFn& evict, FrameId& frameNo)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  if (!freeFrames.empty())
+  {
+    frameNo = freeFrames.back();
+    freeFrames.pop_back();
+    return true;
+  }
+
+  if (a1in.size() > kin || am.empty())
+    return evictFrom(a1in, evict, frameNo) || evictFrom(am, evict, frameNo);
+  return evictFrom(am, evict, frameNo) || evictFrom(a1in, evict, frameNo);
+}
+
+void TwoQPolicy::loaded(const FrameId frameNo, const File* file, const PageId pageNo, const bool cold)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  if (queues[frameNo] == A1IN)
+    a1in.erase(positions[frameNo]);
+  else if (queues[frameNo] == AM)
+    am.erase(positions[frameNo]);
+
+  const PageKey page(file, pageNo);
+  std::map<PageKey, std::list<PageKey>::iterator>::iterator it = a1outIndex.find(page);
+  if (cold)
+  {
+    // oldest end of A1in, and a scan does not make a remembered page hot
+    a1in.push_back(frameNo);
+    positions[frameNo] = --a1in.end();
+    queues[frameNo] = A1IN;
+  }
+  else if (it != a1outIndex.end())
+  {
+    a1out.erase(it->second);
+    a1outIndex.erase(it);
+    am.push_front(frameNo);
+    positions[frameNo] = am.begin();
+    queues[frameNo] = AM;
+  }
+  else
+  {
+    a1in.push_front(frameNo);
+    positions[frameNo] = a1in.begin();
+    queues[frameNo] = A1IN;
+  }
+  framePages[frameNo] = page;
+}
+
+void TwoQPolicy::accessed(const FrameId frameNo)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  // Requests of a page still in A1in are taken as correlated with the first one
+  if (queues[frameNo] == AM)
+    am.splice(am.begin(), am, positions[frameNo]);
+}
+
+void TwoQPolicy::freed(const FrameId frameNo)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  if (queues[frameNo] == A1IN)
+    a1in.erase(positions[frameNo]);
+  else if (queues[frameNo] == AM)
+    am.erase(positions[frameNo]);
+  queues[frameNo] = NONE;
+  if (std::find(freeFrames.begin(), freeFrames.end(), frameNo) == freeFrames.end())
+    freeFrames.push_back(frameNo);
+}
+
+void TwoQPolicy::moved(const FrameId from, const FrameId to)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  moveFreeFrame(freeFrames, from, to);
+  if (queues[from] == NONE)
+    return;
+
+  // the new frame takes the place of the old one in its queue
+  *positions[from] = to;
+  positions[to] = positions[from];
+  queues[to] = queues[from];
+  queues[from] = NONE;
+  framePages[to] = framePages[from];
+}
+
+void TwoQPolicy::nextVictims(const std::size_t count, std::vector<FrameId>& frames)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  std::list<FrameId>& first = a1in.size() > kin || am.empty() ? a1in : am;
+  std::list<FrameId>& second = &first == &a1in ? am : a1in;
+  for (std::list<FrameId>::reverse_iterator it = first.rbegin(); it != first.rend() && frames.size() < count; ++it)
+    frames.push_back(*it);
+  for (std::list<FrameId>::reverse_iterator it = second.rbegin(); it != second.rend() && frames.size() < count; ++it)
+    frames.push_back(*it);
+}
+
+void TwoQPolicy::resize(const std::uint32_t newFrames)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  resizeFreeFrames(freeFrames, numFrames, newFrames);
+  numFrames = newFrames;
+  kin = std::max<std::size_t>(numFrames / 4, 1);
+  kout = std::max<std::size_t>(numFrames / 2, 1);
+  while (a1out.size() > kout)
+  {
+    a1outIndex.erase(a1out.back());
+    a1out.pop_back();
+  }
+}
+
+//----------------------------------------
+// ARC
+//----------------------------------------
+
+ArcPolicy::ArcPolicy(const std::uint32_t numFrames)
+	: numFrames(numFrames), p(0), lists(numFrames, NONE), positions(numFrames), framePages(numFrames)
+{
+  for (std::uint32_t i = numFrames; i > 0; i--)
+    freeFrames.push_back(i - 1);
+}
+
+bool ArcPolicy::evictFrom(const List list, const EvictFn& evict, FrameId& frameNo)
+{
+  std::list<FrameId>& frames = list == T1 ? t1 : t2;
+  std::list<PageKey>& ghostList = list == T1 ? b1 : b2;
+  for (std::list<FrameId>::reverse_iterator it = frames.rbegin(); it != frames.rend(); ++it)
+  {
+    const FrameId victim = *it;
+    if (!evict(victim))
+      continue;
+
+    frames.erase(positions[victim]);
+    lists[victim] = NONE;
+    ghostList.push_front(framePages[victim]);
+    ghosts[framePages[victim]] = std::make_pair(list == T1 ? B1 : B2, ghostList.begin());
+    frameNo = victim;
+    return true;
+  }
+  return false;
+}
+
+void ArcPolicy::dropGhost(const List list)
+{
+  std::list<PageKey>& ghostList = list == B1 ? b1 : b2;
+  ghosts.erase(ghostList.back());
+  ghostList.pop_back();
+}
+
+bool ArcPolicy::pickVictim(const File* file, const PageId pageNo, const EvictFn& evict, FrameId& frameNo)
+{
+  std::lock_guard<std::mutex> guard(latch);
+
+  // A miss on a ghost means its list would have kept the page had it been longer, so move p toward it
+  bool inB2 = false;
+  std::map<PageKey, std::pair<List, std::list<PageKey>::iterator> >::iterator it = ghosts.end();
+  if (pageNo != Page::INVALID_NUMBER)
+    it = ghosts.find(PageKey(file, pageNo));
+  if (it != ghosts.end() && it->second.first == B1)
+  {
+    p = std::min(numFrames, p + std::max<std::size_t>(b2.size() / b1.size(), 1));
+  }
+  else if (it != ghosts.end())
+  {
+    inB2 = true;
+    const std::size_t delta = std::max<std::size_t>(b1.size() / b2.size(), 1);
+    p = p > delta ? p - delta : 0;
+  }
+
+  if (!freeFrames.empty())
+  {
+    frameNo = freeFrames.back();
+    freeFrames.pop_back();
+    return true;
+  }
+
+  if (!t1.empty() && (t1.size() > p || (inB2 && t1.size() == p)))
+    return evictFrom(T1, evict, frameNo) || evictFrom(T2, evict, frameNo);
+  return evictFrom(T2, evict, frameNo) || evictFrom(T1, evict, frameNo);
+}
+
+void ArcPolicy::loaded(const FrameId frameNo, const File* file, const PageId pageNo, const bool cold)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  if (lists[frameNo] == T1)
+    t1.erase(positions[frameNo]);
+  else if (lists[frameNo] == T2)
+    t2.erase(positions[frameNo]);
+
+  const PageKey page(file, pageNo);
+  std::map<PageKey, std::pair<List, std::list<PageKey>::iterator> >::iterator it = ghosts.find(page);
+  if (cold)
+  {
+    // least recently used end of T1, and a scan does not make a remembered page frequent
+    t1.push_back(frameNo);
+    positions[frameNo] = --t1.end();
+    lists[frameNo] = T1;
+  }
+  else if (it != ghosts.end())
+  {
+    // Requested again after it was evicted, so it is requested more than once
+    (it->second.first == B1 ? b1 : b2).erase(it->second.second);
+    ghosts.erase(it);
+    t2.push_front(frameNo);
+    positions[frameNo] = t2.begin();
+    lists[frameNo] = T2;
+  }
+  else
+  {
+    t1.push_front(frameNo);
+    positions[frameNo] = t1.begin();
+    lists[frameNo] = T1;
+  }
+  framePages[frameNo] = page;
+
+  // Keep T1 and B1 within the pool size, and all four lists within twice of it
+  while (t1.size() + b1.size() > numFrames && !b1.empty())
+    dropGhost(B1);
+  while (t1.size() + t2.size() + b1.size() + b2.size() > 2 * numFrames && !b2.empty())
+    dropGhost(B2);
+  while (t1.size() + t2.size() + b1.size() + b2.size() > 2 * numFrames && !b1.empty())
+    dropGhost(B1);
+}
+
+void ArcPolicy::accessed(const FrameId frameNo)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  if (lists[frameNo] == T1)
+    t2.splice(t2.begin(), t1, positions[frameNo]);
+  else if (lists[frameNo] == T2)
+    t2.splice(t2.begin(), t2, positions[frameNo]);
+  else
+    return;
+  lists[frameNo] = T2;
+}
+
+void ArcPolicy::freed(const FrameId frameNo)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  if (lists[frameNo] == T1)
+    t1.erase(positions[frameNo]);
+  else if (lists[frameNo] == T2)
+    t2.erase(positions[frameNo]);
+  lists[frameNo] = NONE;
+  if (std::find(freeFrames.begin(), freeFrames.end(), frameNo) == freeFrames.end())
+    freeFrames.push_back(frameNo);
+}
+
+void ArcPolicy::moved(const FrameId from, const FrameId to)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  moveFreeFrame(freeFrames, from, to);
+  if (lists[from] == NONE)
+    return;
+
+  // the new frame takes the place of the old one in its list
+  *positions[from] = to;
+  positions[to] = positions[from];
+  lists[to] = lists[from];
+  lists[from] = NONE;
+  framePages[to] = framePages[from];
+}
+
+void ArcPolicy::nextVictims(const std::size_t count, std::vector<FrameId>& frames)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  std::list<FrameId>& first = !t1.empty() && t1.size() > p ? t1 : t2;
+  std::list<FrameId>& second = &first == &t1 ? t2 : t1;
+  for (std::list<FrameId>::reverse_iterator it = first.rbegin(); it != first.rend() && frames.size() < count; ++it)
+    frames.push_back(*it);
+  for (std::list<FrameId>::reverse_iterator it = second.rbegin(); it != second.rend() && frames.size() < count; ++it)
+    frames.push_back(*it);
+}
+
+void ArcPolicy::resize(const std::uint32_t newFrames)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  resizeFreeFrames(freeFrames, numFrames, newFrames);
+  numFrames = newFrames;
+  p = std::min(p, numFrames);
+  while (t1.size() + b1.size() > numFrames && !b1.empty())
+    dropGhost(B1);
+  while (t1.size() + t2.size() + b1.size() + b2.size() > 2 * numFrames && !b2.empty())
+    dropGhost(B2);
+  while (t1.size() + t2.size() + b1.size() + b2.size() > 2 * numFrames && !b1.empty())
+    dropGhost(B1);
+}
+
+}
@@ -0,0 +1,454 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "file.h"
+
+namespace badgerdb {
+
+/**
+* @brief Replacement policies a BufMgr can be built with
+*/
+enum ReplacementPolicyKind
+{
+	CLOCK,
+	LRU_K,
+	TWO_Q,
+	ARC
+};
+
+/**
+* @brief Identity of a page: its file and its number in the file
+*/
+typedef std::pair<const File*, PageId> PageKey;
+
+/**
+* @brief Decides which frame of a buffer pool is reused for a page that is not in the pool.
+*
+* The pool reports every frame that receives a page with loaded(), every hit with accessed() and every
+* frame it empties itself with freed(). A page the pool moves to an empty frame, as it does when it shrinks,
+* is reported with moved(). pickVictim() is called when a frame is needed. It offers frames to
+* the pool in the order the policy prefers to lose them, and the pool takes the first one that is empty or
+* holds a page it can evict.
+*
+* pickVictim(), loaded(), freed() and moved() are called with the pool latch held. accessed() is called on readPage()
+* hits, which run concurrently with each other and with the calls above, so policies latch their own state.
+* The pool never holds a page table latch while it calls into the policy, but the policy may hold its latch
+* while it calls evict.
+*/
+class ReplacementPolicy
+{
+ public:
+	/**
+	 * Offered a frame, returns true if the frame is empty or its page was evicted, false if the frame has
+	 * to stay as it is.
+	 */
+  typedef std::function<bool(const FrameId)> EvictFn;
+
+	/**
+	 * Build a policy of the given kind.
+	 *
+	 * @param kind  	Kind of policy
+	 * @param numFrames  Number of frames in the buffer pool, the most resize() may grow it to
+	 */
+  static ReplacementPolicy* create(const ReplacementPolicyKind kind, const std::uint32_t numFrames);
+
+	/**
+   * Destructor of ReplacementPolicy class
+	 */
+  virtual ~ReplacementPolicy() {}
+
+	/**
+	 * Pick a frame for a page that is about to be brought into the pool.
+	 *
+	 * @param file   	File of the page, which some policies remember evicted pages by
+	 * @param pageNo  Page number, Page::INVALID_NUMBER if the page is not allocated yet
+	 * @param evict  	Evicts the page of a frame, see EvictFn
+	 * @param frameNo	Frame number of the picked frame returned via this variable
+	 * @return				False if no frame could be evicted
+	 */
+  virtual bool pickVictim(const File* file, const PageId pageNo, const EvictFn& evict, FrameId& frameNo) = 0;
+
+	/**
+	 * A frame received a page. The frame was picked by pickVictim(), or held a page of a BufferRing that the
+	 * pool reused without asking the policy.
+	 *
+	 * @param frameNo Frame number
+	 * @param file   	File of the page
+	 * @param pageNo  Page number in the file
+	 * @param cold  	True if the page is read once by a scan, so it goes where it is evicted first and
+	 *              	does not count as a repeated request of an evicted page
+	 */
+  virtual void loaded(const FrameId frameNo, const File* file, const PageId pageNo, const bool cold) = 0;
+
+	/**
+	 * The page in a frame was requested while it was in the pool.
+	 *
+	 * @param frameNo Frame number
+	 */
+  virtual void accessed(const FrameId frameNo) = 0;
+
+	/**
+	 * The pool emptied a frame on its own, or did not fill the frame picked by pickVictim().
+	 *
+	 * @param frameNo Frame number
+	 */
+  virtual void freed(const FrameId frameNo) = 0;
+
+	/**
+	 * The pool moved the page of a frame into an empty frame. The page keeps its place among the pages the
+	 * policy tracks, and the frame it left is empty.
+	 *
+	 * @param from  	Frame the page was in
+	 * @param to    	Empty frame the page is in now
+	 */
+  virtual void moved(const FrameId from, const FrameId to) = 0;
+
+	/**
+	 * Frames holding pages in the order the policy would offer them for eviction now, without changing
+	 * anything. Used by the background writer to clean pages before they are evicted.
+	 *
+	 * @param count  	Largest number of frames to return
+	 * @param frames 	Frames returned via this vector
+	 */
+  virtual void nextVictims(const std::size_t count, std::vector<FrameId>& frames) = 0;
+
+	/**
+	 * The pool now uses frames 0 to numFrames - 1. Frames it stops using were emptied and reported with
+	 * freed() first. Called with the pool latch held.
+	 *
+	 * @param numFrames  New number of frames, at most the number the policy was built with
+	 */
+  virtual void resize(const std::uint32_t numFrames) = 0;
+};
+
+/**
+* @brief The clock algorithm: frames are swept in a circle, and a frame referenced since the last sweep gets
+* another round. Cheap, but a large scan sets the reference bit of every page it touches and pushes out pages
+* that are used all the time. Hits only set a bit and take no latch.
+*/
+class ClockPolicy : public ReplacementPolicy
+{
+ private:
+	/**
+   * Number of frames in the buffer pool
+	 */
+  std::uint32_t numFrames;
+
+	/**
+   * Current position of clockhand in our buffer pool
+	 */
+  FrameId clockHand;
+
+	/**
+   * Reference bit of every frame
+	 */
+  std::atomic<bool>* refbits;
+
+ public:
+  ClockPolicy(const std::uint32_t numFrames);
+  ~ClockPolicy();
+  bool pickVictim(const File* file, const PageId pageNo, const EvictFn& evict, FrameId& frameNo);
+  void loaded(const FrameId frameNo, const File* file, const PageId pageNo, const bool cold);
+  void accessed(const FrameId frameNo);
+  void freed(const FrameId frameNo);
+  void moved(const FrameId from, const FrameId to);
+  void nextVictims(const std::size_t count, std::vector<FrameId>& frames);
+  void resize(const std::uint32_t numFrames);
+};
+
+/**
+* @brief LRU-K with K = 2: evicts the page whose second most recent request is the oldest, and pages
+* requested only once before any other. A scan touches each page once, so it can not push out pages used
+* over and over. The request times of evicted pages are remembered for a while, so a page that comes back
+* soon is judged by its whole history.
+*/
+class LruKPolicy : public ReplacementPolicy
+{
+ private:
+	/**
+   * Number of request times kept per page
+	 */
+  static const int K = 2;
+
+	/**
+	 * Request times of a page, most recent first, 0 where there was no request
+	 */
+  struct History
+  {
+    std::uint64_t times[K];
+  };
+
+	/**
+	 * Eviction order of a frame: time of its K-th most recent request, then of its most recent one
+	 */
+  typedef std::pair<std::pair<std::uint64_t, std::uint64_t>, FrameId> OrderKey;
+
+	/**
+   * Number of frames in the buffer pool
+	 */
+  std::uint32_t numFrames;
+
+	/**
+   * Guards the state below
+	 */
+  std::mutex latch;
+
+	/**
+   * Logical time, advanced by every request
+	 */
+  std::uint64_t now;
+
+	/**
+   * Request history of the page in every frame
+	 */
+  std::vector<History> histories;
+
+	/**
+   * Page in every frame
+	 */
+  std::vector<PageKey> framePages;
+
+	/**
+   * True for frames holding a page
+	 */
+  std::vector<bool> resident;
+
+	/**
+   * Frames holding a page, in eviction order
+	 */
+  std::set<OrderKey> order;
+
+	/**
+   * Frames holding no page
+	 */
+  std::vector<FrameId> freeFrames;
+
+	/**
+   * Histories of evicted pages, at most numFrames of them, with their place in retainedOrder
+	 */
+  std::map<PageKey, std::pair<History, std::list<PageKey>::iterator> > retained;
+
+	/**
+   * Evicted pages with a retained history, most recently evicted first
+	 */
+  std::list<PageKey> retainedOrder;
+
+	/**
+   * Eviction order key of a frame
+	 */
+  OrderKey orderKey(const FrameId frameNo) const;
+
+	/**
+   * Record a request of the page in a frame at the current time
+	 */
+  void record(const FrameId frameNo);
+
+ public:
+  LruKPolicy(const std::uint32_t numFrames);
+  bool pickVictim(const File* file, const PageId pageNo, const EvictFn& evict, FrameId& frameNo);
+  void loaded(const FrameId frameNo, const File* file, const PageId pageNo, const bool cold);
+  void accessed(const FrameId frameNo);
+  void freed(const FrameId frameNo);
+  void moved(const FrameId from, const FrameId to);
+  void nextVictims(const std::size_t count, std::vector<FrameId>& frames);
+  void resize(const std::uint32_t numFrames);
+};
+
+/**
+* @brief The 2Q algorithm: new pages enter a FIFO queue A1in holding a quarter of the pool. Pages pushed out
+* of it are remembered in a ghost queue A1out, and only a page requested again while it is remembered enters
+* the main LRU list Am. One-off pages of a scan pass through A1in and leave Am alone.
+*/
+class TwoQPolicy : public ReplacementPolicy
+{
+ private:
+	/**
+   * Queue a frame is on
+	 */
+  enum Queue
+  {
+    NONE,
+    A1IN,
+    AM
+  };
+
+	/**
+   * Number of frames in the buffer pool
+	 */
+  std::uint32_t numFrames;
+
+	/**
+   * Size A1in may grow to before its pages are evicted first
+	 */
+  std::size_t kin;
+
+	/**
+   * Number of pages remembered in A1out
+	 */
+  std::size_t kout;
+
+	/**
+   * Guards the state below
+	 */
+  std::mutex latch;
+
+	/**
+   * Frames of pages requested once, newest first
+	 */
+  std::list<FrameId> a1in;
+
+	/**
+   * Frames of pages requested again, most recently used first
+	 */
+  std::list<FrameId> am;
+
+	/**
+   * Pages evicted from A1in, newest first
+	 */
+  std::list<PageKey> a1out;
+
+	/**
+   * Place of every page in a1out
+	 */
+  std::map<PageKey, std::list<PageKey>::iterator> a1outIndex;
+
+	/**
+   * Queue every frame is on, and its place there
+	 */
+  std::vector<Queue> queues;
+  std::vector<std::list<FrameId>::iterator> positions;
+
+	/**
+   * Page in every frame
+	 */
+  std::vector<PageKey> framePages;
+
+	/**
+   * Frames holding no page
+	 */
+  std::vector<FrameId> freeFrames;
+
+	/**
+   * Offer the frames of a queue to evict, oldest first, and take the frame off the queue if one is evicted
+	 */
+  bool evictFrom(std::list<FrameId>& queue, const EvictFn& evict, FrameId& frameNo);
+
+ public:
+  TwoQPolicy(const std::uint32_t numFrames);
+  bool pickVictim(const File* file, const PageId pageNo, const EvictFn& evict, FrameId& frameNo);
+  void loaded(const FrameId frameNo, const File* file, const PageId pageNo, const bool cold);
+  void accessed(const FrameId frameNo);
+  void freed(const FrameId frameNo);
+  void moved(const FrameId from, const FrameId to);
+  void nextVictims(const std::size_t count, std::vector<FrameId>& frames);
+  void resize(const std::uint32_t numFrames);
+};
+
+/**
+* @brief Adaptive Replacement Cache: LRU lists T1 of pages requested once and T2 of pages requested more
+* often, and ghost lists B1 and B2 of pages recently evicted from them. A miss on a ghost shows which list
+* was cut too short, and moves the target size p of T1 toward it, so the split between recency and
+* frequency follows the workload.
+*/
+class ArcPolicy : public ReplacementPolicy
+{
+ private:
+	/**
+   * List a frame or ghost is on
+	 */
+  enum List
+  {
+    NONE,
+    T1,
+    T2,
+    B1,
+    B2
+  };
+
+	/**
+   * Number of frames in the buffer pool
+	 */
+  std::size_t numFrames;
+
+	/**
+   * Target size of T1
+	 */
+  std::size_t p;
+
+	/**
+   * Guards the state below
+	 */
+  std::mutex latch;
+
+	/**
+   * Frames of T1 and T2, most recently used first
+	 */
+  std::list<FrameId> t1;
+  std::list<FrameId> t2;
+
+	/**
+   * Ghosts of B1 and B2, most recently evicted first
+	 */
+  std::list<PageKey> b1;
+  std::list<PageKey> b2;
+
+	/**
+   * Ghost list of every remembered page, and its place there
+	 */
+  std::map<PageKey, std::pair<List, std::list<PageKey>::iterator> > ghosts;
+
+	/**
+   * List every frame is on, and its place there
+	 */
+  std::vector<List> lists;
+  std::vector<std::list<FrameId>::iterator> positions;
+
+	/**
+   * Page in every frame
+	 */
+  std::vector<PageKey> framePages;
+
+	/**
+   * Frames holding no page
+	 */
+  std::vector<FrameId> freeFrames;
+
+	/**
+   * Offer the frames of T1 or T2 to evict, least recently used first, and turn an evicted page into a ghost
+	 */
+  bool evictFrom(const List list, const EvictFn& evict, FrameId& frameNo);
+
+	/**
+   * Forget the oldest ghost of B1 or B2
+	 */
+  void dropGhost(const List list);
+
+ public:
+  ArcPolicy(const std::uint32_t numFrames);
+  bool pickVictim(const File* file, const PageId pageNo, const EvictFn& evict, FrameId& frameNo);
+  void loaded(const FrameId frameNo, const File* file, const PageId pageNo, const bool cold);
+  void accessed(const FrameId frameNo);
+  void freed(const FrameId frameNo);
+  void moved(const FrameId from, const FrameId to);
+  void nextVictims(const std::size_t count, std::vector<FrameId>& frames);
+  void resize(const std::uint32_t numFrames);
+};
+
+}
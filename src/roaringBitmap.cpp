@@ -0,0 +1,359 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "roaringBitmap.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+namespace badgerdb
+{
+
+/**
+ * Set the bit of every slot of an array container in a zeroed bitmap.
+ */
+static void setBits(const std::vector<std::uint16_t> & values, std::uint64_t *words)
+{
+	for (std::size_t i = 0; i < values.size(); i++) {
+		words[values[i] >> 6] |= (std::uint64_t)1 << (values[i] & 63);
+	}
+}
+
+static bool testBit(const std::vector<std::uint64_t> & words, const std::uint16_t slot)
+{
+	return ( words[slot >> 6] >> (slot & 63) ) & 1;
+}
+
+void RoaringBitmap::normalize(Container & c)
+{
+	if (c.isBitmap() && c.cardinality <= ARRAYMAX) {
+		c.values.clear();
+		c.values.reserve(c.cardinality);
+		for (std::uint32_t w = 0; w < BITMAPWORDS; w++) {
+			std::uint64_t word = c.words[w];
+			while (word != 0) {
+				c.values.push_back((std::uint16_t)( w * 64 + __builtin_ctzll(word) ));
+				word &= word - 1;
+			}
+		}
+		std::vector<std::uint64_t>().swap(c.words);
+	} else if (!c.isBitmap() && c.cardinality > ARRAYMAX) {
+		c.words.assign(BITMAPWORDS, 0);
+		setBits(c.values, &c.words[0]);
+		std::vector<std::uint16_t>().swap(c.values);
+	}
+}
+
+void RoaringBitmap::add(const RecordId rid)
+{
+	std::vector<Container>::iterator it = std::lower_bound(containers.begin(), containers.end(), rid.page_number, keyLess);
+	if (it == containers.end() || it->key != rid.page_number) {
+		Container c;
+		c.key = rid.page_number;
+		c.cardinality = 1;
+		c.values.push_back(rid.slot_number);
+		containers.insert(it, c);
+		return;
+	}
+
+	if (it->isBitmap()) {
+		std::uint64_t & word = it->words[rid.slot_number >> 6];
+		const std::uint64_t bit = (std::uint64_t)1 << (rid.slot_number & 63);
+		if (!(word & bit)) {
+			word |= bit;
+			it->cardinality++;
+		}
+		return;
+	}
+	std::vector<std::uint16_t>::iterator pos = std::lower_bound(it->values.begin(), it->values.end(), rid.slot_number);
+	if (pos != it->values.end() && *pos == rid.slot_number) {
+		return;
+	}
+	it->values.insert(pos, rid.slot_number);
+	it->cardinality++;
+	normalize(*it);
+}
+
+bool RoaringBitmap::remove(const RecordId rid)
+{
+	std::vector<Container>::iterator it = std::lower_bound(containers.begin(), containers.end(), rid.page_number, keyLess);
+	if (it == containers.end() || it->key != rid.page_number) {
+		return false;
+	}
+
+	if (it->isBitmap()) {
+		std::uint64_t & word = it->words[rid.slot_number >> 6];
+		const std::uint64_t bit = (std::uint64_t)1 << (rid.slot_number & 63);
+		if (!(word & bit)) {
+			return false;
+		}
+		word &= ~bit;
+	} else {
+		std::vector<std::uint16_t>::iterator pos = std::lower_bound(it->values.begin(), it->values.end(), rid.slot_number);
+		if (pos == it->values.end() || *pos != rid.slot_number) {
+			return false;
+		}
+		it->values.erase(pos);
+	}
+	it->cardinality--;
+	if (it->cardinality == 0) {
+		containers.erase(it);
+	} else {
+		normalize(*it);
+	}
+	return true;
+}
+
+bool RoaringBitmap::contains(const RecordId rid) const
+{
+	std::vector<Container>::const_iterator it = std::lower_bound(containers.begin(), containers.end(), rid.page_number, keyLess);
+	if (it == containers.end() || it->key != rid.page_number) {
+		return false;
+	}
+	if (it->isBitmap()) {
+		return testBit(it->words, rid.slot_number);
+	}
+	return std::binary_search(it->values.begin(), it->values.end(), rid.slot_number);
+}
+
+std::uint64_t RoaringBitmap::cardinality() const
+{
+	std::uint64_t total = 0;
+	for (std::size_t i = 0; i < containers.size(); i++) {
+		total += containers[i].cardinality;
+	}
+	return total;
+}
+
+void RoaringBitmap::combine(const Container & a, const Container & b, const char op, Container & out)
+{
+	out.key = a.key;
+	out.values.clear();
+	out.words.clear();
+
+	if (!a.isBitmap() && !b.isBitmap()) {
+		std::back_insert_iterator< std::vector<std::uint16_t> > dest(out.values);
+		if (op == '&') {
+			std::set_intersection(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(), dest);
+		} else if (op == '|') {
+			std::set_union(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(), dest);
+		} else {
+			std::set_difference(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(), dest);
+		}
+		out.cardinality = out.values.size();
+		normalize(out);
+		return;
+	}
+
+	// A sparse operand only needs its own slots tested against the dense one
+	if (op != '|' && !a.isBitmap()) {
+		for (std::size_t i = 0; i < a.values.size(); i++) {
+			if (testBit(b.words, a.values[i]) == (op == '&')) {
+				out.values.push_back(a.values[i]);
+			}
+		}
+		out.cardinality = out.values.size();
+		return;
+	}
+	if (op == '&' && !b.isBitmap()) {
+		combine(b, a, op, out);
+		out.key = a.key;
+		return;
+	}
+
+	// Otherwise both operands are combined as bitmaps
+	if (a.isBitmap()) {
+		out.words = a.words;
+	} else {
+		out.words.assign(BITMAPWORDS, 0);
+		setBits(a.values, &out.words[0]);
+	}
+	std::vector<std::uint64_t> scratch;
+	const std::uint64_t *bw;
+	if (b.isBitmap()) {
+		bw = &b.words[0];
+	} else {
+		scratch.assign(BITMAPWORDS, 0);
+		setBits(b.values, &scratch[0]);
+		bw = &scratch[0];
+	}
+
+	out.cardinality = 0;
+	for (std::uint32_t w = 0; w < BITMAPWORDS; w++) {
+		if (op == '&') {
+			out.words[w] &= bw[w];
+		} else if (op == '|') {
+			out.words[w] |= bw[w];
+		} else {
+			out.words[w] &= ~bw[w];
+		}
+		out.cardinality += __builtin_popcountll(out.words[w]);
+	}
+	normalize(out);
+}
+
+RoaringBitmap RoaringBitmap::operator&(const RoaringBitmap & other) const
+{
+	RoaringBitmap result;
+	std::size_t i = 0;
+	std::size_t j = 0;
+	while (i < containers.size() && j < other.containers.size()) {
+		if (containers[i].key < other.containers[j].key) {
+			i++;
+		} else if (other.containers[j].key < containers[i].key) {
+			j++;
+		} else {
+			Container c;
+			combine(containers[i], other.containers[j], '&', c);
+			if (c.cardinality > 0) {
+				result.containers.push_back(c);
+			}
+			i++;
+			j++;
+		}
+	}
+	return result;
+}
+
+RoaringBitmap RoaringBitmap::operator|(const RoaringBitmap & other) const
+{
+	RoaringBitmap result;
+	std::size_t i = 0;
+	std::size_t j = 0;
+	while (i < containers.size() || j < other.containers.size()) {
+		if (j == other.containers.size() || ( i < containers.size() && containers[i].key < other.containers[j].key )) {
+			result.containers.push_back(containers[i++]);
+		} else if (i == containers.size() || other.containers[j].key < containers[i].key) {
+			result.containers.push_back(other.containers[j++]);
+		} else {
+			Container c;
+			combine(containers[i], other.containers[j], '|', c);
+			result.containers.push_back(c);
+			i++;
+			j++;
+		}
+	}
+	return result;
+}
+
+RoaringBitmap RoaringBitmap::operator-(const RoaringBitmap & other) const
+{
+	RoaringBitmap result;
+	std::size_t j = 0;
+	for (std::size_t i = 0; i < containers.size(); i++) {
+		while (j < other.containers.size() && other.containers[j].key < containers[i].key) {
+			j++;
+		}
+		if (j == other.containers.size() || other.containers[j].key != containers[i].key) {
+			result.containers.push_back(containers[i]);
+			continue;
+		}
+		Container c;
+		combine(containers[i], other.containers[j], '-', c);
+		if (c.cardinality > 0) {
+			result.containers.push_back(c);
+		}
+	}
+	return result;
+}
+
+bool RoaringBitmap::operator==(const RoaringBitmap & other) const
+{
+	if (containers.size() != other.containers.size()) {
+		return false;
+	}
+	// Both representations follow from the cardinality, so equal sets have equal containers
+	for (std::size_t i = 0; i < containers.size(); i++) {
+		const Container & a = containers[i];
+		const Container & b = other.containers[i];
+		if (a.key != b.key || a.cardinality != b.cardinality || a.values != b.values || a.words != b.words) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void RoaringBitmap::toRecordIds(std::vector<RecordId> & outRids) const
+{
+	RecordId rid;
+	for (std::size_t i = 0; i < containers.size(); i++) {
+		const Container & c = containers[i];
+		rid.page_number = c.key;
+		if (!c.isBitmap()) {
+			for (std::size_t k = 0; k < c.values.size(); k++) {
+				rid.slot_number = c.values[k];
+				outRids.push_back(rid);
+			}
+			continue;
+		}
+		for (std::uint32_t w = 0; w < BITMAPWORDS; w++) {
+			std::uint64_t word = c.words[w];
+			while (word != 0) {
+				rid.slot_number = (SlotId)( w * 64 + __builtin_ctzll(word) );
+				outRids.push_back(rid);
+				word &= word - 1;
+			}
+		}
+	}
+}
+
+/**
+ * Append the raw bytes of a value.
+ */
+template <class T>
+static void appendBytes(std::vector<char> & bytes, const T *data, const std::size_t count)
+{
+	const char *begin = (const char*)data;
+	bytes.insert(bytes.end(), begin, begin + count * sizeof(T));
+}
+
+void RoaringBitmap::serialize(std::vector<char> & bytes) const
+{
+	// Number of containers, then for each: page number, cardinality and either the array or the bitmap
+	const std::uint32_t numContainers = containers.size();
+	appendBytes(bytes, &numContainers, 1);
+	for (std::size_t i = 0; i < containers.size(); i++) {
+		const Container & c = containers[i];
+		appendBytes(bytes, &c.key, 1);
+		appendBytes(bytes, &c.cardinality, 1);
+		if (c.isBitmap()) {
+			appendBytes(bytes, &c.words[0], BITMAPWORDS);
+		} else {
+			appendBytes(bytes, &c.values[0], c.values.size());
+		}
+	}
+}
+
+std::size_t RoaringBitmap::deserialize(const char *bytes)
+{
+	const char *pos = bytes;
+	std::uint32_t numContainers;
+	memcpy(&numContainers, pos, sizeof(numContainers));
+	pos += sizeof(numContainers);
+
+	containers.assign(numContainers, Container());
+	for (std::uint32_t i = 0; i < numContainers; i++) {
+		Container & c = containers[i];
+		memcpy(&c.key, pos, sizeof(c.key));
+		pos += sizeof(c.key);
+		memcpy(&c.cardinality, pos, sizeof(c.cardinality));
+		pos += sizeof(c.cardinality);
+		if (c.cardinality > ARRAYMAX) {
+			c.words.resize(BITMAPWORDS);
+			memcpy(&c.words[0], pos, BITMAPWORDS * sizeof(std::uint64_t));
+			pos += BITMAPWORDS * sizeof(std::uint64_t);
+		} else {
+			c.values.resize(c.cardinality);
+			memcpy(&c.values[0], pos, c.cardinality * sizeof(std::uint16_t));
+			pos += c.cardinality * sizeof(std::uint16_t);
+		}
+	}
+	return pos - bytes;
+}
+
+}
@@ -0,0 +1,171 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "types.h"
+
+namespace badgerdb
+{
+
+/**
+ * @brief Compressed set of record ids, in the style of Roaring bitmaps.
+ *
+ * Record ids are grouped into one container per heap page. A container holds the slot numbers of the
+ * page either as a sorted array of 16-bit values, while it has at most ARRAYMAX of them, or as a
+ * plain 65536-bit bitmap. Intersection, union and difference work container by container, so pages
+ * present in only one operand are skipped or copied without looking at their slots, and two dense
+ * containers are combined a 64-bit word at a time.
+ *
+ * @warning This class is not threadsafe.
+ */
+class RoaringBitmap
+{
+ public:
+  /**
+   * Largest number of slots kept in an array container. Past it the array would be larger than a bitmap.
+   */
+	static const std::uint32_t ARRAYMAX = 4096;
+
+  /**
+   * Number of 64-bit words in a bitmap container.
+   */
+	static const std::uint32_t BITMAPWORDS = 65536 / 64;
+
+  /**
+   * Add a record id. Does nothing if it is already in the set.
+   *
+   * @param rid     Record id to add.
+   */
+	void add(const RecordId rid);
+
+  /**
+   * Remove a record id.
+   *
+   * @param rid     Record id to remove.
+   * @return        True if the record id was in the set.
+   */
+	bool remove(const RecordId rid);
+
+  /**
+   * True if the record id is in the set.
+   *
+   * @param rid     Record id to test.
+   */
+	bool contains(const RecordId rid) const;
+
+  /**
+   * Number of record ids in the set.
+   */
+	std::uint64_t cardinality() const;
+
+  /**
+   * True if the set holds no record id.
+   */
+	bool empty() const { return containers.empty(); }
+
+  /**
+   * Record ids in both sets.
+   */
+	RoaringBitmap operator&(const RoaringBitmap & other) const;
+
+  /**
+   * Record ids in either set.
+   */
+	RoaringBitmap operator|(const RoaringBitmap & other) const;
+
+  /**
+   * Record ids in this set but not in the other one.
+   */
+	RoaringBitmap operator-(const RoaringBitmap & other) const;
+
+  /**
+   * True if both sets hold the same record ids.
+   */
+	bool operator==(const RoaringBitmap & other) const;
+	bool operator!=(const RoaringBitmap & other) const { return !( *this == other ); }
+
+  /**
+   * Append every record id of the set, ordered by page and then slot number.
+   *
+   * @param outRids     Vector the record ids are appended to.
+   */
+	void toRecordIds(std::vector<RecordId> & outRids) const;
+
+  /**
+   * Append the serialized form of the set.
+   *
+   * @param bytes       Vector the bytes are appended to.
+   */
+	void serialize(std::vector<char> & bytes) const;
+
+  /**
+   * Replace the set with one serialized by serialize().
+   *
+   * @param bytes       Start of the serialized form.
+   * @return            Number of bytes read.
+   */
+	std::size_t deserialize(const char *bytes);
+
+ private:
+  /**
+   * @brief Slots of the set on one heap page.
+   */
+	struct Container {
+	  /**
+	   * Heap page the slots belong to.
+	   */
+		PageId key;
+
+	  /**
+	   * Number of slots in the container, never 0.
+	   */
+		std::uint32_t cardinality;
+
+	  /**
+	   * Sorted slot numbers while cardinality <= ARRAYMAX, empty otherwise.
+	   */
+		std::vector<std::uint16_t> values;
+
+	  /**
+	   * BITMAPWORDS words with one bit per slot number while cardinality > ARRAYMAX, empty otherwise.
+	   */
+		std::vector<std::uint64_t> words;
+
+		bool isBitmap() const { return !words.empty(); }
+	};
+
+  /**
+   * Containers ordered by page number.
+   */
+	std::vector<Container> containers;
+
+  /**
+   * Switch a container to the representation its cardinality calls for.
+   */
+	static void normalize(Container & c);
+
+  /**
+   * Combine two containers of the same page.
+   *
+   * @param a, b    Operands.
+   * @param op      '&', '|' or '-'.
+   * @param out     Result, with cardinality 0 if it is empty.
+   */
+	static void combine(const Container & a, const Container & b, const char op, Container & out);
+
+  /**
+   * Orders containers by page number, for binary searches over containers.
+   */
+	static bool keyLess(const Container & c, const PageId key) { return c.key < key; }
+};
+
+}
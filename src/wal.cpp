@@ -0,0 +1,428 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "wal.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "exceptions/file_not_found_exception.h"
+#include "exceptions/invalid_page_exception.h"
+#include "exceptions/log_io_exception.h"
+
+namespace badgerdb {
+
+/**
+ * Marks the start of every record, so garbage past the last record is not
+ * mistaken for one.
+ */
+static const std::uint32_t LOG_MAGIC = 0x4C414742;  // "BGAL"
+
+/**
+ * Record types.
+ */
+static const std::uint32_t PAGE_RECORD = 1;
+static const std::uint32_t COMMIT_RECORD = 2;
+static const std::uint32_t HEADER_RECORD = 3;
+
+/**
+ * Flag of page and header records whose file is a PageFile rather than a
+ * BlobFile.
+ */
+static const std::uint32_t FLAG_PAGEFILE = 1;
+
+/**
+ * @brief Header of every log record.  A page record is followed by the file
+ *        name and the page image, a header record by the file name and the
+ *        file header, a commit record by nothing.
+ */
+struct LogRecordHeader {
+  /**
+   * Always LOG_MAGIC.
+   */
+  std::uint32_t magic;
+
+  /**
+   * PAGE_RECORD, HEADER_RECORD or COMMIT_RECORD.
+   */
+  std::uint32_t type;
+
+  /**
+   * CRC-32 of the header, with this field zero, and of the payload.
+   */
+  std::uint32_t checksum;
+
+  /**
+   * Page and header records: FLAG_PAGEFILE or 0.
+   */
+  std::uint32_t flags;
+
+  /**
+   * Page and header records: length of the file name following the header.
+   */
+  std::uint32_t name_length;
+
+  /**
+   * Page and header records: size of the page image or file header
+   * following the file name.
+   */
+  std::uint32_t page_size;
+
+  /**
+   * Page records: number of the page.  Header records: 0.  Commit records:
+   * number of page and header records in the group.
+   */
+  std::uint32_t page_number;
+
+  /**
+   * Unused, keeps group aligned.
+   */
+  std::uint32_t reserved;
+
+  /**
+   * Number of the group the record belongs to.
+   */
+  std::uint64_t group;
+};
+
+/**
+ * CRC-32 (IEEE) of len bytes, continuing from crc.
+ */
+static std::uint32_t crc32(std::uint32_t crc, const char* bytes,
+                           const std::size_t len) {
+  static std::uint32_t table[256];
+  static bool table_ready = false;
+  if (!table_ready) {
+    for (std::uint32_t i = 0; i < 256; i++) {
+      std::uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+      }
+      table[i] = c;
+    }
+    table_ready = true;
+  }
+
+  crc = ~crc;
+  for (std::size_t i = 0; i < len; i++) {
+    crc = table[(crc ^ (unsigned char)bytes[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+/**
+ * Length of the record with the given header, header included.
+ */
+static std::size_t recordLength(const LogRecordHeader& header) {
+  return sizeof(LogRecordHeader) + header.name_length + header.page_size;
+}
+
+/**
+ * Checksum of the record at the start of bytes.
+ */
+static std::uint32_t recordChecksum(const char* bytes) {
+  LogRecordHeader header;
+  memcpy(&header, bytes, sizeof(header));
+  header.checksum = 0;
+  std::uint32_t crc = crc32(0, reinterpret_cast<const char*>(&header),
+                            sizeof(header));
+  return crc32(crc, bytes + sizeof(header),
+               recordLength(header) - sizeof(header));
+}
+
+WriteAheadLog::WriteAheadLog(const std::string& name,
+                             const std::uint32_t group_size,
+                             const std::chrono::microseconds max_delay,
+                             const std::size_t checkpoint_size)
+    : filename_(name),
+      group_(1),
+      group_commits_(0),
+      group_size_(group_size),
+      max_delay_(max_delay),
+      log_size_(0),
+      checkpoint_size_(checkpoint_size),
+      num_syncs_(0),
+      num_commits_(0),
+      num_recovered_(0) {
+  fd_ = ::open(filename_.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (fd_ < 0) {
+    throw LogIOException(filename_, "open");
+  }
+  try {
+    recover();
+  } catch (...) {
+    ::close(fd_);
+    throw;
+  }
+}
+
+WriteAheadLog::~WriteAheadLog() {
+  try {
+    flush();
+  } catch (LogIOException&) {
+    // Nothing to report to; the group is lost like on a crash.
+  }
+  ::close(fd_);
+}
+
+std::uint64_t WriteAheadLog::logPage(const File& file,
+                                     const PageId page_number,
+                                     const Page& page) {
+  return logRecord(file, PAGE_RECORD, page_number, &page, file.pageSize());
+}
+
+std::uint64_t WriteAheadLog::logHeader(const File& file) {
+  const FileHeader file_header = file.readHeader();
+  return logRecord(file, HEADER_RECORD, 0, &file_header, file.header_size_);
+}
+
+std::uint64_t WriteAheadLog::logRecord(const File& file,
+                                       const std::uint32_t type,
+                                       const PageId page_number,
+                                       const void* payload,
+                                       const std::size_t size) {
+  const std::pair<std::string, PageId> key(file.filename(), page_number);
+  std::map<std::pair<std::string, PageId>, std::size_t>::iterator it =
+      group_pages_.find(key);
+  if (it != group_pages_.end()) {
+    // Logged before in this group, only the latest image matters
+    memcpy(&buffer_[it->second + sizeof(LogRecordHeader) +
+                    file.filename().size()],
+           payload, size);
+    return group_;
+  }
+
+  LogRecordHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = LOG_MAGIC;
+  header.type = type;
+  header.flags =
+      dynamic_cast<const PageFile*>(&file) != NULL ? FLAG_PAGEFILE : 0;
+  header.name_length = file.filename().size();
+  header.page_size = size;
+  header.page_number = page_number;
+  header.group = group_;
+
+  const std::size_t offset = buffer_.size();
+  buffer_.resize(offset + recordLength(header));
+  memcpy(&buffer_[offset], &header, sizeof(header));
+  memcpy(&buffer_[offset + sizeof(header)], file.filename().data(),
+         header.name_length);
+  memcpy(&buffer_[offset + sizeof(header) + header.name_length], payload,
+         size);
+  group_pages_[key] = offset;
+  return group_;
+}
+
+bool WriteAheadLog::commit() {
+  const std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+  if (group_commits_ == 0) {
+    group_start_ = now;
+  }
+  group_commits_++;
+  num_commits_++;
+  return group_commits_ >= group_size_ || now - group_start_ >= max_delay_;
+}
+
+void WriteAheadLog::flush() {
+  group_commits_ = 0;
+  if (buffer_.empty()) {
+    return;
+  }
+
+  // Images may have been replaced since they were added, checksum them now
+  std::size_t offset = 0;
+  while (offset < buffer_.size()) {
+    LogRecordHeader header;
+    memcpy(&header, &buffer_[offset], sizeof(header));
+    header.checksum = recordChecksum(&buffer_[offset]);
+    memcpy(&buffer_[offset], &header, sizeof(header));
+    offset += recordLength(header);
+  }
+
+  LogRecordHeader commit;
+  memset(&commit, 0, sizeof(commit));
+  commit.magic = LOG_MAGIC;
+  commit.type = COMMIT_RECORD;
+  commit.page_number = group_pages_.size();
+  commit.group = group_;
+  commit.checksum = recordChecksum(reinterpret_cast<const char*>(&commit));
+  buffer_.insert(buffer_.end(), reinterpret_cast<const char*>(&commit),
+                 reinterpret_cast<const char*>(&commit) + sizeof(commit));
+
+  // One write and one sync for the whole group
+  const char* bytes = &buffer_[0];
+  std::size_t left = buffer_.size();
+  while (left > 0) {
+    ssize_t written = ::write(fd_, bytes, left);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw LogIOException(filename_, "write");
+    }
+    bytes += written;
+    left -= written;
+  }
+  if (::fdatasync(fd_) != 0) {
+    throw LogIOException(filename_, "sync");
+  }
+
+  log_size_ += buffer_.size();
+  buffer_.clear();
+  group_pages_.clear();
+  group_++;
+  num_syncs_++;
+}
+
+void WriteAheadLog::truncate() {
+  flush();
+  if (::ftruncate(fd_, 0) != 0 || ::fdatasync(fd_) != 0) {
+    throw LogIOException(filename_, "truncate");
+  }
+  log_size_ = 0;
+}
+
+void WriteAheadLog::recover() {
+  struct stat st;
+  if (::fstat(fd_, &st) != 0) {
+    throw LogIOException(filename_, "read");
+  }
+  if (st.st_size == 0) {
+    return;
+  }
+
+  std::vector<char> log(st.st_size);
+  std::size_t done = 0;
+  while (done < log.size()) {
+    ssize_t n = ::pread(fd_, &log[done], log.size() - done, done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      throw LogIOException(filename_, "read");
+    }
+    done += n;
+  }
+
+  // Walk the records up to the first one that is torn or corrupt, replaying
+  // every group whose commit record was reached.
+  std::map<std::string, File*> files;
+  std::vector<std::size_t> offsets;
+  std::size_t offset = 0;
+  try {
+    while (offset + sizeof(LogRecordHeader) <= log.size()) {
+      LogRecordHeader header;
+      memcpy(&header, &log[offset], sizeof(header));
+      if (header.magic != LOG_MAGIC ||
+          (header.type != PAGE_RECORD && header.type != HEADER_RECORD &&
+           header.type != COMMIT_RECORD) ||
+          header.page_size > Page::MAX_SIZE ||
+          offset + recordLength(header) > log.size() ||
+          header.checksum != recordChecksum(&log[offset])) {
+        break;
+      }
+      if (header.type != COMMIT_RECORD) {
+        offsets.push_back(offset);
+      } else {
+        if (header.page_number == offsets.size()) {
+          replayGroup(log, offsets, files);
+        }
+        offsets.clear();
+      }
+      offset += recordLength(header);
+    }
+
+    for (std::map<std::string, File*>::iterator it = files.begin();
+         it != files.end(); ++it) {
+      if (it->second != NULL && !File::sync(it->first)) {
+        throw LogIOException(it->first, "sync");
+      }
+    }
+  } catch (...) {
+    for (std::map<std::string, File*>::iterator it = files.begin();
+         it != files.end(); ++it) {
+      delete it->second;
+    }
+    throw;
+  }
+  for (std::map<std::string, File*>::iterator it = files.begin();
+       it != files.end(); ++it) {
+    delete it->second;
+  }
+
+  // Everything recovered is on disk in the data files now
+  if (::ftruncate(fd_, 0) != 0 || ::fdatasync(fd_) != 0) {
+    throw LogIOException(filename_, "truncate");
+  }
+}
+
+void WriteAheadLog::replayGroup(const std::vector<char>& log,
+                                const std::vector<std::size_t>& offsets,
+                                std::map<std::string, File*>& files) {
+  PageBuffer page(Page::MAX_SIZE);
+  for (std::size_t i = 0; i < offsets.size(); i++) {
+    LogRecordHeader header;
+    memcpy(&header, &log[offsets[i]], sizeof(header));
+    const std::string name(&log[offsets[i] + sizeof(header)],
+                           header.name_length);
+
+    std::map<std::string, File*>::iterator it = files.find(name);
+    if (it == files.end()) {
+      File* file = NULL;
+      try {
+        if (header.flags & FLAG_PAGEFILE) {
+          file = new PageFile(name, false);
+        } else {
+          file = new BlobFile(name, false);
+        }
+      } catch (FileNotFoundException&) {
+        // The file was removed after its pages were logged
+      }
+      it = files.insert(std::make_pair(name, file)).first;
+    }
+    File* file = it->second;
+    const char* payload =
+        &log[offsets[i] + sizeof(header) + header.name_length];
+    if (file != NULL && header.type == HEADER_RECORD &&
+        header.page_size == file->header_size_) {
+      // The header as of the group's last commit, pages allocated by later
+      // operations that did not commit are dropped with them
+      FileHeader file_header = FileHeader();
+      memcpy(&file_header, payload, header.page_size);
+      file->writeHeader(file_header);
+      continue;
+    }
+    if (file == NULL || header.type != PAGE_RECORD ||
+        file->pageSize() != header.page_size) {
+      continue;
+    }
+
+    memcpy((void*)page.get(), payload, header.page_size);
+    try {
+      file->writePage(header.page_number, *page);
+    } catch (InvalidPageException&) {
+      // The page was deleted from the PageFile after it was logged
+      continue;
+    }
+
+    // A file whose allocations were not made through a logging pool has no
+    // header in the log, its header may not have reached the disk.
+    FileHeader file_header = file->readHeader();
+    if (header.page_number >= file_header.num_pages) {
+      file_header.num_pages = header.page_number + 1;
+      file->writeHeader(file_header);
+    }
+    num_recovered_++;
+  }
+}
+
+}
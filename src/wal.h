@@ -0,0 +1,267 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "file.h"
+#include "page.h"
+
+namespace badgerdb {
+
+/**
+ * @brief Redo log of page images with group commit.
+ *
+ * The buffer manager hands the log an after-image of every page a committed
+ * operation dirtied (see BufMgr::attachLog() and BufMgr::commit()).  Images
+ * collect in memory and go to disk as one group: a single write followed by a
+ * single fdatasync, however many operations committed in between.  A page
+ * dirtied by several operations of the same group is logged only once, with
+ * its latest contents.  Each group ends with a commit record, and a group is
+ * replayed only if all of it, commit record included, reached the disk with
+ * valid checksums.
+ *
+ * A group is forced once group_size operations have committed into it, or on
+ * the first commit after max_delay has passed since the group was started.
+ * Until then committed operations are not yet durable; call flush() to force
+ * them.  Data pages are written lazily by the buffer manager; it only needs to
+ * flush the log before it writes a page whose image is still in memory.
+ *
+ * Constructing the log replays every complete group found in the log file
+ * into the data files, syncs them and empties the log.  This must happen
+ * before any of those files are opened.  Besides page contents, the log holds
+ * the headers of files an operation allocated pages in (see logHeader()), so
+ * a replayed group brings back the page counts its pages were allocated
+ * under, extents included.
+ *
+ * @warning This class is not threadsafe.
+ */
+class WriteAheadLog {
+ public:
+  /**
+   * Default number of committed operations that share one sync.
+   */
+  static const std::uint32_t DEFAULT_GROUP_SIZE = 32;
+
+  /**
+   * Default size in bytes past which needsCheckpoint() asks for a checkpoint.
+   */
+  static const std::size_t DEFAULT_CHECKPOINT_SIZE = 64 * 1024 * 1024;
+
+  /**
+   * Opens the log file, creating it if needed, and recovers from it.
+   *
+   * @param name             Name of the log file.
+   * @param group_size       Number of committed operations after which a
+   *                         group is forced.
+   * @param max_delay        Age of a group after which the next commit forces
+   *                         it.
+   * @param checkpoint_size  Size of the log after which needsCheckpoint()
+   *                         returns true.
+   * @throws  LogIOException  If the log file cannot be opened, read or
+   *                          truncated, or a recovered file cannot be synced.
+   */
+  WriteAheadLog(const std::string& name,
+                const std::uint32_t group_size = DEFAULT_GROUP_SIZE,
+                const std::chrono::microseconds max_delay =
+                    std::chrono::microseconds(2000),
+                const std::size_t checkpoint_size = DEFAULT_CHECKPOINT_SIZE);
+
+  /**
+   * Forces the group being filled and closes the log file.
+   */
+  ~WriteAheadLog();
+
+  /**
+   * Adds the image of a page to the group being filled, replacing an image of
+   * the same page logged earlier in the group.
+   *
+   * @param file         File the page belongs to.
+   * @param page_number  Number of the page in the file.
+   * @param page         Contents of the page, file.pageSize() bytes.
+   * @return  Number of the group the image belongs to.
+   */
+  std::uint64_t logPage(const File& file, const PageId page_number,
+                        const Page& page);
+
+  /**
+   * Adds the current header of a file to the group being filled, replacing a
+   * header of the same file logged earlier in the group.  Replaying the group
+   * writes it back over the header on disk.
+   *
+   * @param file  File whose header to log.
+   * @return  Number of the group the header belongs to.
+   */
+  std::uint64_t logHeader(const File& file);
+
+  /**
+   * Records that an operation committed.  Its pages and headers must have
+   * been logged with logPage() and logHeader() already.
+   *
+   * @return  True if the group is due and flush() should be called now.
+   */
+  bool commit();
+
+  /**
+   * Writes the group being filled to the log file and syncs it.  Does
+   * nothing if the group holds no pages.
+   *
+   * @throws  LogIOException  If the log cannot be written or synced.
+   */
+  void flush();
+
+  /**
+   * Forces the group being filled, then empties the log file.  Only call
+   * this once every logged page has been written to its data file and synced.
+   *
+   * @throws  LogIOException  If the log cannot be written or truncated.
+   */
+  void truncate();
+
+  /**
+   * Returns true if the pages of the given group are on disk in the log.
+   *
+   * @param group  Group number returned by logPage().
+   */
+  bool isDurable(const std::uint64_t group) const { return group < group_; }
+
+  /**
+   * Returns true if the log has grown past its checkpoint size.
+   */
+  bool needsCheckpoint() const {
+    return log_size_ + buffer_.size() >= checkpoint_size_;
+  }
+
+  /**
+   * Returns the name of the log file.
+   */
+  const std::string& filename() const { return filename_; }
+
+  /**
+   * Returns the number of syncs of the log file so far.
+   */
+  std::uint64_t numSyncs() const { return num_syncs_; }
+
+  /**
+   * Returns the number of committed operations so far.
+   */
+  std::uint64_t numCommits() const { return num_commits_; }
+
+  /**
+   * Returns the number of page images replayed when the log was opened.
+   */
+  std::uint64_t numRecovered() const { return num_recovered_; }
+
+ private:
+  WriteAheadLog(const WriteAheadLog&);
+  WriteAheadLog& operator=(const WriteAheadLog&);
+
+  /**
+   * Replays the complete groups in the log file and empties it.
+   */
+  void recover();
+
+  /**
+   * Adds a page or header record to the group being filled, or replaces the
+   * payload of the record logged for the same page earlier in the group.
+   *
+   * @param file         File the record is for.
+   * @param type         Record type.
+   * @param page_number  Number of the page, 0 for the file header.
+   * @param payload      Page image or file header.
+   * @param size         Size of the payload in bytes.
+   * @return  Number of the group the record belongs to.
+   */
+  std::uint64_t logRecord(const File& file, const std::uint32_t type,
+                          const PageId page_number, const void* payload,
+                          const std::size_t size);
+
+  /**
+   * Applies the page and header records at the given offsets of the log
+   * contents to their data files, opening each file once and keeping it in
+   * files.
+   *
+   * @param log      Contents of the log file.
+   * @param offsets  Offsets of the page and header records of one group.
+   * @param files    Data files opened so far, NULL for files that are gone.
+   */
+  void replayGroup(const std::vector<char>& log,
+                   const std::vector<std::size_t>& offsets,
+                   std::map<std::string, File*>& files);
+
+  /**
+   * Name of the log file.
+   */
+  std::string filename_;
+
+  /**
+   * Descriptor of the log file, opened for appending.
+   */
+  int fd_;
+
+  /**
+   * Records of the group being filled, checksummed when the group is flushed.
+   */
+  std::vector<char> buffer_;
+
+  /**
+   * Offset in buffer_ of the record of every page logged in the group, page
+   * number 0 standing for the file header.
+   */
+  std::map<std::pair<std::string, PageId>, std::size_t> group_pages_;
+
+  /**
+   * Number of the group being filled.  Every lower group is durable.
+   */
+  std::uint64_t group_;
+
+  /**
+   * Operations committed into the group being filled.
+   */
+  std::uint32_t group_commits_;
+
+  /**
+   * Time of the first commit into the group being filled.
+   */
+  std::chrono::steady_clock::time_point group_start_;
+
+  /**
+   * Number of committed operations after which a group is forced.
+   */
+  std::uint32_t group_size_;
+
+  /**
+   * Age after which a group is forced by the next commit.
+   */
+  std::chrono::microseconds max_delay_;
+
+  /**
+   * Size in bytes of the log file.
+   */
+  std::size_t log_size_;
+
+  /**
+   * Log size past which a checkpoint is asked for.
+   */
+  std::size_t checkpoint_size_;
+
+  /**
+   * Statistics, see numSyncs(), numCommits() and numRecovered().
+   */
+  std::uint64_t num_syncs_;
+  std::uint64_t num_commits_;
+  std::uint64_t num_recovered_;
+};
+
+}